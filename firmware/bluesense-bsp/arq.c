@@ -0,0 +1,393 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "wait.h"
+#include "serial.h"
+#include "helper.h"
+#include "pkt.h"
+#include "uiconfig.h"
+#include "arq.h"
+
+/*
+	File: arq
+
+	Reliable streaming with a sliding-window automatic repeat request (ARQ) protocol.
+
+	Data written with fputbuf to the FILE returned by arq_open is encapsulated in sequence-numbered frames,
+	which are kept in a retransmit window until they are acknowledged by the receiver.
+	Short stalls of the wireless link thus cause delays rather than data loss: data is only lost when the retransmit window is full,
+	in which case fputbuf returns an error like other streams.
+
+	Frame format (little endian):
+
+		'D' 'A' 'R' seq_lo seq_hi size payload[size] chk_lo chk_hi
+
+	The checksum is the fletcher16 checksum (packet_fletcher16) of all the preceding bytes of the frame.
+
+	The receiver acknowledges frames with the command "a,<seq>", where seq is the sequence number of the next expected frame (cumulative acknowledgement).
+	All frames with a sequence number lower than seq are removed from the window.
+	If no acknowledgement progress is made within ARQ_TIMEOUT ms, all the frames in the window are retransmitted (go-back-N).
+
+	Data written with fputc/fprintf is not framed: it is passed through to the underlying stream.
+
+	*Public functions*
+
+	* arq_open:				Open a reliable stream on top of an existing stream.
+	* arq_close:			Close the reliable stream.
+	* arq_isopen:			Indicates whether the reliable stream is open.
+	* arq_ack:				Process a cumulative acknowledgement.
+	* arq_service:			Send pending frames and handle retransmissions; must be called periodically.
+	* arq_level:			Number of frames in the retransmit window.
+	* arq_printstat:		Prints the statistics of the reliable stream.
+
+	*Frame buffer*
+
+	Frames are stored contiguously in _arq_buffer; a frame never wraps around the end of the buffer.
+	_arq_frame_off and _arq_frame_size store the location of the frames in the window, indexed by the sequence number modulo ARQ_WINDOWMAX.
+
+	* _arq_seq_base:		sequence number of the oldest unacknowledged frame
+	* _arq_seq_send:		sequence number of the next frame to transmit
+	* _arq_seq_next:		sequence number assigned to the next frame to be enqueued
+*/
+
+const char help_arq[] PROGMEM ="r,<en>: reliable streaming with retransmissions when en=1. Frames are acknowledged with a,<seq>";
+const char help_arqack[] PROGMEM ="a,<seq>: acknowledges all reliable streaming frames before seq";
+
+unsigned char mode_stream_arq=0;
+
+FILE _arq_file;
+SERIALPARAM _arq_file_param;
+FILE *_arq_file_underlying=0;
+
+char _arq_buffer[ARQ_BUFFERSIZE];
+unsigned short _arq_frame_off[ARQ_WINDOWMAX];
+unsigned char _arq_frame_size[ARQ_WINDOWMAX];
+unsigned short _arq_wr;
+unsigned short _arq_seq_base,_arq_seq_send,_arq_seq_next;
+unsigned long _arq_t_progress;
+
+// Statistics
+unsigned long _arq_stat_frames,_arq_stat_retransmit,_arq_stat_timeout,_arq_stat_full;
+
+/******************************************************************************
+	function: arq_open
+*******************************************************************************
+	Open a reliable stream on top of the stream f and clear the retransmit window.
+
+	Parameters:
+		f		-	Underlying stream on which the frames are sent (e.g. file_pri)
+
+	Returns:
+		FILE* to use with fputbuf
+******************************************************************************/
+FILE *arq_open(FILE *f)
+{
+	fdev_setup_stream(&_arq_file,_arq_fputchar,0,_FDEV_SETUP_WRITE);
+	_arq_file_param.blocking = 0;
+	_arq_file_param.putbuf = _arq_fputbuf;
+	_arq_file_param.txbuf = 0;
+	_arq_file_param.rxbuf = 0;
+	fdev_set_udata(&_arq_file,(void*)&_arq_file_param);
+
+	_arq_file_underlying = f;
+	_arq_wr=0;
+	_arq_seq_base=_arq_seq_send=_arq_seq_next=0;
+	_arq_t_progress=timer_ms_get();
+	_arq_stat_frames=_arq_stat_retransmit=_arq_stat_timeout=_arq_stat_full=0;
+
+	return &_arq_file;
+}
+/******************************************************************************
+	function: arq_close
+*******************************************************************************
+	Close the reliable stream. Unacknowledged frames are discarded.
+******************************************************************************/
+void arq_close(void)
+{
+	_arq_file_underlying=0;
+}
+/******************************************************************************
+	function: arq_isopen
+*******************************************************************************
+	Returns:
+		0		-	Reliable stream closed
+		1		-	Reliable stream open
+******************************************************************************/
+unsigned char arq_isopen(void)
+{
+	return _arq_file_underlying?1:0;
+}
+/******************************************************************************
+	function: arq_level
+*******************************************************************************
+	Returns the number of frames in the retransmit window (sent or not yet sent,
+	and not yet acknowledged).
+******************************************************************************/
+unsigned char arq_level(void)
+{
+	return _arq_seq_next-_arq_seq_base;
+}
+/******************************************************************************
+	function: arq_ack
+*******************************************************************************
+	Process a cumulative acknowledgement: all the frames with a sequence number
+	lower than seq are removed from the retransmit window.
+
+	Acknowledgements outside of the window (e.g. duplicated or stale) are ignored.
+
+	Parameters:
+		seq		-	Sequence number of the next frame expected by the receiver
+******************************************************************************/
+void arq_ack(unsigned short seq)
+{
+	unsigned short n = seq-_arq_seq_base;
+
+	// Ignore acknowledgements outside of the window or which do not make progress
+	if(n==0 || n>(unsigned short)(_arq_seq_next-_arq_seq_base))
+		return;
+
+	_arq_seq_base = seq;
+	// If the receiver acknowledged frames which are queued for retransmission, skip them
+	if((unsigned short)(_arq_seq_send-_arq_seq_base) > (unsigned short)(_arq_seq_next-_arq_seq_base))
+		_arq_seq_send = _arq_seq_base;
+	_arq_t_progress = timer_ms_get();
+}
+/******************************************************************************
+	function: arq_service
+*******************************************************************************
+	Sends the frames of the window which have not been transmitted yet, as long
+	as the underlying stream accepts them, and restarts the transmission from
+	the oldest unacknowledged frame if no acknowledgement has been received
+	within ARQ_TIMEOUT.
+
+	This function must be called periodically, e.g. from the main loop of the
+	streaming mode; it is also called on each frame write.
+******************************************************************************/
+void arq_service(void)
+{
+	unsigned char idx;
+	unsigned long t;
+
+	if(!_arq_file_underlying)
+		return;
+
+	t = timer_ms_get();
+
+	// Window empty: nothing to do
+	if(_arq_seq_base==_arq_seq_next)
+	{
+		_arq_t_progress = t;
+		return;
+	}
+
+	// Timeout: go back to the oldest unacknowledged frame
+	if(_arq_seq_send!=_arq_seq_base && t-_arq_t_progress>ARQ_TIMEOUT)
+	{
+		_arq_stat_retransmit += (unsigned short)(_arq_seq_send-_arq_seq_base);
+		_arq_stat_timeout++;
+		_arq_seq_send = _arq_seq_base;
+		_arq_t_progress = t;
+	}
+
+	// Transmit the pending frames
+	while(_arq_seq_send!=_arq_seq_next)
+	{
+		idx = _arq_seq_send&(ARQ_WINDOWMAX-1);
+		if(fputbuf(_arq_file_underlying,_arq_buffer+_arq_frame_off[idx],_arq_frame_size[idx]))
+			break;
+		// The retransmit timeout counts from the first transmission following an idle window
+		if(_arq_seq_send==_arq_seq_base)
+			_arq_t_progress = t;
+		_arq_seq_send++;
+	}
+}
+/******************************************************************************
+	function: _arq_alloc
+*******************************************************************************
+	Finds space for a frame of size bytes in the frame buffer.
+
+	Returns:
+		Offset of the frame in the frame buffer, or 0xffff if there is no space.
+******************************************************************************/
+static unsigned short _arq_alloc(unsigned char size)
+{
+	unsigned short oldest;
+
+	// Window empty: restart from the beginning of the buffer
+	if(_arq_seq_base==_arq_seq_next)
+	{
+		_arq_wr=0;
+		return 0;
+	}
+	// Window full
+	if((unsigned short)(_arq_seq_next-_arq_seq_base)>=ARQ_WINDOWMAX)
+		return 0xffff;
+
+	oldest = _arq_frame_off[_arq_seq_base&(ARQ_WINDOWMAX-1)];
+	if(_arq_wr>oldest)
+	{
+		// Frames in [oldest;wr): space at the end or at the beginning of the buffer
+		if(_arq_wr+size<=ARQ_BUFFERSIZE)
+			return _arq_wr;
+		if(size<oldest)
+			return 0;
+		return 0xffff;
+	}
+	// Frames in [oldest;end) and [0;wr): space between wr and oldest
+	if(_arq_wr+size<oldest)
+		return _arq_wr;
+	return 0xffff;
+}
+/******************************************************************************
+	function: _arq_fputbuf
+*******************************************************************************
+	Internally used to enqueue data in the retransmit window when fputbuf is called.
+	Do not call directly.
+
+	The data is encapsulated in a frame, stored in the window and transmission
+	is attempted immediately.
+
+	Parameters:
+		buffer		-		Buffer containing the data
+		size 		-		Size of buffer
+	Returns:
+		0			-		Success
+		EOF			-		Error (window full or data too large)
+******************************************************************************/
+unsigned char _arq_fputbuf(char *buffer,unsigned char size)
+{
+	unsigned short off,chk;
+	unsigned char fsize,idx;
+	char *frame;
+
+	if(size>ARQ_PAYLOADMAX)
+		return EOF;
+
+	fsize = size+ARQ_FRAMEOVERHEAD;
+
+	// Try to free space by sending and processing acknowledgements first
+	off = _arq_alloc(fsize);
+	if(off==0xffff)
+	{
+		arq_service();
+		_arq_stat_full++;
+		return EOF;
+	}
+
+	// Build the frame in place
+	frame = _arq_buffer+off;
+	frame[0]='D';
+	frame[1]='A';
+	frame[2]='R';
+	frame[3]=_arq_seq_next&0xff;
+	frame[4]=_arq_seq_next>>8;
+	frame[5]=size;
+	memcpy(frame+ARQ_HDRSIZE,buffer,size);
+	chk = packet_fletcher16((unsigned char*)frame,ARQ_HDRSIZE+size);
+	frame[ARQ_HDRSIZE+size]=chk&0xff;
+	frame[ARQ_HDRSIZE+size+1]=chk>>8;
+
+	idx = _arq_seq_next&(ARQ_WINDOWMAX-1);
+	_arq_frame_off[idx]=off;
+	_arq_frame_size[idx]=fsize;
+	_arq_wr=off+fsize;
+	_arq_seq_next++;
+	_arq_stat_frames++;
+
+	arq_service();
+
+	return 0;
+}
+/******************************************************************************
+	function: _arq_fputchar
+*******************************************************************************
+	Internally used when fprintf/fputs/fputc are called on the reliable stream.
+	Characters are not framed and are passed through to the underlying stream.
+
+	Parameters:
+		c			-		Character to write
+		f 			-		File stream
+	Returns:
+		0			-		Success
+		EOF			-		Error
+******************************************************************************/
+int _arq_fputchar(char c,FILE *f)
+{
+	if(!_arq_file_underlying)
+		return EOF;
+	return fputc(c,_arq_file_underlying)==EOF?EOF:0;
+}
+/******************************************************************************
+	function: arq_printstat
+*******************************************************************************
+	Prints the statistics of the reliable stream.
+
+	Parameters:
+		f			-		Stream on which to print
+******************************************************************************/
+void arq_printstat(FILE *f)
+{
+	fprintf_P(f,PSTR("ARQ: frames: %lu retransmitted: %lu timeouts: %lu window full: %lu. Window: %u/%u unacknowledged: %u\n"),_arq_stat_frames,_arq_stat_retransmit,_arq_stat_timeout,_arq_stat_full,arq_level(),ARQ_WINDOWMAX,(unsigned short)(_arq_seq_send-_arq_seq_base));
+}
+
+/******************************************************************************
+	function: CommandParserARQ
+*******************************************************************************
+	Parses the reliable streaming command: r,<en>
+
+	The setting is stored in EEPROM and applied when streaming starts.
+
+	Parameters:
+		buffer	-		Pointer to the command string
+		size	-		Size of the command string
+
+	Returns:
+		0		-		Success
+		1		-		Message execution error (message valid)
+		2		-		Message invalid
+******************************************************************************/
+unsigned char CommandParserARQ(char *buffer,unsigned char size)
+{
+	int en;
+
+	unsigned char rv = ParseCommaGetInt(buffer,1,&en);
+	if(rv)
+		return 2;
+
+	mode_stream_arq = en?1:0;
+	ConfigSaveStreamARQ(mode_stream_arq);
+	fprintf_P(file_pri,PSTR("Reliable streaming: %d\n"),mode_stream_arq);
+	return 0;
+}
+/******************************************************************************
+	function: CommandParserARQAck
+*******************************************************************************
+	Parses the acknowledgement command: a,<seq>
+	
+	Acknowledgements are executed silently, without CMDOK, as an unframed reply 
+	for each acknowledgement would be interleaved with the stream. Late 
+	acknowledgements received after the stream is closed are ignored.
+
+	Parameters:
+		buffer	-		Pointer to the command string
+		size	-		Size of the command string
+
+	Returns:
+		3		-		Success, no reply
+		2		-		Message invalid
+******************************************************************************/
+unsigned char CommandParserARQAck(char *buffer,unsigned char size)
+{
+	long seq;
+
+	unsigned char rv = ParseCommaGetLong(buffer,1,&seq);
+	if(rv || seq<0 || seq>65535)
+		return 2;
+	if(arq_isopen())
+		arq_ack(seq);
+	return 3;
+}
@@ -0,0 +1,37 @@
+#ifndef __ARQ_H
+#define __ARQ_H
+
+#include <stdio.h>
+
+// Size of the buffer holding the frames of the retransmit window, in bytes.
+#define ARQ_BUFFERSIZE			1024
+// Maximum number of frames in the retransmit window. Must be a power of 2.
+#define ARQ_WINDOWMAX			32
+// Retransmit timeout in milliseconds: if no acknowledgement progress is made within this time, all unacknowledged frames are sent again.
+#define ARQ_TIMEOUT				500
+
+// Frame structure: header (3 bytes) + sequence number (2 bytes) + payload size (1 byte) + payload + checksum (2 bytes)
+#define ARQ_HDRSIZE				6
+#define ARQ_FRAMEOVERHEAD		(ARQ_HDRSIZE+2)
+#define ARQ_PAYLOADMAX			(255-ARQ_FRAMEOVERHEAD)
+
+extern const char help_arq[];
+extern const char help_arqack[];
+
+extern unsigned char mode_stream_arq;
+
+FILE *arq_open(FILE *f);
+void arq_close(void);
+unsigned char arq_isopen(void);
+void arq_ack(unsigned short seq);
+void arq_service(void);
+unsigned char arq_level(void);
+void arq_printstat(FILE *f);
+
+unsigned char _arq_fputbuf(char *buffer,unsigned char size);
+int _arq_fputchar(char c,FILE *f);
+
+unsigned char CommandParserARQ(char *buffer,unsigned char size);
+unsigned char CommandParserARQAck(char *buffer,unsigned char size);
+
+#endif
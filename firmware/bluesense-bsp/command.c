@@ -15,6 +15,7 @@
 #include "helper.h"
 #include "command.h"
 #include "ds3232.h"
+#include "mux.h"
 
 
 /*
@@ -58,20 +59,28 @@ unsigned char CommandProcess(const COMMANDPARSER *CommandParsers,unsigned char C
 	{
 		return 0;
 	}
+	if(rv==4)
+	{
+		// Executed without reply (e.g. acknowledgements while streaming)
+		return 1;
+	}
 	if(rv==3)
 	{
 		fputs_P(CommandInvalid,file_pri);
 		//fputs_P(CommandInvalid,file_dbg);
+		mux_flush();
 		return 1;
 	}
 	if(rv==1)
 	{
 		fputs_P(CommandSuccess,file_pri);
 		//fputs_P(CommandSuccess,file_dbg);
+		mux_flush();
 		return 1;
 	}
 	fputs_P(CommandError,file_pri);
 	//fputs_P(CommandError,file_dbg);	
+	mux_flush();
 	return 1;
 }
 
@@ -116,6 +125,7 @@ void _CommandPrint(void)
 		1	-	message execution ok (message valid)
 		2	-	message execution error (message valid)
 		3	-	message invalid 
+		4	-	message execution ok, no reply (message valid)
 ******************************************************************************/
 unsigned char CommandGet(const COMMANDPARSER *CommandParsers,unsigned char CommandParsersNum,unsigned char *msgid)
 {
@@ -227,11 +237,13 @@ unsigned char CommandGet(const COMMANDPARSER *CommandParsers,unsigned char Comma
 		1		-	Message execution ok (message valid)
 		2		-	Message execution error (message valid)
 		3		-	Message invalid 
+		4		-	Message execution ok, no reply (message valid)
 		
 	Parsers must return:
 		0		-	Message execution ok (message valid)
 		1		-	Message execution error (message valid)
 		2		-	Message invalid 		
+		3		-	Message execution ok, without CMDOK reply (message valid)
 ******************************************************************************/
 unsigned char CommandDecodeExec(const COMMANDPARSER *CommandParsers,unsigned char CommandParsersNum,char *buffer,unsigned char size,unsigned char *msgid)
 {
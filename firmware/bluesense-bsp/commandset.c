@@ -28,6 +28,7 @@
 #include "ltc2942.h"
 #include "mode.h"
 #include "ufat.h"
+#include "logstream.h"
 
 // Command help
 
@@ -774,6 +775,9 @@ unsigned char CommandParserAnnotation(char *buffer,unsigned char size)
 	}	
 	
 	CurrentAnnotation=a;
+	// Record the change of annotation in the log container
+	if(logstream_isopen())
+		fprintf_P(logstream_file(LOGSTREAM_NOTE),PSTR("N,%lu,%u\n"),timer_ms_get(),a);
 	
 	return 0;
 }
@@ -56,6 +56,7 @@ unsigned char _dbg_numtxbeforerx=5;			// 5: 13743 bytes/sec @1024Hz	6880 bytes/s
 //unsigned char _dbg_numtxbeforerx=1;		// 1: 8254 bytes/sec @1024Hz	4127 bytes/sec @512Hz
 //unsigned char _dbg_numtxbeforerx=10;	// 10: 14894 bytes/sec @1024Hz	7447 bytes/sec @512Hz
 unsigned char _dbg_newnumtxbeforerx=0;
+unsigned char _dbg_period=1;				// Callback divider: 1 for 500Hz
 
 volatile unsigned char _dbg_flag_unregister=0;	// Set to 1 for the callback to self-unregister at the end of the state machine cycle
 
@@ -115,7 +116,7 @@ void dbg_init(void)
 	// Only implement in the non-bootloader mode (in bootloader more, the callback must be handled by the programmer)
 	//timer_register_callback(dbg_callback,3);		// DBG at 250Hz
 	//timer_register_callback(dbg_callback,2);		// DBG at 340Hz		(good tradeoff)
-	timer_register_callback(dbg_callback,1);		// DBG at 500Hz, causes issues with cpu overhead leading to missed MPU samples
+	timer_register_callback(dbg_callback,_dbg_period);		// DBG at 500Hz, causes issues with cpu overhead leading to missed MPU samples
 #endif
 }
 void dbg_deinit(void)
@@ -607,8 +608,14 @@ void dbg_setioparam(unsigned char period,unsigned char txbeforerx)
 	dbg_deinit();
 	// Set new parameters and register callback
 	dbg_setnumtxbeforerx(txbeforerx);
+	_dbg_period=period;
 	timer_register_callback(dbg_callback,period);
 }
+void dbg_getioparam(unsigned char *period,unsigned char *txbeforerx)
+{
+	*period=_dbg_period;
+	*txbeforerx=_dbg_numtxbeforerx;
+}
 
 /*
  Benchmark the speed of the inquire process
@@ -37,6 +37,7 @@ unsigned char dbg_callback_rx(unsigned char p);
 unsigned char dbg_callback(unsigned char p);
 void dbg_bench(void);
 void dbg_setioparam(unsigned char period,unsigned char txbeforerx);
+void dbg_getioparam(unsigned char *period,unsigned char *txbeforerx);
 
 
 // Internal
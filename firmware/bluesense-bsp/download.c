@@ -0,0 +1,223 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "wait.h"
+#include "serial.h"
+#include "helper.h"
+#include "pkt.h"
+#include "dbg.h"
+#include "sd.h"
+#include "ufat.h"
+#include "download.h"
+
+/*
+	File: download
+
+	Download of log files over the primary interface.
+
+	The log is read from the SD card with a streaming (multiblock) read and sent in frames of up to one sector of payload.
+	Each frame carries the byte offset of its payload in the log, so that the host can reassemble the log and
+	resume an interrupted download from the last offset received correctly.
+
+	Frame format:
+
+		'D' 'L' 'F' off_0 off_1 off_2 off_3 size_lo size_hi payload[size] chk_lo chk_hi
+
+	The offset is little endian. The checksum is the fletcher16 checksum (packet_fletcher16) of all the preceding bytes of the frame.
+	The end of the log is indicated by a frame with an empty payload and the offset equal to the log size.
+
+	Text (e.g. command replies) may be sent before and after the frames; the host must ignore bytes outside of frames.
+	The download is aborted when any character is received from the host.
+
+	When the primary interface is USB, the USB I/O parameters are set to their maximum speed during the download
+	and restored afterwards. The Bluetooth interface runs at a fixed baud rate.
+
+	*Public functions*
+
+	* download_log:				Sends a log from an offset.
+*/
+
+const char help_download[] PROGMEM="D,<lognum>[,<offset>|t<sec>]: downloads a log in binary frames, optionally from a byte offset or from a time in seconds using the log index (if enabled)";
+
+/******************************************************************************
+	function: _download_put
+*******************************************************************************
+	Writes a buffer to the stream in chunks, waiting for space in the transmit
+	buffer.
+
+	Returns:
+		0			-		Success
+		1			-		Aborted by the host
+******************************************************************************/
+static unsigned char _download_put(FILE *f,char *buffer,unsigned short size)
+{
+	unsigned char n;
+
+	while(size)
+	{
+		n = size>DOWNLOAD_CHUNK?DOWNLOAD_CHUNK:size;
+		while(fputbuf(f,buffer,n))
+		{
+			if(fgetc(f)!=EOF)
+				return 1;
+		}
+		buffer+=n;
+		size-=n;
+	}
+	return 0;
+}
+/******************************************************************************
+	function: _download_frame
+*******************************************************************************
+	Completes the header and checksum of a frame and sends it.
+	The payload must already be at frame+DOWNLOAD_HDRSIZE.
+
+	Returns:
+		0			-		Success
+		1			-		Aborted by the host
+******************************************************************************/
+static unsigned char _download_frame(FILE *f,char *frame,unsigned long offset,unsigned short size)
+{
+	unsigned short chk;
+
+	frame[0]='D';
+	frame[1]='L';
+	frame[2]='F';
+	frame[3]=offset;
+	frame[4]=offset>>8;
+	frame[5]=offset>>16;
+	frame[6]=offset>>24;
+	frame[7]=size;
+	frame[8]=size>>8;
+	chk = packet_fletcher16((unsigned char*)frame,DOWNLOAD_HDRSIZE+size);
+	frame[DOWNLOAD_HDRSIZE+size]=chk;
+	frame[DOWNLOAD_HDRSIZE+size+1]=chk>>8;
+	return _download_put(f,frame,size+DOWNLOAD_FRAMEOVERHEAD);
+}
+
+/******************************************************************************
+	function: download_log
+*******************************************************************************
+	Sends a log in frames, starting from a byte offset.
+
+	Parameters:
+		f			-		Stream on which to send the log
+		lognum		-		Number of the log
+		offset		-		Offset in bytes from which to send the log
+
+	Returns:
+		0			-		Success
+		1			-		Error
+		2			-		Aborted by the host
+******************************************************************************/
+unsigned char download_log(FILE *f,unsigned char lognum,unsigned long offset)
+{
+	char frame[DOWNLOAD_HDRSIZE+512+2];
+	unsigned long startsector,size,t1;
+	unsigned short n,skip;
+	unsigned char rv=0,period,txbeforerx,retry=DOWNLOAD_RETRY,open=0;
+
+	if(ufat_log_getinfo(lognum,&startsector,&size))
+		return 1;
+	if(offset>size)
+		offset=size;
+
+	fprintf_P(f,PSTR("Download log %u: size %lu from %lu\n"),lognum,size,offset);
+
+	// Maximum USB speed
+	if(f==file_usb)
+	{
+		dbg_getioparam(&period,&txbeforerx);
+		dbg_setioparam(0,128);
+	}
+
+	t1=timer_ms_get();
+	while(offset<size)
+	{
+		// Read the sector containing offset; the first frame may start within the sector.
+		// On error, reopen the stream at the sector which failed.
+		if(!open)
+		{
+			if(sd_streamread_open(startsector+(offset>>9))==0)
+				open=1;
+		}
+		if(!open || sd_streamread_read(frame+DOWNLOAD_HDRSIZE,0))
+		{
+			open=0;
+			if(--retry==0)
+			{
+				rv=1;
+				break;
+			}
+			continue;
+		}
+		retry=DOWNLOAD_RETRY;
+		skip = offset&511;
+		n = 512-skip;
+		if(offset+n>size)
+			n = size-offset;
+		if(skip)
+			memmove(frame+DOWNLOAD_HDRSIZE,frame+DOWNLOAD_HDRSIZE+skip,n);
+		if(_download_frame(f,frame,offset,n))
+		{
+			rv=2;
+			break;
+		}
+		offset+=n;
+	}
+	sd_streamread_close();
+	// End of log
+	if(rv==0)
+		rv = _download_frame(f,frame,size,0)?2:0;
+	if(f==file_usb)
+		dbg_setioparam(period,txbeforerx);
+
+	fprintf_P(f,PSTR("Download %s. Offset %lu. Time: %lu ms\n"),rv==0?"done":(rv==1?"read error":"aborted"),offset,timer_ms_get()-t1);
+	return rv;
+}
+
+/******************************************************************************
+	function: CommandParserDownload
+*******************************************************************************
+	Parses the download command: D,<lognum>[,<offset>|t<sec>]
+	
+	With t<sec>, the download starts at the index record preceding sec seconds
+	from the start of the log (see ufat_log_findtime), or at the start of the 
+	log if the firmware is built without the time index (UFAT_LOG_INDEXPERIOD).
+
+	Parameters:
+		buffer	-		Pointer to the command string
+		size	-		Size of the command string
+
+	Returns:
+		0		-		Success
+		1		-		Message execution error (message valid)
+		2		-		Message invalid
+******************************************************************************/
+unsigned char CommandParserDownload(char *buffer,unsigned char size)
+{
+	char *p1;
+	unsigned long lognum,offset=0,t;
+
+	if(ParseComma(buffer,1,&p1))
+		return 2;
+	if(sscanf(p1,"%lu,t%lu",&lognum,&t)==2)
+	{
+		if(lognum>=ufat_log_getnumlogs())
+			return 2;
+		if(ufat_log_findtime(lognum,t*1000,&offset))
+			return 1;
+	}
+	else if(sscanf(p1,"%lu,%lu",&lognum,&offset)<1)
+		return 2;
+	if(lognum>=ufat_log_getnumlogs())
+		return 2;
+
+	if(download_log(file_pri,lognum,offset))
+		return 1;
+	return 0;
+}
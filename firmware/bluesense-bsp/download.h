@@ -0,0 +1,20 @@
+#ifndef __DOWNLOAD_H
+#define __DOWNLOAD_H
+
+#include <stdio.h>
+
+// Frame structure: header (3 bytes) + offset (4 bytes) + payload size (2 bytes) + payload + checksum (2 bytes)
+#define DOWNLOAD_HDRSIZE			9
+#define DOWNLOAD_FRAMEOVERHEAD		(DOWNLOAD_HDRSIZE+2)
+// Size of the chunks written to the interface; must be smaller than the transmit buffer
+#define DOWNLOAD_CHUNK				128
+// Number of attempts to read a sector
+#define DOWNLOAD_RETRY				3
+
+extern const char help_download[];
+
+unsigned char download_log(FILE *f,unsigned char lognum,unsigned long offset);
+
+unsigned char CommandParserDownload(char *buffer,unsigned char size);
+
+#endif
@@ -52,6 +52,7 @@
 #include "mode.h"
 #include "a3d.h"
 #include "pio.h"
+#include "trigger.h"
 
 
 
@@ -61,7 +62,7 @@ FILE *file_fb;			// Screen
 FILE *file_dbg;			// Debug (assigned to file_bt or file_usb)
 FILE *file_pri;			// Primary (assigned to file_bt or file_usb)
 
-unsigned char sharedbuffer[520];
+unsigned char sharedbuffer[TRIGGER_BUFFERSIZE>520?TRIGGER_BUFFERSIZE:520];	// Also the pre-trigger buffer, see trigger
 
 
 // Device name
@@ -55,6 +55,9 @@ extern unsigned char system_devname[];
 #define CONFIG_ADDR_STREAM_LABEL 24
 #define CONFIG_ADDR_STREAM_PKTCTR 25
 #define CONFIG_ADDR_ENABLE_INFO 26
+#define CONFIG_ADDR_STREAM_ARQ 27
+#define CONFIG_ADDR_STREAM_AXES0 28
+#define CONFIG_ADDR_STREAM_AXES1 29
 
 
 
@@ -30,6 +30,7 @@ Use interface_changedetectenable to enable/disable change detection.
 #include "system.h"
 #include "system-extra.h"
 #include "wait.h"
+#include "mux.h"
 
 
 signed char interface_bt_connected_past=0;
@@ -67,6 +68,16 @@ void interface_usbdown(void)
 {
 	dbg_deinit();
 }
+/*
+	Assigns the primary and debug interfaces. The multiplexer, if open, follows the primary interface.
+*/
+static void _interface_assign(FILE *pri,FILE *dbg)
+{
+	file_pri=pri;
+	file_dbg=dbg;
+	stdin=stdout=stderr=file_pri;
+	mux_retarget(file_pri);
+}
 void interface_hellopri(void)
 {
 	// TODO: use putbuf nonblock
@@ -292,9 +303,7 @@ void _interface_update(signed char cur_bt_connected,signed char cur_usb_connecte
 	// Assignment of primary/secondary if simultaneous connection: bluetooth is primary
 	if( ((interface_bt_connected_past==0||interface_bt_connected_past==-1) && cur_bt_connected==1) && ((interface_usb_connected_past==0||interface_usb_connected_past==-1) && cur_usb_connected==1))
 	{
-		file_pri = file_bt;
-		stdin=stdout=stderr=file_pri;
-		file_dbg = file_usb;
+		_interface_assign(file_bt,file_usb);
 		interface_hellodbg();
 		interface_hellopri();
 	}
@@ -305,16 +314,14 @@ void _interface_update(signed char cur_bt_connected,signed char cur_usb_connecte
 		if( (interface_bt_connected_past==0||interface_bt_connected_past==-1) && cur_bt_connected==1)
 		{
 			// bt is primary: pri doesn't change
-			file_pri=file_bt;
-			file_dbg=file_usb;
+			_interface_assign(file_bt,file_usb);
 			interface_hellopri();
 			interface_hellodbg();
 		}
 		// BT down
 		if(cur_bt_connected==0 && interface_bt_connected_past==1)
 		{
-			file_pri=file_usb;
-			file_dbg=file_bt;
+			_interface_assign(file_usb,file_bt);
 			interface_hellopri();
 			interface_hellodbg();
 		}
@@ -333,11 +340,7 @@ void _interface_update(signed char cur_bt_connected,signed char cur_usb_connecte
 }
 void interface_swap(void)
 {
-	FILE *f;
-	f=file_pri;
-	file_pri=file_dbg;
-	file_dbg=f;
-	stdin=stdout=stderr=file_pri;	
+	_interface_assign(file_dbg,file_pri);
 	interface_hellopri();
 	interface_hellodbg();
 }
@@ -0,0 +1,189 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wait.h"
+#include "sd.h"
+#include "logpack.h"
+
+/*
+	File: logpack
+
+	Sector-aligned packing of the records of logs.
+
+	Each record (one write to the log, e.g. a sample written with fputbuf, or an index record) is written to the sector cache
+	(sd_streamcache_write) within one sector: when a record does not fit in the space left in the sector, the sector is padded
+	with zeros and the record starts the next sector. Records larger than LOGPACK_PAYLOAD, which the log functions do not produce,
+	are split across sectors.
+
+	Sector format:
+
+		LOGPACK_MAGIC LOGPACK_VERSION seq[4] time[4] records... padding size[2] crc[2]
+
+	seq is the sequence number of the sector in the log, from 0, and time the time (timer_ms_get) at which the first record of the
+	sector was written. size is the number of bytes of records; crc is the CRC16 (CRC-CCITT as _crc_xmodem_update, initial value 0)
+	of the 510 preceding bytes. All the fields are little endian.
+
+	A sector is decoded without the others: a record is never split (unless larger than a sector), a corrupted sector only loses its
+	own records, and the sectors of a log can be decoded in parallel and ordered by their sequence number and time.
+	The sector being filled is in the sector cache until it is complete: logpack_flush must be called before the log is closed.
+	support/host/logunpack unpacks the logs.
+
+	*Public functions*
+
+	* logpack_init:				Starts the packing of a log.
+	* logpack_write:			Packs a record.
+	* logpack_flush:			Pads and writes the last sector.
+*/
+
+unsigned long _logpack_seq;									// Sequence number of the sector being filled
+unsigned short _logpack_n;									// Number of bytes of records in the sector
+unsigned char _logpack_started;								// Header of the sector written
+unsigned short _logpack_crc;								// CRC of the bytes of the sector written
+
+/******************************************************************************
+	function: logpack_init
+*******************************************************************************
+	Starts the packing of a log: the next record starts sector 0.
+******************************************************************************/
+void logpack_init(void)
+{
+	_logpack_seq=0;
+	_logpack_n=0;
+	_logpack_started=0;
+}
+
+/******************************************************************************
+	function: _logpack_out
+*******************************************************************************
+	Writes data of the sector being filled to the cache, updating the CRC.
+******************************************************************************/
+static unsigned char _logpack_out(char *buffer,unsigned short size)
+{
+	for(unsigned short i=0;i<size;i++)
+		_logpack_crc=_crc_xmodem_update(_logpack_crc,buffer[i]);
+	return sd_streamcache_write(buffer,size,0);
+}
+/******************************************************************************
+	function: _logpack_u32
+*******************************************************************************
+	Stores a 32-bit value little endian.
+******************************************************************************/
+static void _logpack_u32(char *p,unsigned long v)
+{
+	for(unsigned char i=0;i<4;i++,v>>=8)
+		p[i]=v&0xff;
+}
+/******************************************************************************
+	function: _logpack_startsector
+*******************************************************************************
+	Writes the header of a new sector.
+******************************************************************************/
+static unsigned char _logpack_startsector(void)
+{
+	char hdr[LOGPACK_HDRSIZE];
+
+	hdr[0]=LOGPACK_MAGIC;
+	hdr[1]=LOGPACK_VERSION;
+	_logpack_u32(hdr+2,_logpack_seq);
+	_logpack_u32(hdr+6,timer_ms_get());
+	_logpack_crc=0;
+	_logpack_n=0;
+	_logpack_started=1;
+	return _logpack_out(hdr,LOGPACK_HDRSIZE);
+}
+/******************************************************************************
+	function: _logpack_endsector
+*******************************************************************************
+	Pads the sector with zeros and writes the trailer.
+******************************************************************************/
+static unsigned char _logpack_endsector(unsigned char *numsect)
+{
+	char pad[16];
+	unsigned char rv=0;
+	unsigned short size=_logpack_n;
+
+	memset(pad,0,sizeof(pad));
+	while(_logpack_n<LOGPACK_PAYLOAD)
+	{
+		unsigned short n=LOGPACK_PAYLOAD-_logpack_n<(unsigned short)sizeof(pad)?LOGPACK_PAYLOAD-_logpack_n:sizeof(pad);
+		rv|=_logpack_out(pad,n);
+		_logpack_n+=n;
+	}
+	pad[0]=size&0xff;
+	pad[1]=size>>8;
+	rv|=_logpack_out(pad,2);
+	pad[0]=_logpack_crc&0xff;
+	pad[1]=_logpack_crc>>8;
+	rv|=sd_streamcache_write(pad,2,0);
+	_logpack_started=0;
+	_logpack_seq++;
+	(*numsect)++;
+	return rv;
+}
+
+/******************************************************************************
+	function: logpack_write
+*******************************************************************************
+	Packs a record: the record is written in the sector being filled if it
+	fits, otherwise in the next sector.
+
+	Parameters:
+		buffer		-	Record
+		size		-	Number of bytes
+		numsect		-	Receives the number of sectors completed
+
+	Returns:
+		0			-	Success
+		1			-	Error writing to the cache
+******************************************************************************/
+unsigned char logpack_write(char *buffer,unsigned short size,unsigned char *numsect)
+{
+	unsigned char rv=0;
+
+	*numsect=0;
+	while(size)
+	{
+		if(!_logpack_started)
+			rv|=_logpack_startsector();
+		unsigned short room=LOGPACK_PAYLOAD-_logpack_n;
+		// The record does not fit in the space left: it starts the next sector
+		if(size>room && _logpack_n)
+		{
+			rv|=_logpack_endsector(numsect);
+			continue;
+		}
+		unsigned short n=size<room?size:room;
+		rv|=_logpack_out(buffer,n);
+		_logpack_n+=n;
+		buffer+=n;
+		size-=n;
+		if(_logpack_n==LOGPACK_PAYLOAD)
+			rv|=_logpack_endsector(numsect);
+	}
+	return rv?1:0;
+}
+
+/******************************************************************************
+	function: logpack_flush
+*******************************************************************************
+	Pads and writes the sector being filled. The next record starts a new
+	sector.
+
+	Parameters:
+		numsect		-	Receives the number of sectors completed
+
+	Returns:
+		0			-	Success
+		1			-	Error writing to the cache
+******************************************************************************/
+unsigned char logpack_flush(unsigned char *numsect)
+{
+	*numsect=0;
+	if(_logpack_started && _logpack_endsector(numsect))
+		return 1;
+	return 0;
+}
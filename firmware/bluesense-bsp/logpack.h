@@ -0,0 +1,17 @@
+#ifndef __LOGPACK_H
+#define __LOGPACK_H
+
+// Header of a packed sector: magic, format version, sequence number (32 bits) and time of the first record in ms (32 bits), little endian
+#define LOGPACK_MAGIC			0xD5
+#define LOGPACK_VERSION			1
+#define LOGPACK_HDRSIZE			10
+// Trailer of a packed sector: number of bytes of records (16 bits) and CRC16 of the preceding bytes of the sector, little endian
+#define LOGPACK_TRLSIZE			4
+// Bytes of records in a sector
+#define LOGPACK_PAYLOAD			(512-LOGPACK_HDRSIZE-LOGPACK_TRLSIZE)
+
+void logpack_init(void);
+unsigned char logpack_write(char *buffer,unsigned short size,unsigned char *numsect);
+unsigned char logpack_flush(unsigned char *numsect);
+
+#endif
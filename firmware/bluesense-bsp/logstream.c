@@ -0,0 +1,246 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "serial.h"
+#include "pkt.h"
+#include "mux.h"
+#include "ufat.h"
+#include "logstream.h"
+
+/*
+	File: logstream
+
+	Log container interleaving typed records from multiple producers in one log.
+
+	When a log is opened with logstream_open, each producer (motion or ADC samples, status, battery statistics, annotations) writes to the 
+	stream of its record type (logstream_file), and each record is written to the log as a frame carrying the record type. 
+	All the records go through the sector cache of the open log, so that several data sources are captured in one log without opening and 
+	closing logs.
+
+	Frame format (identical to the frames of the multiplexer, see mux; muxdemux separates the record types of a downloaded log):
+
+		0xA5 type size payload[size] chk_lo chk_hi
+
+	The checksum is the fletcher16 checksum (packet_fletcher16) of all the preceding bytes of the frame.
+
+	Data written with fputbuf is written immediately as one record (two if larger than MUX_PAYLOADMAX). Data written char by char 
+	(fputc/fprintf) is accumulated in a line buffer shared by all record types, and written as one record on newline, when the buffer is full, 
+	when data of another record type is written, or when logstream_flush is called.
+	Each frame is written with one fputbuf call, so that the index records of the log (see ufat) are only inserted between frames.
+
+	*Public functions*
+
+	* logstream_open:			Opens a log as a container.
+	* logstream_close:			Writes pending data and closes the log.
+	* logstream_isopen:			Indicates whether a container is open.
+	* logstream_file:			Returns the FILE of a record type.
+	* logstream_write:			Writes a record.
+	* logstream_flush:			Writes the data accumulated by fputc/fprintf.
+*/
+
+FILE *_logstream_log=0;
+
+FILE _logstream_file[LOGSTREAM_TYPES];
+SERIALPARAM _logstream_file_param[LOGSTREAM_TYPES];
+
+char _logstream_line[LOGSTREAM_LINESIZE];
+unsigned char _logstream_line_n;
+unsigned char _logstream_line_type;
+
+unsigned char _logstream_putbuf_note(char *buffer,unsigned char size);
+unsigned char _logstream_putbuf_status(char *buffer,unsigned char size);
+unsigned char _logstream_putbuf_motion(char *buffer,unsigned char size);
+unsigned char _logstream_putbuf_adc(char *buffer,unsigned char size);
+unsigned char _logstream_putbuf_bat(char *buffer,unsigned char size);
+int _logstream_fputchar(char c,FILE *f);
+
+/******************************************************************************
+	function: logstream_open
+*******************************************************************************
+	Opens a log as a container of typed records.
+
+	Parameters:
+		lognum	-	Number of the log
+
+	Returns:
+		0		-	Success
+		1		-	Error
+******************************************************************************/
+unsigned char logstream_open(unsigned char lognum)
+{
+	unsigned char (*putbuf[LOGSTREAM_TYPES])(char*,unsigned char) = {_logstream_putbuf_note,_logstream_putbuf_status,_logstream_putbuf_motion,_logstream_putbuf_adc,_logstream_putbuf_bat};
+
+	if(_logstream_log)
+		return 1;
+	_logstream_log = ufat_log_open(lognum);
+	if(!_logstream_log)
+		return 1;
+
+	for(unsigned char i=0;i<LOGSTREAM_TYPES;i++)
+	{
+		fdev_setup_stream(&_logstream_file[i],_logstream_fputchar,0,_FDEV_SETUP_WRITE);
+		_logstream_file_param[i].blocking = 0;
+		_logstream_file_param[i].putbuf = putbuf[i];
+		_logstream_file_param[i].txbuf = 0;
+		_logstream_file_param[i].rxbuf = 0;
+		fdev_set_udata(&_logstream_file[i],(void*)&_logstream_file_param[i]);
+	}
+	_logstream_line_n=0;
+	return 0;
+}
+/******************************************************************************
+	function: logstream_close
+*******************************************************************************
+	Writes the pending data and closes the log.
+******************************************************************************/
+void logstream_close(void)
+{
+	if(!_logstream_log)
+		return;
+	logstream_flush();
+	_logstream_log=0;
+	ufat_log_close();
+}
+/******************************************************************************
+	function: logstream_isopen
+*******************************************************************************
+	Returns:
+		0		-	No container open
+		1		-	Container open
+******************************************************************************/
+unsigned char logstream_isopen(void)
+{
+	return _logstream_log?1:0;
+}
+/******************************************************************************
+	function: logstream_file
+*******************************************************************************
+	Returns the stream of a record type.
+
+	Parameters:
+		type	-	Record type (LOGSTREAM_xxx)
+
+	Returns:
+		0		-	No container open or invalid type
+		nonzero	-	FILE* for write operations
+******************************************************************************/
+FILE *logstream_file(unsigned char type)
+{
+	if(!_logstream_log || type>=LOGSTREAM_TYPES)
+		return 0;
+	return &_logstream_file[type];
+}
+/******************************************************************************
+	function: _logstream_putframe
+*******************************************************************************
+	Writes a frame of at most MUX_PAYLOADMAX bytes to the log.
+
+	Returns:
+		0			-		Success
+		nonzero		-		Error (e.g. log full)
+******************************************************************************/
+static unsigned char _logstream_putframe(unsigned char type,char *buffer,unsigned char size)
+{
+	char frame[MUX_PAYLOADMAX+MUX_FRAMEOVERHEAD];
+	unsigned short chk;
+
+	frame[0]=MUX_SYNC;
+	frame[1]=type;
+	frame[2]=size;
+	memcpy(frame+MUX_HDRSIZE,buffer,size);
+	chk = packet_fletcher16((unsigned char*)frame,MUX_HDRSIZE+size);
+	frame[MUX_HDRSIZE+size]=chk&0xff;
+	frame[MUX_HDRSIZE+size+1]=chk>>8;
+	return fputbuf(_logstream_log,frame,size+MUX_FRAMEOVERHEAD);
+}
+/******************************************************************************
+	function: logstream_flush
+*******************************************************************************
+	Writes the data accumulated by fputc/fprintf.
+
+	Returns:
+		0			-		Success
+		nonzero		-		Error
+******************************************************************************/
+unsigned char logstream_flush(void)
+{
+	unsigned char rv=0;
+	if(_logstream_log && _logstream_line_n)
+	{
+		rv = _logstream_putframe(_logstream_line_type,_logstream_line,_logstream_line_n);
+		_logstream_line_n=0;
+	}
+	return rv;
+}
+/******************************************************************************
+	function: logstream_write
+*******************************************************************************
+	Writes a record. Data larger than MUX_PAYLOADMAX is written in two records.
+
+	Parameters:
+		type		-		Record type (LOGSTREAM_xxx)
+		buffer		-		Buffer containing the data
+		size 		-		Size of buffer
+	Returns:
+		0			-		Success
+		nonzero		-		Error
+******************************************************************************/
+unsigned char logstream_write(unsigned char type,char *buffer,unsigned char size)
+{
+	if(!_logstream_log || type>=LOGSTREAM_TYPES)
+		return 1;
+	// Preserve the order of the data
+	logstream_flush();
+	if(size>MUX_PAYLOADMAX)
+	{
+		if(_logstream_putframe(type,buffer,MUX_PAYLOADMAX))
+			return 1;
+		buffer+=MUX_PAYLOADMAX;
+		size-=MUX_PAYLOADMAX;
+	}
+	return _logstream_putframe(type,buffer,size);
+}
+int _logstream_fputchar(char c,FILE *f)
+{
+	unsigned char type = f-_logstream_file;
+	
+	if(!_logstream_log)
+		return EOF;
+	if(_logstream_line_n && _logstream_line_type!=type)
+	{
+		if(logstream_flush())
+			return EOF;
+	}
+	_logstream_line_type=type;
+	_logstream_line[_logstream_line_n++]=c;
+	if(c=='\n' || _logstream_line_n>=LOGSTREAM_LINESIZE)
+	{
+		if(logstream_flush())
+			return EOF;
+	}
+	return 0;
+}
+unsigned char _logstream_putbuf_note(char *buffer,unsigned char size)
+{
+	return logstream_write(LOGSTREAM_NOTE,buffer,size);
+}
+unsigned char _logstream_putbuf_status(char *buffer,unsigned char size)
+{
+	return logstream_write(LOGSTREAM_STATUS,buffer,size);
+}
+unsigned char _logstream_putbuf_motion(char *buffer,unsigned char size)
+{
+	return logstream_write(LOGSTREAM_MOTION,buffer,size);
+}
+unsigned char _logstream_putbuf_adc(char *buffer,unsigned char size)
+{
+	return logstream_write(LOGSTREAM_ADC,buffer,size);
+}
+unsigned char _logstream_putbuf_bat(char *buffer,unsigned char size)
+{
+	return logstream_write(LOGSTREAM_BAT,buffer,size);
+}
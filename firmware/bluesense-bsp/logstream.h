@@ -0,0 +1,24 @@
+#ifndef __LOGSTREAM_H
+#define __LOGSTREAM_H
+
+#include <stdio.h>
+
+// Record types
+#define LOGSTREAM_NOTE			0			// Annotations and text
+#define LOGSTREAM_STATUS		1			// Streaming/logging status (stream_status), including the battery voltage, current and power
+#define LOGSTREAM_MOTION		2			// Motion samples
+#define LOGSTREAM_ADC			3			// ADC samples
+#define LOGSTREAM_BAT			4			// Battery statistics (ltc2942)
+#define LOGSTREAM_TYPES			5
+
+// Size of the buffer accumulating characters written with fputc/fprintf, shared by all record types. A record is written on newline, when full, or when another type is written.
+#define LOGSTREAM_LINESIZE		64
+
+unsigned char logstream_open(unsigned char lognum);
+void logstream_close(void);
+unsigned char logstream_isopen(void);
+FILE *logstream_file(unsigned char type);
+unsigned char logstream_write(unsigned char type,char *buffer,unsigned char size);
+unsigned char logstream_flush(void);
+
+#endif
@@ -0,0 +1,254 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sd.h"
+#include "logzip.h"
+
+/*
+	File: logzip
+
+	Lossless compression of logs, sector by sector.
+
+	The data of the log is compressed with a LZSS coder and written to the sector cache (sd_streamcache_write) in complete sectors.
+	Each sector is decoded independently of the others: the matches only refer to data encoded in the same sector. A sector
+	lost or corrupted only loses its own data, and a log recovered after a power loss (see ufat) is decoded up to its last sector.
+
+	Sector format:
+
+		LOGZIP_MAGIC LOGZIP_VERSION groups... padding
+
+	A group is a flag byte followed by up to 8 items; bit i of the flag byte (LSB first) indicates whether item i is a literal (0)
+	or a match (1). A literal is one byte of data. A match is two bytes: the length minus LOGZIP_MINMATCH and the distance minus 1;
+	the data is copied from distance bytes before, one byte at a time, so that the match can overlap the data it produces.
+	A match whose first byte is LOGZIP_END ends the sector; the remainder of the sector is zero.
+
+	The matches are found with a hash table of the last position of each combination of 3 bytes, which is cheap enough to
+	compress the data as it is logged. The size of a compressed sector is reserved so that the end marker always fits.
+
+	Data written to logzip_write is kept in memory until it is encoded, and the sector being filled until it is complete:
+	logzip_flush must be called before the log is closed. support/host/logunzip decompresses the logs.
+
+	*Public functions*
+
+	* logzip_init:				Starts the compression of a log.
+	* logzip_write:				Compresses data.
+	* logzip_flush:				Encodes the pending data and writes the last sector.
+*/
+
+char _logzip_ring[LOGZIP_RINGSIZE];							// Data: window and data not yet encoded
+unsigned short _logzip_hash[LOGZIP_HASHSIZE];				// Last position of each hash of 3 bytes
+unsigned short _logzip_pos;									// Position of the next byte to encode
+unsigned short _logzip_end;									// Position after the last byte written
+unsigned short _logzip_avail;								// Number of bytes encoded in the sector, i.e. available to matches
+unsigned short _logzip_outn;								// Number of bytes of the sector written to the cache; 0 if the sector is not started
+char _logzip_group[17];										// Group being built: flag byte and up to 8 items
+unsigned char _logzip_groupn;								// Number of bytes in the group, 0 if no group is started
+unsigned char _logzip_groupitems;							// Number of items in the group
+
+/******************************************************************************
+	function: logzip_init
+*******************************************************************************
+	Starts the compression of a log: the next sector starts a new block.
+******************************************************************************/
+void logzip_init(void)
+{
+	_logzip_pos=_logzip_end=0;
+	_logzip_avail=0;
+	_logzip_outn=0;
+	_logzip_groupn=0;
+	_logzip_groupitems=0;
+	memset(_logzip_hash,0,sizeof(_logzip_hash));
+}
+
+/******************************************************************************
+	function: _logzip_out
+*******************************************************************************
+	Writes data of the sector being filled to the cache.
+******************************************************************************/
+static unsigned char _logzip_out(char *buffer,unsigned char size)
+{
+	_logzip_outn+=size;
+	return sd_streamcache_write(buffer,size,0);
+}
+static unsigned char _logzip_flushgroup(void)
+{
+	unsigned char rv=0;
+	if(_logzip_groupn)
+		rv=_logzip_out(_logzip_group,_logzip_groupn);
+	_logzip_groupn=0;
+	_logzip_groupitems=0;
+	return rv;
+}
+/******************************************************************************
+	function: _logzip_item
+*******************************************************************************
+	Adds a literal (n=1) or a match (n=2) to the group. The end marker is a
+	match of one byte.
+******************************************************************************/
+static unsigned char _logzip_item(unsigned char a,unsigned char b,unsigned char match,unsigned char n)
+{
+	if(_logzip_groupitems==8 && _logzip_flushgroup())
+		return 1;
+	if(_logzip_groupn==0)
+	{
+		_logzip_group[0]=0;
+		_logzip_groupn=1;
+	}
+	if(match)
+		_logzip_group[0]|=1<<_logzip_groupitems;
+	_logzip_group[_logzip_groupn++]=a;
+	if(n==2)
+		_logzip_group[_logzip_groupn++]=b;
+	_logzip_groupitems++;
+	return 0;
+}
+/******************************************************************************
+	function: _logzip_room
+*******************************************************************************
+	Indicates whether an item of n bytes fits in the sector, leaving room for
+	the end marker. Starts the sector if needed.
+******************************************************************************/
+static unsigned char _logzip_room(unsigned char n)
+{
+	if(_logzip_outn==0)
+	{
+		char hdr[LOGZIP_HDRSIZE]={(char)LOGZIP_MAGIC,LOGZIP_VERSION};
+		_logzip_out(hdr,LOGZIP_HDRSIZE);
+	}
+	// Flag byte of a new group, and end marker with its flag byte
+	if(_logzip_groupn==0 || _logzip_groupitems==8)
+		n++;
+	return _logzip_outn+_logzip_groupn+n+2<=512;
+}
+/******************************************************************************
+	function: _logzip_endsector
+*******************************************************************************
+	Writes the end marker and pads the sector with zeros.
+******************************************************************************/
+static unsigned char _logzip_endsector(unsigned char *numsect)
+{
+	unsigned char rv;
+
+	rv=_logzip_item(LOGZIP_END,0,1,1);
+	rv|=_logzip_flushgroup();
+	memset(_logzip_group,0,sizeof(_logzip_group));
+	while(_logzip_outn<512)
+		rv|=_logzip_out(_logzip_group,512-_logzip_outn<(unsigned short)sizeof(_logzip_group)?512-_logzip_outn:sizeof(_logzip_group));
+	_logzip_outn=0;
+	_logzip_avail=0;
+	(*numsect)++;
+	return rv;
+}
+static unsigned char _logzip_hashof(unsigned short pos)
+{
+	unsigned char a=_logzip_ring[pos&(LOGZIP_RINGSIZE-1)];
+	unsigned char b=_logzip_ring[(pos+1)&(LOGZIP_RINGSIZE-1)];
+	unsigned char c=_logzip_ring[(pos+2)&(LOGZIP_RINGSIZE-1)];
+	return ((a<<4)^(a>>3)^(b<<2)^c)&(LOGZIP_HASHSIZE-1);
+}
+/******************************************************************************
+	function: _logzip_encode
+*******************************************************************************
+	Encodes the item at the current position: the longest match with the
+	hash candidate, or a literal. If the item does not fit, ends the sector
+	instead: the next call encodes the item in the new sector.
+******************************************************************************/
+static unsigned char _logzip_encode(unsigned char *numsect)
+{
+	unsigned short look=_logzip_end-_logzip_pos;
+	unsigned short best=0,dist=0,cand;
+	unsigned char h;
+
+	if(look>=LOGZIP_MINMATCH)
+	{
+		h=_logzip_hashof(_logzip_pos);
+		cand=_logzip_hash[h];
+		_logzip_hash[h]=_logzip_pos;
+		dist=_logzip_pos-cand;
+		// The candidate may be stale: the data is compared
+		if(dist && dist<=LOGZIP_WINDOW && dist<=_logzip_avail)
+		{
+			unsigned short max=look<LOGZIP_MAXMATCH?look:LOGZIP_MAXMATCH;
+			while(best<max && _logzip_ring[(_logzip_pos+best)&(LOGZIP_RINGSIZE-1)]==_logzip_ring[(_logzip_pos+best-dist)&(LOGZIP_RINGSIZE-1)])
+				best++;
+		}
+	}
+	if(best>=LOGZIP_MINMATCH)
+	{
+		if(!_logzip_room(2))
+			return _logzip_endsector(numsect);
+		if(_logzip_item(best-LOGZIP_MINMATCH,dist-1,1,2))
+			return 1;
+		// Positions within the match
+		for(unsigned short i=1;i<best && _logzip_end-(_logzip_pos+i)>=LOGZIP_MINMATCH;i++)
+			_logzip_hash[_logzip_hashof(_logzip_pos+i)]=_logzip_pos+i;
+		_logzip_pos+=best;
+		_logzip_avail+=best;
+	}
+	else
+	{
+		if(!_logzip_room(1))
+			return _logzip_endsector(numsect);
+		if(_logzip_item(_logzip_ring[_logzip_pos&(LOGZIP_RINGSIZE-1)],0,0,1))
+			return 1;
+		_logzip_pos++;
+		_logzip_avail++;
+	}
+	return 0;
+}
+
+/******************************************************************************
+	function: logzip_write
+*******************************************************************************
+	Compresses data. The data is encoded as soon as LOGZIP_MAXMATCH bytes
+	are pending, and each complete sector is written to the cache.
+
+	Parameters:
+		buffer		-	Data
+		size		-	Number of bytes
+		numsect		-	Receives the number of sectors completed
+
+	Returns:
+		0			-	Success
+		1			-	Error writing to the cache
+******************************************************************************/
+unsigned char logzip_write(char *buffer,unsigned short size,unsigned char *numsect)
+{
+	*numsect=0;
+	while(size--)
+	{
+		_logzip_ring[_logzip_end&(LOGZIP_RINGSIZE-1)]=*buffer++;
+		_logzip_end++;
+		while((unsigned short)(_logzip_end-_logzip_pos)>=LOGZIP_MAXMATCH)
+			if(_logzip_encode(numsect))
+				return 1;
+	}
+	return 0;
+}
+
+/******************************************************************************
+	function: logzip_flush
+*******************************************************************************
+	Encodes the pending data and writes the sector being filled, padded.
+	The next data starts a new sector.
+
+	Parameters:
+		numsect		-	Receives the number of sectors completed
+
+	Returns:
+		0			-	Success
+		1			-	Error writing to the cache
+******************************************************************************/
+unsigned char logzip_flush(unsigned char *numsect)
+{
+	*numsect=0;
+	while(_logzip_pos!=_logzip_end)
+		if(_logzip_encode(numsect))
+			return 1;
+	if(_logzip_outn && _logzip_endsector(numsect))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef __LOGZIP_H
+#define __LOGZIP_H
+
+// First bytes of a compressed sector: magic and format version
+#define LOGZIP_MAGIC			0xC5
+#define LOGZIP_VERSION			1
+#define LOGZIP_HDRSIZE			2
+
+// Match tokens: the distance is at most LOGZIP_WINDOW bytes, within the data of the sector, and the length is LOGZIP_MINMATCH to LOGZIP_MAXMATCH
+#define LOGZIP_WINDOW			256
+#define LOGZIP_MINMATCH			3
+#define LOGZIP_MAXMATCH			66
+// Length byte of a match token marking the end of a sector
+#define LOGZIP_END				0xFF
+
+// Size of the ring buffer of data, holding the window and the data not yet encoded: must be a power of 2 larger than LOGZIP_WINDOW+LOGZIP_MAXMATCH
+#define LOGZIP_RINGSIZE			512
+#define LOGZIP_HASHSIZE			128
+
+void logzip_init(void);
+unsigned char logzip_write(char *buffer,unsigned short size,unsigned char *numsect);
+unsigned char logzip_flush(unsigned char *numsect);
+
+#endif
@@ -14,6 +14,7 @@
 #include "i2c.h"
 #include "i2c_int.h"
 #include "wait.h"
+#include "helper.h"
 
 /*
 	Convert last into mAh using prescaler
@@ -67,6 +68,7 @@
 	* ltc2942_last_mW:				Returns the average power between two background reads in mW.
 	* ltc2942_last_temperature:		Returns the LTC2942 temperature in decidegrees (1 unit=0.1celsius).
 	* ltc2942_last_strstatus		Returns a status string describing the battery mV, mA and mW.
+	* ltc2942_get_longbatstat_avg	Returns the average current and power of the long battery statistics from a given time.
 	
 	*Usage in interrupts*
 	
@@ -779,7 +781,17 @@ unsigned char __ltc2942_trans_read_done(I2C_TRANSACTION *t)
 *******************************************************************************/
 char *ltc2942_last_strstatus(void)
 {
-	sprintf(_ltc2924_batterytext,"V=%d mV; I=%d mA; P=%d mW",ltc2942_last_mV(),ltc2942_last_mA(),ltc2942_last_mW());
+	char *strptr;
+	
+	// Use the formatu16 family rather than sprintf, as this is called by the status functions while sampling
+	strptr=formatstr_P(_ltc2924_batterytext,PSTR("V="));
+	strptr=formatu16(strptr,ltc2942_last_mV());
+	strptr=formatstr_P(strptr,PSTR(" mV; I="));
+	strptr=formats16(strptr,ltc2942_last_mA());
+	strptr=formatstr_P(strptr,PSTR(" mA; P="));
+	strptr=formats16(strptr,ltc2942_last_mW());
+	strptr=formatstr_P(strptr,PSTR(" mW"));
+	*strptr=0;
 	return _ltc2924_batterytext;
 }
 
@@ -938,6 +950,39 @@ void _ltc2942_add_longbatstat(LTC2942_BATSTAT *batstat)
 	}	
 }
 
+/******************************************************************************
+	function: ltc2942_get_longbatstat_avg
+*******************************************************************************	
+	Returns the average current and power of the long battery statistics 
+	from a given time, e.g. to compare the consumption of sessions.
+
+	Parameters
+		t0				-	Time in ms of the first statistics to average
+		mA				-	Pointer receiving the average current
+		mW				-	Pointer receiving the average power
+	Returns:
+		Number of statistics averaged; if 0, mA and mW are 0
+*******************************************************************************/
+unsigned char ltc2942_get_longbatstat_avg(unsigned long t0,signed short *mA,signed short *mW)
+{
+	LTC2942_BATSTAT b;
+	signed long sa=0,sw=0;
+	unsigned char n=0;
+	
+	for(unsigned char i=0;i<ltc2942_get_numlongbatstat();i++)
+	{
+		ltc2942_get_longbatstat(i,&b);
+		if(b.t<t0)
+			continue;
+		sa+=b.mA;
+		sw+=b.mW;
+		n++;
+	}
+	*mA=n?sa/n:0;
+	*mW=n?sw/n:0;
+	return n;
+}
+
 // For debugging
 void _ltc2942_dump_longbatstat()
 {
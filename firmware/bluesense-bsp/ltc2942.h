@@ -67,6 +67,7 @@ signed short ltc2942_last_mWs(unsigned char idx);
 void ltc2942_clear_longbatstat();
 unsigned char ltc2942_get_numlongbatstat();
 void ltc2942_get_longbatstat(unsigned char idx,LTC2942_BATSTAT *batstat);
+unsigned char ltc2942_get_longbatstat_avg(unsigned long t0,signed short *mA,signed short *mW);
 void _ltc2942_add_longbatstat(LTC2942_BATSTAT *batstat);
 void _ltc2942_dump_longbatstat();
 void ltc2942_print_longbatstat(FILE *f);
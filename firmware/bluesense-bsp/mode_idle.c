@@ -44,6 +44,8 @@
 #include "mode_teststream.h"
 #include "mode_adcfast.h"
 #include "mode_siggen.h"
+#include "arq.h"
+#include "mux.h"
 
 
 const char help_x[] PROGMEM ="x";
@@ -98,7 +100,10 @@ const COMMANDPARSER CommandParsersIdle[] =
 	{'O', CommandParserOff,help_O},
 	{'o', CommandParserOffPower,help_o},
 	{'F', CommandParserStreamFormat,help_f},
+	{'P', CommandParserStreamAxes,help_streamaxes},
 	{'i', CommandParserInfo,help_info},
+	{'r', CommandParserARQ,help_arq},
+	{'U', CommandParserMux,help_mux},
 #if ENABLEMODECOULOMB==1	
 	{'c', CommandParserCoulomb,help_coulomb},
 #endif
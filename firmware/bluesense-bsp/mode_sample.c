@@ -8,6 +8,56 @@
 	* mode_sample_logend: 			to terminate logs
 	* help_samplelog				help string
 	* mode_sample_file_log			FILE* for logging
+	* mode_sample_logcontainer		Indicates whether logs are written as containers of typed records (see logstream)
+	* mode_sample_logtype			Record type of the samples of the current mode in a container
+	* mode_sample_logcompact		Indicates whether logs are written in the compact binary format
+	* mode_sample_logcompress		Indicates whether logs are compressed (1, see logzip) or their records packed in sectors (2, see logpack) on the card
+	* mode_sample_logring			Size in MB of the ring of ring logs, 0 for linear logs (see ufat)
+	* mode_sample_logburst			Number of sectors of the burst writes of the logs, 0 to keep the card writing (see sd)
+	* help_sampletrigger			help string
+	* help_sampleburst				help string
+	* mode_sample_logheader			Function of the current mode writing the header of compact logs
+	
+	*Compact logs*
+	
+	With L,<lognum>,<container>,1 the samples are always logged in a compact binary format, regardless of the stream format 
+	(command F), which only applies to the data streamed on the interfaces. This avoids the formatting time and the size 
+	of text logs.
+	
+	The log starts with a header block of text lines describing the fields of the records, written by the function 
+	mode_sample_logheader of the current mode:
+	
+		#H,BSC,<version>,<recordsize>,<rate>			Header: format version, bytes of fields per record, sample rate in Hz (0: unknown)
+		#F,<name>,<type>,<num>,<den>,<unit>			One line per field in record order: type is u16, s16 or u32 (little endian); 
+														the physical value is raw*num/den in unit
+		#D											End of header
+	
+	Each sample is a record made of MODE_SAMPLE_COMPACT_SYNC (0xB5) followed by the fields. The header is written again if the 
+	fields change during logging (command F or P): it applies to the records which follow it.
+	All the text lines, including the index records of the log (see ufat), start with '#' and are only found between records.
+	support/host/logcsv converts compact logs to CSV.
+	
+	*Packed records*
+	
+	With L,<lognum>,<container>,<compact>,2 each record is written within one sector of the card, which carries a sequence 
+	number, a timestamp and a CRC (see logpack): a corrupted sector only loses its own records, and the sectors can be 
+	decoded independently. support/host/logunpack unpacks the log.
+	
+	*Ring logs*
+	
+	With L,<lognum>,<container>,<compact>,<compress>,<ringmb> the log is a ring of ringmb MB ("black box", see ufat): logging 
+	runs until it is stopped, keeping the most recent data. The command T records a trigger in the log and stops logging, 
+	which freezes the ring. support/host/logring linearises the ring.
+	
+	*Burst writes*
+	
+	With B,<sectors> the log is written to the card in bursts of sectors, and the card idles between bursts (see sd). 
+	Bursts are not limited by the sector pool: bursts longer than the pool spread the cost of each burst over more sectors, 
+	while the card idles for the time to fill the pool between bursts. 
+	When logging stops, the number of bursts and the average current and power of the ltc2942 long battery statistics 
+	since the log was started are printed: comparing sessions at the same sample rate with B,0 and with bursts quantifies 
+	the energy saved. The long battery statistics are updated every LTC2942NUMLONGBATSTAT_UPDATEEVERY ms, hence sessions 
+	must last several updates.
 	
 	*TODO*
 	
@@ -42,12 +92,33 @@
 #include "mode_sample.h"
 #include "mode_global.h"
 #include "commandset.h"
+#include "logstream.h"
+#include "trigger.h"
+#include "sd.h"
+#include "ltc2942.h"
 
 
 // Log file used by the modes mode_adc and mode_motionstream
 FILE *mode_sample_file_log;				
+// Log container: when nonzero the samples are written as records of type mode_sample_logtype, interleaved with the status, battery and annotation records
+unsigned char mode_sample_logcontainer=0;
+unsigned char mode_sample_logtype=LOGSTREAM_MOTION;
+// Compact log: when nonzero the samples are logged as compact binary records, described by a header written by mode_sample_logheader
+unsigned char mode_sample_logcompact=0;
+// Compressed log: 1: the log is compressed sector by sector on the card; 2: the records are packed in sectors with a header and CRC
+unsigned char mode_sample_logcompress=0;
+// Ring log: when nonzero the log is a ring of this size in MB
+unsigned short mode_sample_logring=0;
+// Burst writes: when nonzero the log is written to the card in bursts of this number of sectors
+unsigned char mode_sample_logburst=0;
+unsigned long _mode_sample_logt0;				// Time at which the log was started
+void (*mode_sample_logheader)(FILE *f)=0;
 
-const char help_samplelog[] PROGMEM="L[,<lognum>]: without parameter logging is stopped, otherwise logging starts on lognum";
+const char _mode_sample_typename[3][4] PROGMEM={"u16","s16","u32"};
+
+const char help_samplelog[] PROGMEM="L[,<lognum>[,<container>[,<compact>[,<compress>[,<ringmb>]]]]]: without parameter logging is stopped, otherwise logging starts on lognum. With container=1 the log interleaves typed records of samples, status, battery and annotations. With compact=1 the samples are logged in compact binary with a header describing the fields. With compress=1 the log is compressed on the card; with compress=2 the records are packed in sectors with a header and CRC. With ringmb>0 the log is a ring keeping the last ringmb MB";
+const char help_sampleburst[] PROGMEM="B[,<sectors>]: prints or sets the number of sectors written to the card in each burst; the card idles between bursts. 0: the card writes continuously";
+const char help_sampletrigger[] PROGMEM="T: records a trigger in the log and stops logging; the ring of a ring log is frozen";
 
 
 /******************************************************************************
@@ -59,7 +130,10 @@ const char help_samplelog[] PROGMEM="L[,<lognum>]: without parameter logging is
 	mode_file_log.
 	
 	
-	Command format: L[,<lognum>]
+	Command format: L[,<lognum>[,<container>[,<compact>[,<compress>[,<ringmb>]]]]]
+	
+	The container, compact, compress and ring settings are kept for the following logs, including those 
+	started when entering a mode.
 	
 	Parameters:
 		buffer			-			Buffer containing the command
@@ -72,7 +146,8 @@ const char help_samplelog[] PROGMEM="L[,<lognum>]: without parameter logging is
 ******************************************************************************/
 unsigned char CommandParserSampleLog(char *buffer,unsigned char size)
 {
-	unsigned int lognum;
+	unsigned int lognum,container,compact,compress,ring;
+	char *p1;
 	
 	if(size==0)
 	{
@@ -88,20 +163,95 @@ unsigned char CommandParserSampleLog(char *buffer,unsigned char size)
 	
 	// L,lognum was passed: parse
 	unsigned char rv;
-	rv = ParseCommaGetInt((char*)buffer,1,&lognum);
+	rv = ParseComma((char*)buffer,1,&p1);
 	if(rv)
 		return 2;		// Message invalid
+	container = mode_sample_logcontainer;
+	compact = mode_sample_logcompact;
+	compress = mode_sample_logcompress;
+	ring = mode_sample_logring;
+	if(sscanf(p1,"%u,%u,%u,%u,%u",&lognum,&container,&compact,&compress,&ring)<1)
+		return 2;		// Message invalid
+	mode_sample_logcontainer = container?1:0;
+	mode_sample_logcompact = compact?1:0;
+	mode_sample_logcompress = compress<=2?compress:1;
+	mode_sample_logring = ring;
 	
 	rv = mode_sample_startlog(lognum);
 	return rv;			// Returns 0 (ok) or 1 (execution error but message valid)
 }
 
+/******************************************************************************
+	function: CommandParserSampleBurst
+*******************************************************************************	
+	Parses the burst command: prints or sets the number of sectors of the 
+	burst writes, applied immediately to the ongoing log.
+	
+	Command format: B[,<sectors>]
+	
+	Parameters:
+		buffer			-			Buffer containing the command
+		size			-			Length of the buffer containing the command	
+
+	Returns:
+		0		-		Success
+		2		-		Message invalid 
+******************************************************************************/
+unsigned char CommandParserSampleBurst(char *buffer,unsigned char size)
+{
+	unsigned int burst;
+	
+	if(size==0)
+	{
+		fprintf_P(file_pri,PSTR("Burst: %u sectors (pool: %u)\n"),mode_sample_logburst,SD_CACHE_NUMSECT);
+		return 0;
+	}
+	if(ParseCommaGetInt((char*)buffer,1,&burst) || burst>255)
+		return 2;
+	mode_sample_logburst = burst;
+	sd_streamcache_burst(mode_sample_logburst);
+	return 0;
+}
+
+/******************************************************************************
+	function: CommandParserSampleTrigger
+*******************************************************************************	
+	Parses the trigger command: records a trigger in the log and stops 
+	logging. The ring of a ring log is frozen with the data preceding the 
+	trigger.
+	
+	Command format: T
+	
+	Parameters:
+		buffer			-			Buffer containing the command
+		size			-			Length of the buffer containing the command	
+
+	Returns:
+		0		-		Success
+		1		-		Message execution error (message valid)
+******************************************************************************/
+unsigned char CommandParserSampleTrigger(char *buffer,unsigned char size)
+{
+	if(mode_sample_file_log==0)
+	{
+		fprintf_P(file_pri,PSTR("No ongoing logging\n"));
+		return 1;
+	}
+	ufat_log_trigger();
+	mode_sample_logend();
+	return 0;
+}
+
 /******************************************************************************
 	function: mode_sample_startlog
 *******************************************************************************	
 	Starts a log on the specified logfile. 
 	If the filesystem is unavailable or a log is ongoing returns an error.
 	
+	If mode_sample_logcontainer is set, the log is opened as a container and 
+	mode_sample_file_log is the stream of the record type mode_sample_logtype.
+	If mode_sample_logcompact is set, the header of the compact log is written.
+	
 	If lognum is negative, does nothing.
 	
 	Parameters:
@@ -140,14 +290,28 @@ unsigned char mode_sample_startlog(int lognum)
 	//printf("not logging therefore start logging\n");
 	
 	// Not logging therefore start logging
-	fprintf_P(file_pri,PSTR("Logging on %u\n"),lognum);
+	fprintf_P(file_pri,PSTR("Logging on %u%s%s\n"),lognum,mode_sample_logcontainer?" (container)":"",mode_sample_logcompact?" (compact)":"");
+	ufat_log_compress(mode_sample_logcompress==1);
+	ufat_log_pack(mode_sample_logcompress==2);
+	ufat_log_ring((unsigned long)mode_sample_logring<<20);
+	sd_streamcache_burst(mode_sample_logburst);
+	_mode_sample_logt0=timer_ms_get();
+	if(mode_sample_logring)
+		fprintf_P(file_pri,PSTR("Ring of %u MB\n"),mode_sample_logring);
 
-	mode_sample_file_log = ufat_log_open(lognum);
+	if(mode_sample_logcontainer)
+	{
+		if(logstream_open(lognum)==0)
+			mode_sample_file_log = logstream_file(mode_sample_logtype);
+	}
+	else
+		mode_sample_file_log = ufat_log_open(lognum);
 	if(!mode_sample_file_log)
 	{
 		fprintf_P(file_pri,PSTR("Error opening log\n"));
 		return 1;
 	}
+	mode_sample_compact_header();
 	return 0;
 }
 
@@ -155,15 +319,90 @@ unsigned char mode_sample_startlog(int lognum)
 /******************************************************************************
 	function: mode_sample_logend
 *******************************************************************************	
-	Checks whether logging was in progress, and if yes closes the log
+	Checks whether logging was in progress, and if yes closes the log.
+	Prints the number of bursts of the card writes and the average battery 
+	consumption since the log was started.
 
 ******************************************************************************/
 void mode_sample_logend(void)
 {
 	if(mode_sample_file_log)
 	{
+		signed short mA,mW;
+		unsigned char n=ltc2942_get_longbatstat_avg(_mode_sample_logt0,&mA,&mW);
 		fprintf_P(file_pri,PSTR("Terminating logging\n"));
+		fprintf_P(file_pri,PSTR("Burst: %u sectors. Multiblock writes: %u. Battery: %d mA %d mW (%u readings)\n"),mode_sample_logburst,sd_streamcache_getbursts(),mA,mW,n);
 		mode_sample_file_log=0;
-		ufat_log_close();
+		if(logstream_isopen())
+			logstream_close();
+		else
+			ufat_log_close();
 	}
 }
+
+/******************************************************************************
+	function: mode_sample_compact_header
+*******************************************************************************	
+	Writes the header of a compact log with mode_sample_logheader, if a log is 
+	open in the compact format. The pre-trigger buffer is emptied, as its 
+	records precede the header.
+	
+	Must be called when the log is opened, and when the fields of the samples change.
+******************************************************************************/
+void mode_sample_compact_header(void)
+{
+	trigger_clear();
+	if(mode_sample_file_log && mode_sample_logcompact && mode_sample_logheader)
+		mode_sample_logheader(mode_sample_file_log);
+}
+
+/******************************************************************************
+	function: mode_sample_compact_begin
+*******************************************************************************	
+	Writes the first line of the header of a compact log.
+	
+	Parameters:
+		f				-	Log
+		recordsize		-	Number of bytes of the fields of a record, excluding the sync byte
+		rate			-	Sample rate in Hz, or 0 if unknown
+******************************************************************************/
+void mode_sample_compact_begin(FILE *f,unsigned char recordsize,unsigned short rate)
+{
+	fprintf_P(f,PSTR("#H,BSC,%u,%u,%u\n"),MODE_SAMPLE_COMPACT_VERSION,recordsize,rate);
+}
+/******************************************************************************
+	function: mode_sample_compact_field
+*******************************************************************************	
+	Writes the description of a field in the header of a compact log.
+	
+	Parameters:
+		f				-	Log
+		name			-	Name of the field, in program memory
+		index			-	Number appended to the name, or MODE_SAMPLE_NOINDEX
+		type			-	MODE_SAMPLE_T_U16, MODE_SAMPLE_T_S16 or MODE_SAMPLE_T_U32
+		num,den			-	Scale: the value in unit is raw*num/den
+		unit			-	Unit, in program memory
+******************************************************************************/
+void mode_sample_compact_field(FILE *f,const char *name,unsigned char index,unsigned char type,unsigned short num,unsigned short den,const char *unit)
+{
+	char n[8],t[4],u[8];
+	
+	strncpy_P(n,name,sizeof(n)-1);
+	n[sizeof(n)-1]=0;
+	strcpy_P(t,_mode_sample_typename[type]);
+	strncpy_P(u,unit,sizeof(u)-1);
+	u[sizeof(u)-1]=0;
+	if(index==MODE_SAMPLE_NOINDEX)
+		fprintf_P(f,PSTR("#F,%s,%s,%u,%u,%s\n"),n,t,num,den,u);
+	else
+		fprintf_P(f,PSTR("#F,%s%u,%s,%u,%u,%s\n"),n,index,t,num,den,u);
+}
+/******************************************************************************
+	function: mode_sample_compact_end
+*******************************************************************************	
+	Writes the last line of the header of a compact log.
+******************************************************************************/
+void mode_sample_compact_end(FILE *f)
+{
+	fprintf_P(f,PSTR("#D\n"));
+}
@@ -2,13 +2,41 @@
 #define __MODE_SAMPLE_H
 
 
+// Compact logs: each sample is a record made of MODE_SAMPLE_COMPACT_SYNC followed by the binary fields of the sample, 
+// described by a header block of text lines (see mode_sample.c)
+#define MODE_SAMPLE_COMPACT_SYNC		0xB5
+#define MODE_SAMPLE_COMPACT_VERSION		1
+
+// Types of the fields of compact records (little endian)
+#define MODE_SAMPLE_T_U16				0
+#define MODE_SAMPLE_T_S16				1
+#define MODE_SAMPLE_T_U32				2
+
+// Index of a field without index
+#define MODE_SAMPLE_NOINDEX				0xFF
+
 extern FILE *mode_sample_file_log;
+extern unsigned char mode_sample_logcontainer;
+extern unsigned char mode_sample_logcompact;
+extern unsigned char mode_sample_logcompress;
+extern unsigned short mode_sample_logring;
+extern unsigned char mode_sample_logburst;
+extern unsigned char mode_sample_logtype;
+extern void (*mode_sample_logheader)(FILE *f);
 
 extern const char help_samplelog[];
+extern const char help_sampletrigger[];
+extern const char help_sampleburst[];
 
 unsigned char CommandParserSampleLog(char *buffer,unsigned char size);
+unsigned char CommandParserSampleTrigger(char *buffer,unsigned char size);
+unsigned char CommandParserSampleBurst(char *buffer,unsigned char size);
 unsigned char mode_sample_startlog(int lognum);
 void mode_sample_logend(void);
+void mode_sample_compact_header(void);
+void mode_sample_compact_begin(FILE *f,unsigned char recordsize,unsigned short rate);
+void mode_sample_compact_field(FILE *f,const char *name,unsigned char index,unsigned char type,unsigned short num,unsigned short den,const char *unit);
+void mode_sample_compact_end(FILE *f);
 
 
 
@@ -5,6 +5,9 @@
 	
 	This function contains the 'A' mode of the sensor which allows to acquire multiple ADC channels and stream or log them. 
 	
+	In compact logs (see mode_sample) the records contain the packet counter (16-bit), the time in us, the battery, 
+	the label and the channels, according to the stream format; fast mode does not change the records.
+	
 	*TODO*
 	
 	* Statistics when logging could display log-only information (samples acquired, samples lost, samples per second)
@@ -39,6 +42,8 @@
 #include "mode_sample.h"
 #include "mode_sample_adc.h"
 #include "commandset.h"
+#include "mux.h"
+#include "logstream.h"
 
 
 unsigned long mode_adc_period;
@@ -52,9 +57,11 @@ const COMMANDPARSER CommandParsersADC[] =
 	{'H', CommandParserHelp,help_h},
 //	{'A', CommandParserADC,help_a},
 	{'N', CommandParserAnnotation,help_annotation},
-	{'F', CommandParserStreamFormat,help_f},
+	{'F', CommandParserStreamFormatADC,help_f},
 //	{'W', CommandParserSwap,help_w},
 	{'L', CommandParserSampleLog,help_samplelog},
+	{'T', CommandParserSampleTrigger,help_sampletrigger},
+	{'B', CommandParserSampleBurst,help_sampleburst},
 	{'P', CommandParserADCPullup,help_adcpullup},
 	{'Z',CommandParserSync,help_z},
 	{'i',CommandParserInfo,help_info},
@@ -85,6 +92,20 @@ const unsigned char CommandParsersADCNum=sizeof(CommandParsersADC)/sizeof(COMMAN
 		size			-			Length of the buffer containing the command
 			
 ******************************************************************************/
+/******************************************************************************
+	function: CommandParserStreamFormatADC
+*******************************************************************************	
+	Parses the stream format command and writes again the header of a 
+	compact log, as the fields of the records change.
+******************************************************************************/
+unsigned char CommandParserStreamFormatADC(char *buffer,unsigned char size)
+{
+	unsigned char rv=CommandParserStreamFormat(buffer,size);
+	if(!rv)
+		mode_sample_compact_header();
+	return rv;
+}
+
 unsigned char CommandParserADCPullup(char *buffer,unsigned char size)
 {
 	unsigned char rv;
@@ -159,6 +180,39 @@ unsigned char CommandParserADC(char *buffer,unsigned char size)
 
 
 
+/******************************************************************************
+	function: adc_compact_header
+*******************************************************************************	
+	Writes the header of a compact log describing the fields of the ADC samples.
+	
+	Parameters:
+		f		-	Log
+******************************************************************************/
+void adc_compact_header(FILE *f)
+{
+	unsigned char size;
+	
+	size = 2*__builtin_popcount(mode_adc_mask);
+	if(mode_stream_format_pktctr) size+=2;
+	if(mode_stream_format_ts) size+=4;
+	if(mode_stream_format_bat) size+=2;
+	if(mode_stream_format_label) size+=2;
+	
+	mode_sample_compact_begin(f,size,mode_adc_fast?0:1000000l/mode_adc_period);
+	if(mode_stream_format_pktctr)
+		mode_sample_compact_field(f,PSTR("pkt"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U16,1,1,PSTR(""));
+	if(mode_stream_format_ts)
+		mode_sample_compact_field(f,PSTR("t"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U32,1,1,PSTR("us"));
+	if(mode_stream_format_bat)
+		mode_sample_compact_field(f,PSTR("bat"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U16,1,1,PSTR("mV"));
+	if(mode_stream_format_label)
+		mode_sample_compact_field(f,PSTR("label"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U16,1,1,PSTR(""));
+	for(unsigned char i=0;i<8;i++)
+		if(mode_adc_mask&(1<<i))
+			mode_sample_compact_field(f,PSTR("adc"),i,MODE_SAMPLE_T_U16,1,1,PSTR(""));
+	mode_sample_compact_end(f);
+}
+
 /******************************************************************************
 	function: mode_adc
 *******************************************************************************	
@@ -183,9 +237,12 @@ void mode_adc(void)
 	unsigned char enableinfo;
 	unsigned char putbufrv;
 	unsigned short pktctr=0;
+	const char compactsync=MODE_SAMPLE_COMPACT_SYNC;
 	
 	
 	mode_sample_file_log=0;
+	mode_sample_logtype=LOGSTREAM_ADC;							// Record type of the samples if the log is a container
+	mode_sample_logheader=adc_compact_header;					// Header of compact logs
 
 	// Load mode configuration
 	mode_stream_format_bin=ConfigLoadStreamBinary();
@@ -283,13 +340,24 @@ void mode_adc(void)
 			if(time-time_laststatus>10000000)
 			{
 				char str[128];
-				sprintf_P(str,PSTR("ADC mode. Samples: %lu in %lu ms. Sample error: %lu. Log size: %lu\n"),stat_totsample,timer_ms_get()-stat_timemsstart,stat_samplesendfailed,ufat_log_getsize());
-				fputbuf(file_pri,str,strlen(str));
-				fputbuf(file_dbg,str,strlen(str));
+				char *strptr;
+				strptr=formatstr_P(str,PSTR("ADC mode. Samples: "));
+				strptr=formatu32(strptr,stat_totsample);
+				strptr=formatstr_P(strptr,PSTR(" in "));
+				strptr=formatu32(strptr,timer_ms_get()-stat_timemsstart);
+				strptr=formatstr_P(strptr,PSTR(" ms. Sample error: "));
+				strptr=formatu32(strptr,stat_samplesendfailed);
+				strptr=formatstr_P(strptr,PSTR(". Log size: "));
+				strptr=formatu32(strptr,ufat_log_getsize());
+				*strptr++='\n';
+				fputbuf(mux_file(MUX_CH_STATUS),str,strptr-str);
 				_delay_ms(100);
-				sprintf_P(str,PSTR("time us: %lu. time ms: %lu\n"),time,timer_ms_get());
-				fputbuf(file_pri,str,strlen(str));
-				fputbuf(file_dbg,str,strlen(str));
+				strptr=formatstr_P(str,PSTR("time us: "));
+				strptr=formatu32(strptr,time);
+				strptr=formatstr_P(strptr,PSTR(". time ms: "));
+				strptr=formatu32(strptr,timer_ms_get());
+				*strptr++='\n';
+				fputbuf(mux_file(MUX_CH_STATUS),str,strptr-str);
 				time_laststatus = time;
 			}
 		}
@@ -304,11 +372,33 @@ void mode_adc(void)
 		if(mode_sample_file_log)
 			file_stream=mode_sample_file_log;
 		else
-			file_stream=file_pri;
+			file_stream=mux_file(MUX_CH_DATA);
 		
 
 		// Encode the samples
-		if(!mode_stream_format_bin)
+		if(file_stream==mode_sample_file_log && mode_sample_logcompact)
+		{
+			// Compact log record: sync byte and fields, in fast and normal mode
+			packet_init(&packet,&compactsync,1);
+			if(mode_stream_format_pktctr)
+				packet_add16_little(&packet,pktctr);
+			if(mode_stream_format_ts)
+			{
+				packet_add16_little(&packet,time&0xffff);
+				packet_add16_little(&packet,(time>>16)&0xffff);
+			}
+			if(mode_stream_format_bat)
+				packet_add16_little(&packet,system_getbattery());
+			if(mode_stream_format_label)
+				packet_add16_little(&packet,CurrentAnnotation);
+			for(unsigned i=0;i<numchannels;i++)
+				packet_add16_little(&packet,data[i]);
+			packet_end(&packet);
+			putbufrv = fputbuf(file_stream,(char*)packet.data,packet_size(&packet));
+			// Restore the header of the streamed packets
+			packet_init(&packet,"DXX",3);
+		}
+		else if(!mode_stream_format_bin)
 		{
 			// Plain text encoding
 			char *bufferptr=buffer;
@@ -434,7 +524,7 @@ void mode_adc(void)
 	char str[128];
 	sprintf_P(str,PSTR("ADC mode end. Samples: %lu in %lu ms (%lu samples/sec). Samples not transmitted: %lu (%lu %%)\n"),stat_totsample,stat_timemsend-stat_timemsstart,sps,stat_samplesendfailed,stat_samplesendfailed*100/stat_totsample);
 	fputbuf(file_pri,str,strlen(str));
-	fputbuf(file_dbg,str,strlen(str));
+	fputbuf(mux_file(MUX_CH_DBG),str,strlen(str));
 }
 
 
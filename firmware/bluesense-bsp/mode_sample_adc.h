@@ -12,5 +12,7 @@ void mode_adc(void);
 
 unsigned char CommandParserADCPullup(char *buffer,unsigned char size);
 unsigned char CommandParserADC(char *buffer,unsigned char size);
+unsigned char CommandParserStreamFormatADC(char *buffer,unsigned char size);
+void adc_compact_header(FILE *f);
 
 #endif
@@ -7,6 +7,9 @@
 	
 	This mode contains conditional codepath depending on the #defines FIXEDPOINTQUATERNION, FIXEDPOINTQUATERNIONSHIFT and ENABLEQUATERNION.
 	
+	With a trigger source set (command E, see trigger) the samples are only logged around events: until an event they are kept 
+	in the pre-trigger buffer, which is written to the log ahead of the sample triggering the event.
+	
 	*TODO*
 	
 	* Statistics when logging could display log-only information (samples acquired, samples lost, samples per second)
@@ -47,6 +50,10 @@
 #include "mode.h"
 #include "ltc2942.h"
 #include "a3d.h"
+#include "arq.h"
+#include "mux.h"
+#include "logstream.h"
+#include "trigger.h"
 
 // Volatile parameter of the mode 
 MODE_SAMPLE_MOTION_PARAM mode_sample_motion_param;
@@ -65,7 +72,8 @@ unsigned char enableinfo;
 
 unsigned long stat_samplesendfailed;
 unsigned long stat_totsample;
-unsigned long stat_timems_start,stat_t_cur,stat_wakeup,stat_time_laststatus;
+unsigned long stat_timems_start,stat_t_cur,stat_wakeup,stat_time_laststatus,stat_time_lastlogstatus;
+unsigned long stat_status_time_us;					// Maximum time taken to format the status text
 unsigned long int time_lastblink;
 
 MPUMOTIONDATA mpumotiondata;
@@ -74,13 +82,19 @@ MPUMOTIONGEOMETRY mpumotiongeometry;
 
 const char help_samplestatus[] PROGMEM="Battery and logging status";
 const char help_batbench[] PROGMEM="Battery benchmark";
+const char help_trigger[] PROGMEM="E[,<source>,<level>[,<pre>[,<post>]]]: prints or sets the trigger of event-triggered logging. source: 0=off (log all samples), 1=|a|>=level mg, 2=|g|>=level dps, 3=PIO pin level high. pre, post: ms logged before and after the event";
+const char help_streamaxes[] PROGMEM="P[,<hex>]: prints or selects the motion axes to stream. hex: bitmask of axes; bits 0-8: ax,ay,az,gx,gy,gz,mx,my,mz";
 
 const COMMANDPARSER CommandParsersMotionStream[] =
 { 
 	{'H', CommandParserHelp,help_h},
 	//{'W', CommandParserSwap,help_w},
-	{'F', CommandParserStreamFormat,help_f},
+	{'F', CommandParserStreamFormatMotion,help_f},
+	{'P', CommandParserStreamAxes,help_streamaxes},
 	{'L', CommandParserSampleLogMPU,help_samplelog},
+	{'T', CommandParserSampleTrigger,help_sampletrigger},
+	{'B', CommandParserSampleBurst,help_sampleburst},
+	{'E', CommandParserTrigger,help_trigger},
 	{'Z',CommandParserSync,help_z},
 	//{'i',CommandParserInfo,help_info},
 	{'N', CommandParserAnnotation,help_annotation},
@@ -88,6 +102,9 @@ const COMMANDPARSER CommandParsersMotionStream[] =
 	{'q', CommandParserBatteryInfo,help_battery},
 	{'s', CommandParserSampleStatus,help_samplestatus},
 	{'x', CommandParserBatBench,help_batbench},
+	{'r', CommandParserARQ,help_arq},
+	{'a', CommandParserARQAck,help_arqack},
+	{'U', CommandParserMux,help_mux},
 	{'!', CommandParserQuit,help_quit}
 };
 const unsigned char CommandParsersMotionStreamNum=sizeof(CommandParsersMotionStream)/sizeof(COMMANDPARSER); 
@@ -107,8 +124,9 @@ void clearstat(void)
 	stat_totsample=0;
 	stat_samplesendfailed=0;	
 	stat_wakeup=0;	
+	stat_status_time_us=0;
 	
-	stat_t_cur = time_lastblink = stat_time_laststatus = stat_timems_start = timer_ms_get();
+	stat_t_cur = time_lastblink = stat_time_laststatus = stat_time_lastlogstatus = stat_timems_start = timer_ms_get();
 	
 	// If there was a successful change in logging (start, stop, etc) then reset the statistics.
 	mpu_clearstat();	// Clear MPU ISR statistics
@@ -128,7 +146,7 @@ unsigned char CommandParserSampleLogMPU(char *buffer,unsigned char size)
 
 unsigned char CommandParserSampleStatus(char *buffer,unsigned char size)
 {
-	stream_status(file_pri,mode_stream_format_bin);
+	stream_status(mux_file(MUX_CH_STATUS),mode_stream_format_bin);
 	return 0;
 }
 
@@ -137,77 +155,307 @@ unsigned char CommandParserBatBench(char *buffer,unsigned char size)
 	ltc2942_print_longbatstat(file_pri);
 	return 0;
 }
+unsigned char CommandParserStreamFormatMotion(char *buffer,unsigned char size)
+{
+	// Motion specific code to update the fields to stream
+	unsigned char rv=CommandParserStreamFormat(buffer,size);
+	if(!rv)
+	{
+		stream_fields_compile();
+		mode_sample_compact_header();
+	}
+	return rv;
+}
+/******************************************************************************
+	function: CommandParserTrigger
+*******************************************************************************	
+	Parses the trigger command: E[,<source>,<level>[,<pre>[,<post>]]]
+	
+	Without parameter prints the trigger settings and the number of events. 
+	Otherwise sets the trigger of event-triggered logging (see trigger) and 
+	restarts the trigger engine. The settings are kept until reset.
+	
+	Parameters:
+		buffer	-		Pointer to the command string
+		size	-		Size of the command string
 
-// Builds the text string
-unsigned char stream_sample_text(FILE *f)
+	Returns:
+		0		-		Success
+		2		-		Message invalid
+******************************************************************************/
+unsigned char CommandParserTrigger(char *buffer,unsigned char size)
 {
-	char motionstream[192];		// Buffer to build the string of motion data
-	char *strptr = motionstream;
+	char *p1;
+	unsigned char source;
+	unsigned short level,pre,post;
+	unsigned int s;
 	
-	// Format packet counter
-	if(mode_stream_format_pktctr)
+	trigger_get(&source,&level,&pre,&post);
+	if(ParseComma((char*)buffer,1,&p1))
 	{
-		strptr=format1u32(strptr,mpumotiondata.packetctr);
+		fprintf_P(file_pri,PSTR("Trigger source: %u level: %u pre: %u ms post: %u ms. Events: %lu\n"),source,level,pre,post,trigger_count);
+		return 0;
 	}
-	// Format timestamp
-	if(mode_stream_format_ts)
+	if(sscanf(p1,"%u,%u,%u,%u",&s,&level,&pre,&post)<2 || s>=TRIGGER_SOURCES || pre>TRIGGER_PREMAX)
+		return 2;
+	trigger_set(s,level,pre,post);
+	trigger_start(mpu_getaccscale(),mpu_getgyroscale());
+	return 0;
+}
+/******************************************************************************
+	function: CommandParserStreamAxes
+*******************************************************************************	
+	Parses the axes selection command: P[,<hex>]
+	
+	Without parameter prints the current selection. 
+	The selection is stored in EEPROM; axes are only streamed if they are also 
+	acquired by the motion mode.
+	
+	Parameters:
+		buffer	-		Pointer to the command string
+		size	-		Size of the command string
+
+	Returns:
+		0		-		Success
+		1		-		Message execution error (message valid)
+		2		-		Message invalid 
+******************************************************************************/
+unsigned char CommandParserStreamAxes(char *buffer,unsigned char size)
+{
+	char *p1;
+	unsigned int axes;
+	
+	if(ParseComma((char*)buffer,1,&p1))
 	{
-		strptr = format1u32(strptr,mpumotiondata.time);
+		fprintf_P(file_pri,PSTR("Axes: %03X\n"),ConfigLoadStreamAxes());
+		return 0;
 	}
-	// Format battery
+	if(sscanf(p1,"%x",&axes)!=1 || axes>0x1ff)
+		return 2;
+	
+	mode_stream_axes = axes;
+	ConfigSaveStreamAxes(axes);
+	stream_fields_compile();
+	mode_sample_compact_header();
+	fprintf_P(file_pri,PSTR("Axes: %03X\n"),axes);
+	return 0;
+}
+
+/******************************************************************************
+*******************************************************************************
+STREAM FIELDS   STREAM FIELDS   STREAM FIELDS   STREAM FIELDS   STREAM FIELDS   
+*******************************************************************************
+******************************************************************************/
+/*
+	The content of a sample is described by a list of fields compiled by 
+	stream_fields_compile when streaming starts or when the stream format changes.
+	Each field indicates the address of the data, the number of consecutive values,
+	and the functions encoding the values in text and binary.
+	
+	The encoders (stream_sample_text, stream_sample_bin and stream_sample_compact) walk the field list, 
+	instead of testing the format flags and sample mode for each sample. The field identifiers 
+	describe the fields in the header of compact logs (stream_compact_header).
+	
+	Data which is not part of mpumotiondata or mpumotiongeometry (battery, label) 
+	is copied in _stream_aux before encoding each sample.
+*/
+STREAM_FIELD stream_fields[STREAM_FIELDMAX];
+unsigned char stream_fields_n;
+unsigned short mode_stream_axes=0x1ff;			// Bitmask of motion axes to stream: ax,ay,az,gx,gy,gz,mx,my,mz
+struct {
+	unsigned short bat;
+	unsigned short label;
+} _stream_aux;
+unsigned char _stream_accscale,_stream_gyroscale;		// Scales read by stream_start, for the header of compact logs
+
+const char _stream_axisname[9][3] PROGMEM={"ax","ay","az","gx","gy","gz","mx","my","mz"};
+
+char *_sf_text_u32(char *strptr,const void *src,unsigned char n)
+{
+	const unsigned long *v = (const unsigned long*)src;
+	while(n--)
+		strptr = format1u32(strptr,*v++);
+	return strptr;
+}
+char *_sf_text_u16(char *strptr,const void *src,unsigned char n)
+{
+	const unsigned short *v = (const unsigned short*)src;
+	while(n--)
+		strptr = format1u16(strptr,*v++);
+	return strptr;
+}
+char *_sf_text_s16(char *strptr,const void *src,unsigned char n)
+{
+	return formatns16(strptr,(const signed short*)src,n);
+}
+char *_sf_text_quaternion(char *strptr,const void *src,unsigned char n)
+{
+	#if ENABLEQUATERNION==1
+		#if FIXEDPOINTQUATERNION==1
+			strptr = format4fract16(strptr,mpumotiongeometry.q0,mpumotiongeometry.q1,mpumotiongeometry.q2,mpumotiongeometry.q3);
+		#else
+			strptr = format4qfloat(strptr,mpumotiongeometry.q0,mpumotiongeometry.q1,mpumotiongeometry.q2,mpumotiongeometry.q3);
+		#endif
+	#endif
+	return strptr;
+}
+char *_sf_text_euler(char *strptr,const void *src,unsigned char n)
+{
+	return format3float(strptr,mpumotiongeometry.yaw,mpumotiongeometry.pitch,mpumotiongeometry.roll);
+}
+char *_sf_text_qdbg(char *strptr,const void *src,unsigned char n)
+{
+	floattoa(mpumotiongeometry.alpha,strptr);
+	strptr+=7;
+	*strptr=' ';
+	strptr++;
+	floatqtoa(mpumotiongeometry.x,strptr);
+	strptr+=6;
+	*strptr=' ';
+	strptr++;
+	floatqtoa(mpumotiongeometry.y,strptr);
+	strptr+=6;
+	*strptr=' ';
+	strptr++;
+	floatqtoa(mpumotiongeometry.z,strptr);
+	strptr+=6;
+	*strptr=' ';
+	strptr++;
+	return strptr;
+}
+void _sf_bin_u32(PACKET *p,const void *src,unsigned char n)
+{
+	const unsigned long *v = (const unsigned long*)src;
+	while(n--)
+		packet_add32_little(p,*v++);
+}
+void _sf_bin_u16(PACKET *p,const void *src,unsigned char n)
+{
+	const unsigned short *v = (const unsigned short*)src;
+	while(n--)
+		packet_add16_little(p,*v++);
+}
+void _sf_bin_quaternion(PACKET *p,const void *src,unsigned char n)
+{
+	#if ENABLEQUATERNION==1
+		#if FIXEDPOINTQUATERNION==1
+			_Accum k;
+			signed short v;
+			k = q0*10000k; v = k;
+			packet_add16_little(p,v);
+			k = q1*10000k; v = k;
+			packet_add16_little(p,v);
+			k = q2*10000k; v = k;
+			packet_add16_little(p,v);
+			k = q3*10000k; v = k;
+			packet_add16_little(p,v);	
+		#else
+			float k;
+			signed short v;
+			k = mpumotiongeometry.q0*10000.0; v = k;
+			packet_add16_little(p,v);
+			k = mpumotiongeometry.q1*10000.0; v = k;
+			packet_add16_little(p,v);
+			k = mpumotiongeometry.q2*10000.0; v = k;
+			packet_add16_little(p,v);
+			k = mpumotiongeometry.q3*10000.0; v = k;
+			packet_add16_little(p,v);	
+		#endif
+	#else
+	packet_add16_little(p,1);
+	packet_add16_little(p,0);
+	packet_add16_little(p,0);
+	packet_add16_little(p,0);
+	#endif
+}
+void _sf_bin_none(PACKET *p,const void *src,unsigned char n)
+{
+}
+
+/******************************************************************************
+	function: _stream_fields_add
+*******************************************************************************	
+	Appends a field to the field list.
+******************************************************************************/
+static void _stream_fields_add(unsigned char id,const void *src,unsigned char n,char *(*text)(char *,const void *,unsigned char),void (*bin)(PACKET *,const void *,unsigned char))
+{
+	if(stream_fields_n>=STREAM_FIELDMAX)
+		return;
+	stream_fields[stream_fields_n].id = id;
+	stream_fields[stream_fields_n].src = src;
+	stream_fields[stream_fields_n].n = n;
+	stream_fields[stream_fields_n].text = text;
+	stream_fields[stream_fields_n].bin = bin;
+	stream_fields_n++;
+}
+
+/******************************************************************************
+	function: stream_fields_compile
+*******************************************************************************	
+	Builds the list of fields to stream from the stream format (mode_stream_format_*),
+	the motion sample mode (sample_mode) and the selected axes (mode_stream_axes).
+	
+	Consecutive selected axes are grouped in a single field.
+	
+	Must be called when any of these change.
+******************************************************************************/
+void stream_fields_compile(void)
+{
+	const signed short *axes = &mpumotiondata.ax;		// The 9 axes are contiguous in MPUMOTIONDATA
+	unsigned short axesmask=0;
+	unsigned char run=0;
+	
+	stream_fields_n=0;
+	
+	if(mode_stream_format_pktctr)
+		_stream_fields_add(STREAM_ID_PKTCTR,&mpumotiondata.packetctr,1,_sf_text_u32,_sf_bin_u32);
+	if(mode_stream_format_ts)
+		_stream_fields_add(STREAM_ID_TIME,&mpumotiondata.time,1,_sf_text_u32,_sf_bin_u32);
 	if(mode_stream_format_bat)
-	{
-		strptr = format1u16(strptr,system_getbattery());
-	}
-	// Format label
+		_stream_fields_add(STREAM_ID_BAT,&_stream_aux.bat,1,_sf_text_u16,_sf_bin_u16);
 	if(mode_stream_format_label)
-	{
-		strptr=format1u16(strptr,CurrentAnnotation);
-	}
-	// Formats acceleration if selected
+		_stream_fields_add(STREAM_ID_LABEL,&_stream_aux.label,1,_sf_text_u16,_sf_bin_u16);
+		
+	// Axes available in the motion mode, restricted to the axes selected by the user
 	if(sample_mode & MPU_MODE_BM_A)
-		strptr = format3s16(strptr,mpumotiondata.ax,mpumotiondata.ay,mpumotiondata.az);
-	// Formats gyro if selected
+		axesmask |= 0b000000111;
 	if(sample_mode & MPU_MODE_BM_G)
-		strptr = format3s16(strptr,mpumotiondata.gx,mpumotiondata.gy,mpumotiondata.gz);
-	// Formats magnetic if selected
+		axesmask |= 0b000111000;
 	if(sample_mode & MPU_MODE_BM_M)
-		strptr = format3s16(strptr,mpumotiondata.mx,mpumotiondata.my,mpumotiondata.mz);
-	// Formats quaternions if selected
-	
-	if(sample_mode & MPU_MODE_BM_Q)
+		axesmask |= 0b111000000;
+	axesmask &= mode_stream_axes;
+	for(unsigned char i=0;i<=9;i++)
 	{
-		#if ENABLEQUATERNION==1
-			#if FIXEDPOINTQUATERNION==1
-				strptr = format4fract16(strptr,mpumotiongeometry.q0,mpumotiongeometry.q1,mpumotiongeometry.q2,mpumotiongeometry.q3);
-			#else
-				strptr = format4qfloat(strptr,mpumotiongeometry.q0,mpumotiongeometry.q1,mpumotiongeometry.q2,mpumotiongeometry.q3);
-			#endif
-		#endif
+		if(i<9 && (axesmask&(1<<i)))
+			run++;
+		else if(run)
+		{
+			_stream_fields_add(STREAM_ID_AXIS+i-run,axes+i-run,run,_sf_text_s16,_sf_bin_u16);
+			run=0;
+		}
 	}
+	
+	if(sample_mode & MPU_MODE_BM_Q)
+		_stream_fields_add(STREAM_ID_QUAT,0,4,_sf_text_quaternion,_sf_bin_quaternion);
+	// Euler angles and quaternion debug information are only available in text mode
 	if(sample_mode & MPU_MODE_BM_E)
-	{
-		strptr = format3float(strptr,mpumotiongeometry.yaw,mpumotiongeometry.pitch,mpumotiongeometry.roll);
-	}
+		_stream_fields_add(STREAM_ID_EULER,0,3,_sf_text_euler,_sf_bin_none);
 	if(sample_mode & MPU_MODE_QDBG)
-	{
-		floattoa(mpumotiongeometry.alpha,strptr);
-		strptr+=7;
-		*strptr=' ';
-		strptr++;
-		floatqtoa(mpumotiongeometry.x,strptr);
-		strptr+=6;
-		*strptr=' ';
-		strptr++;
-		floatqtoa(mpumotiongeometry.y,strptr);
-		strptr+=6;
-		*strptr=' ';
-		strptr++;
-		floatqtoa(mpumotiongeometry.z,strptr);
-		strptr+=6;
-		*strptr=' ';
-		strptr++;
-	}
+		_stream_fields_add(STREAM_ID_QDBG,0,4,_sf_text_qdbg,_sf_bin_none);
+}
+
+// Builds the text string
+unsigned char stream_sample_text(FILE *f)
+{
+	char motionstream[192];		// Buffer to build the string of motion data
+	char *strptr = motionstream;
+	
+	_stream_aux.bat = system_getbattery();
+	_stream_aux.label = CurrentAnnotation;
+	
+	for(unsigned char i=0;i<stream_fields_n;i++)
+		strptr = stream_fields[i].text(strptr,stream_fields[i].src,stream_fields[i].n);
+	
 	*strptr='\n';		
 	strptr++;
 
@@ -215,97 +463,111 @@ unsigned char stream_sample_text(FILE *f)
 		return 1;
 	return 0;	
 }
+// Adds the binary fields of the sample to a packet
+static void _stream_sample_pack(PACKET *p)
+{
+	_stream_aux.bat = system_getbattery();
+	_stream_aux.label = CurrentAnnotation;
+	
+	for(unsigned char i=0;i<stream_fields_n;i++)
+		stream_fields[i].bin(p,stream_fields[i].src,stream_fields[i].n);
+	
+	packet_end(p);
+}
 unsigned char stream_sample_bin(FILE *f)
 {
 	PACKET p;
 	packet_init(&p,"DXX",3);
 	
-	
-	// Format packet counter
-	if(mode_stream_format_pktctr)
-	{
-		packet_add32_little(&p,mpumotiondata.packetctr);
-	}
-	// Format timestamp
-	if(mode_stream_format_ts)
-	{
-		packet_add16_little(&p,mpumotiondata.time&0xffff);
-		packet_add16_little(&p,(mpumotiondata.time>>16)&0xffff);
-	}
-	// Format battery
-	if(mode_stream_format_bat)
-		packet_add16_little(&p,system_getbattery());
-	if(mode_stream_format_label)
-		packet_add16_little(&p,CurrentAnnotation);
-		
-	// Formats acceleration if selected
-	if(sample_mode & MPU_MODE_BM_A)
-	{
-		packet_add16_little(&p,mpumotiondata.ax);
-		packet_add16_little(&p,mpumotiondata.ay);
-		packet_add16_little(&p,mpumotiondata.az);
-	}
-	// Formats gyro if selected
-	if(sample_mode & MPU_MODE_BM_G)
-	{
-		packet_add16_little(&p,mpumotiondata.gx);
-		packet_add16_little(&p,mpumotiondata.gy);
-		packet_add16_little(&p,mpumotiondata.gz);
-	}
-	// Formats magnetic if selected
-	if(sample_mode & MPU_MODE_BM_M)
-	{
-		packet_add16_little(&p,mpumotiondata.mx);
-		packet_add16_little(&p,mpumotiondata.my);
-		packet_add16_little(&p,mpumotiondata.mz);
-	}
-	// Formats quaternions if selected
-	if(sample_mode & MPU_MODE_BM_Q)
-	{	
-		#if ENABLEQUATERNION==1
-			#if FIXEDPOINTQUATERNION==1
-				_Accum k;
-				signed short v;
-				k = q0*10000k; v = k;
-				packet_add16_little(&p,v);
-				k = q1*10000k; v = k;
-				packet_add16_little(&p,v);
-				k = q2*10000k; v = k;
-				packet_add16_little(&p,v);
-				k = q3*10000k; v = k;
-				packet_add16_little(&p,v);	
-			#else
-				float k;
-				signed short v;
-				k = mpumotiongeometry.q0*10000.0; v = k;
-				packet_add16_little(&p,v);
-				k = mpumotiongeometry.q1*10000.0; v = k;
-				packet_add16_little(&p,v);
-				k = mpumotiongeometry.q2*10000.0; v = k;
-				packet_add16_little(&p,v);
-				k = mpumotiongeometry.q3*10000.0; v = k;
-				packet_add16_little(&p,v);	
-			#endif
-		#else
-		packet_add16_little(&p,1);
-		packet_add16_little(&p,0);
-		packet_add16_little(&p,0);
-		packet_add16_little(&p,0);
-		#endif
-	}
-	
-	packet_end(&p);
+	_stream_sample_pack(&p);
 	packet_addchecksum_fletcher16_little(&p);
 	int s = packet_size(&p);
 	if(fputbuf(f,(char*)p.data,s))
 		return 1;
 	return 0;
 }
+// Compact log record: sync byte followed by the binary fields, without checksum
+unsigned char stream_sample_compact(FILE *f)
+{
+	PACKET p;
+	const char sync=MODE_SAMPLE_COMPACT_SYNC;
+	packet_init(&p,&sync,1);
+	
+	_stream_sample_pack(&p);
+	int s = packet_size(&p);
+	if(fputbuf(f,(char*)p.data,s))
+		return 1;
+	return 0;
+}
 
-
+/******************************************************************************
+	function: stream_compact_header
+*******************************************************************************	
+	Writes the header of a compact log describing the binary fields of the 
+	motion samples (see mode_sample).
+	
+	Accelerometer and gyroscope values are scaled according to the scales read 
+	by stream_start; magnetometer values are 0.15uT per LSB (16-bit output);
+	the quaternion is multiplied by 10000. Euler angles and quaternion debug 
+	information are not available in binary and are not logged.
+	
+	Parameters:
+		f		-	Log
+******************************************************************************/
+void stream_compact_header(FILE *f)
+{
+	PACKET p;
+	
+	// Size of the fields
+	packet_init(&p,0,0);
+	_stream_sample_pack(&p);
+	
+	mode_sample_compact_begin(f,packet_size(&p),mpu_getmodesamplerate(mode_sample_motion_param.mode));
+	for(unsigned char i=0;i<stream_fields_n;i++)
+	{
+		unsigned char id=stream_fields[i].id;
+		switch(id)
+		{
+			case STREAM_ID_PKTCTR:
+				mode_sample_compact_field(f,PSTR("pkt"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U32,1,1,PSTR(""));
+				break;
+			case STREAM_ID_TIME:
+				mode_sample_compact_field(f,PSTR("t"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U32,1,1,PSTR("ms"));
+				break;
+			case STREAM_ID_BAT:
+				mode_sample_compact_field(f,PSTR("bat"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U16,1,1,PSTR("mV"));
+				break;
+			case STREAM_ID_LABEL:
+				mode_sample_compact_field(f,PSTR("label"),MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_U16,1,1,PSTR(""));
+				break;
+			case STREAM_ID_QUAT:
+				for(unsigned char j=0;j<4;j++)
+					mode_sample_compact_field(f,PSTR("q"),j,MODE_SAMPLE_T_S16,1,10000,PSTR(""));
+				break;
+			case STREAM_ID_EULER:
+			case STREAM_ID_QDBG:
+				break;
+			default:
+				// Group of axes: full scale over 32768 LSB
+				for(unsigned char a=id-STREAM_ID_AXIS;a<id-STREAM_ID_AXIS+stream_fields[i].n;a++)
+				{
+					if(a<3)
+						mode_sample_compact_field(f,_stream_axisname[a],MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_S16,2<<_stream_accscale,32768,PSTR("g"));
+					else if(a<6)
+						mode_sample_compact_field(f,_stream_axisname[a],MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_S16,250<<_stream_gyroscale,32768,PSTR("dps"));
+					else
+						mode_sample_compact_field(f,_stream_axisname[a],MODE_SAMPLE_NOINDEX,MODE_SAMPLE_T_S16,3,20,PSTR("uT"));
+				}
+		}
+	}
+	mode_sample_compact_end(f);
+}
 
 unsigned char stream_sample(FILE *f)
 {
+	// Compact logs are always binary, including the samples kept before a trigger
+	if(mode_sample_logcompact && (f==mode_sample_file_log || f==trigger_file()))
+		return stream_sample_compact(f);
 	if(mode_stream_format_bin==0)
 		return stream_sample_text(f);
 	else
@@ -323,6 +585,9 @@ unsigned char stream_sample(FILE *f)
 	The packet definition string is: DII;is-s-siiiiic;f
 
 	In text streaming mode an easy to parse string is sent prefixed by '#'.
+	The string is assembled with the formatu32 family of functions rather than
+	sprintf, as this is called while sampling. The time to format the string is
+	measured and the maximum is reported by mode_motionstream when it ends.
 	
 	
 	
@@ -345,11 +610,39 @@ void stream_status(FILE *f,unsigned char bin)
 	if(bin==0)
 	{
 		// Information text
-		char str[128];
-		sprintf_P(str,PSTR("#t=%lu ms; %s"),stat_t_cur-stat_timems_start,ltc2942_last_strstatus());
-		fputbuf(f,str,strlen(str));
-		sprintf_P(str,PSTR("; wps=%lu; errbsy=%lu; errfull=%lu; errsend=%lu; spl=%lu; log=%lu KB; logmax=%lu KB; logfull=%lu %%\n"),wps,cnt_sample_errbusy,cnt_sample_errfull,stat_samplesendfailed,stat_totsample,ufat_log_getsize()>>10,ufat_log_getmaxsize()>>10,ufat_log_getsize()/(ufat_log_getmaxsize()/100l));
-		fputbuf(f,str,strlen(str));
+		char str[160];
+		char *strptr;
+		unsigned long t1=timer_us_get();
+		
+		strptr=formatstr_P(str,PSTR("#t="));
+		strptr=formatu32(strptr,stat_t_cur-stat_timems_start);
+		strptr=formatstr_P(strptr,PSTR(" ms; "));
+		strptr=formatstr(strptr,ltc2942_last_strstatus());
+		fputbuf(f,str,strptr-str);
+		
+		strptr=formatstr_P(str,PSTR("; wps="));
+		strptr=formatu32(strptr,wps);
+		strptr=formatstr_P(strptr,PSTR("; errbsy="));
+		strptr=formatu32(strptr,cnt_sample_errbusy);
+		strptr=formatstr_P(strptr,PSTR("; errfull="));
+		strptr=formatu32(strptr,cnt_sample_errfull);
+		strptr=formatstr_P(strptr,PSTR("; errsend="));
+		strptr=formatu32(strptr,stat_samplesendfailed);
+		strptr=formatstr_P(strptr,PSTR("; spl="));
+		strptr=formatu32(strptr,stat_totsample);
+		strptr=formatstr_P(strptr,PSTR("; log="));
+		strptr=formatu32(strptr,ufat_log_getsize()>>10);
+		strptr=formatstr_P(strptr,PSTR(" KB; logmax="));
+		strptr=formatu32(strptr,ufat_log_getmaxsize()>>10);
+		strptr=formatstr_P(strptr,PSTR(" KB; logfull="));
+		strptr=formatu32(strptr,ufat_log_getsize()/(ufat_log_getmaxsize()/100l));
+		strptr=formatstr_P(strptr,PSTR(" %\n"));
+		
+		unsigned long t2=timer_us_get();
+		if(t2-t1>stat_status_time_us)
+			stat_status_time_us=t2-t1;
+		
+		fputbuf(f,str,strptr-str);
 	}
 	else
 	{
@@ -386,12 +679,19 @@ void stream_start(void)
 	mode_stream_format_pktctr=ConfigLoadStreamPktCtr();
 	mode_stream_format_label = ConfigLoadStreamLabel();
 	enableinfo = ConfigLoadEnableInfo();
+	mode_stream_arq = ConfigLoadStreamARQ();
+	mode_stream_axes = ConfigLoadStreamAxes();
 	
-	fprintf_P(file_pri,PSTR("Acc scale: %d\n"),mpu_getaccscale());
-	fprintf_P(file_pri,PSTR("Gyro scale: %d\n"),mpu_getgyroscale());
+	// Reading the scales reconfigures the MPU: they are read once before sampling
+	_stream_accscale=mpu_getaccscale();
+	_stream_gyroscale=mpu_getgyroscale();
+	fprintf_P(file_pri,PSTR("Acc scale: %d\n"),_stream_accscale);
+	fprintf_P(file_pri,PSTR("Gyro scale: %d\n"),_stream_gyroscale);
 	
 	mpu_config_motionmode(mode_sample_motion_param.mode,1);	
 	
+	// Build the list of fields to stream from the format and motion mode
+	stream_fields_compile();
 	
 	
 	// Clear statistics
@@ -476,6 +776,7 @@ unsigned char CommandParserMotion(char *buffer,unsigned char size)
 void mode_motionstream(void)
 {
 	unsigned char putbufrv;
+	FILE *file_arq=0;
 	
 	fprintf_P(file_pri,PSTR("SMPLMOTION>\n"));
 
@@ -489,10 +790,16 @@ void mode_motionstream(void)
 	sleep_enable();
 
 	mode_sample_file_log=0;										// Initialise log to null 
+	mode_sample_logtype=LOGSTREAM_MOTION;						// Record type of the samples if the log is a container
+	mode_sample_logheader=0;									// The header of a compact log is written once the fields are known
 	mode_sample_startlog(mode_sample_motion_param.logfile);		// Initialise log will be initiated if needed here
 
 	stream_start();
 	
+	mode_sample_logheader=stream_compact_header;
+	mode_sample_compact_header();
+	trigger_start(_stream_accscale,_stream_gyroscale);
+	
 	fprintf_P(file_pri,PSTR("Sample rate: %u\n"),_mpu_samplerate);
 
 	
@@ -523,6 +830,21 @@ void mode_motionstream(void)
 				break;			
 		}
 		
+		// Reliable streaming: open or close according to the current setting, and send pending frames or retransmissions.
+		// Reliable streaming is only used when streaming to the primary interface.
+		if(mode_stream_arq && !mode_sample_file_log)
+		{
+			if(!file_arq)
+				file_arq = arq_open(mux_file(MUX_CH_DATA));
+			arq_service();
+		}
+		else if(file_arq)
+		{
+			arq_printstat(file_pri);
+			arq_close();
+			file_arq=0;
+		}
+		
 		// Blink
 		if(stat_t_cur-time_lastblink>1000)
 		{		
@@ -535,11 +857,17 @@ void mode_motionstream(void)
 			if(stat_t_cur-stat_time_laststatus>10000)
 			//if(stat_t_cur-stat_time_laststatus>2000)
 			{
-				stream_status(file_pri,mode_stream_format_bin);
+				stream_status(mux_file(MUX_CH_STATUS),mode_stream_format_bin);
 				stat_time_laststatus=stat_time_laststatus+10000;
 				stat_wakeup=0;
 			}
 		}
+		// Periodic status, including the battery, in the log container
+		if(logstream_isopen() && stat_t_cur-stat_time_lastlogstatus>=MSM_LOGSTATUSPERIOD)
+		{
+			stream_status(logstream_file(LOGSTREAM_STATUS),mode_stream_format_bin);
+			stat_time_lastlogstatus=stat_t_cur;
+		}
 		
 		// Stream existing data
 		unsigned char l = mpu_data_level();
@@ -561,13 +889,27 @@ void mode_motionstream(void)
 			
 				// Send data to primary stream or to log if available
 				FILE *file_stream;
+				putbufrv=0;
 				if(mode_sample_file_log)
+				{
 					file_stream=mode_sample_file_log;
+					// Event-triggered logging: the samples before an event are kept in the pre-trigger buffer, written to the log on the event
+					if(trigger_enabled())
+					{
+						unsigned char trig = trigger_check(&mpumotiondata);
+						if(trig==TRIGGER_IDLE)
+							file_stream=trigger_file();
+						if(trig==TRIGGER_FIRED)
+							putbufrv=trigger_flush(mode_sample_file_log);
+					}
+				}
+				else if(file_arq)
+					file_stream=file_arq;
 				else
-					file_stream=file_pri;
+					file_stream=mux_file(MUX_CH_DATA);
 
 				// Send the samples and check for error
-				putbufrv = stream_sample(file_stream);
+				putbufrv |= stream_sample(file_stream);
 				
 				// Update the statistics in case of errors
 				if(putbufrv)
@@ -598,12 +940,28 @@ void mode_motionstream(void)
 	// Stop acquiring data
 	stream_stop();	
 	
+	// Stop reliable streaming; unacknowledged frames are lost
+	if(file_arq)
+	{
+		arq_printstat(file_pri);
+		arq_close();
+	}
+	
+	// With a log container, store the battery statistics and the final status in the log of the session
+	unsigned char batlogged=logstream_isopen();
+	if(batlogged)
+	{
+		ltc2942_print_longbatstat(logstream_file(LOGSTREAM_BAT));
+		stream_status(logstream_file(LOGSTREAM_STATUS),mode_stream_format_bin);
+		mpu_printstat(logstream_file(LOGSTREAM_NOTE));
+	}
+	
 	// Stop the logging, if logging was ongoing
 	mode_sample_logend();
 	
 	#ifdef MSM_LOGBAT
-		// Store batstat in a logfile
-		if(ufat_available())
+		// Store batstat in a logfile, unless already stored in the log container
+		if(ufat_available() && !batlogged)
 		{
 			mode_sample_file_log = ufat_log_open(ufat_log_getnumlogs()-1);
 			if(!mode_sample_file_log)
@@ -636,6 +994,9 @@ void mode_motionstream(void)
 	mpu_printstat(file_pri);
 	
 	fprintf_P(file_pri,PSTR("MPU Geometry time: %lu us\n"),mpu_compute_geometry_time());
+	fprintf_P(file_pri,PSTR("Status text time (max): %lu us\n"),stat_status_time_us);
+	if(trigger_enabled())
+		fprintf_P(file_pri,PSTR("Trigger events: %lu\n"),trigger_count);
 	
 	// Total errors
 	unsigned long cnt_sample_errbusy, cnt_sample_errfull,toterr;
@@ -2,13 +2,45 @@
 #define __MODE_MOTIONSTREAM_H
 
 #include "command.h"
+#include "pkt.h"
 
 // MSM_LOGBAT: if defined, logs the battery level in the last log file, if the filesystem is available.
+// With a log container (L,<lognum>,1) the battery statistics are instead stored in the log of the session.
 // #define MSM_LOGBAT
 
+// Period in ms of the status records (including the battery) written in a log container
+#define MSM_LOGSTATUSPERIOD 10000
+
 extern const char help_streamlog[] PROGMEM;
+extern const char help_streamaxes[] PROGMEM;
+
+// Maximum number of fields in a sample: packet counter, time, battery, label, up to 5 groups of axes, quaternion, euler, quaternion debug
+#define STREAM_FIELDMAX 12
+
+// Identifiers of the fields, used to describe the fields in the header of compact logs
+#define STREAM_ID_PKTCTR	0
+#define STREAM_ID_TIME		1
+#define STREAM_ID_BAT		2
+#define STREAM_ID_LABEL		3
+#define STREAM_ID_QUAT		4
+#define STREAM_ID_EULER		5
+#define STREAM_ID_QDBG		6
+#define STREAM_ID_AXIS		7			// STREAM_ID_AXIS+0 to STREAM_ID_AXIS+8: first axis of the field (ax,ay,az,gx,gy,gz,mx,my,mz)
+
+// Field of a sample: identifier, address of the data, number of consecutive values, and text and binary encoders
+typedef struct {
+	unsigned char id;
+	const void *src;
+	unsigned char n;
+	char *(*text)(char *strptr,const void *src,unsigned char n);
+	void (*bin)(PACKET *p,const void *src,unsigned char n);
+} STREAM_FIELD;
+
+extern unsigned short mode_stream_axes;
 
 unsigned char stream_sample(FILE *f);
+unsigned char stream_sample_compact(FILE *f);
+void stream_compact_header(FILE *f);
 
 // Structure to hold the volatile parameters of this mode
 typedef struct {
@@ -25,6 +57,10 @@ void mode_sample_motion_setparam(unsigned char mode, int logfile, int duration);
 unsigned char CommandParserSampleLogMPU(char *buffer,unsigned char size);
 unsigned char CommandParserSampleStatus(char *buffer,unsigned char size);
 unsigned char CommandParserBatBench(char *buffer,unsigned char size);
+unsigned char CommandParserStreamFormatMotion(char *buffer,unsigned char size);
+unsigned char CommandParserStreamAxes(char *buffer,unsigned char size);
+unsigned char CommandParserTrigger(char *buffer,unsigned char size);
+void stream_fields_compile(void);
 void stream_status(FILE *f,unsigned char bin);
 unsigned char CommandParserMotion(char *buffer,unsigned char size);
 void mode_motionstream(void);
@@ -37,6 +37,7 @@
 #include "sd.h"
 #include "ufat.h"
 #include "test_sd.h"
+#include "download.h"
 
 const char help_sdinit[] PROGMEM="Low-level SD card initialisation";
 const char help_erase[] PROGMEM="E,<sectorstart>,<sectorend>: erase all sectors or from [start;end]. If start and end are zero the entire flash is erased.";
@@ -44,20 +45,23 @@ const char help_write[] PROGMEM="W,<sector>,<value>: Fills a sector with the giv
 const char help_stream[] PROGMEM="S,<sector>,<value>,<size>,<bsize>: Writes size bytes data in streaming mode with caching; sends data by blocks of size bsize";
 const char help_read[] PROGMEM="R,<sector>: Reads a sector (sector number in decimal)";
 const char help_volume[] PROGMEM="Initialise volume";
-const char help_format[] PROGMEM="F,<numlogfiles>: Format the card for numlogfiles and initialise the volume (maximum numlogfiles=14)";
+const char help_format[] PROGMEM="F,<numlogfiles>[,<fixedsize>]: Format the card for numlogfiles and initialise the volume (maximum numlogfiles=14). Logs use the free space of the card, or fixed-size slots if fixedsize is 1";
 const char help_logtest[] PROGMEM="l,<lognum>,<sizekb>: QA test. Logs test data to <lognum> up to <sizekb> KB. Use to validate speed/consistency of SD card writes.";
 //const char help_logtest2[] PROGMEM="L,<lognum>,<sizebytes>,<char>,<bsiz>: Writes to lognum sizebytes character char in bsiz blocks";
 const char help_sdbench[] PROGMEM="B,<benchtype>";
 const char help_sdbench2[] PROGMEM="b,<startsect>,<sizekb> stream cache write from startsect up to sizekb";
 const char help_sdbench3[] PROGMEM="1,<startsect>,<sizekb>,<preerasekb> stream cache write from startsect up to sizekb, optional preerase kb";
+const char help_sdbenchread[] PROGMEM="M,<startsect>,<sizekb>: compares block reads and stream (multiblock) reads from startsect up to sizekb";
+const char help_sdbenchlatency[] PROGMEM="P,<startsect>,<sizekb>,<rate>[,<samplesize>]: write latency profile from startsect up to sizekb at rate bytes/s (0: maximum). Reports the busy time histogram, maximum stall and minimum buffer per motion mode with samplesize bytes/sample (default 32)";
 const char help_sd_dbg[] PROGMEM ="== Debug/test ==";
 
-#define CommandParsersSDNum 15
+#define CommandParsersSDNum 18
 const COMMANDPARSER CommandParsersSD[CommandParsersSDNum] =
 { 
 	{'H', CommandParserHelp,help_h},	
 	{'!', CommandParserQuit,help_quit},		
 	{'F', CommandParserSDFormat,help_format},
+	{'D', CommandParserDownload,help_download},
 	// Test/debug
 	{0,0,help_sd_dbg},
 	{'I', CommandParserSDInit,help_sdinit},
@@ -74,6 +78,8 @@ const COMMANDPARSER CommandParsersSD[CommandParsersSDNum] =
 	{'b', CommandParserSDBench2,help_sdbench2},
 	{'1', CommandParserSDBench_t1,help_sdbench3},
 	{'2', CommandParserSDBench_t2,help_sdbench2},
+	{'M', CommandParserSDBenchRead,help_sdbenchread},
+	{'P', CommandParserSDBenchLatency,help_sdbenchlatency},
 	
 };
 
@@ -183,6 +189,31 @@ unsigned char CommandParserSDBench_t1(char *buffer,unsigned char size)
 	sd_bench_stream_write2(startaddr,sizekb*1024l,preerasekb*2l);
 	return 0;
 }
+unsigned char CommandParserSDBenchRead(char *buffer,unsigned char size)
+{
+	// Parse arguments
+	unsigned long startaddr,sizekb;
+	unsigned char rv = ParseCommaGetLong(buffer,2,&startaddr,&sizekb);
+	if(rv)
+		return 2;
+	
+	sd_bench_read(startaddr,sizekb*1024l);
+	return 0;
+}
+unsigned char CommandParserSDBenchLatency(char *buffer,unsigned char size)
+{
+	char *p1;
+	unsigned long startaddr,sizekb,rate;
+	unsigned int samplesize=32;
+	
+	if(ParseComma(buffer,1,&p1))
+		return 2;
+	if(sscanf(p1,"%lu,%lu,%lu,%u",&startaddr,&sizekb,&rate,&samplesize)<3 || samplesize==0)
+		return 2;
+	
+	sd_bench_latency(startaddr,sizekb*1024l,rate,samplesize);
+	return 0;
+}
 unsigned char CommandParserSDBench_t2(char *buffer,unsigned char size)
 {
 	// Parse arguments
@@ -200,12 +231,15 @@ unsigned char CommandParserSDBench_t2(char *buffer,unsigned char size)
 
 unsigned char CommandParserSDFormat(char *buffer,unsigned char size)
 {
-	unsigned int numlog;
-	if(ParseCommaGetInt((char*)buffer,1,&numlog))
+	char *p1;
+	unsigned int numlog,fixedsize=0;
+	if(ParseComma((char*)buffer,1,&p1))
+		return 2;
+	if(sscanf(p1,"%u,%u",&numlog,&fixedsize)<1)
 		return 2;
 		
-	fprintf_P(file_pri,PSTR("Formatting with %u log files\n"),numlog);
-	ufat_format(numlog);
+	fprintf_P(file_pri,PSTR("Formatting with %u log files (%s)\n"),numlog,fixedsize?"fixed size":"extents");
+	ufat_format(numlog,fixedsize);
 	return 0;
 }
 /*unsigned char CommandParserSDLogTest2(char *buffer,unsigned char size)
@@ -400,6 +434,12 @@ unsigned char CommandParserSDInit(char *buffer,unsigned char size)
 		return 1;
 	}
 	
+	// Negotiate the SPI clock by reading the MBR
+	unsigned short khz;
+	unsigned char fallback;
+	rv = sd_spi_tune(0);
+	sd_spi_getstat(&khz,&fallback);
+	printf_P(PSTR("SPI clock: %u KHz%s\n"),khz,rv?" (tuning error)":"");
 	
 	return 0;
 }
@@ -22,6 +22,8 @@ unsigned char CommandParserSDBench(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench2(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench_t1(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench_t2(char *buffer,unsigned char size);
+unsigned char CommandParserSDBenchRead(char *buffer,unsigned char size);
+unsigned char CommandParserSDBenchLatency(char *buffer,unsigned char size);
 
 void mode_sd(void);
 
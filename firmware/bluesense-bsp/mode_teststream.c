@@ -37,6 +37,7 @@
 
 #include "commandset.h"
 #include "mode_global.h"
+#include "mux.h"
 
 FILE *file_log;				// Log file
 FILE *file_stream;		// File where to stream
@@ -296,11 +297,11 @@ void mode_teststream(void)
 	// Print statistics
 	unsigned long sps = stat_totsample*1000/(stat_timemsend-stat_timemsstart);
 	fprintf_P(file_pri,PSTR("ADC mode end. Samples: %lu in %lu ms (%lu samples/sec). Samples not transmitted: %lu (%lu %%)\n"),stat_totsample,stat_timemsend-stat_timemsstart,sps,stat_samplesendfailed,stat_samplesendfailed*100/stat_totsample);
-	fprintf_P(file_dbg,PSTR("ADC mode end. Samples: %lu in %lu ms (%lu samples/sec). Samples not transmitted: %lu (%lu %%)\n"),stat_totsample,stat_timemsend-stat_timemsstart,sps,stat_samplesendfailed,stat_samplesendfailed*100/stat_totsample);
+	fprintf_P(mux_file(MUX_CH_DBG),PSTR("ADC mode end. Samples: %lu in %lu ms (%lu samples/sec). Samples not transmitted: %lu (%lu %%)\n"),stat_totsample,stat_timemsend-stat_timemsstart,sps,stat_samplesendfailed,stat_samplesendfailed*100/stat_totsample);
 	
 	_delay_ms(1000);
 	fprintf_P(file_pri,PSTR("ADCSRA: %02X\n"),ADCSRA);
-	fprintf_P(file_dbg,PSTR("ADCSRA: %02X\n"),ADCSRA);
+	fprintf_P(mux_file(MUX_CH_DBG),PSTR("ADCSRA: %02X\n"),ADCSRA);
 	
 	
 	return;
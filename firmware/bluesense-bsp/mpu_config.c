@@ -398,6 +398,24 @@ void mpu_getmodename(unsigned char motionmode,char *buffer)
 	strcpy_P(buffer,(PGM_P)pgm_read_word(mc_options+motionmode));
 }
 
+/******************************************************************************
+	function: mpu_getmodesamplerate
+*******************************************************************************	
+	Returns the sample rate of a motion mode from its ID.
+	
+	Parameters:
+		motionmode	-	Motion sensor mode
+		
+	Returns:
+		Sample rate in Hz, or 0 if the motionmode is invalid or off.
+*******************************************************************************/
+unsigned short mpu_getmodesamplerate(unsigned char motionmode)
+{
+	if(motionmode>=MOTIONCONFIG_NUM)
+		return 0;
+	return config_sensorsr_settings[motionmode][11];
+}
+
 
 /******************************************************************************
 	function: mpu_printmotionmode
@@ -0,0 +1,402 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "serial.h"
+#include "helper.h"
+#include "pkt.h"
+#include "mux.h"
+
+/*
+	File: mux
+
+	Logical channel multiplexing over the primary interface.
+
+	When the multiplexer is open, all the data sent to the primary interface is encapsulated in frames carrying a channel number,
+	so that the host can separate command replies, status, sample data and debug prints without parsing heuristics.
+
+	Frame format:
+
+		0xA5 channel size payload[size] chk_lo chk_hi
+
+	The checksum is the fletcher16 checksum (packet_fletcher16) of all the preceding bytes of the frame.
+
+	Output which is not explicitly sent to a channel (e.g. fprintf(file_pri,...) in command parsers) is sent on channel MUX_CH_CTRL:
+	the multiplexer replaces the write functions of the primary interface stream when opened, and restores them when closed.
+	When the primary interface changes (e.g. Bluetooth connects), interface calls mux_retarget: the multiplexer restores the
+	previous stream and takes over the new primary interface, keeping the data accumulated on the channels.
+	
+	Debug prints are written to mux_file(MUX_CH_DBG): framed on the primary interface when the multiplexer is open, otherwise 
+	sent unframed to the debug interface (file_dbg) as without multiplexing.
+	Data written char by char (fputc/fprintf) is accumulated per channel and sent as one frame on newline, when the line buffer
+	is full, or when mux_flush is called. Data written with fputbuf is sent immediately as one frame.
+
+	*Priorities*
+
+	Channels MUX_CH_DATA and MUX_CH_DBG are low-priority: their frames are only written if MUX_RESERVE bytes remain free in the transmit
+	buffer of the interface afterwards. Command replies and status therefore never wait behind a full transmit buffer of sample data.
+	Low-priority frames which do not fit are rejected (fputbuf returns an error), as with other streams.
+
+	The commands received from the host are not framed.
+
+	*Public functions*
+
+	* mux_open:				Open the multiplexer on a stream (the primary interface).
+	* mux_close:			Close the multiplexer and restore the stream.
+	* mux_retarget:			Move the multiplexer to a new primary interface.
+	* mux_isopen:			Indicates whether the multiplexer is open.
+	* mux_file:				Returns the FILE of a channel, or file_pri if the multiplexer is not open.
+	* mux_write:			Sends a frame on a channel.
+	* mux_flush:			Sends the data accumulated by fputc/fprintf on all channels.
+*/
+
+const char help_mux[] PROGMEM ="U,<en>: when en=1 multiplexes all output in channel frames (0: control, 1: status, 2: data, 3: debug)";
+
+// Reserve in the transmit buffer needed to send on each channel
+const unsigned char _mux_reserve[MUX_CHANNELS] PROGMEM = {0,0,MUX_RESERVE,MUX_RESERVE};
+
+FILE *_mux_file_underlying=0;
+int (*_mux_put_org)(char,FILE*);
+unsigned char (*_mux_putbuf_org)(char*,unsigned char);
+
+FILE _mux_file[MUX_CHANNELS];
+SERIALPARAM _mux_file_param[MUX_CHANNELS];
+
+char _mux_line[MUX_CHANNELS][MUX_LINESIZE];
+unsigned char _mux_line_n[MUX_CHANNELS];
+
+unsigned char _mux_putbuf_ctrl(char *buffer,unsigned char size);
+unsigned char _mux_putbuf_status(char *buffer,unsigned char size);
+unsigned char _mux_putbuf_data(char *buffer,unsigned char size);
+unsigned char _mux_putbuf_dbg(char *buffer,unsigned char size);
+int _mux_fputchar(char c,FILE *f);
+int _mux_fputchar_ctrl(char c,FILE *f);
+
+/******************************************************************************
+	function: _mux_hook
+*******************************************************************************
+	Redirects the output of the stream f to the control channel, keeping its
+	write functions to send the frames.
+******************************************************************************/
+static void _mux_hook(FILE *f)
+{
+	SERIALPARAM *p = (SERIALPARAM*)fdev_get_udata(f);
+	_mux_put_org = f->put;
+	_mux_putbuf_org = p->putbuf;
+	f->put = _mux_fputchar_ctrl;
+	p->putbuf = _mux_putbuf_ctrl;
+	_mux_file_underlying = f;
+}
+/******************************************************************************
+	function: _mux_unhook
+*******************************************************************************
+	Restores the write functions of the stream the multiplexer is open on.
+******************************************************************************/
+static void _mux_unhook(void)
+{
+	SERIALPARAM *p = (SERIALPARAM*)fdev_get_udata(_mux_file_underlying);
+	_mux_file_underlying->put = _mux_put_org;
+	p->putbuf = _mux_putbuf_org;
+	_mux_file_underlying=0;
+}
+/******************************************************************************
+	function: _mux_target
+*******************************************************************************
+	Returns the stream the multiplexer is open on and its original putbuf.
+	The interface may change from an interrupt (mux_retarget): both are read
+	atomically.
+******************************************************************************/
+static FILE *_mux_target(unsigned char (**putbuf)(char*,unsigned char))
+{
+	FILE *f;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		f = _mux_file_underlying;
+		*putbuf = _mux_putbuf_org;
+	}
+	return f;
+}
+
+/******************************************************************************
+	function: mux_open
+*******************************************************************************
+	Open the multiplexer on the stream f, typically the primary interface.
+
+	All output subsequently sent to f is sent on channel MUX_CH_CTRL.
+	f must be a serial stream (i.e. with a SERIALPARAM user data).
+
+	Parameters:
+		f		-	Stream to multiplex
+******************************************************************************/
+void mux_open(FILE *f)
+{
+	unsigned char (*putbuf[MUX_CHANNELS])(char*,unsigned char) = {_mux_putbuf_ctrl,_mux_putbuf_status,_mux_putbuf_data,_mux_putbuf_dbg};
+
+	if(_mux_file_underlying || !f)
+		return;
+
+	for(unsigned char i=0;i<MUX_CHANNELS;i++)
+	{
+		fdev_setup_stream(&_mux_file[i],_mux_fputchar,0,_FDEV_SETUP_WRITE);
+		_mux_file_param[i].blocking = 0;
+		_mux_file_param[i].putbuf = putbuf[i];
+		_mux_file_param[i].txbuf = 0;
+		_mux_file_param[i].rxbuf = 0;
+		fdev_set_udata(&_mux_file[i],(void*)&_mux_file_param[i]);
+		_mux_line_n[i]=0;
+	}
+
+	// Redirect the output of the stream to the control channel
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		_mux_hook(f);
+	}
+}
+/******************************************************************************
+	function: mux_close
+*******************************************************************************
+	Sends pending data, closes the multiplexer and restores the stream on which
+	the multiplexer was opened.
+******************************************************************************/
+void mux_close(void)
+{
+	if(!_mux_file_underlying)
+		return;
+	mux_flush();
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		_mux_unhook();
+	}
+}
+/******************************************************************************
+	function: mux_retarget
+*******************************************************************************
+	Moves the multiplexer to the stream f when the primary interface changes:
+	the write functions of the previous stream are restored and the output of
+	f is sent on channel MUX_CH_CTRL. The data accumulated on the channels is
+	kept and sent on f.
+	
+	Does nothing if the multiplexer is closed. May be called from an interrupt.
+
+	Parameters:
+		f		-	New primary interface
+******************************************************************************/
+void mux_retarget(FILE *f)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(_mux_file_underlying && f && f!=_mux_file_underlying)
+		{
+			_mux_unhook();
+			_mux_hook(f);
+		}
+	}
+}
+/******************************************************************************
+	function: mux_isopen
+*******************************************************************************
+	Returns:
+		0		-	Multiplexer closed
+		1		-	Multiplexer open
+******************************************************************************/
+unsigned char mux_isopen(void)
+{
+	return _mux_file_underlying?1:0;
+}
+/******************************************************************************
+	function: mux_file
+*******************************************************************************
+	Returns the stream of a channel.
+
+	If the multiplexer is not open, returns file_pri, or file_dbg for MUX_CH_DBG,
+	so that callers can use mux_file regardless of whether multiplexing is active.
+
+	Parameters:
+		ch		-	Channel (MUX_CH_xxx)
+******************************************************************************/
+FILE *mux_file(unsigned char ch)
+{
+	unsigned char (*putbuf)(char*,unsigned char);
+	FILE *f = _mux_target(&putbuf);
+	
+	if(!f && ch==MUX_CH_DBG)
+		return file_dbg;
+	if(!f || ch>=MUX_CHANNELS)
+		return file_pri;
+	if(ch==MUX_CH_CTRL)
+		return f;
+	return &_mux_file[ch];
+}
+/******************************************************************************
+	function: _mux_putframe
+*******************************************************************************
+	Sends a frame of at most MUX_PAYLOADMAX bytes, checking the reserve space
+	of the channel.
+
+	Returns:
+		0			-		Success
+		nonzero		-		Error
+******************************************************************************/
+static unsigned char _mux_putframe(unsigned char ch,char *buffer,unsigned char size)
+{
+	char frame[MUX_PAYLOADMAX+MUX_FRAMEOVERHEAD];
+	unsigned short chk;
+	unsigned char reserve = pgm_read_byte(&_mux_reserve[ch]);
+	unsigned char (*putbuf)(char*,unsigned char);
+	FILE *f = _mux_target(&putbuf);
+
+	if(!f)
+		return 1;
+	if(reserve && fgettxbuffree(f)<(unsigned short)size+MUX_FRAMEOVERHEAD+reserve)
+		return 1;
+
+	frame[0]=MUX_SYNC;
+	frame[1]=ch;
+	frame[2]=size;
+	memcpy(frame+MUX_HDRSIZE,buffer,size);
+	chk = packet_fletcher16((unsigned char*)frame,MUX_HDRSIZE+size);
+	frame[MUX_HDRSIZE+size]=chk&0xff;
+	frame[MUX_HDRSIZE+size+1]=chk>>8;
+
+	// High-priority frames wait for space if the interface is blocking
+	while(putbuf(frame,size+MUX_FRAMEOVERHEAD))
+	{
+		if(reserve || !serial_isblocking(f))
+			return 1;
+	}
+	return 0;
+}
+/******************************************************************************
+	function: _mux_flushline
+*******************************************************************************
+	Sends the characters accumulated on a channel.
+******************************************************************************/
+static unsigned char _mux_flushline(unsigned char ch)
+{
+	unsigned char rv=0;
+	if(_mux_line_n[ch])
+	{
+		rv = _mux_putframe(ch,_mux_line[ch],_mux_line_n[ch]);
+		_mux_line_n[ch]=0;
+	}
+	return rv;
+}
+/******************************************************************************
+	function: mux_write
+*******************************************************************************
+	Sends data on a channel. Data larger than MUX_PAYLOADMAX is sent in two frames.
+
+	Parameters:
+		ch			-		Channel (MUX_CH_xxx)
+		buffer		-		Buffer containing the data
+		size 		-		Size of buffer
+	Returns:
+		0			-		Success
+		nonzero		-		Error
+******************************************************************************/
+unsigned char mux_write(unsigned char ch,char *buffer,unsigned char size)
+{
+	if(!_mux_file_underlying || ch>=MUX_CHANNELS)
+		return 1;
+	// Preserve the order of the channel data
+	_mux_flushline(ch);
+	if(size>MUX_PAYLOADMAX)
+	{
+		if(_mux_putframe(ch,buffer,MUX_PAYLOADMAX))
+			return 1;
+		buffer+=MUX_PAYLOADMAX;
+		size-=MUX_PAYLOADMAX;
+	}
+	return _mux_putframe(ch,buffer,size);
+}
+/******************************************************************************
+	function: mux_flush
+*******************************************************************************
+	Sends the data accumulated by fputc/fprintf on all channels.
+
+	Called after each command is processed, so that replies which do not end
+	with a newline are not delayed.
+******************************************************************************/
+void mux_flush(void)
+{
+	if(!_mux_file_underlying)
+		return;
+	for(unsigned char i=0;i<MUX_CHANNELS;i++)
+		_mux_flushline(i);
+}
+/******************************************************************************
+	function: _mux_putc
+*******************************************************************************
+	Accumulates a character on a channel and sends the line when complete.
+******************************************************************************/
+static int _mux_putc(unsigned char ch,char c)
+{
+	_mux_line[ch][_mux_line_n[ch]++]=c;
+	if(c=='\n' || _mux_line_n[ch]>=MUX_LINESIZE)
+	{
+		if(_mux_flushline(ch))
+			return EOF;
+	}
+	return 0;
+}
+int _mux_fputchar(char c,FILE *f)
+{
+	return _mux_putc(f-_mux_file,c);
+}
+int _mux_fputchar_ctrl(char c,FILE *f)
+{
+	return _mux_putc(MUX_CH_CTRL,c);
+}
+unsigned char _mux_putbuf_ctrl(char *buffer,unsigned char size)
+{
+	return mux_write(MUX_CH_CTRL,buffer,size);
+}
+unsigned char _mux_putbuf_status(char *buffer,unsigned char size)
+{
+	return mux_write(MUX_CH_STATUS,buffer,size);
+}
+unsigned char _mux_putbuf_data(char *buffer,unsigned char size)
+{
+	return mux_write(MUX_CH_DATA,buffer,size);
+}
+unsigned char _mux_putbuf_dbg(char *buffer,unsigned char size)
+{
+	return mux_write(MUX_CH_DBG,buffer,size);
+}
+
+/******************************************************************************
+	function: CommandParserMux
+*******************************************************************************
+	Parses the multiplexing command: U,<en>
+
+	The multiplexer is opened on the current primary interface. The setting is
+	not persistent: after a reset the output is not multiplexed.
+
+	Parameters:
+		buffer	-		Pointer to the command string
+		size	-		Size of the command string
+
+	Returns:
+		0		-		Success
+		1		-		Message execution error (message valid)
+		2		-		Message invalid
+******************************************************************************/
+unsigned char CommandParserMux(char *buffer,unsigned char size)
+{
+	int en;
+
+	unsigned char rv = ParseCommaGetInt(buffer,1,&en);
+	if(rv)
+		return 2;
+
+	if(en)
+		mux_open(file_pri);
+	else
+		mux_close();
+	fprintf_P(file_pri,PSTR("Multiplexing: %d\n"),mux_isopen());
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef __MUX_H
+#define __MUX_H
+
+#include <stdio.h>
+
+// Logical channels
+#define MUX_CH_CTRL				0			// Command replies and any other output to the primary interface
+#define MUX_CH_STATUS			1			// Streaming/logging status (stream_status)
+#define MUX_CH_DATA				2			// Sample data
+#define MUX_CH_DBG				3			// Debug prints, sent to file_dbg when the multiplexer is closed
+#define MUX_CHANNELS			4
+
+// Frame structure: sync (1 byte) + channel (1 byte) + payload size (1 byte) + payload + checksum (2 bytes)
+#define MUX_SYNC				0xA5
+#define MUX_HDRSIZE				3
+#define MUX_FRAMEOVERHEAD		(MUX_HDRSIZE+2)
+#define MUX_PAYLOADMAX			(255-MUX_FRAMEOVERHEAD)
+
+// Size of the per-channel buffer accumulating characters written with fputc/fprintf. A frame is sent on newline or when full.
+#define MUX_LINESIZE			64
+// Space in the transmit buffer reserved to high-priority channels: low-priority channels are only sent if this space remains free afterwards.
+#define MUX_RESERVE				128
+
+extern const char help_mux[];
+
+void mux_open(FILE *f);
+void mux_close(void);
+void mux_retarget(FILE *f);
+unsigned char mux_isopen(void);
+FILE *mux_file(unsigned char ch);
+unsigned char mux_write(unsigned char ch,char *buffer,unsigned char size);
+void mux_flush(void);
+
+unsigned char CommandParserMux(char *buffer,unsigned char size);
+
+#endif
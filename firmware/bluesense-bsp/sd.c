@@ -72,13 +72,85 @@
 		2. Provide the block data with any number of calls to sd_streamcache_write
 		3. Close the block with sd_streamcache_close
 
-	sd_streamcache_write returns only if the entire data has been written to the card or to the cache, or if there is an error.
+	sd_streamcache_write returns only if the entire data has been written to the cache, or if there is an error.
 	Note that this behavior is different from sd_stream_write which returns when a block is completed or all the data is written.
 	
+	The cache is a pool of SD_CACHE_NUMSECT sector buffers. Complete sectors are written to the card in the background:
+	a state machine called by the timer interrupt waits for the card to be ready and the sector data is transferred by the SPI 
+	interrupt. sd_streamcache_write only copies the data into a free buffer, and only blocks when all the buffers are queued.
+	The timer callback is registered while the multiblock write is open.
+	
 	
 	* sd_stream_open:				Start a stream write at the specified address (used both for caching and non-caching streaming writes).
 	* sd_streamcache_write:			Writes data in streaming multiblock write with caching.
 	* sd_streamcache_close			Finishes a multiblock write with caching.
+	* sd_streamcache_sync			Writes the complete sectors and terminates the multiblock write, which is reopened by the next write.
+	* sd_streamcache_wrap			Makes the streaming write wrap around an area of sectors (ring).
+	* sd_streamcache_burst			Selects burst writes: the card is written in bursts of sectors and idles in between.
+	* sd_streamcache_getstat		Returns the cache usage statistics of the current or last streaming write.
+	* sd_streamcache_getbursts		Returns the number of multiblock writes of the current or last streaming write.
+	* sd_streamcache_isidle			Indicates whether the multiblock write is terminated, e.g. between bursts.
+	
+	The number of sector buffers is SD_CACHE_NUMSECT: 2 by default (double buffering), larger pools can be defined in the Makefile 
+	for cards which stall longer than a sector takes to fill. The high-water mark of the number of queued sectors indicates 
+	whether the cache is sufficient for a card and data rate.
+	
+	With sd_streamcache_wrap the sector following the end of an area is the start of the area. When the last sector of the area is 
+	queued, the queued sectors are written and the multiblock write is terminated (as sd_streamcache_sync): the next sector 
+	reopens the multiblock write at the start of the area.
+	
+	*Burst writes*
+	
+	By default the multiblock write is opened as soon as a sector is queued and remains open until the streaming write is closed 
+	or synced: the card is kept in the receive-data state for the whole session, and the timer callback polls it at every tick.
+	With sd_streamcache_burst(n) the complete sectors are kept in the pool until n sectors are queued, or the pool is full; the 
+	multiblock write is then opened, and the background writer terminates it once n sectors have been written since it was 
+	opened and no sector is queued: it sends the stop token and polls the card until it has programmed the data, without 
+	blocking the producer. The next sd_streamcache_write then unregisters the timer callback. Between bursts the card is 
+	deselected and idles. 
+	
+	The burst length (at most 255 sectors) is independent of the pool. With n at most SD_CACHE_NUMSECT the burst is written 
+	from the pool at once and the card idles while the next n sectors are produced. A longer burst is opened when the pool is 
+	full and remains open while the producer refills the pool, with the card waiting for data: the idle period between bursts 
+	is the time to fill the pool, and the cost of each burst is spread over n sectors. Each burst costs the commands to open 
+	and terminate the multiblock write and the programming of the card after termination. A block write must not follow 
+	the termination too closely: sd_streamcache_sync waits until 6ms have elapsed since it. The energy saved depends on the card and on n: it is measured by comparing the average current 
+	of the ltc2942 long battery statistics over sessions with and without bursts (see mode_sample).
+	
+	*Streaming reads*
+	
+	Stream read functions read consecutive sectors with a single multiblock read command, instead of one command
+	per sector with sd_block_read. The card reads ahead the next sector while the application processes the current one,
+	which brings the read speed close to the SPI bandwidth.
+	
+	To perform a streaming read:
+	
+		1. Open the stream at the first sector with sd_streamread_open
+		2. Read consecutive sectors with any number of calls to sd_streamread_read
+		3. Close the stream with sd_streamread_close
+	
+	The card remains selected while a stream read is open: no other SD card function must be called until sd_streamread_close.
+	
+	* sd_streamread_open:			Start a stream read at the specified address.
+	* sd_streamread_read:			Reads the next sector of a stream read.
+	* sd_streamread_close:			Terminates a stream read.
+	
+	*SPI clock*
+	
+	The SPI clock is set to the fastest divider (SPI_DIV_2) by init_module. After sd_init, sd_spi_tune negotiates the 
+	clock: a reference sector (e.g. the MBR) is read at the slowest clock, and then starting from the fastest divider it is 
+	read again, checking the CRC16 sent by the card and the data, and the fastest divider passing all the reads is kept.
+	Nothing is written to the card, so that the negotiation is safe on any card layout and on power loss.
+	
+	The card does not check the CRC of the data written (CRC is off in SPI mode), but the CRC of the data read is always checked:
+	- sd_block_read retries at a lower clock on CRC errors;
+	- sd_streamread_read reopens the stream read at the same sector at a lower clock on CRC errors;
+	- streaming writes with caching continue at a lower clock when the card rejects a sector.
+	The clock is only lowered, one divider at a time, until the next sd_spi_tune.
+	
+	* sd_spi_tune:					Selects the fastest SPI clock passing CRC-checked reads of a reference sector.
+	* sd_spi_slower:				Lowers the SPI clock by one divider.
+	* sd_spi_getstat:				Returns the SPI clock and the number of times it was lowered since sd_spi_tune.
 	
 	*Dependencies*
 	
@@ -91,6 +163,7 @@
 	
 	*Usage in interrupts*
 	Not suitable for use in interrupts.
+	No other SPI transfer must take place while a streaming write with caching is open.
 	
 	
 	*Possible improvements*
@@ -340,6 +413,30 @@ BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOC
 *************************************************************************************************************************************************************
 ************************************************************************************************************************************************************/
 
+/******************************************************************************
+	function: _sd_block_read_crc
+*******************************************************************************
+	Reads a sector of data from sector addr and checks its CRC.
+	
+	Parameters:
+		addr		-	Address in sector
+		buffer		-	Buffer of 512 bytes which receives the data
+	
+	Returns:
+		0			- 	Success
+		1			- 	Error
+		2			- 	CRC error
+******************************************************************************/
+static unsigned char _sd_block_read_crc(unsigned long addr,char *buffer)
+{
+	unsigned short checksum;
+	
+	if(_sd_command_r1_datablock(MMC_READ_SINGLE_BLOCK,addr>>24,addr>>16,addr>>8,addr,0,buffer,512,&checksum))
+		return 1;
+	if(_sd_crc16(0,buffer,512)!=checksum)
+		return 2;
+	return 0;
+}
 /******************************************************************************
 	function: sd_block_read
 *******************************************************************************
@@ -348,6 +445,9 @@ BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOC
 	The block size is fixed at 512 bytes, i.e. one sector.
 	Uses internally the single block write function.
 	
+	The CRC of the data is checked. On CRC errors the read is retried at a lower
+	SPI clock.
+	
 	Parameters:
 		addr		-	Address in sector (0=first sector, 1=second sector, ...)
 		buffer		-	Buffer of 512 bytes which receives the data
@@ -358,9 +458,14 @@ BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOC
 ******************************************************************************/
 unsigned char sd_block_read(unsigned long addr,char *buffer)
 {
-	unsigned short checksum;
-	unsigned char response = _sd_command_r1_datablock(MMC_READ_SINGLE_BLOCK,addr>>24,addr>>16,addr>>8,addr,0,buffer,512,&checksum);
-	return response;
+	unsigned char rv;
+	
+	while((rv=_sd_block_read_crc(addr,buffer))==2)
+	{
+		if(sd_spi_slower())
+			break;
+	}
+	return rv;
 }
 
 /******************************************************************************
@@ -431,8 +536,20 @@ unsigned char _sd_write_stream_mustpreerase;			// Indicates whether the pre-eras
 unsigned long _sd_write_stream_preerase;				// Indicates how many sectors must be pre-erased
 
 
-char _sdbuffer[SD_CACHE_SIZE];							// Cache memory for streaming writes with caching, also used for padding
-unsigned short _sdbuffer_n;								// Amount of memory used in cache
+char _sdbuffer[SD_CACHE_NUMSECT][512];					// Sector buffer pool for streaming writes with caching, also used for padding
+unsigned short _sdbuffer_n;								// Amount of data in the sector being filled
+volatile unsigned char _sd_pool_wr;						// Number of sectors queued (free-running, modified by the producer)
+volatile unsigned char _sd_pool_rd;						// Number of sectors written (free-running, modified by the background writer)
+unsigned long _sd_pool_address;							// Address of the sector being filled
+volatile unsigned char _sd_bg_state=SD_BG_OFF;			// State of the background writer
+unsigned char _sd_pool_hwm;								// High-water mark: maximum number of sectors queued since sd_stream_open
+unsigned short _sd_pool_stall;							// Number of times the producer waited for a free buffer since sd_stream_open
+volatile unsigned char _sd_bg_rejected;					// The card rejected a sector: the clock is lowered when recovering
+unsigned long _sd_wrap_start,_sd_wrap_end;				// Area around which the streaming write wraps; _sd_wrap_end is 0 if the write does not wrap
+unsigned char _sd_burst;								// Number of sectors of a burst write, 0 to keep the multiblock write open
+unsigned char _sd_burst_rd;								// _sd_pool_rd when the multiblock write was opened
+unsigned short _sd_pool_opens;							// Number of times the multiblock write was opened since sd_stream_open
+unsigned char _sd_bg_closed;							// The background writer terminated the burst at _sd_write_stream_t1 (see sd_streamcache_sync)
 
 /******************************************************************************
 	function: sd_stream_open
@@ -455,7 +572,16 @@ void sd_stream_open(unsigned long addr,unsigned long preerase)
 	_sd_write_stream_block_started = 0;				// Start data token not sent yet
 	_sd_write_stream_numwritten = 0;				// No bytes written yet
 	_sdbuffer_n=0;									// Number of data into buffer	
+	_sd_pool_wr=_sd_pool_rd=0;						// No sector queued
+	_sd_pool_address=addr;							// Address of the sector being filled
+	_sd_pool_hwm=0;									// Statistics
+	_sd_pool_stall=0;
+	_sd_pool_opens=0;
+	_sd_bg_closed=0;
+	_sd_bg_state=SD_BG_OFF;							// Background writer stopped until the multiblock write is opened
 	_sd_write_stream_error=0;						// Number of errors
+	_sd_bg_rejected=0;
+	_sd_wrap_end=0;									// No wrap
 	if(preerase)
 		_sd_write_stream_mustpreerase=1;			// The pre-erase command must be issued prior to multiblock write
 	else
@@ -625,7 +751,7 @@ unsigned char sd_stream_close(unsigned long *currentsect)
 		unsigned short topad = 512-_sd_write_stream_numwritten;
 
 		// Write
-		sd_stream_write(_sdbuffer,topad,0);
+		sd_stream_write(_sdbuffer[0],topad,0);
 
 		// Flag as closed, even if the stop operation may fail
 		_sd_write_stream_block_started=0;
@@ -649,6 +775,243 @@ STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   ST
 *************************************************************************************************************************************************************
 ************************************************************************************************************************************************************/
 
+/*
+	Streaming writes with caching use a pool of SD_CACHE_NUMSECT sector buffers.
+	
+	The producer (sd_streamcache_write) copies the data into the sector being filled. When the sector is full it is queued 
+	and the next buffer of the pool is used.
+	
+	The queued sectors are written by a background writer:
+	- _sd_streamcache_callback is called by the timer interrupt at 1024Hz. It starts the transfer of a queued sector when the card is ready,
+	sends the CRC and checks the data response once the sector is transferred, and polls the card until it is ready after programming.
+	- The sector data is transferred by the SPI interrupt (spi_wn_int_cb); _sd_streamcache_datadone is called upon completion.
+	
+	The foreground only opens and closes the multiblock write (which requires commands with a response), and recovers from write errors. 
+	The producer blocks only if all the buffers of the pool are queued, i.e. if the card is on average slower than the data rate.
+	
+	_sd_pool_wr is only modified by the producer and _sd_pool_rd by the background writer. Both are free-running counters; the number
+	of queued sectors is their difference, and the buffer index is the counter modulo SD_CACHE_NUMSECT.
+*/
+/******************************************************************************
+	function: _sd_streamcache_datadone
+*******************************************************************************
+	Called from the SPI interrupt when the data of a sector is transferred.
+******************************************************************************/
+void _sd_streamcache_datadone(void)
+{
+	_sd_bg_state=SD_BG_DATADONE;
+}
+/******************************************************************************
+	function: _sd_streamcache_callback
+*******************************************************************************
+	State machine of the background writer, called from the timer interrupt.
+	
+	The card is only accessed in states SD_BG_IDLE, SD_BG_DATADONE, SD_BG_BUSY 
+	and SD_BG_STOP. With burst writes the multiblock write is terminated in 
+	SD_BG_IDLE once the burst is written, and the state machine stops in 
+	SD_BG_STOPPED when the card is ready (see _sd_streamcache_stopped).
+	In case of error the state machine stops in SD_BG_ERROR; the sector is lost 
+	and the foreground closes the multiblock write, which is reopened at the next 
+	sector.
+	
+	Returns:
+		0
+******************************************************************************/
+unsigned char _sd_streamcache_callback(unsigned char p)
+{
+	unsigned char rv;
+	
+	switch(_sd_bg_state)
+	{
+		case SD_BG_DATADONE:
+			// Send CRC and check data was received
+			rv = _sd_block_stop_nowait();
+			// The buffer is free, and the next sector is written at the next address, even if the card rejected the data
+			_sd_pool_rd++;
+			_sd_write_stream_address++;
+			if(rv)
+			{
+				_sd_write_stream_error++;
+				_sd_bg_rejected=1;
+				_sd_bg_state=SD_BG_ERROR;
+				return 0;
+			}
+			_sd_write_stream_t1=timer_ms_get();
+			_sd_bg_state=SD_BG_BUSY;
+			// Fall through: check if the card is ready
+		case SD_BG_BUSY:
+			// Send multiple FF to prevent timeout, as in _sd_block_stop_dowait
+			spi_rw_noselect(0xFF);
+			spi_rw_noselect(0xFF);
+			spi_rw_noselect(0xFF);
+			rv = spi_rw_noselect(0xFF);
+			if(rv!=0xFF)
+			{
+				if(timer_ms_get()-_sd_write_stream_t1>=MMC_TIMEOUT_READWRITE)
+				{
+					_sd_write_stream_error++;
+					_sd_bg_state=SD_BG_ERROR;
+				}
+				return 0;
+			}
+			_sd_bg_state=SD_BG_IDLE;
+			// Fall through: start the next sector
+		case SD_BG_IDLE:
+			if(_sd_pool_rd==_sd_pool_wr)
+			{
+				// Burst written: terminate the multiblock write, as _sd_multiblock_close, to let the card idle until the next burst
+				if(_sd_burst && (unsigned char)(_sd_pool_rd-_sd_burst_rd)>=_sd_burst)
+				{
+					spi_rw_noselect(MMC_STOPMULTIBLOCK);
+					_sd_write_stream_t1=timer_ms_get();
+					_sd_bg_state=SD_BG_STOP;
+				}
+				return 0;
+			}
+			spi_rw_noselect(MMC_STARTMULTIBLOCK);			// Send Data Token
+			_sd_bg_state=SD_BG_DATA;
+			spi_wn_int_cb(_sdbuffer[_sd_pool_rd&(SD_CACHE_NUMSECT-1)],512,_sd_streamcache_datadone);
+			return 0;
+		case SD_BG_STOP:
+			spi_rw_noselect(0xFF);
+			spi_rw_noselect(0xFF);
+			spi_rw_noselect(0xFF);
+			rv = spi_rw_noselect(0xFF);
+			if(rv!=0xFF)
+			{
+				if(timer_ms_get()-_sd_write_stream_t1>=MMC_TIMEOUT_READWRITE)
+				{
+					_sd_write_stream_error++;
+					_sd_bg_state=SD_BG_ERROR;
+				}
+				return 0;
+			}
+			sd_select_n(1);
+			_sd_write_stream_t1=timer_ms_get();
+			_sd_bg_state=SD_BG_STOPPED;
+			return 0;
+		default:
+			return 0;
+	}
+}
+/******************************************************************************
+	function: _sd_streamcache_open
+*******************************************************************************
+	Opens the multiblock write at the address of the next sector to write and 
+	starts the background writer.
+	
+	Returns:
+		0				-	Success
+		other			-	Failure
+******************************************************************************/
+static unsigned char _sd_streamcache_open(void)
+{
+	unsigned char rv;
+	
+	#ifdef MMCDBG
+		printf_P(PSTR("open stream\n"));
+	#endif
+	// Issue the multiblock write, with an optional preerase if this is the first time the multiblock write is started.
+	// As multiple starts could occur if an error occured during transfer, the preerase should be decremented by the number of written sector. Currently this logic is not implemented.
+	if(_sd_write_stream_mustpreerase)
+	{
+		rv = _sd_multiblock_open(_sd_write_stream_address,_sd_write_stream_preerase);
+		_sd_write_stream_mustpreerase=0;		// No more pre-erase now
+	}
+	else
+	{
+		rv = _sd_multiblock_open(_sd_write_stream_address,0);		// No preerase
+	}
+	if(rv)
+	{
+		#ifdef MMCDBG
+			printf_P(PSTR("sd_streamcache_write. _sd_multiblock_open failed\r"));
+		#endif
+		_sd_write_stream_error++;
+		return 1;
+	}
+	_sd_write_stream_open=1;
+	_sd_pool_opens++;
+	_sd_burst_rd=_sd_pool_rd;
+	_sd_bg_closed=0;
+	
+	// Start the background writer
+	_sd_bg_state=SD_BG_IDLE;
+	if(!timer_isregistered_callback(_sd_streamcache_callback))
+	{
+		if(timer_register_callback(_sd_streamcache_callback,0)==-1)
+		{
+			_sd_bg_state=SD_BG_OFF;
+			_sd_multiblock_close();
+			_sd_write_stream_open=0;
+			_sd_write_stream_error++;
+			return 1;
+		}
+	}
+	return 0;
+}
+/******************************************************************************
+	function: _sd_streamcache_recover
+*******************************************************************************
+	Terminates the multiblock write after an error of the background writer.
+	The multiblock write is reopened when the next sector is queued.
+	If the card rejected the sector, the SPI clock is lowered.
+******************************************************************************/
+static void _sd_streamcache_recover(void)
+{
+	_sd_multiblock_close();
+	_sd_write_stream_open=0;
+	_sd_bg_state=SD_BG_OFF;
+	if(_sd_bg_rejected)
+	{
+		_sd_bg_rejected=0;
+		sd_spi_slower();
+	}
+}
+/******************************************************************************
+	function: _sd_streamcache_stopped
+*******************************************************************************
+	Stops the background writer once it has terminated a burst. The multiblock 
+	write is reopened when the next burst is queued.
+******************************************************************************/
+static void _sd_streamcache_stopped(void)
+{
+	if(_sd_bg_state!=SD_BG_STOPPED)
+		return;
+	timer_unregister_callback(_sd_streamcache_callback);
+	_sd_bg_state=SD_BG_OFF;
+	_sd_write_stream_open=0;
+	_sd_bg_closed=1;
+}
+/******************************************************************************
+	function: _sd_streamcache_wait
+*******************************************************************************
+	Waits until at most n sectors are queued, opening the multiblock write and
+	recovering from errors of the background writer as needed.
+	
+	Returns:
+		Number of errors
+******************************************************************************/
+static unsigned char _sd_streamcache_wait(unsigned char n)
+{
+	unsigned char error=0;
+	
+	while((unsigned char)(_sd_pool_wr-_sd_pool_rd)>n)
+	{
+		if(_sd_bg_state==SD_BG_ERROR)
+		{
+			_sd_streamcache_recover();
+			error++;
+		}
+		_sd_streamcache_stopped();
+		if(!_sd_write_stream_open)
+		{
+			if(_sd_streamcache_open())
+				return error+1;
+		}
+	}
+	return error;
+}
 
 /******************************************************************************
 	function:	sd_streamcache_write
@@ -657,15 +1020,17 @@ STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   ST
 
 	Rationale for caching: after completing a block the card needs some time to be ready for a new block. This time is
 	generally short but occasionnally may be longer when block reordering occurs.
-	If sd_streamcache_write is called while the card is still busy from a prior write the data is moved into the cache and the function returns immediately.
-	If the cache has no space for the data then the function will block until the cards is ready and will open a new block and write directly the data to the card.
-	Upon subsequent writes, or calling sd_streamcache_close, the cache content is written to the card.
+	The data is copied into a pool of sector buffers and the function returns immediately. Complete sectors are written to 
+	the card in the background by the timer and SPI interrupts. 
+	If all the buffers of the pool are queued the function blocks until the background writer frees one.
+	
+	The last sector is only written once complete, or when sd_streamcache_close is called.
 		
-	This function uses the cache buffer _sdbuffer and ensures it does not grow above SD_CACHE_SIZE.
+	The pool holds SD_CACHE_NUMSECT sectors (SD_CACHE_SIZE bytes).
 
 	Parameters:
 		buffer			-	Buffer of data to write	
-		size			-	Number of bytes to write. Use size=0 to flush the buffer.
+		size			-	Number of bytes to write. size=0 only handles errors of the background writer.
 		currentsect		-	Optionally a pointer to a variable holding the address (in sectors) of the block currently being used to store the data. 
 							If 0, the address will not be provided
 
@@ -675,217 +1040,73 @@ STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   ST
 ******************************************************************************/
 unsigned char sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentsect)
 {
-	// Find how many bytes can effectively be written until the sector is full.
-	unsigned long effw;
-	unsigned char rv,error;
+	unsigned short effw;
+	unsigned char error;
 
 	// Error indicates the number of errors that occurred during this function. Normally it should remain 0.
 	error=0;			
 	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: size: %u. incache: %u: strmopen: %d blkstr: %d wrinblk: %u addr: %lX\r"),size,_sdbuffer_n,_sd_write_stream_open,_sd_write_stream_block_started,_sd_write_stream_numwritten,_sd_write_stream_address);
-	#endif
-
-	// This loop will be iterated to write size bytes to the card every time a block is completed
-sd_streamcache_write_loop:
-	//fputc('W',file_pri);
-	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write_loop: size: %u\n"),size);
+		printf_P(PSTR("sd_streamcache_write: size: %u. incache: %u: queued: %u strmopen: %d state: %d addr: %lX\r"),size,_sdbuffer_n,(unsigned char)(_sd_pool_wr-_sd_pool_rd),_sd_write_stream_open,_sd_bg_state,_sd_pool_address);
 	#endif
-	//fprintf(file_pri,"write2. size: %u. _sdbuffer_n: %u\n",size,_sdbuffer_n);
 
 	// Update current sector written to
 	if(currentsect)
-		*currentsect = _sd_write_stream_address;
+		*currentsect = _sd_pool_address;
 		
-	// Wait for card to become ready from previous block write (_sd_write_stream_mustwait)	
-	while(_sd_write_stream_mustwait)					// Enter wait loop if neeeded regardless of the amount of data to write
+	// Recover from an error of the background writer
+	if(_sd_bg_state==SD_BG_ERROR)
 	{
-		//fputc('w',file_pri);
-		// Get card status
-		rv = spi_rw_noselect(0xFF);
-		// To prevent timeout if streaming slowly. E.g. when sending one packet to the card every second only one FF is sent to the card per second, which timeouts MMC_TIMEOUT_READWRITE.
-		// Sending more FF is harmless at the cost of slightly slower maximum write speed (less than 0.5%).
-		rv = spi_rw_noselect(0xFF);
-		rv = spi_rw_noselect(0xFF);
-		rv = spi_rw_noselect(0xFF);
-		
-		#ifdef MMCDBG
-			printf_P(PSTR("sd_streamcache: wait <- %02X\n"),rv);
-		#endif
-			
-		// DAN TOCHECK: add more clocks here
-		
-		if(rv==0xff)
-		{
-			// Card responds that it is ready: indicate wait not needed and exit from loop
-			_sd_write_stream_mustwait=0;
-			break;
-		}
-		// Check the time elapsed from _sd_block_stop_nowait for a timeout.
-		// ISSUE: with certain cards and slow streaming speed, the following timeouts. 
-		// This happens because multiple FF's must be sent above, and only one FF is sent per "putbuf" call. Options: send multiple FF's above, or increase the timeout. 
-		// Choice: issue multiple FF above
-		if(timer_ms_get()-_sd_write_stream_t1>=MMC_TIMEOUT_READWRITE)
-		{
-			//printf("Dan timeout\n");
-			// Timeout waiting for card. Close the block
-			//fputc('t',file_pri);			
-			_sd_write_stream_error++;
-			error++;
-			_sd_multiblock_close();
-			_sd_write_stream_open=0;							// Multiblock write not open
-			break;
-		}
-		// If size is nonzero (don't force writing buffer) and user data fits in cache buffer then store user data in cache and return immediately with success
-		// If the user data does not fit in the cache buffer then this while loop will block until the card is ready or a timeout occurs
-		// The size test ensures the cache buffer never holds more than SD_CACHE_SIZE bytes.
-		if(size && size<=SD_CACHE_SIZE-_sdbuffer_n)
-		{
-			//fputc('b',file_pri);
-			memcpy(_sdbuffer+_sdbuffer_n,buffer,size);
-			_sdbuffer_n+=size;
-			//return error|0x80;
-			#ifdef MMCDBG
-				printf_P(PSTR("sd_streamcache_write: cached, return ok\n"));
-			#endif
-			return error;		// Error is 0 (success)
-		}
-
-	}
-	// Here: card is ready (transaction/block may or may not be open/closed)
-		
-	// Nothing to write in the user-provided buffer nor in the cache buffer therefore returns successfully.
-	if(size==0 && _sdbuffer_n==0)
-	{
-		#ifdef MMCDBG
-			printf_P(PSTR("sd_streamcache_write: return ok\n"));
-		#endif
-		return error;			// Error is 0 (success)
+		_sd_streamcache_recover();
+		error++;
 	}
-		
+	// Burst terminated by the background writer: stop it until the next burst
+	_sd_streamcache_stopped();
 	
-	//	Write command not yet send.
-	if(!_sd_write_stream_open)
+	while(size)
 	{
-		#ifdef MMCDBG
-			printf_P(PSTR("open stream\n"));
-		#endif
-		//fputc('o',file_pri);
-		// Issue the multiblock write, with an optional preerase if this is the first time the multiblock write is started.
-		// As multiple starts could occur if an error occured during transfer, the preerase should be decremented by the number of written sector. Currently this logic is not implemented.
-		if(_sd_write_stream_mustpreerase)
+		// All buffers queued: wait for the background writer
+		if((unsigned char)(_sd_pool_wr-_sd_pool_rd)>=SD_CACHE_NUMSECT)
 		{
-			rv = _sd_multiblock_open(_sd_write_stream_address,_sd_write_stream_preerase);
-			_sd_write_stream_mustpreerase=0;		// No more pre-erase now
-		}
-		else
-		{
-			rv = _sd_multiblock_open(_sd_write_stream_address,0);		// No preerase
+			_sd_pool_stall++;
+			error+=_sd_streamcache_wait(SD_CACHE_NUMSECT-1);
+			if((unsigned char)(_sd_pool_wr-_sd_pool_rd)>=SD_CACHE_NUMSECT)
+				return error;
 		}
 		
-		if(rv)
-		{
-			#ifdef MMCDBG
-				//printf_P(PSTR("sd_streamcache_write. size: %ld. strmopen: %d strmstrt: %d numwritten: %ld addr: %lX\r"),size,_sd_write_stream_open,_sd_write_stream_started,_sd_write_stream_numwritten,_sd_write_stream_address);
-				printf_P(PSTR("sd_streamcache_write. _sd_write_stream_address failed\r"));
-			#endif
-			_sd_write_stream_error++;
-			error++;
-			//return error|0x20;					// Abort if the open failed
-			return error;
-		}	
-		_sd_write_stream_open = 1;					// Block write is now open,...	
-		_sd_write_stream_block_started=0;			// Block has not started
-	}
-
-	// Block start not yet sent
-	if(!_sd_write_stream_block_started)
-	{
-		#ifdef MMCDBG
-			printf_P(PSTR("start block\n"));
-		#endif
-		//fputc('b',file_pri);
-		spi_rw_noselect(MMC_STARTMULTIBLOCK);	// Send Data Token
-		_sd_write_stream_block_started=1;			// Block has started
-		_sd_write_stream_numwritten=0;				// So far wrote 0
-	}
-		
-	// Write the data until: either all data is written, or a block is completed (whichever comes first)
-	// First write data in cache buffer, if any. 
-	// It is always possible to write the entire cache buffer because the only time the buffer can 
-	// fill itself and become full is during the waiting for card ready; and the first time the card is ready 
-	// the buffer is emptied and stays empty.	
-	// _sdbuffer_n must be <=512, which means maximum buffer size is 512 bytes.
-	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: write %u cache\n"),_sdbuffer_n);
-	#endif
-	_sd_writebuffer(_sdbuffer,_sdbuffer_n);
-	_sd_write_stream_numwritten+=_sdbuffer_n;
-	_sdbuffer_n=0;
-	
-	//printf("num: %u\n",_sd_write_stream_numwritten);
-	
-	// Write the user-provided buffer or a subset of it until card the block is full	
-	if(size<=512-_sd_write_stream_numwritten)
-		effw=size;
-	else
-		effw=512-_sd_write_stream_numwritten;
+		// Copy the data until either all data is copied, or the sector is full
+		if(size<=512-_sdbuffer_n)
+			effw=size;
+		else
+			effw=512-_sdbuffer_n;
+		memcpy(_sdbuffer[_sd_pool_wr&(SD_CACHE_NUMSECT-1)]+_sdbuffer_n,buffer,effw);
+		_sdbuffer_n+=effw;
+		buffer+=effw;
+		size-=effw;
 		
-	// Send data and update counters
-	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: write %u data\n"),effw);
-	#endif
-	_sd_writebuffer(buffer,effw);
-	_sd_write_stream_numwritten+=effw;
-	// Update the buffer pointer and counter
-	buffer+=effw;
-	size-=effw;
-	
-	//printf("num: %u\n",_sd_write_stream_numwritten);
-	
-	
-	// If a block is full, terminates it
-	if(_sd_write_stream_numwritten>=512)
-	{
-		//fputc('s',file_pri);
-		// Reset the internal state for the next block
-		_sd_write_stream_block_started=0;								// Block hasn't started
-	
-		// Increment the write address to the next sector for the next write call.
-		_sd_write_stream_address+=1;
-	
-		// Stop block
-		#ifdef MMCDBG
-			printf_P(PSTR("close block\n"));
-		#endif
-		rv = _sd_block_stop_nowait();
-		_sd_write_stream_t1=timer_ms_get();
-		_sd_write_stream_mustwait=1;
-
-		// If the call failed we terminate the multiblock write 
-		if(rv!=0)
+		// Sector full: queue it
+		if(_sdbuffer_n>=512)
 		{
-			//fputc('e',file_pri);
-			// Wait for the block to complete
-			_sd_write_stream_error++;
-			error++;
-			_sd_block_stop_dowait();
-			_sd_multiblock_close();
-			_sd_write_stream_open=0;							// Multiblock write not open
-			_sd_write_stream_mustwait=0;
+			_sdbuffer_n=0;
+			_sd_pool_wr++;
+			_sd_pool_address++;
+			if((unsigned char)(_sd_pool_wr-_sd_pool_rd)>_sd_pool_hwm)
+				_sd_pool_hwm=_sd_pool_wr-_sd_pool_rd;
+			// End of the ring: the multiblock write is reopened at the start of the area
+			if(_sd_pool_address==_sd_wrap_end)
+			{
+				error+=sd_streamcache_sync();
+				_sd_pool_address=_sd_write_stream_address=_sd_wrap_start;
+			}
 		}
 	}
 	
-	// If size is non null, loop to write the remaining data
-	if(size!=0)
+	// Open the multiblock write when sectors are queued, or a burst (at most the pool) with burst writes; this is also where it is reopened after an error
+	if(!_sd_write_stream_open && (unsigned char)(_sd_pool_wr-_sd_pool_rd)>=(!_sd_burst?1:_sd_burst<SD_CACHE_NUMSECT?_sd_burst:SD_CACHE_NUMSECT))
 	{
-		//printf("loop\n");
-		goto sd_streamcache_write_loop;
+		if(_sd_streamcache_open())
+			error++;
 	}
 
-	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: return ok\n"));
-	#endif
 	// Success
 	return error;
 }
@@ -894,6 +1115,9 @@ sd_streamcache_write_loop:
 	sd_streamcache_close
 *******************************************************************************	
 	Terminates a streaming write with caching.
+	
+	Pads the last sector, waits until all the queued sectors are written, 
+	stops the background writer and terminates the multiblock write.
 
 	Parameters:
 		currentsect		-	Optionally a pointer to a variable holding the address (in sectors) of the last block to hold data of the streaming write.
@@ -908,91 +1132,395 @@ unsigned char sd_streamcache_close(unsigned long *currentsect)
 	unsigned char response;
 
 	#if SD_DBG_STREAM==1
-		printf_P(PSTR("sd_streamcache_close: strmopen: %d blkstr: %d wrinblk: %u addr: %lX\r"),_sd_write_stream_open,_sd_write_stream_block_started,_sd_write_stream_numwritten,_sd_write_stream_address);
+		printf_P(PSTR("sd_streamcache_close: strmopen: %d state: %d incache: %u queued: %u addr: %lX\r"),_sd_write_stream_open,_sd_bg_state,_sdbuffer_n,(unsigned char)(_sd_pool_wr-_sd_pool_rd),_sd_write_stream_address);
 	#endif
 	
-	// 1. Flush the cache. At this stage the block should be closed, but without waiting for ready
-	response=sd_streamcache_write(0,0,0);
+	// 1. Pad the sector being filled and queue it. This buffer is always free.
+	if(_sdbuffer_n)
+	{
+		memset(_sdbuffer[_sd_pool_wr&(SD_CACHE_NUMSECT-1)]+_sdbuffer_n,0x55,512-_sdbuffer_n);
+		_sdbuffer_n=0;
+		_sd_pool_wr++;
+		_sd_pool_address++;
+	}
+	
+	// 2. Write the queued sectors, stop the background writer and terminate the multiblock write
+	response = sd_streamcache_sync();
+	
+	// Get the address of the last written block.
+	if(currentsect)
+	{
+		*currentsect = _sd_write_stream_address-1;
+	}
+	
 	if(response)
 	{
 		printf_P(PSTR("sd_streamcache_close: error flushing\n"));
-		_sd_multiblock_close();
-		_sd_write_stream_open=0;
 		return 1;
 	}
+	return 0;
+}
+/******************************************************************************
+	sd_streamcache_sync
+*******************************************************************************	
+	Writes all the complete sectors queued, stops the background writer and 
+	terminates the multiblock write. The data of the sector being filled is kept.
+	Returns at least 6ms after the termination of the multiblock write, which 
+	allows a block write to follow.
+	
+	This allows other card operations (e.g. updating the root) during a streaming 
+	write with caching. The multiblock write is reopened at the next sector by 
+	the next sd_streamcache_write.
+							
+	Return value:
+		0				-	Ok
+		Nonzero			-	Error
+******************************************************************************/
+unsigned char sd_streamcache_sync(void)
+{
+	unsigned char response=0,error=0;
 	
-	// 2. Check if padding to terminate a block is needed
-	if(_sd_write_stream_block_started)
+	// Wait until all the sectors are written, and for the card to be ready after the last one
+	if(_sd_bg_state==SD_BG_ERROR)
 	{
-		unsigned short topad = 512-_sd_write_stream_numwritten;
-		#if SD_DBG_STREAM==1
-			printf("padding: %u topad: %u\n",_sd_write_stream_numwritten,topad);
-		#endif
-
-		// Write
-		memset(_sdbuffer,0x55,topad);
-		response = sd_streamcache_write(_sdbuffer,topad,0);
-		if(response)
-		{
-			printf_P(PSTR("sd_streamcache_close: error padding\n"));
-			_sd_multiblock_close();
-			_sd_write_stream_open=0;
-			return 1;
-		}
-		// 3. Flush cache again for the padding, if data was cached
-		response=sd_streamcache_write(0,0,0);
-		if(response)
-		{
-			printf_P(PSTR("sd_streamcache_close: error flushing\n"));
-			_sd_multiblock_close();
-			_sd_write_stream_open=0;
-			return 1;
-		}	
+		_sd_streamcache_recover();
+		error++;
 	}
+	error+=_sd_streamcache_wait(0);
+	while(_sd_bg_state==SD_BG_BUSY);
+	
+	// Stop the background writer; discard the sectors which could not be written
+	timer_unregister_callback(_sd_streamcache_callback);
+	// The background writer may have terminated the burst in the meantime: wait for the card as _sd_multiblock_close
+	if(_sd_bg_state==SD_BG_STOP)
+	{
+		response = _sd_block_stop_dowait();
+		sd_select_n(1);
+		_sd_write_stream_t1=timer_ms_get();
+		_sd_bg_state=SD_BG_STOPPED;
+	}
+	if(_sd_bg_state==SD_BG_STOPPED)
+	{
+		_sd_write_stream_open=0;
+		_sd_bg_closed=1;
+	}
+	if(_sd_bg_state==SD_BG_ERROR)
+		error++;
+	_sd_bg_state=SD_BG_OFF;
+	_sd_pool_rd=_sd_pool_wr;
 	
 	#if SD_DBG_STREAM==1
-		printf_P(PSTR("sd_streamcache_close after pad+flush: strmopen: %d blkstr: %d wrinblk: %u addr: %lX\r"),_sd_write_stream_open,_sd_write_stream_block_started,_sd_write_stream_numwritten,_sd_write_stream_address);
+		printf_P(PSTR("sd_streamcache_sync after flush: strmopen: %d errors: %d addr: %lX\r"),_sd_write_stream_open,error,_sd_write_stream_address);
 	#endif
-
-	// 4. This "Flush cache" is used to wait for ready after a block close; if there was no need to wait it returns transparently.
-	response=sd_streamcache_write(0,0,0);
-	if(response)
+	
+	if(_sd_write_stream_open)
 	{
-		printf_P(PSTR("sd_streamcache_close: error flushing\n"));
-		_sd_multiblock_close();
+		// Terminates the multiblock write
+		response = _sd_multiblock_close();
 		_sd_write_stream_open=0;
+		
+		#if SD_DBG_STREAM==1
+			printf_P(PSTR("_sd_multiblock_close: %02X\n"),response);
+		#endif
+
+		// On Samsung Evo (32GB) doing a regular block write immediately after streamclose leads to error (e.g. when updating the root)
+		// This seems to be due to the need for a delay. When bluetooth or USB connected this delay seems to be critical (likely due to the USB interrupt routine adding extra time).
+		// A delay of 5ms seems sufficient. Use 6ms for margin.
+		_delay_ms(6);
+	}
+	else if(_sd_bg_closed)
+	{
+		// Terminated by the background writer at the end of a burst: only wait for the rest of the delay, as the caller may write a block next
+		while(timer_ms_get()-_sd_write_stream_t1<6);
+	}
+	_sd_bg_closed=0;
+	
+	if(error || response)
 		return 1;
-	}	
+	return 0;
+}
+
+/******************************************************************************
+	function: sd_streamcache_wrap
+*******************************************************************************
+	Makes the current streaming write with caching wrap around an area: the
+	sector following end-1 is start. Must be called after sd_stream_open, 
+	which cancels the wrap.
 	
-	// Get the address of the last written block.
+	Parameters:
+		start		-	First sector of the area
+		end			-	Sector following the area
+******************************************************************************/
+void sd_streamcache_wrap(unsigned long start,unsigned long end)
+{
+	_sd_wrap_start=start;
+	_sd_wrap_end=end;
+}
+
+/******************************************************************************
+	function: sd_streamcache_burst
+*******************************************************************************
+	Selects burst writes for the streaming writes with caching (see burst 
+	writes). Applies from the next call to sd_streamcache_write, and is kept 
+	across streaming writes.
+	
+	Parameters:
+		n			-	Number of sectors of a burst, independent of SD_CACHE_NUMSECT; 
+						0 keeps the multiblock write open
+******************************************************************************/
+void sd_streamcache_burst(unsigned char n)
+{
+	_sd_burst=n;
+}
+/******************************************************************************
+	function: sd_streamcache_getbursts
+*******************************************************************************
+	Returns the number of times the multiblock write of the current or last 
+	streaming write with caching was opened since sd_stream_open: the number 
+	of bursts with burst writes, and otherwise the number of reopenings after 
+	a sync or an error.
+******************************************************************************/
+unsigned short sd_streamcache_getbursts(void)
+{
+	return _sd_pool_opens;
+}
+/******************************************************************************
+	function: sd_streamcache_isidle
+*******************************************************************************
+	Indicates whether the multiblock write of the streaming write with caching
+	is terminated: between bursts with burst writes, or after a sync. Other 
+	card operations (e.g. sd_erase) are then possible without sd_streamcache_sync; 
+	the sectors kept in the pool are written by a later sd_streamcache_write.
+	A block write must however be preceded by sd_streamcache_sync, which 
+	waits for the delay after the termination of a burst.
+	
+	Returns:
+		0			-	Multiblock write open
+		1			-	Card idle
+******************************************************************************/
+unsigned char sd_streamcache_isidle(void)
+{
+	_sd_streamcache_stopped();
+	return _sd_write_stream_open?0:1;
+}
+/******************************************************************************
+	function: sd_streamcache_getstat
+*******************************************************************************
+	Returns the cache usage statistics of the current or last streaming write
+	with caching, since sd_stream_open.
+	
+	Parameters:
+		hwm			-	Pointer receiving the maximum number of sectors queued 
+						(at most SD_CACHE_NUMSECT)
+		stall		-	Pointer receiving the number of times sd_streamcache_write 
+						waited for a free buffer
+******************************************************************************/
+void sd_streamcache_getstat(unsigned char *hwm,unsigned short *stall)
+{
+	*hwm = _sd_pool_hwm;
+	*stall = _sd_pool_stall;
+}
+
+/************************************************************************************************************************************************************
+*************************************************************************************************************************************************************
+STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   
+*************************************************************************************************************************************************************
+************************************************************************************************************************************************************/
+
+unsigned char _sd_read_stream_open=0;					// Multiblock read command sent
+unsigned long _sd_read_stream_address;					// Address of the next sector to read
+
+/******************************************************************************
+	function: sd_streamread_open
+*******************************************************************************
+	Start a stream read at the specified address.
+	
+	Internally the multiblock read command is issued: the card reads ahead the 
+	next sectors while the application processes the current one.
+	If a stream read is already open it is closed first.
+	
+	Parameters:
+		addr		-		Read start address in sectors
+	
+	Returns:
+		0			- 		Success
+		nonzero		- 		Error
+******************************************************************************/
+unsigned char sd_streamread_open(unsigned long addr)
+{
+	unsigned char rv;
+	
+	sd_streamread_close();
+	
+	rv = _sd_multiblock_read_open(addr);
+	if(rv)
+		return rv;
+	_sd_read_stream_open=1;
+	_sd_read_stream_address=addr;
+	return 0;
+}
+/******************************************************************************
+	function:	sd_streamread_read
+*******************************************************************************
+	Reads the next sector of a stream read.
+	
+	On CRC errors the stream read is reopened at the same sector at a lower SPI clock.
+	In case of error the stream read is closed; sd_streamread_open must be called
+	to resume reading, e.g. from the sector returned in currentsect.
+	
+	Parameters:
+		buffer		-		Buffer of 512 bytes which receives the data
+		currentsect	-		Pointer receiving the address of the sector read, or 0
+	
+	Returns:
+		0			- 		Success
+		nonzero		- 		Error
+******************************************************************************/
+unsigned char sd_streamread_read(char *buffer,unsigned long *currentsect)
+{
+	unsigned short checksum;
+	
+	if(!_sd_read_stream_open)
+		return 1;
 	if(currentsect)
+		*currentsect=_sd_read_stream_address;
+	while(1)
 	{
-		*currentsect = _sd_write_stream_address-1;
+		if(_sd_readblock_ns(buffer,512,&checksum))
+		{
+			sd_streamread_close();
+			return 1;
+		}
+		if(_sd_crc16(0,buffer,512)==checksum)
+			break;
+		// CRC error: read the sector again at a lower clock
+		sd_streamread_close();
+		if(sd_spi_slower() || sd_streamread_open(_sd_read_stream_address))
+			return 1;
 	}
+	_sd_read_stream_address++;
+	return 0;
+}
+/******************************************************************************
+	function: sd_streamread_close
+*******************************************************************************
+	Terminates a stream read. Does nothing if no stream read is open.
 	
-	// 5. Terminates the multiblock write
-	response = _sd_multiblock_close();
+	Returns:
+		0			- 		Success
+		nonzero		- 		Error
+******************************************************************************/
+unsigned char sd_streamread_close(void)
+{
+	if(!_sd_read_stream_open)
+		return 0;
+	_sd_read_stream_open=0;
+	return _sd_multiblock_read_close();
+}
+
+/************************************************************************************************************************************************************
+*************************************************************************************************************************************************************
+SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   SPI CLOCK   
+*************************************************************************************************************************************************************
+************************************************************************************************************************************************************/
+
+// SPI dividers from the fastest to the slowest: the SPI clock is F_CPU/(2<<_sd_spi_speed)
+const unsigned char _sd_spi_div[SD_SPI_NUMSPEED] PROGMEM = {SPI_DIV_2,SPI_DIV_4,SPI_DIV_8,SPI_DIV_16,SPI_DIV_32,SPI_DIV_64,SPI_DIV_128};
+unsigned char _sd_spi_speed=0;							// Index of the current divider in _sd_spi_div; init_module sets SPI_DIV_2
+unsigned char _sd_spi_fallback=0;						// Number of times the clock was lowered since sd_spi_tune
+
+static void _sd_spi_set(unsigned char speed)
+{
+	_sd_spi_speed=speed;
+	spi_init(pgm_read_byte(&_sd_spi_div[speed]));
+}
+/******************************************************************************
+	function: sd_spi_tune
+*******************************************************************************
+	Selects the fastest SPI clock at which the card reliably transfers data.
 	
-	#if SD_DBG_STREAM==1
-		printf_P(PSTR("_sd_multiblock_close: %02X\n"),response);
-	#endif
+	The reference sector sect is read at the slowest clock. Starting from the 
+	fastest divider, it is then read SD_SPI_TUNE_READS times; the CRC of the 
+	data read and the data are checked against the reference. The fastest 
+	divider passing all the reads is kept. The card is only read: the reference 
+	sector should hold varied data (e.g. the MBR, sector 0), as a sector of 
+	zeros exercises few transitions.
 	
-	// 5. Flag as closed
-	_sd_write_stream_open=0;
+	Must be called after sd_init and not during a streaming read or write. 
+	The sector buffers of streaming writes with caching are used.
 	
-	if(response)
+	Parameters:
+		sect		-	Reference sector
+	
+	Returns:
+		0			- 	Success
+		1			- 	Error: no divider passed the test, or the reference sector could not be read.
+						The slowest clock is then used.
+******************************************************************************/
+unsigned char sd_spi_tune(unsigned long sect)
+{
+	char *ref=_sdbuffer[0],*buf=_sdbuffer[1];
+	unsigned char speed,r=0;
+	
+	_sd_spi_fallback=0;
+	
+	// Read the reference at the slowest clock
+	_sd_spi_set(SD_SPI_NUMSPEED-1);
+	if(_sd_block_read_crc(sect,ref))
+		return 1;
+	
+	for(speed=0;speed<SD_SPI_NUMSPEED;speed++)
+	{
+		_sd_spi_set(speed);
+		for(r=0;r<SD_SPI_TUNE_READS;r++)
+		{
+			memset(buf,~ref[r],512);
+			if(_sd_block_read_crc(sect,buf) || memcmp(buf,ref,512))
+				break;
+		}
+		if(r==SD_SPI_TUNE_READS)
+			break;
+	}
+	if(speed==SD_SPI_NUMSPEED)
 	{
-		printf_P(PSTR("sd_streamcache_close: error multiblock close\n"));
+		_sd_spi_set(SD_SPI_NUMSPEED-1);
 		return 1;
 	}
-
-	// On Samsung Evo (32GB) doing a regular block write immediately after streamclose leads to error (e.g. when updating the root)
-	// This seems to be due to the need for a delay. When bluetooth or USB connected this delay seems to be critical (likely due to the USB interrupt routine adding extra time).
-	// A delay of 5ms seems sufficient. Use 6ms for margin.
-	_delay_ms(6);
-
 	return 0;
 }
+/******************************************************************************
+	function: sd_spi_slower
+*******************************************************************************
+	Lowers the SPI clock by one divider, after a CRC or write error.
+	
+	Must not be called while an interrupt-driven SPI transfer is ongoing.
+	
+	Returns:
+		0			- 	Success
+		1			- 	The clock is already the slowest
+******************************************************************************/
+unsigned char sd_spi_slower(void)
+{
+	if(_sd_spi_speed>=SD_SPI_NUMSPEED-1)
+		return 1;
+	_sd_spi_set(_sd_spi_speed+1);
+	_sd_spi_fallback++;
+	return 0;
+}
+/******************************************************************************
+	function: sd_spi_getstat
+*******************************************************************************
+	Returns the SPI clock and the number of times it was lowered since sd_spi_tune.
+	
+	Parameters:
+		khz			-	Pointer receiving the SPI clock in KHz
+		fallback	-	Pointer receiving the number of times the clock was lowered
+******************************************************************************/
+void sd_spi_getstat(unsigned short *khz,unsigned char *fallback)
+{
+	*khz = (F_CPU/2000)>>_sd_spi_speed;
+	*fallback = _sd_spi_fallback;
+}
 
 unsigned char sd_erase(unsigned long addr1,unsigned long addr2)
 {
@@ -10,9 +10,11 @@
 #define SD_SEND_IF_COND							8
 #define MMC_SEND_CSD							9
 #define MMC_SEND_CID							10
+#define MMC_STOP_TRANSMISSION					12
 #define MMC_SEND_STATUS							13
 #define MMC_SET_BLOCKLEN						16
 #define MMC_READ_SINGLE_BLOCK					17
+#define MMC_READ_MULTIPLE_BLOCK					18
 #define MMC_WRITE_BLOCK							24
 #define MMC_WRITE_MULTIPLE_BLOCK				25
 #define MMC_PROGRAM_CSD							27
@@ -49,11 +51,35 @@
 
 #define SD_CHECK_BIT							0x80			// MSB set to 0 indicates R1 answer
 
-#define SD_CACHE_SIZE 512
+// Streaming writes with caching: number of sector buffers in the pool. Must be a power of 2, at most 128.
+// The default of 2 sectors (1KB, as the double buffer before the pool) is the minimum for writing a sector while the next is filled.
+// Larger pools are opted in from the Makefile for cards which stall: see the Makefile for the stall absorbed by each size.
+#ifndef SD_CACHE_NUMSECT
+#define SD_CACHE_NUMSECT 2
+#endif
+#if (SD_CACHE_NUMSECT&(SD_CACHE_NUMSECT-1)) || SD_CACHE_NUMSECT<2 || SD_CACHE_NUMSECT>128
+#error SD_CACHE_NUMSECT must be a power of 2 between 2 and 128
+#endif
+#define SD_CACHE_SIZE (SD_CACHE_NUMSECT*512)
+
+// States of the background writer of streaming writes with caching
+#define SD_BG_OFF								0				// Multiblock write not open: the background writer does not access the card
+#define SD_BG_IDLE								1				// Card ready, waiting for a sector
+#define SD_BG_DATA								2				// Sector data sent by the SPI interrupt
+#define SD_BG_DATADONE							3				// Sector data sent, CRC and data response pending
+#define SD_BG_BUSY								4				// Card programming the sector
+#define SD_BG_ERROR								5				// Write error: the multiblock write must be closed by the foreground
+#define SD_BG_STOP								6				// Burst written: stop token sent, card programming
+#define SD_BG_STOPPED							7				// Burst terminated and card deselected: the foreground stops the background writer
 
 
 #define SD_CRC_CMD55							0x65
 
+// SPI clock: sd_spi_tune selects the fastest of the SD_SPI_NUMSPEED dividers (SPI_DIV_2 to SPI_DIV_128) which passes 
+// SD_SPI_TUNE_READS CRC-checked reads of a reference sector
+#define SD_SPI_NUMSPEED							7
+#define SD_SPI_TUNE_READS						4
+
 //#define MMCDBG
 // Debug streaming write functions
 //#define SD_DBG_STREAM 1
@@ -63,6 +89,7 @@
 //#define MMCCLOCKMORE
 
 extern unsigned short _sdbuffer_n;
+extern volatile unsigned char _sd_bg_state;
 
 
 void sd_select_n(char ss);
@@ -89,9 +116,27 @@ unsigned char sd_streamcache_write(char *buffer,unsigned short size,unsigned lon
 //unsigned char sd_write_stream_write_block(unsigned char *buffer,unsigned long *currentaddr);
 //unsigned char sd_write_stream_write_block2(unsigned char *buffer,unsigned long *currentaddr);
 unsigned char sd_streamcache_close(unsigned long *currentaddr);
+unsigned char sd_streamcache_sync(void);
+void sd_streamcache_wrap(unsigned long start,unsigned long end);
+unsigned char _sd_streamcache_callback(unsigned char p);
+void _sd_streamcache_datadone(void);
+void sd_streamcache_getstat(unsigned char *hwm,unsigned short *stall);
+void sd_streamcache_burst(unsigned char n);
+unsigned short sd_streamcache_getbursts(void);
+unsigned char sd_streamcache_isidle(void);
+
+// Multiblock streaming reads
+unsigned char sd_streamread_open(unsigned long addr);
+unsigned char sd_streamread_read(char *buffer,unsigned long *currentsect);
+unsigned char sd_streamread_close(void);
 
 unsigned char sd_erase(unsigned long addr1,unsigned long addr2);
 
+// SPI clock
+unsigned char sd_spi_tune(unsigned long sect);
+unsigned char sd_spi_slower(void);
+void sd_spi_getstat(unsigned short *khz,unsigned char *fallback);
+
 // Print functions
 void sd_print_csd(FILE *f,CSD *csd);
 void sd_print_cid(FILE *f,CID *cid);
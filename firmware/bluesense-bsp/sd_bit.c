@@ -5,6 +5,7 @@
 #include <avr/power.h>
 #include <avr/eeprom.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 #include <stdio.h>
 #include <string.h>
 #include "wait.h"
@@ -28,6 +29,7 @@
 	* _sd_crc7command:					Part of the CRC7 computation.
 	* _sd_crc7byte:						Part of the CRC7 computation.
 	* _sd_crc7end:						Part of the CRC7 computation.
+	* _sd_crc16:						CRC16 of a data block.
 	
 	
 	
@@ -220,3 +222,28 @@ unsigned short sd_crc16end(unsigned short crc16)
 	return crc16;
 }
 */
+
+/******************************************************************************
+	function: _sd_crc16
+*******************************************************************************	
+	CRC16 of a data block (CRC-CCITT, polynomial x^16+x^12+x^5+1, initial 
+	value 0), as sent by the card after the data of a read block, most 
+	significant byte first.
+	
+	Uses the avr-libc _crc_xmodem_update, which is the same CRC without the
+	augmentation of sd_crc16/sd_crc16end.
+	
+	Parameters:
+		crc16		-	Current CRC: 0 for a new block
+		data		-	Data
+		n			-	Number of bytes
+	
+	Returns
+		crc16		-	New CRC
+******************************************************************************/
+unsigned short _sd_crc16(unsigned short crc16,char *data,unsigned short n)
+{
+	while(n--)
+		crc16 = _crc_xmodem_update(crc16,*data++);
+	return crc16;
+}
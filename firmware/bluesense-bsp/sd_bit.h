@@ -6,6 +6,7 @@ unsigned long _sd_bit2val(char *data,unsigned int startbit,unsigned int n);
 unsigned char _sd_crc7command(unsigned char cmd,unsigned char p1,unsigned char p2,unsigned char p3,unsigned char p4);
 unsigned char _sd_crc7byte(unsigned char crc7,unsigned char d);
 unsigned char _sd_crc7end(unsigned char crc7);
+unsigned short _sd_crc16(unsigned short crc16,char *data,unsigned short n);
 
 
 //unsigned short sd_crc16(unsigned short crc16,unsigned char d);
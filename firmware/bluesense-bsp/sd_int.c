@@ -83,8 +83,11 @@
 
 	* _sd_multiblock_open:			Selects the card and starts a multiblock write by sending the MMC_WRITE_MULTIPLE_BLOCK command.
 	* _sd_multiblock_close: 		Terminates the multiblock write by sending MMC_STOPBLOCK and deselecting the card.
+	* _sd_multiblock_read_open:		Selects the card and starts a multiblock read by sending the MMC_READ_MULTIPLE_BLOCK command.
+	* _sd_multiblock_read_close:	Terminates the multiblock read by sending MMC_STOP_TRANSMISSION and deselecting the card.
 	
 	Note that there is no internal "_sd_multiblock write" in this library; use _sd_writebuffer internally.
+	Likewise, the blocks of a multiblock read are read with _sd_readblock_ns.
 
 	
 	
@@ -424,8 +427,6 @@ unsigned char _sd_waitblock_ns(void)
 ******************************************************************************/
 unsigned char _sd_readblock_ns(char *buffer,unsigned short n,unsigned short *checksum)
 {
-	unsigned short i;
-
 	if(_sd_waitblock_ns())
 	{
 		// Waitblock timed out
@@ -433,10 +434,7 @@ unsigned char _sd_readblock_ns(char *buffer,unsigned short n,unsigned short *che
 	}
 
 	// read in data
-	for(i=0; i<n;i++)
-	{
-		*buffer++ = spi_rw_noselect(0xFF);
-	}	
+	spi_rn_noselect(buffer,n);
 	
 	// Read 16-bit CRC
 	*checksum = spi_rw_noselect(0xFF);
@@ -1337,6 +1335,87 @@ unsigned char _sd_multiblock_close(void)
 	return response;
 }
 
+/******************************************************************************
+	_sd_multiblock_read_open
+*******************************************************************************
+	Selects the card and starts a multiblock read by sending the MMC_READ_MULTIPLE_BLOCK command.
+	Used by streaming read commands.
+	
+	The card then sends consecutive blocks, each preceded by a start block token,
+	until MMC_STOP_TRANSMISSION is issued. The blocks are read with _sd_readblock_ns.
+
+	Parameters:
+		addr		-	Read start address in sectors
+			
+	Returns:
+		0			-	Ok
+		other		-	Error
+******************************************************************************/
+unsigned char _sd_multiblock_read_open(unsigned long addr)
+{
+	unsigned char rv;
+	char r1;
+
+	sd_select_n(0);				//	Select card
+	
+	rv=_sd_command_rn_ns(MMC_READ_MULTIPLE_BLOCK,addr>>24,addr>>16,addr>>8,addr,0x55,&r1,1);
+	if (rv!=0)					// Command failed
+	{
+		sd_select_n(1);			// Deselect card
+		return rv;				
+	}
+	return 0;
+}
+/******************************************************************************
+	_sd_multiblock_read_close
+*******************************************************************************
+	Terminates the multiblock read by sending MMC_STOP_TRANSMISSION and deselecting the card.
+	Used by streaming read commands.
+	
+	Can be called at any time during the multiblock read, including while the card
+	is sending a block: the card aborts the transmission.
+	
+	Does:
+	- Send MMC_STOP_TRANSMISSION
+	- Discard the stuff byte following the command and wait for the R1 response
+	- Wait for the card to be ready (R1b response)
+	- Deselect the card
+
+	Returns:
+		0			-	Ok
+		other		-	Error
+******************************************************************************/
+unsigned char _sd_multiblock_read_close(void)
+{
+	unsigned char r1;
+	unsigned long int t1;
+	
+	spi_rw_noselect(MMC_STOP_TRANSMISSION|0x40);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0x61);								// CRC of CMD12 with zero argument
+	
+	// The byte following the command is a stuff byte, which may be data from the aborted block
+	spi_rw_noselect(0xFF);
+	
+	t1 = timer_ms_get();
+	do
+	{
+		r1 = spi_rw_noselect(0xFF);
+	}
+	while( (r1&SD_CHECK_BIT) && (timer_ms_get()-t1<MMC_TIMEOUT_ICOMMAND));
+	
+	// Wait until not busy
+	if(_sd_block_stop_dowait())
+		r1 = 2;
+	
+	sd_select_n(1);										// Deselect card
+	
+	return r1;
+}
+
 /******************************************************************************
 	function: _sd_wait_notbusy
 *******************************************************************************	
@@ -135,6 +135,10 @@ void _sd_writeconst(unsigned char b,unsigned short size);
 unsigned char _sd_multiblock_open(unsigned long addr,unsigned long preerase);
 unsigned char _sd_multiblock_close(void);
 
+// Internal multiblock reads
+unsigned char _sd_multiblock_read_open(unsigned long addr);
+unsigned char _sd_multiblock_read_close(void);
+
 // Helpers
 unsigned char __sd_wait_notbusy(unsigned long timeout);
 
@@ -40,6 +40,9 @@
 	* spi_rwn:						Exchanges n bytes with the SPI slave.
 	* spi_rwn_noselect: 			Exchanges n bytes with the SPI slave.
 	* spi_wn_noselect:				Writes n bytes to an SPI slave without storing the value returned by the slave.
+	* spi_rn_noselect:				Reads n bytes from an SPI slave, sending 0xFF.
+	* spi_wn_int_cb:				Writes n bytes to an SPI slave using interrupt-driven transfer and calls a callback on completion.
+	* spi_isbusy:					Indicates whether an interrupt-driven transfer is ongoing.
 	
 	
 	
@@ -49,6 +52,11 @@
 	However, as the transfer functions are blocking until the transfer is completed, they may be inadequate 
 	if time-sensitive interrupts must be serviced.	
 	
+	*Interrupt-driven transfer*
+	
+	spi_wn_int_cb returns immediately and the data is transferred by the SPI interrupt (spi-isr.S). The polled
+	transfer functions must not be called while an interrupt-driven transfer is ongoing (spi_isbusy).
+	
 	*Possible improvements*
 	Communication with some peripherals is sometimes one way only from the master to the slave.
 	In this case, waiting for completion of the transfer at the end of a transfer function may be 
@@ -60,7 +68,10 @@
 */
 
 
-//volatile unsigned char _spi_ongoing=0;
+volatile unsigned char _spi_ongoing=0;
+volatile char *_spi_bufferptr;
+volatile unsigned short _spi_n;
+void (*_spi_callback)(void);
 
 
 /******************************************************************************
@@ -81,7 +92,7 @@ void spi_init(unsigned char spidiv)
 	SPCR = 0b01010000|(spidiv&0b11);					// SPE, MSTR, SPR
 	SPSR = (spidiv>>2)&1;								// SPI2X
 	
-	//_spi_ongoing=0;
+	_spi_ongoing=0;
 }
 
 /******************************************************************************
@@ -250,3 +261,97 @@ void spi_wn_noselect(char *ptr,unsigned short n)
 	}
 }
 
+/******************************************************************************
+	function: spi_rn_noselect
+*******************************************************************************	
+	Reads n bytes from an SPI slave, sending 0xFF for each byte.
+	
+	The transfer of the next byte is started as soon as the previous byte is 
+	received, and the received byte is stored while the next one is transferred.
+	This makes this function faster than spi_rwn_noselect and is used to read 
+	data blocks from the SD card.
+	
+	This function does not select/deselect the slave; this must be done by user
+	code.
+		
+	Parameters:
+		ptr		-	buffer receiving the data read from the slave
+		n		-	number of bytes to read from the slave
+		
+	Returns:
+		-
+******************************************************************************/
+void spi_rn_noselect(char *ptr,unsigned short n)
+{
+	char c;
+	
+	if(n==0)
+		return;
+	
+	SPDR = 0xFF;
+	while(--n)
+	{
+		while(!(SPSR & (1<<SPIF)));
+		c = SPDR;
+		SPDR = 0xFF;								// Start the next transfer before storing the data
+		*ptr++ = c;
+	}
+	while(!(SPSR & (1<<SPIF)));
+	*ptr = SPDR;
+}
+
+/******************************************************************************
+	function: spi_wn_int_cb
+*******************************************************************************	
+	Writes n bytes to an SPI slave using interrupt-driven transfer, without 
+	storing the value returned by the slave.
+	
+	Returns immediately if an interrupt-driven transfer is ongoing. The callback 
+	is called from the SPI interrupt upon completion of the transfer.
+	
+	This function does not select/deselect the slave; this must be done by user
+	code.
+	
+	This function can be called in an interrupt safely.
+	
+	Parameters:
+		ptr		-	buffer comprising the data to send to the slave; must remain 
+					valid until the end of the transfer
+		n		-	number of bytes to send to the slave; must be nonzero
+		cb		-	callback called upon completion, or 0
+		
+	Returns:
+		0		-	Transaction initiated
+		1		-	Error initiating transaction
+******************************************************************************/
+unsigned char spi_wn_int_cb(char *ptr,unsigned short n,void (*cb)(void))
+{
+	if(_spi_ongoing)
+		return 1;
+		
+	_spi_ongoing=1;
+	_spi_bufferptr=ptr+1;
+	_spi_n=n-1;
+	_spi_callback=cb;
+	
+	// Activate interrupt. SPIF is cleared as the polled functions read SPDR after the transfer.
+	SPCR |= (1<<SPIE);
+	
+	// Start the transfer: the interrupt sends the remaining bytes
+	SPDR = *ptr;
+	
+	return 0;
+}
+/******************************************************************************
+	function: spi_isbusy
+*******************************************************************************	
+	Indicates whether an interrupt-driven transfer is ongoing.
+	
+	Returns:
+		0		-	No transfer ongoing
+		1		-	Transfer ongoing
+******************************************************************************/
+unsigned char spi_isbusy(void)
+{
+	return _spi_ongoing;
+}
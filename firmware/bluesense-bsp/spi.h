@@ -24,6 +24,14 @@ void spi_rwn(char *ptr,unsigned char n);
 void spi_rwn_noselect(char *ptr,unsigned short n);
 void spi_rwn_int(char *ptr,unsigned char n);
 void spi_wn_noselect(char *ptr,unsigned short n);
+void spi_rn_noselect(char *ptr,unsigned short n);
+unsigned char spi_wn_int_cb(char *ptr,unsigned short n,void (*cb)(void));
+unsigned char spi_isbusy(void);
+
+extern volatile unsigned char _spi_ongoing;
+extern volatile char *_spi_bufferptr;
+extern volatile unsigned short _spi_n;
+extern void (*_spi_callback)(void);
 
 
 #endif
\ No newline at end of file
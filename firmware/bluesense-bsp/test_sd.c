@@ -37,6 +37,7 @@
 #include "spi.h"
 #include "sd.h"
 #include "ufat.h"
+#include "mpu_config.h"
 
 
 
@@ -759,3 +760,193 @@ void sd_bench_streamcache_write2(unsigned long startsect,unsigned long size,unsi
 	}
 	
 }*/
+
+/*
+	Compares single block reads (sd_block_read) and streaming reads (sd_streamread_read) of size bytes from startsect.
+*/
+void sd_bench_read(unsigned long startsect,unsigned long size)
+{
+	char buf[512];
+	unsigned long t1,t2,t3;
+	unsigned long n=size>>9;
+	unsigned long fail1=0,fail2=0;
+	
+	printf_P(PSTR("Benchmarking read from %lu up to %lu\n"),startsect,size);
+	
+	t1=timer_ms_get();
+	for(unsigned long i=0;i<n;i++)
+	{
+		if(sd_block_read(startsect+i,buf))
+			fail1++;
+	}
+	t2=timer_ms_get();
+	if(sd_streamread_open(startsect))
+	{
+		printf_P(PSTR("Failed sd_streamread_open\n"));
+		return;
+	}
+	for(unsigned long i=0;i<n;i++)
+	{
+		if(sd_streamread_read(buf,0))
+		{
+			fail2++;
+			if(sd_streamread_open(startsect+i+1))
+				break;
+		}
+	}
+	if(sd_streamread_close())
+		printf_P(PSTR("Failed sd_streamread_close\n"));
+	t3=timer_ms_get();
+	
+	printf_P(PSTR("Block read: %lu ms (%lu KB/s), %lu errors\n"),t2-t1,t2-t1?(n>>1)*1000/(t2-t1):0,fail1);
+	printf_P(PSTR("Stream read: %lu ms (%lu KB/s), %lu errors\n"),t3-t2,t3-t2?(n>>1)*1000/(t3-t2):0,fail2);
+}
+
+/*
+	Write latency profiler, to qualify SD cards before deployment.
+	
+	Writes size bytes from startsect with streaming writes without cache (sd_stream_write) at a sustained rate of rate bytes/s,
+	or as fast as possible if rate is 0. Each sector is written when the data it holds would be available at that rate.
+	The busy time of each sector write (transfer and card busy) is reported as a histogram in ms with the worst times in us.
+	
+	The busy times are also used to simulate logging in each motion mode with samplesize bytes per sample: sectors become
+	available at the data rate of the mode and are written one after the other with the measured busy times.
+	The minimum buffer is the largest amount of data held while a sector is written: the sector being written and the data
+	sampled since that sector became available. It is compared to the streaming cache (SD_CACHE_SIZE).
+	Some cards stall longer at higher rates: the rate should be at least that of the fastest mode to qualify.
+*/
+#define SD_BENCH_LAT_RATES		16					// Maximum number of distinct sample rates of the motion modes
+#define SD_BENCH_LAT_MAXUS		600000000l			// Waits are limited to 10 minutes to avoid overflows
+
+/*
+	Returns the buffer in bytes to hold a sector being written and the data produced at rate bytes/s during us microseconds.
+*/
+static unsigned long _sd_bench_buffer(unsigned long us,unsigned long rate)
+{
+	unsigned long ms;
+	
+	if(us>SD_BENCH_LAT_MAXUS)
+		us=SD_BENCH_LAT_MAXUS;
+	ms=us/1000;
+	return 512+(ms/1000)*rate+(ms%1000)*rate/1000;
+}
+
+void sd_bench_latency(unsigned long startsect,unsigned long size,unsigned long rate,unsigned short samplesize)
+{
+	char buf[512];
+	char name[96];
+	unsigned long t0,t1,t2,tnext,period,d,dtot=0,dmax=0,needmax=0;
+	unsigned long n=size>>9,numfail=0;
+	unsigned long hist1[11];	// 1ms bins from 0ms to 10-infms
+	unsigned long hist10[11];	// 10ms bins from 0ms to 100-infms
+	unsigned long hist100[11];	// 100ms bins from 0ms to 1-infs
+	unsigned long slist[10];	// Worst times
+	unsigned short rates[SD_BENCH_LAT_RATES];		// Distinct sample rates of the motion modes
+	unsigned long wait[SD_BENCH_LAT_RATES];		// Simulated wait of the next sector before its write starts (us)
+	unsigned long need[SD_BENCH_LAT_RATES];		// Minimum buffer (bytes)
+	unsigned char nrates=0,k;
+	unsigned char rv;
+	
+	hist_init(hist1,11);
+	hist_init(hist10,11);
+	hist_init(hist100,11);
+	memset(slist,0,10*sizeof(unsigned long));
+	
+	for(unsigned char m=1;m<MOTIONCONFIG_NUM;m++)
+	{
+		unsigned short r = mpu_getmodesamplerate(m);
+		for(k=0;k<nrates && rates[k]!=r;k++);
+		if(k==nrates && nrates<SD_BENCH_LAT_RATES)
+		{
+			rates[k]=r;
+			wait[k]=need[k]=0;
+			nrates++;
+		}
+	}
+	
+	memset(buf,'0',512);
+	buf[511]='\n';
+	period = rate?512000000l/rate:0;				// Time to fill a sector at the sustained rate (us)
+	
+	printf_P(PSTR("Write latency from %lu up to %lu at %lu bytes/s\n"),startsect,size,rate);
+	sd_stream_open(startsect,0);
+	
+	t0=tnext=timer_us_get();
+	for(unsigned long i=0;i<n;i++)
+	{
+		if((i&511)==511)
+		{
+			fprintf_P(file_pri,PSTR("%luB\n"),(i+1)<<9);
+			printhist(hist1,hist10,hist100);
+		}
+		
+		// Wait until the sector is full at the sustained rate
+		tnext+=period;
+		while((long)(timer_us_get()-tnext)<0);
+		
+		char *strptr = buf;
+		strptr=format1u32(strptr,i);
+		strptr=format1u32(strptr,numfail);
+		
+		t1 = timer_us_get();
+		rv = sd_stream_write(buf,512,0);
+		t2 = timer_us_get();
+		if(rv)
+			numfail++;
+		
+		d=t2-t1;
+		dtot+=d;
+		if(d>dmax)
+			dmax=d;
+		hist_insert(hist1,11,1,d>65535000l?65535:d/1000);
+		hist_insert(hist10,11,10,d>65535000l?65535:d/1000);
+		hist_insert(hist100,11,100,d>65535000l?65535:d/1000);
+		slist_add(slist,10,d);
+		
+		// Data held at the sustained rate: the sector and the data sampled since it was available at tnext
+		if(rate && _sd_bench_buffer(t2-tnext,rate)>needmax)
+			needmax=_sd_bench_buffer(t2-tnext,rate);
+		if(!rate)
+			tnext=t2;
+		
+		// Simulation of the motion modes: the sector waits for the previous ones, then is written in d
+		for(k=0;k<nrates;k++)
+		{
+			unsigned long r = (unsigned long)rates[k]*samplesize;
+			if(r==0)
+				continue;
+			unsigned long w = wait[k]+d;
+			if(w>SD_BENCH_LAT_MAXUS)
+				w=SD_BENCH_LAT_MAXUS;
+			if(_sd_bench_buffer(w,r)>need[k])
+				need[k]=_sd_bench_buffer(w,r);
+			unsigned long a = 512000000l/r;				// Time to fill a sector in the mode (us)
+			wait[k] = w>a?w-a:0;
+		}
+	}
+	rv = sd_stream_close(0);
+	if(rv!=0)
+		printf_P(PSTR("Failed sd_stream_close\n"));
+	t2=timer_us_get()-t0;
+	
+	printf_P(PSTR("Done. Sectors: %lu. Num fail: %lu. Time: %lu ms (%lu KB/s)\n"),n,numfail,t2/1000,t2>=1000?(n>>1)*1000/(t2/1000):0);
+	printf_P(PSTR("Busy time: average %lu us, maximum stall %lu us\n"),n?dtot/n:0,dmax);
+	printhist(hist1,hist10,hist100);
+	printf_P(PSTR("Worst times (us):\n"));
+	for(unsigned char i=0;i<10;i++)
+		printf_P(PSTR("%lu "),slist[i]);
+	printf_P(PSTR("\n"));
+	if(rate)
+		printf_P(PSTR("Minimum buffer at %lu bytes/s: %lu bytes\n"),rate,needmax);
+	
+	printf_P(PSTR("Minimum buffer per motion mode with %u bytes/sample (cache: %u bytes):\n"),samplesize,SD_CACHE_SIZE);
+	for(unsigned char m=1;m<MOTIONCONFIG_NUM;m++)
+	{
+		unsigned short r = mpu_getmodesamplerate(m);
+		for(k=0;k<nrates && rates[k]!=r;k++);
+		if(k==nrates)
+			continue;
+		mpu_getmodename(m,name);
+		printf_P(PSTR("%02u: %6lu bytes/s buffer %6lu bytes (%lu sectors) %s %s\n"),m,(unsigned long)r*samplesize,need[k],(need[k]+511)>>9,need[k]<=SD_CACHE_SIZE?"ok  ":"over",name);
+	}
+}
@@ -51,6 +51,8 @@ void sd_bench_write(unsigned long startsect,unsigned long size);
 void sd_bench_write2(unsigned long startsect,unsigned long size);
 void sd_bench_stream_write2(unsigned long startsect,unsigned long size,unsigned long preerase);
 void sd_bench_streamcache_write2(unsigned long startsect,unsigned long size,unsigned long preerase);
+void sd_bench_read(unsigned long startsect,unsigned long size);
+void sd_bench_latency(unsigned long startsect,unsigned long size,unsigned long rate,unsigned short samplesize);
 
 #endif
 
@@ -0,0 +1,324 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "serial.h"
+#include "pio.h"
+#include "trigger.h"
+
+/*
+	File: trigger
+
+	Event-triggered logging of the motion samples, with a pre-trigger buffer.
+
+	When a trigger source is set (trigger_set), the samples are not written to the log until an event: they are written to the
+	pre-trigger buffer (trigger_file), which keeps the records of the last pre milliseconds, or fewer if the buffer is full.
+	The sampling loop calls trigger_check for each sample: on an event the content of the buffer is written to the log
+	(trigger_flush) ahead of the sample, and the samples are then written to the log until post milliseconds after the last
+	sample meeting the trigger condition. Periods without events write nothing to the card.
+
+	The trigger condition is the norm of the acceleration or of the angular rate at or above a level, or a high level on a PIO pin.
+	The accelerometer or gyroscope must be sampled in the current motion mode for the corresponding source to trigger.
+
+	The buffer holds whole records: each fputbuf call is one record, stored with its size and the time of the sample
+	(TRIGGER_RECORDHDR bytes), and the oldest records are dropped to make room. The characters written with fputc/fprintf are
+	appended to the current record until the end of the line, the next sample, or 255 bytes. The records are written to the log
+	as they were formatted (text, binary or compact), and the buffer is cleared when the format of the records changes.
+	
+	The buffer is sharedbuffer, which is free during motion sampling (see TRIGGER_BUFFERSIZE). trigger_flush rotates it in place
+	so that the records are contiguous, and writes them to the log without copying.
+
+	*Public functions*
+
+	* trigger_set:				Sets the trigger source, level, and pre-trigger and post-trigger durations.
+	* trigger_get:				Returns the trigger settings.
+	* trigger_enabled:			Indicates whether a trigger source is set.
+	* trigger_start:			Starts the trigger engine with the scales of the motion sensor.
+	* trigger_clear:			Empties the pre-trigger buffer and ends the current event.
+	* trigger_check:			Evaluates the trigger condition on a sample.
+	* trigger_file:				Returns the FILE writing to the pre-trigger buffer.
+	* trigger_flush:			Writes the pre-trigger buffer to a log.
+*/
+
+unsigned long trigger_count;									// Number of events since trigger_start
+
+unsigned char _trigger_source=TRIGGER_OFF;
+unsigned short _trigger_level;
+unsigned short _trigger_pre=2000;								// Pre-trigger duration in ms
+unsigned short _trigger_post=2000;								// Post-trigger duration in ms
+unsigned long _trigger_level2;									// Square of the level in sensor units
+unsigned char _trigger_active;									// Event ongoing
+unsigned long _trigger_last;									// Time of the last sample meeting the condition
+unsigned long _trigger_t;										// Time of the current sample
+
+#define _trigger_buffer ((char*)sharedbuffer)					// Pre-trigger records: size, time (16 bits) and data
+unsigned short _trigger_head;									// Position of the oldest record
+unsigned short _trigger_used;									// Number of bytes used
+unsigned short _trigger_rec;									// Position of the record extended by fputc
+unsigned char _trigger_recopen;									// fputc extends the record at _trigger_rec
+
+FILE _trigger_file;
+SERIALPARAM _trigger_file_param;
+
+unsigned char _trigger_putbuf(char *buffer,unsigned char size);
+int _trigger_fputchar(char c,FILE *f);
+
+/******************************************************************************
+	function: trigger_set
+*******************************************************************************
+	Sets the trigger. trigger_start must be called to apply the settings.
+
+	Parameters:
+		source	-	TRIGGER_OFF, TRIGGER_ACC, TRIGGER_GYR or TRIGGER_PIO
+		level	-	Level in mg (TRIGGER_ACC), dps (TRIGGER_GYR), or pin number (TRIGGER_PIO)
+		pre		-	Pre-trigger duration in ms, at most TRIGGER_PREMAX
+		post	-	Post-trigger duration in ms
+******************************************************************************/
+void trigger_set(unsigned char source,unsigned short level,unsigned short pre,unsigned short post)
+{
+	_trigger_source=source<TRIGGER_SOURCES?source:TRIGGER_OFF;
+	_trigger_level=level;
+	_trigger_pre=pre<TRIGGER_PREMAX?pre:TRIGGER_PREMAX;
+	_trigger_post=post;
+}
+void trigger_get(unsigned char *source,unsigned short *level,unsigned short *pre,unsigned short *post)
+{
+	*source=_trigger_source;
+	*level=_trigger_level;
+	*pre=_trigger_pre;
+	*post=_trigger_post;
+}
+unsigned char trigger_enabled(void)
+{
+	return _trigger_source!=TRIGGER_OFF;
+}
+/******************************************************************************
+	function: trigger_start
+*******************************************************************************
+	Starts the trigger engine: converts the level to sensor units, configures
+	the PIO pin, and empties the pre-trigger buffer.
+
+	Parameters:
+		accscale	-	Accelerometer scale (mpu_getaccscale): full scale 2g<<accscale
+		gyroscale	-	Gyroscope scale (mpu_getgyroscale): full scale 250dps<<gyroscale
+******************************************************************************/
+void trigger_start(unsigned char accscale,unsigned char gyroscale)
+{
+	unsigned long l=0;
+
+	if(_trigger_source==TRIGGER_ACC)
+		l=(unsigned long)_trigger_level*32768/(2000ul<<accscale);
+	if(_trigger_source==TRIGGER_GYR)
+		l=(unsigned long)_trigger_level*32768/(250ul<<gyroscale);
+	if(_trigger_source==TRIGGER_PIO)
+		PIOPinMode(_trigger_level,PIOMODE_INPUT);
+	_trigger_level2=l*l;
+
+	fdev_setup_stream(&_trigger_file,_trigger_fputchar,0,_FDEV_SETUP_WRITE);
+	_trigger_file_param.blocking=0;
+	_trigger_file_param.putbuf=_trigger_putbuf;
+	_trigger_file_param.txbuf=0;
+	_trigger_file_param.rxbuf=0;
+	fdev_set_udata(&_trigger_file,(void*)&_trigger_file_param);
+
+	trigger_count=0;
+	trigger_clear();
+}
+/******************************************************************************
+	function: trigger_clear
+*******************************************************************************
+	Empties the pre-trigger buffer and ends the current event, e.g. when a log
+	is opened or when the format of the records changes.
+******************************************************************************/
+void trigger_clear(void)
+{
+	_trigger_head=0;
+	_trigger_used=0;
+	_trigger_recopen=0;
+	_trigger_active=0;
+}
+static unsigned long _trigger_norm2(signed short x,signed short y,signed short z)
+{
+	return (unsigned long)((long)x*x)+(unsigned long)((long)y*y)+(unsigned long)((long)z*z);
+}
+/******************************************************************************
+	function: trigger_check
+*******************************************************************************
+	Evaluates the trigger condition on a sample. Must be called for each sample
+	before writing it.
+
+	Parameters:
+		d		-	Sample
+
+	Returns:
+		TRIGGER_IDLE	-	No event: the sample is written to trigger_file
+		TRIGGER_FIRED	-	Start of an event: trigger_flush writes the buffer to the log, then the sample is written to the log
+		TRIGGER_LIVE	-	Event ongoing: the sample is written to the log
+******************************************************************************/
+unsigned char trigger_check(MPUMOTIONDATA *d)
+{
+	unsigned char fire=0;
+
+	_trigger_t=d->time;
+	_trigger_recopen=0;
+	switch(_trigger_source)
+	{
+		case TRIGGER_ACC:
+			fire=_trigger_norm2(d->ax,d->ay,d->az)>=_trigger_level2;
+			break;
+		case TRIGGER_GYR:
+			fire=_trigger_norm2(d->gx,d->gy,d->gz)>=_trigger_level2;
+			break;
+		case TRIGGER_PIO:
+			fire=PIODigitalRead(_trigger_level);
+			break;
+		default:
+			return TRIGGER_LIVE;
+	}
+	if(fire)
+	{
+		_trigger_last=d->time;
+		if(!_trigger_active)
+		{
+			_trigger_active=1;
+			trigger_count++;
+			return TRIGGER_FIRED;
+		}
+		return TRIGGER_LIVE;
+	}
+	if(_trigger_active && d->time-_trigger_last<_trigger_post)
+		return TRIGGER_LIVE;
+	_trigger_active=0;
+	return TRIGGER_IDLE;
+}
+FILE *trigger_file(void)
+{
+	return &_trigger_file;
+}
+// Byte of the buffer at a position relative to the oldest record; TRIGGER_BUFFERSIZE is a power of 2
+static char *_trigger_at(unsigned short pos)
+{
+	return &_trigger_buffer[(_trigger_head+pos)&(TRIGGER_BUFFERSIZE-1)];
+}
+static void _trigger_drop(void)
+{
+	unsigned short n=(unsigned char)*_trigger_at(0)+TRIGGER_RECORDHDR;
+	if(_trigger_head==_trigger_rec)
+		_trigger_recopen=0;
+	_trigger_head=(_trigger_head+n)&(TRIGGER_BUFFERSIZE-1);
+	_trigger_used-=n;
+}
+// Reverses the bytes of the buffer from i to j-1
+static void _trigger_reverse(unsigned short i,unsigned short j)
+{
+	while(i+1<j)
+	{
+		char t=_trigger_buffer[i];
+		_trigger_buffer[i++]=_trigger_buffer[--j];
+		_trigger_buffer[j]=t;
+	}
+}
+static unsigned short _trigger_age(void)
+{
+	unsigned short t=(unsigned char)*_trigger_at(1)|((unsigned short)(unsigned char)*_trigger_at(2)<<8);
+	return (unsigned short)_trigger_t-t;
+}
+/******************************************************************************
+	function: _trigger_putbuf
+*******************************************************************************
+	Stores a record in the pre-trigger buffer, dropping the oldest records
+	to make room and those older than the pre-trigger duration.
+
+	Returns:
+		0			-		Success
+		1			-		Record larger than the buffer
+******************************************************************************/
+unsigned char _trigger_putbuf(char *buffer,unsigned char size)
+{
+	unsigned short n=size+TRIGGER_RECORDHDR;
+
+	_trigger_recopen=0;
+	if(n>TRIGGER_BUFFERSIZE)
+		return 1;
+	while(_trigger_used && (TRIGGER_BUFFERSIZE-_trigger_used<n || _trigger_age()>_trigger_pre))
+		_trigger_drop();
+	_trigger_used+=n;
+	*_trigger_at(_trigger_used-n)=size;
+	*_trigger_at(_trigger_used-n+1)=_trigger_t&0xff;
+	*_trigger_at(_trigger_used-n+2)=(_trigger_t>>8)&0xff;
+	for(unsigned short i=_trigger_used-size;i<_trigger_used;i++)
+		*_trigger_at(i)=*buffer++;
+	return 0;
+}
+/******************************************************************************
+	function: _trigger_fputchar
+*******************************************************************************
+	Appends a character to the record started by the previous character, 
+	or starts a record. The record ends with a newline or at 255 bytes.
+******************************************************************************/
+int _trigger_fputchar(char c,FILE *f)
+{
+	char *size=&_trigger_buffer[_trigger_rec];
+	
+	if(_trigger_recopen && *size!=(char)255)
+	{
+		// Make room: the record is the most recent and, as TRIGGER_BUFFERSIZE>=512, not the oldest of a full buffer
+		if(_trigger_used==TRIGGER_BUFFERSIZE)
+			_trigger_drop();
+	}
+	if(!_trigger_recopen || *size==(char)255)
+	{
+		if(_trigger_putbuf(&c,1))
+			return EOF;
+		_trigger_rec=(_trigger_head+_trigger_used-1-TRIGGER_RECORDHDR)&(TRIGGER_BUFFERSIZE-1);
+		_trigger_recopen=1;
+	}
+	else
+	{
+		*_trigger_at(_trigger_used++)=c;
+		(*size)++;
+	}
+	if(c=='\n')
+		_trigger_recopen=0;
+	return 0;
+}
+/******************************************************************************
+	function: trigger_flush
+*******************************************************************************
+	Writes the records of the pre-trigger buffer to a log, oldest first, with
+	one fputbuf call per record, and empties the buffer.
+	
+	The buffer is first rotated in place so that the oldest record is at the 
+	start of the buffer: each record is then contiguous and is written from
+	the buffer.
+
+	Parameters:
+		f			-		Log
+
+	Returns:
+		0			-		Success
+		1			-		Error writing to the log
+******************************************************************************/
+unsigned char trigger_flush(FILE *f)
+{
+	unsigned char rv=0;
+	unsigned char n;
+
+	// Rotate by three reversals
+	_trigger_reverse(0,_trigger_head);
+	_trigger_reverse(_trigger_head,TRIGGER_BUFFERSIZE);
+	_trigger_reverse(0,TRIGGER_BUFFERSIZE);
+	for(unsigned short pos=0;pos<_trigger_used;pos+=n+TRIGGER_RECORDHDR)
+	{
+		n=_trigger_buffer[pos];
+		if(fputbuf(f,&_trigger_buffer[pos+TRIGGER_RECORDHDR],n))
+			rv=1;
+	}
+	_trigger_head=0;
+	_trigger_used=0;
+	_trigger_recopen=0;
+	return rv;
+}
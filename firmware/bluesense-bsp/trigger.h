@@ -0,0 +1,43 @@
+#ifndef __TRIGGER_H
+#define __TRIGGER_H
+
+#include <stdio.h>
+#include "mpu.h"
+
+// Trigger sources
+#define TRIGGER_OFF				0			// Event-triggered logging disabled: all the samples are logged
+#define TRIGGER_ACC				1			// Norm of the acceleration at or above the level in mg
+#define TRIGGER_GYR				2			// Norm of the angular rate at or above the level in dps
+#define TRIGGER_PIO				3			// PIO pin high; the level is the pin number
+#define TRIGGER_SOURCES			4
+
+// Result of trigger_check
+#define TRIGGER_IDLE			0			// No event: the sample goes to the pre-trigger buffer
+#define TRIGGER_FIRED			1			// Start of an event: the pre-trigger buffer is written to the log ahead of the sample
+#define TRIGGER_LIVE			2			// Event ongoing: the sample goes to the log
+
+// Size of the pre-trigger buffer, a power of 2 which can be defined in the Makefile. Each record takes TRIGGER_RECORDHDR bytes
+// in addition to its data, e.g. 512 bytes hold 0.5 s of compact records of 6 axes and time (18 bytes) at 50 Hz.
+// The buffer is sharedbuffer (global.c), which is otherwise only used by mpu_calibrate: up to 512 bytes it costs no SRAM,
+// larger buffers enlarge sharedbuffer.
+#ifndef TRIGGER_BUFFERSIZE
+#define TRIGGER_BUFFERSIZE		512
+#endif
+#if TRIGGER_BUFFERSIZE<512 || (TRIGGER_BUFFERSIZE&(TRIGGER_BUFFERSIZE-1))
+#error TRIGGER_BUFFERSIZE must be a power of 2, at least 512
+#endif
+#define TRIGGER_RECORDHDR		3
+#define TRIGGER_PREMAX			60000		// Longest pre-trigger duration in ms
+
+extern unsigned long trigger_count;
+
+void trigger_set(unsigned char source,unsigned short level,unsigned short pre,unsigned short post);
+void trigger_get(unsigned char *source,unsigned short *level,unsigned short *pre,unsigned short *post);
+unsigned char trigger_enabled(void);
+void trigger_start(unsigned char accscale,unsigned char gyroscale);
+void trigger_clear(void);
+unsigned char trigger_check(MPUMOTIONDATA *d);
+FILE *trigger_file(void);
+unsigned char trigger_flush(FILE *f);
+
+#endif
@@ -12,6 +12,8 @@
 #include "global.h"
 #include "sd.h"
 #include "ufat.h"
+#include "logzip.h"
+#include "logpack.h"
 #include "serial.h"
 #include "helper.h"
 #include "system-extra.h"
@@ -33,14 +35,15 @@
 	* Only legacy 8.3 file names are supported
 	* Folders are not supported
 	* File names are pre-defined and cannot be changed
-	* The maximum size of files is the same for all files and pre-defined during formatting based on the total card capacity (i.e. MaxFileSize=CardCapacity/NumFiles)
+	* With fixed-size allocation, the maximum size of files is the same for all files and pre-defined during formatting based on the total card capacity (i.e. MaxFileSize=CardCapacity/NumFiles).
+	  With extent allocation (the default), a file can use all the free space of the card, up to the FAT32 limit of 4GB (see log allocation)
 	* The filesystem must only be formatted by this library; formatting on a computer will not result in a card that this library can use
 	* Any file write, file rename or file move operation performed on a computer will lead to errors or data loss the next time that this library attempts to write to the card. 
 	  There is no issue if the card is only used on a computer after such an operation. However, if the card were used again with this library a formatting would be required.
 	* The first sector of the ROOT entry contains 16 directory entries. The entry 0 is the volume ID; entries 1 to n are the log files, entry n+1 to 14 are dummy files marked as erased to prevent the 
 	  OS from modifying this; entry 15 is uFAT metadata, stored as a file marked as erased. Upon checking the filesystem a checksum is run on this metadata to ensure no other operating system
 	  has tampered with them.
-	* During formatting all the clusters that the log files will use when having the maximum size are marked as used (cluster linked, i.e. nonzero value). 
+	* During formatting all the clusters that the log files will use when having the maximum size are marked as used (cluster linked or end of chain, i.e. nonzero value). 
 	  This prevents another OS from using clusters that uFAT needs as the log file grows.
 	  Consequently the disk free space reported by a conventional OS will be constant and tiny (in the MB range), regardless of the size of the uFAT files.
 	
@@ -52,8 +55,10 @@
 	* The size of the clusters is 64 sectors (64*512=32KB)
 	* The ROOT directory for the uFAT files is stored in exactly one sector; this limits the number of ROOT entries to a maximum of 16, and therefore the number of files to 14 (volumeID+14 log files+metadata stored as a fake file).
 	* The first cluster of each files is allocated on a cluster that is the first cluster of a sector of the FAT (i.e. start location is a multiple of 128 clusters). This simplifies the FAT update.
-	* Upon formatting, files are pre-allocated on consecutive clusters which avoid fragmentation. The FAT is programmed accordingly. As data is written to the file, only the file length needs to be updated. This avoids slow FAT updates.
-	* The file size is updated only upon closing a file. This speeds-up streaming writes at the expense of lower reliability if the platform crashes before a file is closed.
+	* Files are allocated on consecutive clusters which avoid fragmentation. With fixed-size allocation the files are pre-allocated upon formatting and the FAT is programmed accordingly: 
+	  as data is written to the file, only the file length needs to be updated. This avoids slow FAT updates.
+	* The file size is updated upon closing a file, and every UFAT_LOG_CHECKPOINT bytes while the file is written (see size checkpoints). This speeds-up streaming writes 
+	  at the expense of losing at most UFAT_LOG_CHECKPOINT bytes if the platform crashes before a file is closed and the end of the data cannot be recovered.
 
 	It is recommended to ensure another operating system never writes to a uFAT formatted sd-card. 
 	Windows generally creates a "System Volume Information" and associated files when an SD-card is plugged in, without user intervention. 
@@ -70,14 +75,121 @@
 	* ufat_init:						Initialise the uFAT filesystem including low-level card initialisation and filesystem check.
 	* ufat_available:					Indicates whether the system successfully detected a disk with uFAT.
 	* ufat_log_open:					Opens the indicated log file for write operations using fprintf, fputc, fputbuf, etc
+	* ufat_log_compress:				Selects whether the logs opened next are compressed
+	* ufat_log_pack:					Selects whether the records of the logs opened next are packed in sectors
+	* ufat_log_ring:					Selects whether the logs opened next are rings, and the size of the ring
+	* ufat_log_trigger:					Marks a trigger in the open log, before it is closed
 	* ufat_log_close:					Close the previously opened log file
 	* ufat_log_test:					Test writing data to a log file
-	* ufat_log_getmaxsize: 				Returns the maximum size of files in the given filesystem.
+	* ufat_log_getmaxsize: 				Returns the maximum size of the open log, or of files in the given filesystem.
 	* ufat_log_getsize: 				Returns the size of the currently open file.
 	* ufat_log_getnumlogs:				Returns the number of logs available
+	* ufat_log_getinfo:					Returns the start sector and size of a log
+	* ufat_log_findtime:				Returns the offset of the index record preceding a time in a log
 	
 
 
+	*Time index*
+	
+	The time index is opt-in: UFAT_LOG_INDEXPERIOD is 0 by default and the logs are then written unchanged. 
+	When UFAT_LOG_INDEXPERIOD is nonzero, index records are inserted in the log so that a time range can be found without decoding 
+	the log from the start. Index records are text lines written at a record boundary (before data written with fputbuf, or after a newline 
+	when writing with fputc/fprintf), at most every UFAT_LOG_INDEXPERIOD ms:
+	
+		#I,<time>,<pkt>,<offset>
+	
+	time is the system time in ms (timer_ms_get), pkt the number of records (fputbuf calls or lines) written before the index record, 
+	and offset the byte offset of the index record in the log. The first index record is written when the log is opened, at offset 0.
+	
+	When the log is closed, a summary of at most UFAT_LOG_INDEXSUMMARY index records, evenly spaced over the log, is appended to the log 
+	followed by a trailer line giving the offset of the summary:
+	
+		#S,<time>,<pkt>,<offset>			(one line per summary entry, copy of an index record)
+		#E,<time>,<pkt>,<summaryoffset>
+	
+	A time is found by reading the trailer at the end of the log, then the summary, and then scanning the index records between two 
+	summary entries (ufat_log_findtime). If the log has no summary (e.g. the log was not closed), all the index records are scanned.
+	With the index enabled, the readers of binary log formats must tolerate these lines, i.e. resynchronise on their packet header.
+	Without index, ufat_log_findtime returns the start of the log.
+	
+	
+	*Log allocation*
+	
+	The allocation is selected when formatting (ufat_format). With fixed-size allocation, the log area is split in numlogfile slots of equal size.
+	
+	With extent allocation, the logs share the log area. When a log is opened it is placed at the start of the largest free area, i.e. between 
+	the end of a log (or the start of the log area) and the start of the next log (or the end of the card), ignoring the previous content of the log 
+	being opened. The log can then grow until this free area is exhausted. Logs start on a multiple of 128 clusters, so that a FAT sector 
+	only holds the chain of one log.
+	
+	Upon formatting, all the clusters of the log area are marked as end of chain, which reserves them. The FAT chain of a log is written 
+	when the log is closed (and at each size checkpoint, so that only the last FAT sector is rewritten at close). The chain extends to the next 
+	multiple of 128 clusters after the end of the data. The size of 0 in the metadata entry indicates extent allocation; empty logs have no start cluster.
+	
+	
+	*Size checkpoints*
+	
+	When UFAT_LOG_CHECKPOINT is nonzero, the root is written when a log is opened and then every UFAT_LOG_CHECKPOINT bytes, with the size of the 
+	complete sectors written so far. The number of the open log is stored in the metadata entry and cleared when the log is closed.
+	At each checkpoint the multiblock write is terminated (sd_streamcache_sync).
+	
+	The area of 2*UFAT_LOG_CHECKPOINT bytes after the data is kept erased (_ufat_log_eraseahead): it is erased when the log is opened, 
+	and then in steps of UFAT_LOG_ERASESTEP sectors as the data is written. A write to the log waits for at most one step. 
+	A step is erased when the card idles (between bursts, see sd_streamcache_burst, and after a checkpoint), at most once per idle 
+	period, i.e. per opening of the multiblock write (sd_streamcache_getbursts); the multiblock write is only terminated for a step 
+	when more than half a checkpoint is not erased. The erased area thus always extends at least 1.5*UFAT_LOG_CHECKPOINT bytes after 
+	the data. The number and the longest duration of the checkpoints and of the steps are shown by log_printstatus.
+	
+	If the platform loses power, the log appears to a computer with the size of the last checkpoint. ufat_init finds that the log was not 
+	closed and recovers the data written after the checkpoint: the UFAT_LOG_RECOVERWINDOW sectors after the checkpoint (1.25*UFAT_LOG_CHECKPOINT) 
+	hold either data of the log or erased sectors (all bytes 0x00 or 0xFF), and the end of the data follows the last sector of this window 
+	which is not erased. Sectors of data which look erased within the data are thus kept. Compressed and packed sectors start with a magic 
+	byte and never look erased; in other logs, sectors of data all 0x00 or all 0xFF at the very end of the data are not recovered.
+	Only the sector being filled in memory is lost. The recovered log has no index summary.
+	
+	
+	*Compression*
+	
+	With ufat_log_compress(1) the logs opened next are compressed sector by sector (see logzip) before being written to the card. 
+	The size of the log, the size checkpoints and the recovery apply to the compressed sectors, while the offsets of the index records 
+	are offsets in the decompressed log: the decompressed log (support/host/logunzip) is identical to the log written without compression, 
+	and its index is used on the host. ufat_log_findtime does not find the index records of compressed logs, which are downloaded entirely.
+	The data written since the last complete sector is in memory until the sector is complete: it may be more than a sector 
+	of uncompressed data, which is lost on a power loss.
+	
+	
+	*Packed records*
+	
+	With ufat_log_pack(1) the records of the logs opened next are packed in sectors (see logpack): each write to the log 
+	(fputbuf, index record) is within one sector, and each sector has a header with a sequence number and a time, and a CRC. 
+	As with compression the size of the log counts the packed sectors and the offsets of the index records are offsets in the 
+	unpacked log (support/host/logunpack), which is identical to the log written without packing; ufat_log_findtime does not 
+	apply. Data written with fprintf is written character by character and is split across sectors. Compression has priority 
+	over packing: the compressed sectors are already decoded independently.
+	
+	
+	*Ring logs*
+	
+	With ufat_log_ring(size) the logs opened next are rings ("black box"): the log has a fixed size of one header sector followed 
+	by a ring of size bytes, and the data wraps around the ring (sd_streamcache_wrap), so that logging can run indefinitely while keeping 
+	the most recent data. The log is never full.
+	
+	The header sector is a text line updated when the log is opened, at each size checkpoint and when the log is closed:
+	
+		#R,<ringsectors>,<size>,<state>
+	
+	size is the number of bytes written since the log was opened (at a checkpoint: the complete sectors), i.e. the position of the 
+	end of the data is size modulo the ring. state is UFAT_LOG_RING_OPEN (0), UFAT_LOG_RING_CLOSED (1) or UFAT_LOG_RING_TRIGGERED (2):
+	a trigger (ufat_log_trigger) writes a line #T,<time>,<pkt>,<offset> in the data, and the log is then closed to freeze the ring.
+	
+	As in linear logs the area of 2*UFAT_LOG_CHECKPOINT bytes after the data is kept erased, wrapping around the ring: the erased 
+	sectors after the end of the data separate the most recent data from the oldest. The header of an open ring has a fifth field, 
+	the recovery window in sectors: after a power loss the end of the data follows the last sector which is not erased within the 
+	window after the size of the header. It is not recovered on the card: support/host/logring linearises the ring.
+	The size checkpoints and the erased area reduce the data kept by up to 2*UFAT_LOG_CHECKPOINT. The offsets of the index records 
+	count from the opening of the log, and ufat_log_findtime does not apply to ring logs.
+	
+	
 	*Dependencies*
 	
 	* spi
@@ -226,10 +338,38 @@ const char _str_ufat[] = "uFAT: ";
 //#define UFATDBG
 
 unsigned long _log_current_sector,_log_current_size;
+unsigned long _log_current_offset;								// Size of the data written to the open log, before compression
 unsigned char _log_current_log;
+unsigned char _log_compress;									// Compress the logs opened next
+unsigned char _log_pack;										// Pack the records of the logs opened next in sectors
+unsigned long _log_ringsize;									// Size of the ring of the logs opened next, 0 for linear logs
+unsigned long _log_ring;										// Number of sectors of the ring of the open log, 0 for a linear log
+unsigned char _log_ringstate;									// State written in the header when the ring log is closed
 FILE _log_file;
 SERIALPARAM _log_file_param;
 
+// Time index
+unsigned long _log_index_last;								// Time of the last index record
+unsigned long _log_index_pkt;								// Number of records written to the log
+unsigned char _log_index_linestart;							// Indicates that the next character written with fputc is at the start of a line
+LOGINDEX _log_index_summary[UFAT_LOG_INDEXSUMMARY];			// Index summary: every _log_index_stride index record
+unsigned char _log_index_n;									// Number of entries in the index summary
+unsigned short _log_index_stride;							// Number of index records per summary entry
+unsigned short _log_index_count;							// Number of index records to skip before the next summary entry
+
+// Size checkpoints
+unsigned long _log_checkpoint;								// Size of the log at the last checkpoint
+unsigned long _log_erasedend;								// Number of sectors erased from the start of the log
+unsigned short _log_erasesteps;								// Number of erase ahead steps since the log was opened
+unsigned short _log_erasemax;								// Longest erase ahead step in ms
+unsigned short _log_eraseopens;								// Number of openings of the multiblock write at the last step
+unsigned short _log_checkpoints;							// Number of checkpoints since the log was opened
+unsigned short _log_checkpointmax;							// Longest checkpoint in ms
+
+// Log allocation
+unsigned long _log_maxsize;									// Maximum size of the open log
+unsigned long _log_fatdone;									// Number of clusters of the open log whose FAT sectors are final (extent allocation)
+
 
 #define _UFAT_NUMLOGENTRY 14								// Maximum number 14; 16 root entries=volid+logs+metadata
 char ufatblock[512];								// Multiuse buffer
@@ -242,6 +382,12 @@ unsigned long _logoffsetcluster=128;						// Offset of the logging area from the
 //unsigned long testfilecluster=3;
 
 unsigned short _ufat_secfrommidnight_to_fattime(unsigned long secfrommidnight);
+unsigned char _ufat_log_index(char type,unsigned long time,unsigned long pkt,unsigned long offset);
+unsigned char _ufat_log_erase(unsigned long from,unsigned long to);
+unsigned char _ufat_log_ringheader(unsigned char state);
+void _ufat_log_index_add(unsigned long t);
+void _ufat_log_index_check(void);
+unsigned char _ufat_log_scanindex(unsigned long startsector,unsigned long from,unsigned long to,char type,unsigned long t,unsigned long *t0,unsigned long *offset,unsigned long *next);
 
 /************************************************************************************************************************************************************
 *************************************************************************************************************************************************************
@@ -270,12 +416,14 @@ PUBLIC FUNCTIONS   PUBLIC FUNCTIONS   PUBLIC FUNCTIONS   PUBLIC FUNCTIONS   PUBL
 	
 	Parameters:
 		numlogfile			-	Number of log files to create (between 1 and _UFAT_NUMLOGENTRY).
+		fixedsize			-	1 to split the card in numlogfile slots of equal size; 0 for extent allocation, 
+								where each log can use all the free space of the card
 				
 	Returns:
 		0					-	Success
 		1					-	Error
 ******************************************************************************/
-unsigned char ufat_format(unsigned char numlogfile)
+unsigned char ufat_format(unsigned char numlogfile,unsigned char fixedsize)
 {
 	unsigned char rv;
 	
@@ -343,7 +491,7 @@ unsigned char ufat_format(unsigned char numlogfile)
 		rv = sd_block_write(i,ufatblock);
 		if(rv)
 		{
-			fprintf_P(file_pri,PSTR("%sError clearing FAT at sector %lu\n"),i);
+			fprintf_P(file_pri,PSTR("%sError clearing FAT at sector %lu\n"),_str_ufat,i);
 			return 1;
 		}
 	}
@@ -371,16 +519,22 @@ unsigned char ufat_format(unsigned char numlogfile)
 	// - The first cluster all all log files must fit in the first entry of a FAT sector (to avoid read/write across logs when modifying one FAT sector). Hence the start location must be rounded down to multiple of 128 clusters.
 	// Start sector where log files placed
 	_fsinfo.logstartcluster=_logoffsetcluster;
+	_fsinfo.logopen=0;
+	_fsinfo.logextent=fixedsize?0:1;
 	// Number of available sectors in partition: capacity minus space between start of cluster and start of partition - reserved space for root.
 	unsigned long availclust = _fsinfo.numclusters-_logoffsetcluster;
 	#ifdef UFATDBG
 		printf_P("%sClusters for log files: %lu (total clusters: %lu, offset: %lu)\n",_str_ufat,availclust,_fsinfo.numclusters,_logoffsetcluster);
 	#endif
-	_fsinfo.logsizecluster = availclust/numlogfile;
+	// With extent allocation, the logs share the entire log area
+	if(_fsinfo.logextent)
+		_fsinfo.logsizecluster = availclust;
+	else
+		_fsinfo.logsizecluster = availclust/numlogfile;
 	// Round down to multiple of 128 clusters to ensure each file first cluster starts on a new fat sector
 	_fsinfo.logsizecluster>>=7;
 	_fsinfo.logsizecluster<<=7;
-	_fsinfo.logsizebytes = _fsinfo.logsizecluster*_fsinfo.sectors_per_cluster*512;
+	_fsinfo.logsizebytes = _ufat_clustertobytes(_fsinfo.logsizecluster);
 	#ifdef UFATDBG
 		printf_P("%sLog file size: %lu clusters, %lu bytes\n",_str_ufat,_fsinfo.logsizecluster,_fsinfo.logsizebytes);
 	#endif
@@ -397,7 +551,11 @@ unsigned char ufat_format(unsigned char numlogfile)
 		#endif		
 		// Extension
 		sprintf(_logentries[i].ext,"%03u",i);
-		_logentries[i].startcluster=_fsinfo.logstartcluster+_fsinfo.logsizecluster*i;
+		// With extent allocation the logs are placed when opened
+		if(_fsinfo.logextent)
+			_logentries[i].startcluster=_fsinfo.logstartcluster;
+		else
+			_logentries[i].startcluster=_fsinfo.logstartcluster+_fsinfo.logsizecluster*i;
 		_logentries[i].startsector=_fsinfo.cluster_begin + (_logentries[i].startcluster-2)*_fsinfo.sectors_per_cluster;			// Cluster numbering starts at 2
 		//_logentries[i].size=_fsinfo.logsizecluster*_fsinfo.sectors_per_cluster*512;
 		_logentries[i].size=0;
@@ -426,11 +584,19 @@ unsigned char ufat_format(unsigned char numlogfile)
 		
 	_ufat_format_fat_root(_fsinfo.fat_sector);
 	//if(_fsinfo.fat2_sector) _ufat_format_fat_root(_fsinfo.fat2_sector);
-	for(unsigned l=0;l<numlogfile;l++)
+	if(_fsinfo.logextent)
+	{
+		fprintf_P(file_pri,PSTR("%sWriting FAT for log area\n"),_str_ufat);
+		_ufat_format_fat_free(_fsinfo.fat_sector);
+	}
+	else
 	{
-		fprintf_P(file_pri,PSTR("%sWriting FAT for log %d\n"),_str_ufat,l);
-		_ufat_format_fat_log(l,_fsinfo.fat_sector);
-		//if(_fsinfo.fat2_sector) _ufat_format_fat_log(l,_fsinfo.fat2_sector);
+		for(unsigned l=0;l<numlogfile;l++)
+		{
+			fprintf_P(file_pri,PSTR("%sWriting FAT for log %d\n"),_str_ufat,l);
+			_ufat_format_fat_log(l,_fsinfo.fat_sector);
+			//if(_fsinfo.fat2_sector) _ufat_format_fat_log(l,_fsinfo.fat2_sector);
+		}
 	}
 	
 	// Here must reread root to initialise the FS; while we should be okay and could just set fs as available, we piggy back on _ufat_init_fs
@@ -532,15 +698,56 @@ FILE *ufat_log_open(unsigned char n)
 	_log_file_param.rxbuf = 0;
 	fdev_set_udata(&_log_file,(void*)&_log_file_param);
 	
+	// With extent allocation, place the log in the largest free area
+	if(_fsinfo.logextent && _ufat_log_allocate(n))
+	{
+		fprintf_P(file_pri,PSTR("%sNo free space\n"),_str_ufat);
+		return 0;
+	}
+	
 	// Clear the size of file
 	_log_current_log = n;
 	_log_current_size=_logentries[n].size=0;
 	_log_current_sector=_logentries[n].startsector;
+	_log_maxsize=_ufat_clustertobytes(_ufat_log_maxcluster(n));
+	_log_fatdone=0;
+	
+	// Ring log: header sector followed by the ring
+	_log_ring=0;
+	if(_log_ringsize)
+	{
+		_log_ring=_log_ringsize>>9;
+		if(_log_ring>(_log_maxsize>>9)-1)
+			_log_ring=(_log_maxsize>>9)-1;
+		if(_log_ring<(UFAT_LOG_RINGMIN>>9))
+		{
+			fprintf_P(file_pri,PSTR("%sNo space for the ring\n"),_str_ufat);
+			return 0;
+		}
+		_log_maxsize=(_log_ring+1)<<9;
+		_log_ringstate=UFAT_LOG_RING_CLOSED;
+	}
 	
 	
-	// Erase file area; this seems more effective than the pre-erase command and helps reduce latency of writes
-	fprintf_P(file_pri,PSTR("%sErase sectors %lu-%lu\n"),_str_ufat,_log_current_sector,_log_current_sector+(_fsinfo.logsizebytes>>9)-1);
-	if(sd_erase(_log_current_sector,_log_current_sector+(_fsinfo.logsizebytes>>9)-1))
+	// Erase the beginning of the file area; this seems more effective than the pre-erase command and helps reduce latency of writes.
+	// Erasing the entire file area takes seconds on large cards; the remainder is pre-erased by the multiblock write (ACMD23), 
+	// and the latency of the writes is hidden by the sector cache.
+	unsigned long t1 = timer_ms_get();
+	unsigned long erasesize = _log_maxsize>>9;
+	if(UFAT_LOG_ERASESIZE && erasesize>UFAT_LOG_ERASESIZE)
+		erasesize = UFAT_LOG_ERASESIZE;
+	// Size checkpoints require an erased area of 2*UFAT_LOG_CHECKPOINT after the checkpoint
+	if(erasesize<(2*UFAT_LOG_CHECKPOINT>>9))
+		erasesize = 2*UFAT_LOG_CHECKPOINT>>9;
+	if(erasesize>_log_maxsize>>9)
+		erasesize = _log_maxsize>>9;
+	// The erased area counts data sectors, after the header of a ring
+	_log_erasedend = erasesize-(_log_ring?1:0);
+	_log_erasesteps=_log_erasemax=0;
+	_log_eraseopens=0;
+	_log_checkpoints=_log_checkpointmax=0;
+	fprintf_P(file_pri,PSTR("%sErase sectors %lu-%lu\n"),_str_ufat,_log_current_sector,_log_current_sector+erasesize-1);
+	if(sd_erase(_log_current_sector,_log_current_sector+erasesize-1))
 	{
 		#ifdef UFATDBG
 			printf("Error erasing file\n");
@@ -548,9 +755,56 @@ FILE *ufat_log_open(unsigned char n)
 		return 0;
 	}
 	
-	fprintf_P(file_pri,PSTR("%sStreaming write at sector %lu\n"),_str_ufat,_log_current_sector);
+	// Mark the log as open, with size 0. With extent allocation the root is also written as the log may have moved.
+	// A ring log has its final size and FAT chain, and its header is the checkpoint: it is not marked as open.
+	_log_checkpoint=0;
+	if(_log_ring)
+	{
+		_logentries[n].size=_log_maxsize;
+		if((_fsinfo.logextent && _ufat_log_writefat(n)) || _ufat_write_root(_fsinfo.lognum) || _ufat_log_ringheader(UFAT_LOG_RING_OPEN))
+			return 0;
+	}
+	else if(UFAT_LOG_CHECKPOINT || _fsinfo.logextent)
+	{
+		if(UFAT_LOG_CHECKPOINT)
+			_fsinfo.logopen=n+1;
+		if(_ufat_write_root(_fsinfo.lognum))
+		{
+			_fsinfo.logopen=0;
+			return 0;
+		}
+	}
+	
+	fprintf_P(file_pri,PSTR("%sStreaming write at sector %lu%s\n"),_str_ufat,_log_current_sector,_log_compress?" (compressed)":_log_pack?" (packed)":"");
 	// Open stream specifying a pre-erase size
-	sd_stream_open(_log_current_sector,_fsinfo.logsizebytes>>9);
+	if(_log_ring)
+	{
+		fprintf_P(file_pri,PSTR("%sRing of %lu sectors\n"),_str_ufat,_log_ring);
+		sd_stream_open(_log_current_sector+1,_log_ring);
+		sd_streamcache_wrap(_log_current_sector+1,_log_current_sector+1+_log_ring);
+	}
+	else
+		sd_stream_open(_log_current_sector,_log_maxsize>>9);
+	
+	_log_current_offset=0;
+	if(_log_compress)
+		logzip_init();
+	else if(_log_pack)
+		logpack_init();
+	
+	// Initialise the time index and write the first index record
+	_log_index_pkt=0;
+	_log_index_linestart=1;
+	_log_index_n=0;
+	_log_index_stride=1;
+	_log_index_count=0;
+	if(UFAT_LOG_INDEXPERIOD)
+	{
+		_log_index_last=timer_ms_get();
+		_ufat_log_index_add(_log_index_last);
+	}
+	
+	fprintf_P(file_pri,PSTR("%sLog open time: %lu ms\n"),_str_ufat,timer_ms_get()-t1);
 	
 	return &_log_file;
 }
@@ -569,6 +823,23 @@ unsigned char ufat_log_close(void)
 	//printf("ufat_log_close\n");
 	//fdev_close(_log_file);			// ? why is this commented out?
 	
+	// Append the index summary and the trailer indicating where the summary starts
+	if(UFAT_LOG_INDEXPERIOD)
+	{
+		unsigned long summary=_log_current_offset;
+		for(unsigned char i=0;i<_log_index_n;i++)
+			_ufat_log_index('S',_log_index_summary[i].time,_log_index_summary[i].pkt,_log_index_summary[i].offset);
+		_ufat_log_index('E',timer_ms_get(),_log_index_pkt,summary);
+	}
+	// Write the last compressed or packed sector
+	if(_log_compress || _log_pack)
+	{
+		unsigned char numsect;
+		if(_log_compress?logzip_flush(&numsect):logpack_flush(&numsect))
+			fprintf_P(file_pri,PSTR("%sFailed compressed write\n"),_str_ufat);
+		_log_current_size+=(unsigned long)numsect<<9;
+	}
+	
 	rv = sd_streamcache_close(0);
 	if(rv!=0)
 	{
@@ -583,18 +854,28 @@ unsigned char ufat_log_close(void)
 	
 	
 		
+	// The header of a ring gives the end of the data
+	if(_log_ring && _ufat_log_ringheader(_log_ringstate))
+	{
+		fprintf_P(file_pri,PSTR("%sError writing ring header\n"),_str_ufat);
+	}
+	
 	// Here must write root
-	_logentries[_log_current_log].size = _log_current_size;
+	if(!_log_ring)
+		_logentries[_log_current_log].size = _log_current_size;
 	_logentries[_log_current_log].time = _ufat_secfrommidnight_to_fattime(timer_s_get_frommidnight());
+	_fsinfo.logopen=0;
+	// With extent allocation the FAT chain is written up to the end of the log before the root points to it.
+	// With fixed-size allocation _ufat_format_fat_log reserves all clusters on formatting, and the FAT does not need to be written here.
+	if(_fsinfo.logextent && _ufat_log_writefat(_log_current_log))
+	{
+		fprintf_P(file_pri,PSTR("%sError writing FAT\n"),_str_ufat);
+	}
 	rv = _ufat_write_root(_fsinfo.lognum);
 	if(rv)
 	{
 		fprintf_P(file_pri,PSTR("%sError writing root\n"),_str_ufat);
 	}
-	// Two variant of the code exist. If _ufat_format_fat_log reserves only the minimum number of clusters needed for the file size then it must be called again here.
-	// Currently _ufat_format_fat_log reserves all clusters on formatting, and this does not need to be called here.
-	// _ufat_format_fat_log(_log_current_log,_fsinfo.fat_sector);
-	//if(_fsinfo.fat2_sector) _ufat_format_fat_log(_log_current_log,_fsinfo.fat2_sector);
 	return 0;
 }
 /******************************************************************************
@@ -777,7 +1058,9 @@ void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reporte
 /******************************************************************************
 	function: ufat_log_getmaxsize
 *******************************************************************************	
-	Returns the maximum size of files in the given filesystem.
+	Returns the maximum size of the open log. With extent allocation this depends
+	on the free space when the log was opened. Before a log is opened, returns 
+	the maximum size of files in the given filesystem.
 	
 	This function requires the filesystem to be initialised.
 
@@ -795,7 +1078,7 @@ unsigned long ufat_log_getmaxsize(void)
 		#endif
 		return 0;
 	}
-	return _fsinfo.logsizebytes;
+	return _log_maxsize;
 }
 /******************************************************************************
 	function: ufat_log_getsize
@@ -843,6 +1126,81 @@ unsigned char ufat_log_getnumlogs(void)
 	}
 	return _fsinfo.lognum;
 }
+/******************************************************************************
+	function: ufat_log_getinfo
+*******************************************************************************	
+	Returns the start sector and the size of a log, as recorded in the root
+	when the log was last closed.
+	
+	This function requires the filesystem to be initialised.
+	
+	Parameters:
+		n				-	Number of the log
+		startsector		-	Pointer receiving the start sector of the log
+		size			-	Pointer receiving the size of the log in bytes
+
+	Returns:
+		0				-	Success
+		1				-	Error
+******************************************************************************/
+unsigned char ufat_log_getinfo(unsigned char n,unsigned long *startsector,unsigned long *size)
+{
+	if(_fsinfo.fs_available==0 || n>=_fsinfo.lognum)
+	{
+		#ifdef UFATDBG
+			printf("fs not available or invalid lognum\n");
+		#endif
+		return 1;
+	}
+	*startsector = _logentries[n].startsector;
+	*size = _logentries[n].size;
+	return 0;
+}
+/******************************************************************************
+	function: ufat_log_findtime
+*******************************************************************************	
+	Returns the offset of the last index record at or before a time in a log, 
+	so that the log can be read (e.g. downloaded) from this time.
+	
+	The time is relative to the first index record, written when the log was opened.
+	The summary at the end of the log is used to find the index records to scan;
+	if the log has no summary all the index records are scanned.
+	
+	This function requires the filesystem to be initialised and must not be 
+	called while a log is open.
+	
+	Parameters:
+		n				-	Number of the log
+		t				-	Time from the start of the log in ms
+		offset			-	Pointer receiving the offset of the index record, 
+							or 0 if the log has no index record before t
+
+	Returns:
+		0				-	Success
+		1				-	Error
+******************************************************************************/
+unsigned char ufat_log_findtime(unsigned char n,unsigned long t,unsigned long *offset)
+{
+	unsigned long startsector,size,summary,from=0,to,t0=0xFFFFFFFF,te=0xFFFFFFFF,dummy;
+	
+	*offset=0;
+	if(ufat_log_getinfo(n,&startsector,&size))
+		return 1;
+	to=size;
+	
+	// Trailer: the last line of the log
+	if(_ufat_log_scanindex(startsector,size>UFAT_LOG_INDEXLINE?size-UFAT_LOG_INDEXLINE:0,size,'E',0xFFFFFFFF,&te,&summary,&dummy)==0 && summary<size)
+	{
+		// Summary: find the summary entries around t
+		to=summary;
+		_ufat_log_scanindex(startsector,summary,size,'S',t,&t0,&from,&to);
+	}
+	// Index records between the summary entries
+	_ufat_log_scanindex(startsector,from,to,'I',t,&t0,offset,&dummy);
+	if(*offset<from)
+		*offset=from;
+	return 0;
+}
 
 /************************************************************************************************************************************************************
 *************************************************************************************************************************************************************
@@ -851,6 +1209,341 @@ INTERNAL FUNCTIONS   INTERNAL FUNCTIONS   INTERNAL FUNCTIONS   INTERNAL FUNCTION
 ************************************************************************************************************************************************************/
 
 
+/******************************************************************************
+	function: _ufat_log_index
+*******************************************************************************	
+	Writes an index record line to the open log.
+	
+	Parameters:
+		type		-		Record type: 'I' (index), 'S' (summary) or 'E' (trailer)
+		time		-		Time field
+		pkt			-		Record counter field
+		offset		-		Offset field
+	Returns:
+		0			-		Success
+		1			-		Error or log full
+******************************************************************************/
+unsigned char _ufat_log_index(char type,unsigned long time,unsigned long pkt,unsigned long offset)
+{
+	char line[UFAT_LOG_INDEXLINE];
+	unsigned char n;
+	
+	n = snprintf_P(line,UFAT_LOG_INDEXLINE,PSTR("#%c,%lu,%lu,%lu\n"),type,time,pkt,offset);
+	if(_ufat_log_write(line,n))
+		return 1;
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log_index_add
+*******************************************************************************	
+	Writes an index record at the current position of the log and adds it to 
+	the index summary every _log_index_stride records.
+	
+	When the summary is full every other entry is discarded and the stride is 
+	doubled, so that the summary remains evenly spaced over the log.
+******************************************************************************/
+void _ufat_log_index_add(unsigned long t)
+{
+	unsigned long offset=_log_current_offset;
+	
+	if(_ufat_log_index('I',t,_log_index_pkt,offset))
+		return;
+	if(_log_index_count)
+	{
+		_log_index_count--;
+		return;
+	}
+	if(_log_index_n==UFAT_LOG_INDEXSUMMARY)
+	{
+		for(unsigned char i=0;i<UFAT_LOG_INDEXSUMMARY/2;i++)
+			_log_index_summary[i]=_log_index_summary[i*2];
+		_log_index_n=UFAT_LOG_INDEXSUMMARY/2;
+		_log_index_stride<<=1;
+	}
+	_log_index_summary[_log_index_n].time=t;
+	_log_index_summary[_log_index_n].pkt=_log_index_pkt;
+	_log_index_summary[_log_index_n].offset=offset;
+	_log_index_n++;
+	_log_index_count=_log_index_stride-1;
+}
+/******************************************************************************
+	function: _ufat_log_index_check
+*******************************************************************************	
+	Writes an index record if UFAT_LOG_INDEXPERIOD elapsed since the last one.
+	Must be called at a record boundary.
+******************************************************************************/
+void _ufat_log_index_check(void)
+{
+	if(!UFAT_LOG_INDEXPERIOD)
+		return;
+	unsigned long t=timer_ms_get();
+	if(t-_log_index_last<UFAT_LOG_INDEXPERIOD)
+		return;
+	_log_index_last=t;
+	_ufat_log_index_add(t);
+}
+/******************************************************************************
+	function: _ufat_log_scanindex
+*******************************************************************************	
+	Reads the log between two offsets and parses the index records of a type.
+	
+	Records are accepted until the first record later than t. The time of 
+	the records is relative to t0; if t0 is 0xFFFFFFFF it is set to the time
+	of the first record found.
+	Index records are only accepted if their offset field matches their position
+	in the log, so that data which happens to look like an index record is ignored. Records are found at any position, as they are 
+	not preceded by a newline in binary logs.
+	
+	Uses ufatblock.
+	
+	Parameters:
+		startsector	-		Start sector of the log
+		from		-		Offset from which to scan
+		to			-		Offset up to which to scan
+		type		-		Record type
+		t			-		Time
+		t0			-		Time origin
+		offset		-		Receives the offset field of the last record at or before t
+		next		-		Receives the offset field of the first record after t, 
+							or is unchanged if there is none
+	Returns:
+		0			-		Success: at least one record at or before t was found
+		1			-		No record or read error
+******************************************************************************/
+unsigned char _ufat_log_scanindex(unsigned long startsector,unsigned long from,unsigned long to,char type,unsigned long t,unsigned long *t0,unsigned long *offset,unsigned long *next)
+{
+	char line[UFAT_LOG_INDEXLINE];
+	unsigned char n=0,rv=1,done=0;
+	unsigned long pos=from,linestart=0,rt,pkt,off;
+	unsigned short i=from&511;
+	
+	if(from>=to)
+		return 1;
+	if(sd_streamread_open(startsector+(from>>9)))
+		return 1;
+	while(pos<to && !done)
+	{
+		if(sd_streamread_read(ufatblock,0))
+			return rv;
+		for(;i<512 && pos<to;i++,pos++)
+		{
+			char c=ufatblock[i];
+			// A record starts at '#' and ends at a newline; in binary logs it is not preceded by a newline
+			if(c=='#')
+			{
+				n=0;
+				linestart=pos;
+			}
+			if(c!='\n')
+			{
+				// Long lines are truncated: they are not index records
+				if(n<UFAT_LOG_INDEXLINE-1)
+					line[n++]=c;
+				continue;
+			}
+			line[n]=0;
+			if(line[0]=='#' && line[1]==type && sscanf(line+2,",%lu,%lu,%lu",&rt,&pkt,&off)==3 && (type!='I' || off==linestart))
+			{
+				if(*t0==0xFFFFFFFF)
+					*t0=rt;
+				if(rt-*t0>t)
+				{
+					*next=off;
+					done=1;
+					break;
+				}
+				*offset=off;
+				rv=0;
+			}
+			n=0;
+		}
+		i=0;
+	}
+	sd_streamread_close();
+	return rv;
+}
+
+/******************************************************************************
+	function: _ufat_log_checkpoint
+*******************************************************************************	
+	Writes the size of the complete sectors of the open log to the root. 
+	
+	The multiblock write is terminated and is reopened by the next write.
+	The number and the longest duration of the checkpoints are shown by 
+	log_printstatus.
+******************************************************************************/
+void _ufat_log_checkpoint(void)
+{
+	unsigned long t1=timer_ms_get();
+	
+	_log_checkpoint=_log_current_size;
+	_log_checkpoints++;
+	
+	// Write the complete sectors to the card; the sector being filled remains in memory
+	if(sd_streamcache_sync())
+	{
+		fprintf_P(file_pri,PSTR("%sCheckpoint: error flushing\n"),_str_ufat);
+		return;
+	}
+	
+	// The size of a ring is fixed: its header gives the end of the data
+	if(_log_ring)
+	{
+		if(_ufat_log_ringheader(UFAT_LOG_RING_OPEN))
+			fprintf_P(file_pri,PSTR("%sCheckpoint: error writing ring header\n"),_str_ufat);
+	}
+	else
+	{
+		_logentries[_log_current_log].size = _log_current_size&0xFFFFFE00;
+		_logentries[_log_current_log].time = _ufat_secfrommidnight_to_fattime(timer_s_get_frommidnight());
+		if(_fsinfo.logextent && _ufat_log_writefat(_log_current_log))
+			fprintf_P(file_pri,PSTR("%sCheckpoint: error writing FAT\n"),_str_ufat);
+		if(_ufat_write_root(_fsinfo.lognum))
+			fprintf_P(file_pri,PSTR("%sCheckpoint: error writing root\n"),_str_ufat);
+	}
+	
+	t1=timer_ms_get()-t1;
+	if(t1>_log_checkpointmax)
+		_log_checkpointmax=t1;
+}
+
+/******************************************************************************
+	function: _ufat_log_eraseahead
+*******************************************************************************	
+	Keeps the area of 2*UFAT_LOG_CHECKPOINT bytes after the data of the open 
+	log erased (see size checkpoints), erasing at most UFAT_LOG_ERASESTEP 
+	sectors per call; in a ring this erases the oldest data.
+	
+	A step is erased when the card idles, at most once per idle period: the 
+	card must have been written since the last step (sd_streamcache_getbursts).
+	Otherwise the multiblock write is terminated for a step only when more 
+	than half a checkpoint is not erased. Each call thus waits for at most 
+	one step.
+******************************************************************************/
+void _ufat_log_eraseahead(void)
+{
+	unsigned long maxsector=_log_maxsize>>9;
+	unsigned long end,n,t1;
+	
+	end = (_log_current_size>>9)+(2*UFAT_LOG_CHECKPOINT>>9);
+	if(!_log_ring && end>maxsector)
+		end=maxsector;
+	if(end<=_log_erasedend)
+		return;
+	n=end-_log_erasedend;
+	// Erase complete steps, except for the last sectors of a linear log
+	if(n<UFAT_LOG_ERASESTEP && (_log_ring || end<maxsector))
+		return;
+	if(!sd_streamcache_isidle() || sd_streamcache_getbursts()==_log_eraseopens)
+	{
+		if(n<=(UFAT_LOG_CHECKPOINT>>10))
+			return;
+		if(sd_streamcache_sync())
+		{
+			fprintf_P(file_pri,PSTR("%sErase ahead: error flushing\n"),_str_ufat);
+			return;
+		}
+	}
+	if(n>UFAT_LOG_ERASESTEP)
+		n=UFAT_LOG_ERASESTEP;
+	
+	t1=timer_ms_get();
+	// The step is skipped on error: a power loss until it is rewritten may recover stale sectors
+	if(_ufat_log_erase(_log_erasedend,_log_erasedend+n))
+		fprintf_P(file_pri,PSTR("%sErase ahead: error erasing sectors %lu-%lu\n"),_str_ufat,_log_erasedend,_log_erasedend+n-1);
+	_log_erasedend+=n;
+	_log_eraseopens=sd_streamcache_getbursts();
+	t1=timer_ms_get()-t1;
+	if(t1>_log_erasemax)
+		_log_erasemax=t1;
+	_log_erasesteps++;
+}
+/******************************************************************************
+	function: _ufat_log_iserased
+*******************************************************************************	
+	Indicates whether a sector is erased, i.e. all its bytes are 0x00 or 0xFF 
+	(depending on the card).
+	
+	Parameters:
+		block		-		Data of the sector
+	
+	Returns:
+		0			-		Sector not erased
+		1			-		Sector erased
+******************************************************************************/
+unsigned char _ufat_log_iserased(char *block)
+{
+	if(block[0]!=0x00 && block[0]!=(char)0xFF)
+		return 0;
+	for(unsigned short i=1;i<512;i++)
+		if(block[i]!=block[0])
+			return 0;
+	return 1;
+}
+/******************************************************************************
+	function: _ufat_log_recover
+*******************************************************************************	
+	Recovers the size of a log which was not closed.
+	
+	The UFAT_LOG_RECOVERWINDOW sectors after the last checkpoint hold data of 
+	the log or erased sectors: the end of the data follows the last sector of 
+	the window which is not erased, so that data looking erased (e.g. a sector 
+	of zeros in a binary log) does not truncate the log. The window is read with
+	a streaming read. The size and the open log in the root are then updated,
+	and with extent allocation the FAT chain after the checkpoint is written.
+	
+	Parameters:
+		n			-		Number of the log
+	
+	Returns:
+		0			-		Success
+		1			-		Error
+******************************************************************************/
+unsigned char _ufat_log_recover(unsigned char n)
+{
+	unsigned long startsector=_logentries[n].startsector;
+	unsigned long from=_logentries[n].size>>9,to,end,k;
+	
+	to = from+UFAT_LOG_RECOVERWINDOW;
+	if(to>_ufat_clustertobytes(_ufat_log_maxcluster(n))>>9)
+		to=_ufat_clustertobytes(_ufat_log_maxcluster(n))>>9;
+	// The FAT is final up to the FAT sector holding the end of the chain at the checkpoint
+	_log_fatdone=_ufat_sizetocluster(_logentries[n].size);
+	if(_log_fatdone)
+		_log_fatdone-=128;
+	
+	fprintf_P(file_pri,PSTR("%sLog %u not closed: recovering from size %lu\n"),_str_ufat,n,_logentries[n].size);
+	
+	end=from;
+	if(from<to)
+	{
+		if(sd_streamread_open(startsector+from))
+		{
+			fprintf_P(file_pri,PSTR("%sRecovery: read error\n"),_str_ufat);
+			return 1;
+		}
+		for(k=from;k<to;k++)
+		{
+			if(sd_streamread_read(ufatblock,0))
+			{
+				sd_streamread_close();
+				fprintf_P(file_pri,PSTR("%sRecovery: read error\n"),_str_ufat);
+				return 1;
+			}
+			if(!_ufat_log_iserased(ufatblock))
+				end=k+1;
+		}
+		sd_streamread_close();
+	}
+	
+	_logentries[n].size=end<<9;
+	_fsinfo.logopen=0;
+	fprintf_P(file_pri,PSTR("%sRecovered size: %lu\n"),_str_ufat,_logentries[n].size);
+	if(_fsinfo.logextent && _ufat_log_writefat(n))
+		return 1;
+	return _ufat_write_root(_fsinfo.lognum);
+}
+
 /******************************************************************************
 	function: _ufat_init_sd
 *******************************************************************************	
@@ -874,6 +1567,8 @@ unsigned char _ufat_init_sd(void)
 	CSD csd;
 	SDSTAT sdstat;
 	unsigned long capacity_sector;
+	unsigned short khz;
+	unsigned char fallback;
 	
 	// Initialise fsinfo with card and fs not available
 	_fsinfo.card_available=0;
@@ -892,6 +1587,11 @@ unsigned char _ufat_init_sd(void)
 		fprintf_P(file_pri,PSTR("%sSD unsuitable\n"),_str_ufat);
 		return 1;
 	}
+	// Negotiate the SPI clock by reading the MBR: nothing is written before the card is known to be formatted with uFAT
+	if(sd_spi_tune(0))
+		fprintf_P(file_pri,PSTR("%sSPI clock tuning error\n"),_str_ufat);
+	sd_spi_getstat(&khz,&fallback);
+	fprintf_P(file_pri,PSTR("%sSPI clock %u KHz\n"),_str_ufat,khz);
 	_fsinfo.card_available=1;
 	_fsinfo.card_capacity_sector=capacity_sector;
 	return 0;	
@@ -912,6 +1612,7 @@ unsigned char _ufat_init_sd(void)
 	_fsinfo.logstartcluster
 	_fsinfo.logsizecluster
 	_fsinfo.logsizebytes
+	_fsinfo.logextent
 	_fsinfo.lognum
 	
 	Parameters:
@@ -957,6 +1658,7 @@ unsigned char _ufat_init_fs(void)
 		checksum+=fe->name[i];
 	checksum+=fe->ext[0];
 	checksum+=fe->ext[1];
+	checksum+=fe->ntres;
 	fprintf_P(file_pri,PSTR("%sid: %02X checksum: %02X (obtained: %02X)\n"),_str_ufat,fe->name[0],fe->ext[2],checksum);
 	if(!(fe->name[0]==0xE5 && fe->ext[2]==checksum))
 	{
@@ -966,9 +1668,15 @@ unsigned char _ufat_init_fs(void)
 	_fsinfo.logstartcluster = *(unsigned long*)(fe->name+1);
 	_fsinfo.logsizecluster = *(unsigned long*)(fe->name+5);		
 	_fsinfo.lognum=fe->ext[1];
-	_fsinfo.logsizebytes=_fsinfo.logsizecluster*_fsinfo.sectors_per_cluster*512;	
+	_fsinfo.logopen=fe->ntres;
+	// A size of 0 indicates extent allocation: the logs share the log area up to the end of the partition
+	_fsinfo.logextent=_fsinfo.logsizecluster==0?1:0;
+	if(_fsinfo.logextent)
+		_fsinfo.logsizecluster=((_fsinfo.numclusters-_fsinfo.logstartcluster)>>7)<<7;
+	_fsinfo.logsizebytes=_ufat_clustertobytes(_fsinfo.logsizecluster);
+	_log_maxsize=_fsinfo.logsizebytes;
 	
-	fprintf_P(file_pri,PSTR("%snumlogs: %d startcluster: %lu sizecluster: %lu sizebytes: %lu\n"),_str_ufat,_fsinfo.lognum,_fsinfo.logstartcluster,_fsinfo.logsizecluster,_fsinfo.logsizebytes);
+	fprintf_P(file_pri,PSTR("%snumlogs: %d startcluster: %lu sizecluster: %lu sizebytes: %lu extent: %u\n"),_str_ufat,_fsinfo.lognum,_fsinfo.logstartcluster,_fsinfo.logsizecluster,_fsinfo.logsizebytes,_fsinfo.logextent);
 	
 	// 7. Convert root to _logentries
 	for(unsigned l=0;l<_fsinfo.lognum;l++)
@@ -984,6 +1692,18 @@ unsigned char _ufat_init_fs(void)
 	// The filesystem is available
 	_fsinfo.fs_available=1;
 	
+	// 8. Recover the end of a log which was not closed
+	if(_fsinfo.logopen)
+	{
+		if(_fsinfo.logopen<=_fsinfo.lognum)
+			_ufat_log_recover(_fsinfo.logopen-1);
+		else
+		{
+			_fsinfo.logopen=0;
+			_ufat_write_root(_fsinfo.lognum);
+		}
+	}
+	
 	return 0;
 	
 }
@@ -1235,8 +1955,12 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 		fe->ntres=0;
 		fe->createtimetenth=0;
 		fe->size = _logentries[i].size;
-		fe->clusterhi = _logentries[i].startcluster>>16;
-		fe->clusterlo = _logentries[i].startcluster&0xffff;
+		// With extent allocation empty logs have no cluster, unless open (the start cluster is needed to recover the log)
+		unsigned long cluster = _logentries[i].startcluster;
+		if(_fsinfo.logextent && _logentries[i].size==0 && _fsinfo.logopen!=i+1)
+			cluster = 0;
+		fe->clusterhi = cluster>>16;
+		fe->clusterlo = cluster&0xffff;
 	}
 	// ROOT entry numlogfiles to_UFAT_NUMLOGENTRY: "dummy" files appearing as erased to reserve space in the ROOT and avoid Windows to create e.g. "System Volume Information" and overwriting our metadata
 	for(unsigned i=numlogfile;i<_UFAT_NUMLOGENTRY;i++)
@@ -1266,13 +1990,15 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 	fe=(FILEENTRYRAW*)(ufatblock+480);
 	fe->name[0]=0xE5;				// Mark of an erased file
 	*(unsigned long*)(fe->name+1) = _fsinfo.logstartcluster;		// Start cluster
-	*(unsigned long*)(fe->name+5) = _fsinfo.logsizecluster;			// Max file size in clusters
+	*(unsigned long*)(fe->name+5) = _fsinfo.logextent?0:_fsinfo.logsizecluster;	// Max file size in clusters, 0 for extent allocation (the 4 bytes span name[5..7] and ext[0])
 	fe->ext[1] = numlogfile;
+	fe->ntres = _fsinfo.logopen;									// Open log; 0 on cards formatted before this field was used, which leaves their checksum unchanged
 	unsigned checksum=0;
 	for(unsigned i=0;i<8;i++)
 		checksum+=fe->name[i];
 	checksum+=fe->ext[0];
 	checksum+=fe->ext[1];
+	checksum+=fe->ntres;
 	fe->ext[2]=checksum;
 	/*fe->name[1]=0;
 	fe->ext[0]='J';
@@ -1283,7 +2009,6 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 	fe->writedate = 0b0001000100101000;		// 8.08.1980
 	fe->createdate=fe->accessdate=fe->writedate;
 	fe->createtime=fe->writetime;
-	fe->ntres=0;
 	fe->createtimetenth=0;
 	fe->size = 0;
 	fe->clusterhi = 0;
@@ -1363,61 +2088,231 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 ******************************************************************************/
 unsigned char _ufat_format_fat_log(unsigned char i,unsigned long fat_sector)
 {
-	unsigned long firstcluster;
-	unsigned long cluster;
-	unsigned long oldfatsect;						// oldfatsect is offset from fat_sector, it is the current sector of the FAT being written.
-	unsigned long fsc;
-	
-	//memset(ufatblock,0,512);						// This flags all the clusters as unused. The linked chain is built after.
-	memset(ufatblock,0xff,512);						// This flags all the clusters as used (but end of file). The linked chain is built after. 
-													// Marking as used is to prevent another OS from using these clusters. A disk analysis tool would indicate that these clusters are incorrectly reserved.
-	
-	// Find the first and last cluster of the log entry i. The last cluster is determined by the file size.
-	firstcluster = _logentries[i].startcluster;	
 	/*
-	// This version of the code writes only as many clusters as needed for the given file size.
+	// A variant of the code would write only as many clusters as needed for the given file size.
 	// This can lead to issue when another operating system looks for empty clusters to store files: the other OS would use clusters that uFAT will require if the file grows
-	if(_logentries[i].size)
-		fsc = (_logentries[i].size+32767)>>15;			// File size in cluster rounded up
-	else
-		fsc = 1;										// If file is size 0 reserve a minimum of 1 cluster*/
+	*/
 	// This version of the code writes all the clusters needed for the maximum possible size of the file; this should prevent another OS to reclaim clusters that uFAT will require if the file grows.
-	fsc = _fsinfo.logsizecluster;					// To reserve all clusters of the file
-		
-	// Creates a list of cluster from the first pointing to the next
-	// Iterate from cluster 0 to fsc. Each FAT sector can hold 128 clusters.
-	// Write the FAT sector at regular intervals when: the last cluster that fits in the current FAT sector is updated, or when the last cluster of the file is put in the FAT
-	// Initialise oldfactsect with the FAT sector holding the first cluster of the file
-	for(cluster=0,oldfatsect=(firstcluster+cluster)/128;cluster<fsc;cluster++)
+	return _ufat_write_fat_chain(fat_sector,_logentries[i].startcluster,0,_fsinfo.logsizecluster);
+}
+/******************************************************************************
+	function: _ufat_write_fat_chain
+*******************************************************************************	
+	Writes the FAT sectors of a chain of consecutive clusters, the last one 
+	being marked as the end of the chain. 
+	
+	Assumes that the FAT sectors comprise only clusters of this chain: firstcluster 
+	and from must be multiples of 128. If numcluster is not a multiple of 128, 
+	the entries following the end of the chain are marked as used.
+	
+	Parameters:
+		fat_sector		-	Location of the FAT
+		firstcluster	-	First cluster of the chain
+		from			-	Offset in clusters from firstcluster of the first FAT entry to write; 
+							the FAT sectors before are assumed to be already written
+		numcluster		-	Number of clusters of the chain
+				
+	Returns:
+		0					-	Success
+		1					-	Error
+******************************************************************************/
+unsigned char _ufat_write_fat_chain(unsigned long fat_sector,unsigned long firstcluster,unsigned long from,unsigned long numcluster)
+{
+	unsigned long *c = (unsigned long*)ufatblock;
+	
+	memset(ufatblock,0xff,512);						// Entries after the end of the chain are flagged as used (but end of file)
+	
+	// Iterate from cluster from to numcluster. Each FAT sector can hold 128 clusters.
+	// Write the FAT sector when the last cluster that fits in the current FAT sector is updated, or when the last cluster of the chain is put in the FAT
+	for(unsigned long cluster=from;cluster<numcluster;cluster++)
 	{
 		// Find the offset of the cluster within the current FAT sector; this is done by a bitmask with 0x7F, as there are 128 clusters per FAT sector
-		unsigned long *c = (unsigned long*)ufatblock;
-		if(cluster!=fsc-1)
+		if(cluster!=numcluster-1)
 			c[cluster&0x7f] = firstcluster+cluster+1;				// If the current cluster is not the last one, then point to the next cluster
 		else
-			//c[cluster&0x7f] = 0xFFFFFFF8;
 			c[cluster&0x7f] = 0x0FFFFFFF;							// If the current cluster is the last one, flag the cluster as the end of the chain.
 		
-		// Write the FAT sector either if the cluster is the last one of the file, or if the next cluster would be on the next fat sector
-		// The last cluster of the current fat sector is when cluster is 127, 255, ...
-		if( (cluster&0x7f)==0x7f || cluster==fsc-1)
+		if( (cluster&0x7f)==0x7f || cluster==numcluster-1)
 		{
-			// Write old fat sect
-			//printf_P(PSTR("Writing FAT sector %lu (%lu/%lu)... "),fat_sector+oldfatsect,cluster,fsc);
-			unsigned char rv = sd_block_write(fat_sector+oldfatsect,ufatblock);
-			if(rv!=0)
+			unsigned long fatsect = fat_sector+(firstcluster+cluster)/128;
+			if(sd_block_write(fatsect,ufatblock))
 			{
-				fprintf_P(file_pri,PSTR("Error writing FAT sector %lu (%lu/%lu)... "),fat_sector+oldfatsect,cluster,fsc);
+				fprintf_P(file_pri,PSTR("Error writing FAT sector %lu (%lu/%lu)... "),fatsect,cluster,numcluster);
 				return 1;
 			}
-			//printf_P(PSTR("\n"));
-			oldfatsect++;											// Point to the next FAT sector
-			memset(ufatblock,0,512);								// Reset our buffer
+			memset(ufatblock,0xff,512);
+		}
+	}
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_format_fat_free
+*******************************************************************************	
+	Marks all the clusters of the log area as end of chain, which reserves them 
+	for the logs with extent allocation.
+	
+	Parameters:
+		fat_sector		-	Location of the FAT
+				
+	Returns:
+		0					-	Success
+		1					-	Error
+******************************************************************************/
+unsigned char _ufat_format_fat_free(unsigned long fat_sector)
+{
+	unsigned long first = _fsinfo.logstartcluster/128;
+	unsigned long last = (_fsinfo.logstartcluster+_fsinfo.logsizecluster)/128;
+	
+	memset(ufatblock,0xff,512);
+	for(unsigned long s=first;s<last;s++)
+	{
+		if(sd_block_write(fat_sector+s,ufatblock))
+		{
+			fprintf_P(file_pri,PSTR("Error writing FAT sector %lu\n"),fat_sector+s);
+			return 1;
 		}
-		
 	}
 	return 0;
 }
+/******************************************************************************
+	function: _ufat_clustertobytes
+*******************************************************************************	
+	Converts a number of clusters to bytes, limited to the maximum size of a 
+	FAT32 file (4GB-1).
+******************************************************************************/
+unsigned long _ufat_clustertobytes(unsigned long numcluster)
+{
+	unsigned long max = 0xFFFFFFFFul/(_fsinfo.sectors_per_cluster*512ul);
+	if(numcluster>max)
+		numcluster=max;
+	return numcluster*_fsinfo.sectors_per_cluster*512ul;
+}
+/******************************************************************************
+	function: _ufat_sizetocluster
+*******************************************************************************	
+	Returns the number of clusters holding size bytes, rounded up to a multiple 
+	of 128 clusters (i.e. one FAT sector).
+******************************************************************************/
+unsigned long _ufat_sizetocluster(unsigned long size)
+{
+	unsigned long numsector = (size>>9)+((size&511)?1:0);
+	unsigned long numcluster = (numsector+_fsinfo.sectors_per_cluster-1)/_fsinfo.sectors_per_cluster;
+	return (numcluster+127)&0xFFFFFF80;
+}
+/******************************************************************************
+	function: _ufat_log_gapend
+*******************************************************************************	
+	With extent allocation, returns the end of the free area starting at a 
+	cluster, i.e. the start of the next log other than n, or the end of the log area.
+	
+	Parameters:
+		n				-	Log to ignore (the log being placed)
+		start			-	First cluster of the free area
+	
+	Returns:
+		First cluster after the free area; start if start is within another log
+******************************************************************************/
+unsigned long _ufat_log_gapend(unsigned char n,unsigned long start)
+{
+	unsigned long end = _fsinfo.logstartcluster+_fsinfo.logsizecluster;
+	
+	for(unsigned char i=0;i<_fsinfo.lognum;i++)
+	{
+		if(i==n || _logentries[i].size==0)
+			continue;
+		unsigned long s = _logentries[i].startcluster;
+		if(start>=s && start<s+_ufat_sizetocluster(_logentries[i].size))
+			return start;
+		if(s>=start && s<end)
+			end = s;
+	}
+	return end;
+}
+/******************************************************************************
+	function: _ufat_log_maxcluster
+*******************************************************************************	
+	Returns the maximum number of clusters of a log from its start cluster.
+******************************************************************************/
+unsigned long _ufat_log_maxcluster(unsigned char n)
+{
+	unsigned long end;
+	
+	if(!_fsinfo.logextent)
+		return _fsinfo.logsizecluster;
+	end = _ufat_log_gapend(n,_logentries[n].startcluster);
+	if(end<_logentries[n].startcluster)
+		return 0;
+	return end-_logentries[n].startcluster;
+}
+/******************************************************************************
+	function: _ufat_log_allocate
+*******************************************************************************	
+	With extent allocation, places a log at the start of the largest free area.
+	The free areas start at the start of the log area or at the end of a log.
+	The previous content of log n is ignored.
+	
+	Parameters:
+		n				-	Number of the log
+	
+	Returns:
+		0				-	Success
+		1				-	No free space
+******************************************************************************/
+unsigned char _ufat_log_allocate(unsigned char n)
+{
+	unsigned long start,end,best=0,bestsize=0;
+	
+	// Candidate start: the end of each log, and the start of the log area (i==lognum)
+	for(unsigned char i=0;i<=_fsinfo.lognum;i++)
+	{
+		if(i==_fsinfo.lognum)
+			start = _fsinfo.logstartcluster;
+		else
+		{
+			if(i==n || _logentries[i].size==0)
+				continue;
+			start = _logentries[i].startcluster+_ufat_sizetocluster(_logentries[i].size);
+		}
+		end = _ufat_log_gapend(n,start);
+		if(end>start && end-start>bestsize)
+		{
+			best = start;
+			bestsize = end-start;
+		}
+	}
+	if(bestsize==0)
+		return 1;
+	
+	_logentries[n].startcluster = best;
+	_logentries[n].startsector = _fsinfo.cluster_begin + (best-2)*_fsinfo.sectors_per_cluster;			// Cluster numbering starts at 2
+	fprintf_P(file_pri,PSTR("%sLog %u at cluster %lu: %lu clusters free\n"),_str_ufat,n,best,bestsize);
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log_writefat
+*******************************************************************************	
+	With extent allocation, writes the FAT chain of a log up to its size, from 
+	the FAT sectors not yet final (_log_fatdone). The last FAT sector holds the 
+	end of the chain and is written again if the log grows.
+	
+	Parameters:
+		n				-	Number of the log
+	
+	Returns:
+		0				-	Success
+		1				-	Error
+******************************************************************************/
+unsigned char _ufat_log_writefat(unsigned char n)
+{
+	unsigned long numcluster = _ufat_sizetocluster(_logentries[n].size);
+	
+	if(numcluster==0)
+		return 0;
+	if(_ufat_write_fat_chain(_fsinfo.fat_sector,_logentries[n].startcluster,_log_fatdone,numcluster))
+		return 1;
+	_log_fatdone = numcluster-128;
+	return 0;
+}
 
 /******************************************************************************
 	function: _ufat_format_fat_root
@@ -1684,6 +2579,148 @@ void ufat_print_loginfo(FILE *f)
 }
 
 
+/******************************************************************************
+	function: ufat_log_compress
+*******************************************************************************	
+	Selects whether the logs opened next are compressed (see compression).
+	
+	Parameters:
+		on			-		1 to compress the logs, 0 otherwise
+******************************************************************************/
+void ufat_log_compress(unsigned char on)
+{
+	_log_compress=on;
+}
+/******************************************************************************
+	function: ufat_log_pack
+*******************************************************************************	
+	Selects whether the records of the logs opened next are packed in sectors
+	(see packed records).
+	
+	Parameters:
+		on			-		1 to pack the records, 0 otherwise
+******************************************************************************/
+void ufat_log_pack(unsigned char on)
+{
+	_log_pack=on;
+}
+/******************************************************************************
+	function: ufat_log_ring
+*******************************************************************************	
+	Selects whether the logs opened next are rings (see ring logs).
+	
+	Parameters:
+		size		-		Size of the ring in bytes, at least UFAT_LOG_RINGMIN and 
+							limited to the space available; 0 for linear logs
+******************************************************************************/
+void ufat_log_ring(unsigned long size)
+{
+	_log_ringsize=size;
+}
+/******************************************************************************
+	function: ufat_log_trigger
+*******************************************************************************	
+	Writes a trigger record at the current position of the open log, at a 
+	record boundary. The header of a ring log indicates the trigger when the 
+	log is closed, which freezes the ring.
+******************************************************************************/
+void ufat_log_trigger(void)
+{
+	_ufat_log_index('T',timer_ms_get(),_log_index_pkt,_log_current_offset);
+	_log_ringstate=UFAT_LOG_RING_TRIGGERED;
+}
+/******************************************************************************
+	function: _ufat_log_ringheader
+*******************************************************************************	
+	Writes the header sector of the open ring log. Uses ufatblock.
+	The streaming write must not be ongoing.
+	
+	Parameters:
+		state		-		UFAT_LOG_RING_OPEN: the size is that of the complete 
+							sectors; otherwise the state of the closed log
+	Returns:
+		0			-		Success
+		1			-		Error
+******************************************************************************/
+unsigned char _ufat_log_ringheader(unsigned char state)
+{
+	memset(ufatblock,0,512);
+	if(state==UFAT_LOG_RING_OPEN)
+		sprintf_P(ufatblock,PSTR("#R,%lu,%lu,%u,%lu\n"),_log_ring,_log_current_size&0xFFFFFE00,state,(unsigned long)UFAT_LOG_RECOVERWINDOW);
+	else
+		sprintf_P(ufatblock,PSTR("#R,%lu,%lu,%u\n"),_log_ring,_log_current_size,state);
+	return sd_block_write(_logentries[_log_current_log].startsector,ufatblock)?1:0;
+}
+/******************************************************************************
+	function: _ufat_log_erase
+*******************************************************************************	
+	Erases data sectors of the open log, wrapping around the ring of a ring log.
+	
+	Parameters:
+		from		-		First data sector from the start of the log data
+		to			-		Data sector following the last one to erase; less than
+							the number of sectors of the ring after from
+	Returns:
+		0			-		Success
+		1			-		Error
+******************************************************************************/
+unsigned char _ufat_log_erase(unsigned long from,unsigned long to)
+{
+	unsigned long start=_logentries[_log_current_log].startsector;
+	
+	if(!_log_ring)
+		return sd_erase(start+from,start+to-1);
+	start++;
+	from%=_log_ring;
+	to=(to-1)%_log_ring;
+	if(from<=to)
+		return sd_erase(start+from,start+to);
+	return sd_erase(start+from,start+_log_ring-1)|sd_erase(start,start+to);
+}
+/******************************************************************************
+	function: _ufat_log_write
+*******************************************************************************	
+	Writes data to the open log, compressing it if the log is compressed, 
+	or as one record of a packed log. Do not call directly.
+	
+	Parameters:
+		buffer		-		Buffer containing the data
+		size 		-		Size of buffer
+	Returns:
+		0			-		Success
+		1			-		Error
+		2			-		Log full: nothing is written
+******************************************************************************/
+unsigned char _ufat_log_write(char *buffer,unsigned short size)
+{
+	unsigned char rv,numsect;
+	
+	if(!_log_compress && !_log_pack)
+	{
+		if(!_log_ring && _log_current_size+size>_log_maxsize)
+			return 2;
+		rv = sd_streamcache_write(buffer,size,0);
+		_log_current_size+=size;
+	}
+	else if(_log_compress)
+	{
+		// Room for the sector being filled, the worst case expansion of the data (a flag byte per 8 literals) and the last sector
+		if(!_log_ring && _log_current_size+size+(size>>3)+1024>_log_maxsize)
+			return 2;
+		rv = logzip_write(buffer,size,&numsect);
+		_log_current_size+=(unsigned long)numsect<<9;
+	}
+	else
+	{
+		// Room for the sector being filled and the sectors of the record
+		if(!_log_ring && _log_current_size+size+1024>_log_maxsize)
+			return 2;
+		rv = logpack_write(buffer,size,&numsect);
+		_log_current_size+=(unsigned long)numsect<<9;
+	}
+	_log_current_offset+=size;
+	return rv?1:0;
+}
 /******************************************************************************
 	function: _ufat_log_fputbuf
 *******************************************************************************	
@@ -1699,19 +2736,26 @@ void ufat_print_loginfo(FILE *f)
 ******************************************************************************/
 unsigned char _ufat_log_fputbuf(char *buffer,unsigned char size)
 {
-	// Check if space to write to file
-	if(_log_current_size+size>_fsinfo.logsizebytes)
+	// Index record before the data: fputbuf writes complete records
+	_ufat_log_index_check();
+	
+	unsigned char rv = _ufat_log_write(buffer,size);
+	// Log full
+	if(rv==2)
 	{
 		return EOF;
 	}
-
-	unsigned char rv = sd_streamcache_write(buffer,size,0);
-	_log_current_size+=size;
+	_log_index_pkt++;
+	_log_index_linestart=1;
 	if(rv!=0)
 	{
 		printf("Writing block to sector %lu failed\n",_log_current_sector);
 		return EOF;
 	}
+	if(UFAT_LOG_CHECKPOINT && _log_current_size-_log_checkpoint>=UFAT_LOG_CHECKPOINT)
+		_ufat_log_checkpoint();
+	if(UFAT_LOG_CHECKPOINT)
+		_ufat_log_eraseahead();
 
 	return 0;	
 	
@@ -1731,19 +2775,28 @@ unsigned char _ufat_log_fputbuf(char *buffer,unsigned char size)
 ******************************************************************************/
 int _ufat_log_fputchar(char c,FILE *f)
 {
-	// Check if space to write to file
-	if(_log_current_size>=_fsinfo.logsizebytes)
+	// Index record only at the start of a line
+	if(_log_index_linestart)
+		_ufat_log_index_check();
+	
+	unsigned char rv = _ufat_log_write(&c,1);
+	// Log full
+	if(rv==2)
 	{
 		return EOF;
 	}
-	
-	unsigned char rv = sd_streamcache_write(&c,1,0);
-	_log_current_size++;
+	_log_index_linestart = c=='\n'?1:0;
+	if(c=='\n')
+		_log_index_pkt++;
 	if(rv!=0)
 	{
 		printf("Writing block to sector %lu failed\n",_log_current_sector);
 		return EOF;
 	}
+	if(UFAT_LOG_CHECKPOINT && _log_current_size-_log_checkpoint>=UFAT_LOG_CHECKPOINT)
+		_ufat_log_checkpoint();
+	if(UFAT_LOG_CHECKPOINT)
+		_ufat_log_eraseahead();
 	return 0;
 }
 
@@ -1754,6 +2807,21 @@ void log_printstatus(FILE *f)
 	fprintf_P(f,PSTR("%sCurrent log: %u\n"),_str_ufat,_log_current_log);
 	fprintf_P(f,PSTR("\tsize: %lu\n"),_log_current_size);
 	fprintf_P(f,PSTR("\tsector: %lu\n"),_log_current_sector);
+	if(_log_ring)
+		fprintf_P(f,PSTR("\tring: %lu sectors\n"),_log_ring);
+	
+	unsigned char hwm;
+	unsigned short stall;
+	sd_streamcache_getstat(&hwm,&stall);
+	fprintf_P(f,PSTR("\tcache high-water mark: %u/%u sectors\n"),hwm,SD_CACHE_NUMSECT);
+	fprintf_P(f,PSTR("\tcache full: %u\n"),stall);
+	fprintf_P(f,PSTR("\tcheckpoints: %u, longest %u ms\n"),_log_checkpoints,_log_checkpointmax);
+	fprintf_P(f,PSTR("\terase ahead: %u steps, longest %u ms\n"),_log_erasesteps,_log_erasemax);
+	
+	unsigned short khz;
+	unsigned char fallback;
+	sd_spi_getstat(&khz,&fallback);
+	fprintf_P(f,PSTR("\tSPI clock: %u KHz (lowered %u times)\n"),khz,fallback);
 }
 
 
@@ -55,8 +55,10 @@ typedef struct {
 	// Data about logs. This information is hidden in last entry of root.
 	unsigned char lognum;
 	unsigned long logstartcluster;
-	unsigned long logsizecluster;
+	unsigned long logsizecluster;						// Maximum size of a log; with extent allocation, size of the log area
 	unsigned long logsizebytes;
+	unsigned char logextent;							// Logs allocated in extents of variable size (1) or in fixed-size slots (0)
+	unsigned char logopen;								// Number of the open log plus one, or 0 if no log is open (i.e. all logs were closed)
 	// Availability
 	unsigned char fs_available;							// Indicates that the card is formatted with the uFAT and therefore files can be written
 	unsigned char card_available;						// Indicates that low-level card initialisation is successful: an sd-card is available
@@ -95,9 +97,54 @@ typedef struct {
 	unsigned short time;
 } LOGENTRY;
 
+typedef struct {
+	unsigned long time;
+	unsigned long pkt;
+	unsigned long offset;
+} LOGINDEX;
+
 // Start location of the partition; there is no fixed rule defining where it should start except after the MBR. 
 #define _UFAT_PARTITIONSTART 8192											
 
+// Number of sectors erased when opening a log (4MB); the remainder of the log area is pre-erased with ACMD23 by the multiblock write. 
+// Use 0 to erase the entire log area when opening a log: this delays the start of logging by seconds on large cards.
+#define UFAT_LOG_ERASESIZE 8192
+
+// Time index: an index record is written in the log at most every UFAT_LOG_INDEXPERIOD ms, at a record boundary. 0 (default): no index.
+#ifndef UFAT_LOG_INDEXPERIOD
+#define UFAT_LOG_INDEXPERIOD 0
+#endif
+// Maximum number of entries of the index summary written when closing the log
+#define UFAT_LOG_INDEXSUMMARY 16
+// Maximum length of an index record line
+#define UFAT_LOG_INDEXLINE 48
+
+// Size checkpoint: the size of the open log is written to the root every UFAT_LOG_CHECKPOINT bytes, so that the log survives a power loss. 
+// The data after the last checkpoint is recovered by ufat_init. Use 0 to disable checkpoints.
+#ifndef UFAT_LOG_CHECKPOINT
+#define UFAT_LOG_CHECKPOINT 1048576l
+#endif
+
+// Erase ahead: the area of 2*UFAT_LOG_CHECKPOINT bytes after the data of a log is kept erased in steps of UFAT_LOG_ERASESTEP sectors
+#ifndef UFAT_LOG_ERASESTEP
+#define UFAT_LOG_ERASESTEP 128
+#endif
+#if UFAT_LOG_CHECKPOINT && UFAT_LOG_ERASESTEP>(UFAT_LOG_CHECKPOINT>>11)
+#error UFAT_LOG_ERASESTEP must be at most a quarter of UFAT_LOG_CHECKPOINT
+#endif
+// Recovery window: number of sectors after a checkpoint holding data of the log or erased sectors, scanned to recover a log
+#define UFAT_LOG_RECOVERWINDOW ((UFAT_LOG_CHECKPOINT+(UFAT_LOG_CHECKPOINT>>2))>>9)
+
+// Ring logs: minimum size of the ring, which must hold the area erased ahead of the data (2*UFAT_LOG_CHECKPOINT) and the data kept
+#define UFAT_LOG_RINGMIN 4194304l
+#if UFAT_LOG_RINGMIN<4*UFAT_LOG_CHECKPOINT
+#error UFAT_LOG_RINGMIN must be at least 4*UFAT_LOG_CHECKPOINT
+#endif
+// State of a ring log in its header sector
+#define UFAT_LOG_RING_OPEN 0
+#define UFAT_LOG_RING_CLOSED 1
+#define UFAT_LOG_RING_TRIGGERED 2
+
 extern FSINFO _fsinfo;														// Summary of key info here
 extern char ufatblock[];
 
@@ -108,12 +155,24 @@ unsigned char _ufat_format_mbr_boot(void);
 
 //unsigned char ufat_format_alllinkedfat(unsigned long fat_sector,unsigned long firstcluster,unsigned long totclusters);
 unsigned char _ufat_format_fat_log(unsigned char i,unsigned long fat_sector);
+unsigned char _ufat_format_fat_free(unsigned long fat_sector);
+unsigned char _ufat_write_fat_chain(unsigned long fat_sector,unsigned long firstcluster,unsigned long from,unsigned long numcluster);
+unsigned long _ufat_clustertobytes(unsigned long numcluster);
+unsigned long _ufat_sizetocluster(unsigned long size);
+unsigned long _ufat_log_gapend(unsigned char n,unsigned long start);
+unsigned long _ufat_log_maxcluster(unsigned char n);
+unsigned char _ufat_log_allocate(unsigned char n);
+unsigned char _ufat_log_writefat(unsigned char n);
 unsigned char _ufat_write_root(unsigned char numlogfile);
+void _ufat_log_checkpoint(void);
+void _ufat_log_eraseahead(void);
+unsigned char _ufat_log_iserased(char *block);
+unsigned char _ufat_log_recover(unsigned char n);
 
 unsigned char _ufat_format_fat_root(unsigned long fat_sector);
 unsigned char _ufat_mbr_boot_read(void);
 
-unsigned char ufat_format(unsigned char numlogfile);
+unsigned char ufat_format(unsigned char numlogfile,unsigned char fixedsize);
 unsigned char ufat_mbr_boot_init(void);
 unsigned char _ufat_init_sd(void);
 unsigned char _ufat_init_fs(void);
@@ -128,6 +187,11 @@ void ufat_fileentryraw2logentry(FILEENTRYRAW *fer,LOGENTRY *le);
 unsigned char ufat_init(void);
 unsigned char ufat_available(void);
 FILE *ufat_log_open(unsigned char n);
+void ufat_log_compress(unsigned char on);
+void ufat_log_pack(unsigned char on);
+void ufat_log_ring(unsigned long size);
+void ufat_log_trigger(void);
+unsigned char _ufat_log_write(char *buffer,unsigned short size);
 int _ufat_log_fputchar(char c,FILE *f);
 unsigned char _ufat_log_fputbuf(char *buffer,unsigned char size);
 unsigned char ufat_log_close(void);
@@ -137,5 +201,7 @@ void log_printstatus(FILE *f);
 unsigned long ufat_log_getmaxsize(void);
 unsigned long ufat_log_getsize(void);
 unsigned char ufat_log_getnumlogs(void);
+unsigned char ufat_log_getinfo(unsigned char n,unsigned long *startsector,unsigned long *size);
+unsigned char ufat_log_findtime(unsigned char n,unsigned long t,unsigned long *offset);
 
 #endif
\ No newline at end of file
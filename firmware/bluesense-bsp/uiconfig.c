@@ -140,6 +140,28 @@ unsigned char ConfigLoadEnableInfo(void)
 {
 	return eeprom_read_byte((uint8_t*)CONFIG_ADDR_ENABLE_INFO) ? 1:0;
 }
+void ConfigSaveStreamARQ(unsigned char arq)
+{
+	eeprom_write_byte((uint8_t*)CONFIG_ADDR_STREAM_ARQ, arq?1:0);
+}
+unsigned char ConfigLoadStreamARQ(void)
+{
+	return eeprom_read_byte((uint8_t*)CONFIG_ADDR_STREAM_ARQ)==1 ? 1:0;
+}
+void ConfigSaveStreamAxes(unsigned short axes)
+{
+	eeprom_write_byte((uint8_t*)CONFIG_ADDR_STREAM_AXES0,(axes>>0)&0xff);
+	eeprom_write_byte((uint8_t*)CONFIG_ADDR_STREAM_AXES1,(axes>>8)&0xff);
+}
+unsigned short ConfigLoadStreamAxes(void)
+{
+	unsigned short v;
+	v = eeprom_read_byte((uint8_t*)CONFIG_ADDR_STREAM_AXES1);
+	v<<=8;
+	v |= eeprom_read_byte((uint8_t*)CONFIG_ADDR_STREAM_AXES0);
+	// 9 axes; an unprogrammed EEPROM selects all axes
+	return v&0x1ff;
+}
 
 
 /******************************************************************************
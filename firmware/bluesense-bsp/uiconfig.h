@@ -31,6 +31,10 @@ void ConfigSaveEnableLCD(unsigned char lcden);
 unsigned char ConfigLoadEnableLCD(void);
 void ConfigSaveEnableInfo(unsigned char ien);
 unsigned char ConfigLoadEnableInfo(void);
+void ConfigSaveStreamARQ(unsigned char arq);
+unsigned char ConfigLoadStreamARQ(void);
+void ConfigSaveStreamAxes(unsigned short axes);
+unsigned short ConfigLoadStreamAxes(void);
 void ConfigSaveMotionMode(unsigned char mode);
 unsigned char ConfigLoadMotionMode(void);
 void ConfigSaveTSPeriod(unsigned long period);
@@ -810,6 +810,217 @@ char *format1u16(char *strptr,unsigned short a)
 	strptr++;
 	return strptr;
 }
+/******************************************************************************
+	Function: formatns16
+*******************************************************************************
+	Formats an array of signed short numbers into an ascii string.
+	The output is identical to calling format3s16 on the numbers: each number is 
+	formatted with a sign (space or minus) and 5 digits, followed by a space.
+	The string is not null terminated.
+	
+	All the numbers are converted in a single pass, extracting the digits by 
+	repeated subtraction straight into the output, which avoids the function 
+	calls and intermediate null-terminated strings of s16toa/u16toa. 
+	This is intended to format an entire row of sample data at once (e.g. the 9 
+	contiguous motion axes of MPUMOTIONDATA).
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string; 
+							must hold at least 7*n bytes
+		v			-		Numbers to format
+		n			-		Number of numbers to format
+	
+******************************************************************************/
+char *formatns16(char *strptr,const signed short *v,unsigned char n)
+{
+	unsigned short u;
+	char d;
+	
+	while(n--)
+	{
+		signed short x = *v++;
+		if(x<0)
+		{
+			*strptr++='-';
+			u=-x;
+		}
+		else
+		{
+			*strptr++=' ';
+			u=x;
+		}
+		d='0';
+		while(u>=10000)
+		{
+			u-=10000;
+			d++;
+		}
+		*strptr++=d;
+		d='0';
+		while(u>=1000)
+		{
+			u-=1000;
+			d++;
+		}
+		*strptr++=d;
+		d='0';
+		while(u>=100)
+		{
+			u-=100;
+			d++;
+		}
+		*strptr++=d;
+		d='0';
+		while(u>=10)
+		{
+			u-=10;
+			d++;
+		}
+		*strptr++=d;
+		*strptr++='0'+u;
+		*strptr++=' ';
+	}
+	return strptr;
+}
+/******************************************************************************
+	Function: formatu32
+*******************************************************************************
+	Formats 1 unsigned 32-bit number into an ascii string without leading zeros.
+	The string is not null terminated and no space is added after the number.
+	
+	This function and the other variable width formatters (formatu16, formats32, 
+	formats16, formatstr, formatstr_P) are used to assemble status text by 
+	chaining calls, which is considerably faster than sprintf with %lu.
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string
+		a			-		Number to format
+	
+******************************************************************************/
+char *formatu32(char *strptr,unsigned long a)
+{
+	char tmp[11];
+	char *p=tmp;
+	u32toa(a,tmp);
+	// Skip the leading zeros, keeping at least one digit
+	while(*p=='0' && p<tmp+9)
+		p++;
+	while(*p)
+		*strptr++=*p++;
+	return strptr;
+}
+/******************************************************************************
+	Function: formatu16
+*******************************************************************************
+	Formats 1 unsigned 16-bit number into an ascii string without leading zeros.
+	The string is not null terminated and no space is added after the number.
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string
+		a			-		Number to format
+	
+******************************************************************************/
+char *formatu16(char *strptr,unsigned short a)
+{
+	char tmp[6];
+	char *p=tmp;
+	u16toa(a,tmp);
+	while(*p=='0' && p<tmp+4)
+		p++;
+	while(*p)
+		*strptr++=*p++;
+	return strptr;
+}
+/******************************************************************************
+	Function: formats32
+*******************************************************************************
+	Formats 1 signed 32-bit number into an ascii string without leading zeros.
+	A minus sign precedes negative numbers; no sign is added to positive numbers.
+	The string is not null terminated and no space is added after the number.
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string
+		a			-		Number to format
+	
+******************************************************************************/
+char *formats32(char *strptr,signed long a)
+{
+	if(a<0)
+	{
+		*strptr++='-';
+		return formatu32(strptr,-(unsigned long)a);
+	}
+	return formatu32(strptr,a);
+}
+/******************************************************************************
+	Function: formats16
+*******************************************************************************
+	Formats 1 signed 16-bit number into an ascii string without leading zeros.
+	A minus sign precedes negative numbers; no sign is added to positive numbers.
+	The string is not null terminated and no space is added after the number.
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string
+		a			-		Number to format
+	
+******************************************************************************/
+char *formats16(char *strptr,signed short a)
+{
+	if(a<0)
+	{
+		*strptr++='-';
+		return formatu16(strptr,-(unsigned short)a);
+	}
+	return formatu16(strptr,a);
+}
+/******************************************************************************
+	Function: formatstr
+*******************************************************************************
+	Copies a null-terminated string; the null terminator is not copied.
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string
+		str			-		String to copy
+	
+******************************************************************************/
+char *formatstr(char *strptr,const char *str)
+{
+	while(*str)
+		*strptr++=*str++;
+	return strptr;
+}
+/******************************************************************************
+	Function: formatstr_P
+*******************************************************************************
+	Copies a null-terminated string located in program memory; the null 
+	terminator is not copied.
+	
+	The function returns a pointer to the first byte after the end of the string.
+	
+	Parameters:
+		strptr		-		pointer to the buffer that will receive the string
+		str			-		String in program memory to copy
+	
+******************************************************************************/
+char *formatstr_P(char *strptr,const char *str)
+{
+	char c;
+	while((c=pgm_read_byte(str++)))
+		*strptr++=c;
+	return strptr;
+}
 /******************************************************************************
 	Function: format4fract16
 *******************************************************************************
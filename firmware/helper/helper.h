@@ -62,6 +62,13 @@ unsigned char TimeAddSeconds(unsigned short hour, unsigned short min, unsigned s
 char *format3s16(char *strptr,signed short x,signed short y,signed short z);
 char *format1u32(char *strptr,unsigned long a);
 char *format1u16(char *strptr,unsigned short a);
+char *formatns16(char *strptr,const signed short *v,unsigned char n);
+char *formatu32(char *strptr,unsigned long a);
+char *formatu16(char *strptr,unsigned short a);
+char *formats32(char *strptr,signed long a);
+char *formats16(char *strptr,signed short a);
+char *formatstr(char *strptr,const char *str);
+char *formatstr_P(char *strptr,const char *str);
 #ifdef __cplusplus
 char *format4qfloat(char *strptr,float q0,float q1,float q2,float q3);
 char *format3float(char *strptr,float q0,float q1,float q2);
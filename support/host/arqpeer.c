@@ -0,0 +1,243 @@
+/*
+	arqpeer - host side of the BlueSense reliable streaming (ARQ) protocol
+
+	Reads the byte stream of a BlueSense node in reliable streaming mode (command r,1),
+	validates the sequence-numbered frames, delivers their payload in order on stdout,
+	and sends cumulative acknowledgements (a,<seq>) back to the node.
+	Bytes outside of frames (command replies, status, debug prints) are written to stderr.
+
+	Usage:
+		arqpeer <device> [baud]		Connect to a serial device (e.g. /dev/rfcomm0, /dev/ttyUSB0)
+		arqpeer -p					Create a pseudo-terminal and print its name; a test program or
+									simulator can open it in place of the node
+
+	Build:
+		gcc -O2 -o arqpeer arqpeer.c
+
+	Frame format (see firmware/bluesense-bsp/arq.c):
+
+		'D' 'A' 'R' seq_lo seq_hi size payload[size] chk_lo chk_hi
+*/
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+
+#define ARQ_HDRSIZE			6
+#define ARQ_FRAMEOVERHEAD	(ARQ_HDRSIZE+2)
+// Send an acknowledgement after this many frames, or after ACK_PERIOD ms if frames were received
+#define ACK_FRAMES			8
+#define ACK_PERIOD			50
+
+unsigned short fletcher16(const unsigned char *data,int len)
+{
+	unsigned short sum1=0xff,sum2=0xff;
+	while(len)
+	{
+		int tlen = len>21?21:len;
+		len-=tlen;
+		do
+		{
+			sum1 += *data++;
+			sum2 += sum1;
+		}
+		while(--tlen);
+		sum1 = (sum1&0xff)+(sum1>>8);
+		sum2 = (sum2&0xff)+(sum2>>8);
+	}
+	sum1 = (sum1&0xff)+(sum1>>8);
+	sum2 = (sum2&0xff)+(sum2>>8);
+	return sum1<<8|sum2;
+}
+
+unsigned long time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000ul+ts.tv_nsec/1000000ul;
+}
+
+speed_t baud2speed(long baud)
+{
+	switch(baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		default: return 0;
+	}
+}
+
+int open_device(const char *dev,long baud)
+{
+	struct termios tio;
+	int fd = open(dev,O_RDWR|O_NOCTTY);
+	if(fd<0)
+	{
+		perror(dev);
+		return -1;
+	}
+	if(tcgetattr(fd,&tio)==0)
+	{
+		cfmakeraw(&tio);
+		if(baud)
+		{
+			speed_t s = baud2speed(baud);
+			if(!s)
+			{
+				fprintf(stderr,"Unsupported baud rate %ld\n",baud);
+				close(fd);
+				return -1;
+			}
+			cfsetispeed(&tio,s);
+			cfsetospeed(&tio,s);
+		}
+		tcsetattr(fd,TCSANOW,&tio);
+	}
+	return fd;
+}
+
+int open_pty(void)
+{
+	struct termios tio;
+	int fd = posix_openpt(O_RDWR|O_NOCTTY);
+	if(fd<0 || grantpt(fd) || unlockpt(fd))
+	{
+		perror("pty");
+		return -1;
+	}
+	if(tcgetattr(fd,&tio)==0)
+	{
+		cfmakeraw(&tio);
+		tcsetattr(fd,TCSANOW,&tio);
+	}
+	fprintf(stderr,"arqpeer: pseudo-terminal: %s\n",ptsname(fd));
+	return fd;
+}
+
+void send_ack(int fd,unsigned short seq)
+{
+	char str[16];
+	int n = snprintf(str,sizeof(str),"a,%u\n",seq);
+	if(write(fd,str,n)!=n)
+		perror("write");
+}
+
+int main(int argc,char **argv)
+{
+	int fd;
+	unsigned char buf[4096];
+	int n=0;
+	unsigned short expected=0;
+	unsigned long frames_ok=0,frames_dup=0,frames_bad=0;
+	unsigned pending_ack=0;
+	unsigned long t_lastack;
+
+	if(argc<2)
+	{
+		fprintf(stderr,"Usage: %s <device> [baud] | -p\n",argv[0]);
+		return 1;
+	}
+	if(strcmp(argv[1],"-p")==0)
+		fd = open_pty();
+	else
+		fd = open_device(argv[1],argc>2?atol(argv[2]):0);
+	if(fd<0)
+		return 1;
+
+	t_lastack = time_ms();
+	while(1)
+	{
+		struct pollfd pfd = {fd,POLLIN,0};
+		int rv = poll(&pfd,1,ACK_PERIOD);
+		if(rv<0)
+		{
+			perror("poll");
+			break;
+		}
+		if(rv>0)
+		{
+			int r = read(fd,buf+n,sizeof(buf)-n);
+			if(r<=0)
+			{
+				// A pseudo-terminal returns an error until the other side is opened
+				if(strcmp(argv[1],"-p")==0)
+				{
+					usleep(100000);
+					continue;
+				}
+				break;
+			}
+			n+=r;
+		}
+
+		// Extract frames from the buffer
+		int i=0;
+		while(i<n)
+		{
+			if(buf[i]!='D' || (i+1<n && buf[i+1]!='A') || (i+2<n && buf[i+2]!='R'))
+			{
+				fputc(buf[i],stderr);
+				i++;
+				continue;
+			}
+			// Incomplete header or frame: wait for more data
+			if(n-i<ARQ_HDRSIZE || n-i<buf[i+5]+ARQ_FRAMEOVERHEAD)
+				break;
+			int size = buf[i+5];
+			unsigned short seq = buf[i+3]|(buf[i+4]<<8);
+			unsigned short chk = buf[i+ARQ_HDRSIZE+size]|(buf[i+ARQ_HDRSIZE+size+1]<<8);
+			if(fletcher16(buf+i,ARQ_HDRSIZE+size)!=chk)
+			{
+				// Corrupted: skip the header byte and resynchronise
+				frames_bad++;
+				fputc(buf[i],stderr);
+				i++;
+				continue;
+			}
+			if(seq==expected)
+			{
+				fwrite(buf+i+ARQ_HDRSIZE,1,size,stdout);
+				expected++;
+				frames_ok++;
+				pending_ack++;
+			}
+			else
+			{
+				// Out of order or duplicate: acknowledge again what was received so far
+				frames_dup++;
+				pending_ack++;
+			}
+			i+=size+ARQ_FRAMEOVERHEAD;
+		}
+		memmove(buf,buf+i,n-i);
+		n-=i;
+		// The buffer is full of non-frame data: discard it
+		if(n==sizeof(buf))
+			n=0;
+		fflush(stdout);
+
+		unsigned long t = time_ms();
+		if(pending_ack>=ACK_FRAMES || (pending_ack && t-t_lastack>=ACK_PERIOD))
+		{
+			send_ack(fd,expected);
+			pending_ack=0;
+			t_lastack=t;
+		}
+	}
+	fprintf(stderr,"arqpeer: frames: %lu out of order: %lu corrupted: %lu\n",frames_ok,frames_dup,frames_bad);
+	close(fd);
+	return 0;
+}
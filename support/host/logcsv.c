@@ -0,0 +1,182 @@
+/*
+	logcsv - converts a compact log of a BlueSense node to CSV
+
+	Compact logs are written with the command L,<lognum>,<container>,1 (see firmware/bluesense-bsp/mode_sample.c). They start
+	with a header describing the fields of the records, written again when the fields change:
+
+		#H,BSC,<version>,<recordsize>,<rate>
+		#F,<name>,<type>,<num>,<den>,<unit>			one line per field; type is u16, s16 or u32, little endian
+		#D
+
+	followed by records made of the sync byte 0xB5 and <recordsize> bytes of fields. The other text lines starting with '#'
+	(e.g. the index records of the log) are skipped. A CSV header row is printed after each header of the log.
+
+	Usage:
+		logcsv <input> [-r]			Reads a log (- for stdin) and writes CSV to stdout. The values are scaled to
+									the units of the header, unless -r (raw values) is given
+
+	Logs written as containers are first demultiplexed: muxdemux <log> -c 2 | logcsv -     (motion; channel 3 for ADC)
+
+	Build:
+		gcc -O2 -o logcsv logcsv.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPACT_SYNC		0xB5
+#define COMPACT_MAXFIELD	64
+
+typedef struct {
+	char name[16];
+	char unit[16];
+	int type;							// 0: u16, 1: s16, 2: u32
+	unsigned num,den;
+} FIELD;
+
+FIELD fields[COMPACT_MAXFIELD];
+int numfields,recordsize;
+int valid;								// Nonzero once a complete header was read
+
+static int typesize(int type)
+{
+	return type==2?4:2;
+}
+
+// Parses a header line; returns nonzero if the line is not a valid header line
+static int parseline(char *line)
+{
+	char type[8];
+	unsigned version,size,rate;
+	FIELD *f;
+
+	if(strncmp(line,"#H,",3)==0)
+	{
+		valid = 0;
+		numfields = 0;
+		if(sscanf(line,"#H,BSC,%u,%u,%u",&version,&size,&rate)!=3 || version!=1)
+			return 1;
+		recordsize = size;
+		return 0;
+	}
+	if(strncmp(line,"#F,",3)==0)
+	{
+		if(numfields>=COMPACT_MAXFIELD)
+			return 1;
+		f = &fields[numfields];
+		f->unit[0] = 0;
+		if(sscanf(line,"#F,%15[^,],%7[^,],%u,%u,%15[^\n]",f->name,type,&f->num,&f->den,f->unit)<4 || f->den==0)
+			return 1;
+		if(strcmp(type,"u16")==0) f->type=0;
+		else if(strcmp(type,"s16")==0) f->type=1;
+		else if(strcmp(type,"u32")==0) f->type=2;
+		else return 1;
+		numfields++;
+		return 0;
+	}
+	if(strncmp(line,"#D",2)==0)
+	{
+		int size=0;
+		for(int i=0;i<numfields;i++)
+			size+=typesize(fields[i].type);
+		if(size!=recordsize)
+		{
+			fprintf(stderr,"logcsv: header fields (%d bytes) do not match the record size (%d bytes)\n",size,recordsize);
+			return 1;
+		}
+		for(int i=0;i<numfields;i++)
+		{
+			if(fields[i].unit[0])
+				printf("%s%s[%s]",i?",":"",fields[i].name,fields[i].unit);
+			else
+				printf("%s%s",i?",":"",fields[i].name);
+		}
+		printf("\n");
+		valid = 1;
+	}
+	return 0;
+}
+
+static void printrecord(const unsigned char *r,int raw)
+{
+	for(int i=0;i<numfields;i++)
+	{
+		FIELD *f = &fields[i];
+		long v;
+
+		if(f->type==2)
+			v = (unsigned long)(r[0]|(r[1]<<8)|((unsigned long)r[2]<<16)|((unsigned long)r[3]<<24));
+		else if(f->type==1)
+			v = (short)(r[0]|(r[1]<<8));
+		else
+			v = r[0]|(r[1]<<8);
+		r+=typesize(f->type);
+
+		if(i)
+			putchar(',');
+		if(raw || f->den==1)
+			printf("%ld",v*(raw?1:(long)f->num));
+		else
+			printf("%.6g",(double)v*f->num/f->den);
+	}
+	putchar('\n');
+}
+
+int main(int argc,char **argv)
+{
+	FILE *in;
+	int c,raw=0;
+	unsigned long records=0,skipped=0;
+	unsigned char record[256];
+	char line[256];
+
+	if(argc<2)
+	{
+		fprintf(stderr,"Usage: %s <input> [-r]\n",argv[0]);
+		return 1;
+	}
+	raw = argc>2 && strcmp(argv[2],"-r")==0;
+	in = strcmp(argv[1],"-")==0 ? stdin : fopen(argv[1],"rb");
+	if(!in)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	while((c=getc(in))!=EOF)
+	{
+		if(c=='#')
+		{
+			// Text line between records
+			int n=0;
+			line[n++]=c;
+			while((c=getc(in))!=EOF && c!='\n')
+				if(n<(int)sizeof(line)-1)
+					line[n++]=c;
+			line[n]=0;
+			if(parseline(line))
+			{
+				fprintf(stderr,"logcsv: invalid header line: %s\n",line);
+				valid=0;
+			}
+			continue;
+		}
+		if(c!=COMPACT_SYNC || !valid)
+		{
+			skipped++;
+			continue;
+		}
+		if(fread(record,1,recordsize,in)!=(size_t)recordsize)
+		{
+			// Record cut by the end of the log
+			skipped++;
+			break;
+		}
+		printrecord(record,raw);
+		records++;
+	}
+	fprintf(stderr,"logcsv: records: %lu skipped bytes: %lu\n",records,skipped);
+	if(in!=stdin)
+		fclose(in);
+	return 0;
+}
@@ -0,0 +1,717 @@
+/*
+	logdecode - decodes a packed compact log of a BlueSense node on all cores into one array per channel
+
+	The log must be compact (command L,<lognum>,<container>,1, see logcsv) with its records packed in sectors (compress=2, see
+	firmware/bluesense-bsp/logpack.c): each sector holds whole records and carries a sequence number and a CRC, hence the sectors
+	are decoded independently. The log is split across threads in four passes:
+
+		1. each thread checks the CRC of a range of sectors
+		2. the valid sectors are ordered by sequence number (duplicates dropped, gaps reported) and each thread copies the records
+		   of a range of the ordered sectors to the unpacked log
+		3. each thread finds the compact headers (#H,BSC) of its range; the headers are parsed and the channels are the union of
+		   the fields of all the headers, by name
+		4. each thread decodes the records of its range with the header preceding the range, into its own arrays
+
+	The arrays of the threads are then written in order: <prefix>.<channel>.f64 holds one little endian double per record, in
+	the units of the header (raw values with -r), NaN when the field is not in the header of the record. The channels, units,
+	number of records, and the gaps of the sample counter (field pkt) including across the ranges of the threads are printed
+	on stderr. The arrays can be loaded directly, e.g. numpy.fromfile('log.ax.f64') or fread(fopen('log.ax.f64'),inf,'double').
+
+	With -c the arrays are written to one columnar file instead, which is memory mapped by the analyses
+	(support/matlab/read_columnar.m, or numpy.memmap with the offsets of the channel table). All the fields are little endian,
+	and the arrays and tables start at multiples of 64 bytes:
+
+		header (64 bytes)		"BSCOL\0\0\0", version (u32, 1), channels (u32), rows (u64), rows per chunk (u32), chunks (u32),
+								time channel (s32, field t, -1 if none), label channel (s32, field label, -1 if none),
+								offset of the chunk statistics (u64), zero padding
+		channel table			per channel (64 bytes): name (16 chars), unit (16 chars), offset of the array (u64), type (u32,
+								1: double), zero padding
+		chunk statistics		per chunk, per channel: minimum and maximum (double) of the rows of the chunk, NaN if no value;
+								the time range of a chunk is the minimum and maximum of the time channel
+		arrays					per channel: rows doubles
+
+	The chunk statistics let the analyses skip the chunks outside a time range or a range of values without reading them.
+
+	Usage:
+		logdecode [-j <threads>] [-r] <input> <prefix>		Decodes a log extracted from the card. threads defaults to the number of cores
+		logdecode [-j <threads>] [-r] [-k <rows>] -c <input> <output>
+															Writes the columnar file output, with chunks of rows (default 65536)
+
+	Build:
+		gcc -O2 -pthread -o logdecode logdecode.c
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOGPACK_MAGIC		0xD5
+#define LOGPACK_VERSION		1
+#define LOGPACK_HDRSIZE		10
+#define LOGPACK_TRLSIZE		4
+#define LOGPACK_PAYLOAD		(512-LOGPACK_HDRSIZE-LOGPACK_TRLSIZE)
+
+#define COMPACT_SYNC		0xB5
+#define COMPACT_MAXFIELD	64
+#define MAXCHANNEL			64
+#define MAXTHREAD			256
+#define COLUMNAR_ALIGN		64
+#define COLUMNAR_TYPE_F64	1
+
+typedef struct {
+	char name[16];
+	char unit[16];
+	int type;							// 0: u16, 1: s16, 2: u32
+	unsigned num,den;
+	int channel;						// Index of the output array
+} FIELD;
+
+typedef struct {
+	unsigned long offset,end;			// Offset of the #H line and after the #D line in the unpacked log
+	int valid;
+	int recordsize,numfields;
+	FIELD fields[COMPACT_MAXFIELD];
+	int pkt;							// Field of the sample counter, -1 if none
+} HEADER;
+
+typedef struct {
+	char name[16];
+	char unit[16];
+} CHANNEL;
+
+typedef struct {
+	unsigned long seq;
+	int size;							// Bytes of records, -1 if the sector is invalid
+	unsigned long offset;				// Offset of the records in the unpacked log
+} SECTOR;
+
+typedef struct {
+	int id;
+	unsigned long first,last;			// Range of sectors (pass 1) or of ordered sectors (pass 2)
+	unsigned long start,end;			// Range of the unpacked log (passes 3 and 4)
+	unsigned long *hdr;					// Offsets of the headers found in pass 3
+	int numhdr,maxhdr;
+	double *col[MAXCHANNEL];			// Decoded records
+	unsigned long rows,maxrows;
+	unsigned long skipped,pktgaps;
+	unsigned long leading;				// Bytes skipped at the start of the range
+	unsigned long pos;					// End of the last record or line decoded, possibly beyond the range
+	int haspkt;
+	unsigned long firstpkt,lastpkt;
+	int lastpkttype;
+} WORKER;
+
+const unsigned char *image;
+unsigned long numsectors;
+SECTOR *sectors;
+unsigned long *order,numorder;
+unsigned char *stream;
+unsigned long streamsize;
+HEADER *headers;
+int numheaders;
+CHANNEL channels[MAXCHANNEL];
+int numchannels;
+int numthreads;
+int raw;
+WORKER workers[MAXTHREAD];
+unsigned long chunkrows=65536,numchunks;
+double *stats;							// Chunk statistics: minimum and maximum per chunk and channel
+
+static int typesize(int type)
+{
+	return type==2?4:2;
+}
+
+static unsigned long le32(const unsigned char *p)
+{
+	return p[0]|(p[1]<<8)|((unsigned long)p[2]<<16)|((unsigned long)p[3]<<24);
+}
+
+static unsigned short crc16(const unsigned char *p,int n)
+{
+	unsigned short crc=0;
+	while(n--)
+	{
+		crc ^= (unsigned short)*p++<<8;
+		for(int i=0;i<8;i++)
+			crc = crc&0x8000 ? (crc<<1)^0x1021 : crc<<1;
+	}
+	return crc;
+}
+
+// Runs a pass on all the workers
+static void run(void *(*pass)(void*))
+{
+	pthread_t t[MAXTHREAD];
+	for(int i=0;i<numthreads;i++)
+		pthread_create(&t[i],0,pass,&workers[i]);
+	for(int i=0;i<numthreads;i++)
+		pthread_join(t[i],0);
+}
+
+// Pass 1: checks the sectors
+static void *pass_check(void *arg)
+{
+	WORKER *w = (WORKER*)arg;
+	for(unsigned long i=w->first;i<w->last;i++)
+	{
+		const unsigned char *s = image+i*512;
+		SECTOR *sec = &sectors[i];
+		int n = s[508]|(s[509]<<8);
+		sec->size = -1;
+		if(s[0]!=LOGPACK_MAGIC || s[1]!=LOGPACK_VERSION || n>LOGPACK_PAYLOAD || crc16(s,510)!=(s[510]|(s[511]<<8)))
+			continue;
+		sec->seq = le32(s+2);
+		sec->size = n;
+	}
+	return 0;
+}
+
+// Pass 2: copies the records of the ordered sectors to the unpacked log
+static void *pass_copy(void *arg)
+{
+	WORKER *w = (WORKER*)arg;
+	for(unsigned long i=w->first;i<w->last;i++)
+	{
+		SECTOR *sec = &sectors[order[i]];
+		memcpy(stream+sec->offset,image+order[i]*512+LOGPACK_HDRSIZE,sec->size);
+	}
+	return 0;
+}
+
+// Pass 3: finds the headers starting in the range
+static void *pass_headers(void *arg)
+{
+	WORKER *w = (WORKER*)arg;
+	static const char tag[]="#H,BSC,";
+	unsigned long pos=w->start;
+	unsigned long limit = w->end+sizeof(tag)-2<streamsize ? w->end+sizeof(tag)-2 : streamsize;
+
+	while(pos<limit)
+	{
+		unsigned char *p = (unsigned char*)memmem(stream+pos,limit-pos,tag,sizeof(tag)-1);
+		if(!p)
+			break;
+		if(w->numhdr==w->maxhdr)
+		{
+			w->maxhdr = w->maxhdr?w->maxhdr*2:16;
+			w->hdr = (unsigned long*)realloc(w->hdr,w->maxhdr*sizeof(unsigned long));
+		}
+		w->hdr[w->numhdr++] = p-stream;
+		pos = p-stream+1;
+	}
+	return 0;
+}
+
+// Parses a header line; returns nonzero if the line is not a valid header line
+static int parseline(HEADER *h,const char *line)
+{
+	char type[8];
+	unsigned version,size,rate;
+	FIELD *f;
+
+	if(strncmp(line,"#H,",3)==0)
+	{
+		if(sscanf(line,"#H,BSC,%u,%u,%u",&version,&size,&rate)!=3 || version!=1)
+			return 1;
+		h->recordsize = size;
+		return 0;
+	}
+	if(strncmp(line,"#F,",3)==0)
+	{
+		if(h->numfields>=COMPACT_MAXFIELD)
+			return 1;
+		f = &h->fields[h->numfields];
+		f->unit[0] = 0;
+		if(sscanf(line,"#F,%15[^,],%7[^,],%u,%u,%15[^\n]",f->name,type,&f->num,&f->den,f->unit)<4 || f->den==0)
+			return 1;
+		if(strcmp(type,"u16")==0) f->type=0;
+		else if(strcmp(type,"s16")==0) f->type=1;
+		else if(strcmp(type,"u32")==0) f->type=2;
+		else return 1;
+		h->numfields++;
+		return 0;
+	}
+	if(strncmp(line,"#D",2)==0)
+	{
+		int size=0;
+		for(int i=0;i<h->numfields;i++)
+			size+=typesize(h->fields[i].type);
+		if(size!=h->recordsize)
+		{
+			fprintf(stderr,"logdecode: header at offset %lu: fields (%d bytes) do not match the record size (%d bytes)\n",h->offset,size,h->recordsize);
+			return 1;
+		}
+		h->valid = 1;
+		return 0;
+	}
+	return 1;
+}
+
+// Parses the header block at h->offset and maps its fields to the channels
+static void parseheader(HEADER *h)
+{
+	char line[256];
+	unsigned long pos=h->offset;
+
+	h->valid = 0;
+	h->numfields = 0;
+	h->pkt = -1;
+	while(pos<streamsize && stream[pos]=='#' && !h->valid)
+	{
+		int n=0;
+		while(pos<streamsize && stream[pos]!='\n')
+		{
+			if(n<(int)sizeof(line)-1)
+				line[n++]=stream[pos];
+			pos++;
+		}
+		pos++;
+		line[n]=0;
+		if(parseline(h,line))
+		{
+			fprintf(stderr,"logdecode: invalid header line at offset %lu: %s\n",pos,line);
+			break;
+		}
+	}
+	h->end = pos;
+	if(!h->valid)
+		return;
+	for(int i=0;i<h->numfields;i++)
+	{
+		FIELD *f = &h->fields[i];
+		int c;
+		for(c=0;c<numchannels && strcmp(channels[c].name,f->name);c++);
+		if(c==MAXCHANNEL)
+		{
+			fprintf(stderr,"logdecode: more than %d channels: %s ignored\n",MAXCHANNEL,f->name);
+			f->channel = -1;
+			continue;
+		}
+		if(c==numchannels)
+		{
+			strcpy(channels[c].name,f->name);
+			strcpy(channels[c].unit,raw?"":f->unit);
+			numchannels++;
+		}
+		f->channel = c;
+		if(strcmp(f->name,"pkt")==0)
+			h->pkt = i;
+	}
+}
+
+// Appends a record to the arrays of a worker
+static void decoderecord(WORKER *w,const HEADER *h,const unsigned char *r)
+{
+	if(w->rows==w->maxrows)
+	{
+		w->maxrows = w->maxrows?w->maxrows*2:65536;
+		for(int c=0;c<numchannels;c++)
+			w->col[c] = (double*)realloc(w->col[c],w->maxrows*sizeof(double));
+	}
+	for(int c=0;c<numchannels;c++)
+		w->col[c][w->rows] = NAN;
+	for(int i=0;i<h->numfields;i++)
+	{
+		const FIELD *f = &h->fields[i];
+		long v;
+
+		if(f->type==2)
+			v = (long)le32(r);
+		else if(f->type==1)
+			v = (short)(r[0]|(r[1]<<8));
+		else
+			v = r[0]|(r[1]<<8);
+		r+=typesize(f->type);
+
+		if(i==h->pkt)
+		{
+			// Sample counter: u16 or u32, wrapping
+			unsigned long mask = f->type==2?0xFFFFFFFFul:0xFFFFul;
+			if(!w->haspkt)
+			{
+				w->haspkt = 1;
+				w->firstpkt = v;
+			}
+			else if((unsigned long)v!=((w->lastpkt+1)&mask))
+				w->pktgaps++;
+			w->lastpkt = v;
+			w->lastpkttype = f->type;
+		}
+		if(f->channel>=0)
+			w->col[f->channel][w->rows] = raw?(double)v:(double)v*f->num/f->den;
+	}
+	w->rows++;
+}
+
+// Pass 4: decodes the records starting in the range
+static void *pass_decode(void *arg)
+{
+	WORKER *w = (WORKER*)arg;
+	unsigned long pos=w->start;
+	int cur=-1,next=0;
+
+	// Header preceding the range, and first header of the range
+	while(next<numheaders && headers[next].offset<w->start)
+		cur=next++;
+	while(pos<w->end)
+	{
+		unsigned char c=stream[pos];
+		if(c=='#')
+		{
+			// Header or other text line between records
+			if(next<numheaders && headers[next].offset==pos)
+			{
+				cur = next++;
+				pos = headers[cur].end;
+				continue;
+			}
+			while(pos<streamsize && stream[pos]!='\n')
+				pos++;
+			pos++;
+			continue;
+		}
+		if(c!=COMPACT_SYNC || cur<0 || !headers[cur].valid)
+		{
+			// E.g. the end of a text line started in the preceding range, or records following an invalid header
+			if(w->skipped==pos-w->start)
+				w->leading++;
+			w->skipped++;
+			pos++;
+			continue;
+		}
+		if(pos+1+headers[cur].recordsize>streamsize)
+		{
+			// Record cut by the end of the log
+			w->skipped+=streamsize-pos;
+			break;
+		}
+		decoderecord(w,&headers[cur],stream+pos+1);
+		pos+=1+headers[cur].recordsize;
+	}
+	w->pos = pos;
+	return 0;
+}
+
+// Chunk statistics of the channels of a worker
+static void *pass_stats(void *arg)
+{
+	WORKER *w = (WORKER*)arg;
+	for(int c=w->id;c<numchannels;c+=numthreads)
+	{
+		unsigned long row=0;
+		for(unsigned long k=0;k<numchunks;k++)
+		{
+			stats[(k*numchannels+c)*2] = NAN;
+			stats[(k*numchannels+c)*2+1] = NAN;
+		}
+		for(int i=0;i<numthreads;i++)
+			for(unsigned long j=0;j<workers[i].rows;j++,row++)
+			{
+				double v = workers[i].col[c][j];
+				double *st = &stats[(row/chunkrows*numchannels+c)*2];
+				if(isnan(v))
+					continue;
+				if(isnan(st[0]) || v<st[0])
+					st[0] = v;
+				if(isnan(st[1]) || v>st[1])
+					st[1] = v;
+			}
+	}
+	return 0;
+}
+
+static void put32(unsigned char *p,unsigned long v)
+{
+	for(int i=0;i<4;i++,v>>=8)
+		p[i]=v&0xFF;
+}
+static void put64(unsigned char *p,unsigned long long v)
+{
+	for(int i=0;i<8;i++,v>>=8)
+		p[i]=v&0xFF;
+}
+static unsigned long long align(unsigned long long o)
+{
+	return (o+COLUMNAR_ALIGN-1)/COLUMNAR_ALIGN*COLUMNAR_ALIGN;
+}
+static int findchannel(const char *name)
+{
+	for(int c=0;c<numchannels;c++)
+		if(strcmp(channels[c].name,name)==0)
+			return c;
+	return -1;
+}
+
+// Writes the columnar file; returns nonzero on error
+static int writecolumnar(const char *name,unsigned long rows)
+{
+	FILE *out;
+	unsigned char hdr[COLUMNAR_ALIGN],pad[COLUMNAR_ALIGN];
+	unsigned long long offset,statsoffset;
+
+	if(!(out=fopen(name,"wb")))
+	{
+		perror(name);
+		return 1;
+	}
+	numchunks = (rows+chunkrows-1)/chunkrows;
+	stats = (double*)malloc((numchunks?numchunks:1)*numchannels*2*sizeof(double));
+	run(pass_stats);
+
+	statsoffset = align(COLUMNAR_ALIGN+(unsigned long long)numchannels*COLUMNAR_ALIGN);
+	offset = align(statsoffset+(unsigned long long)numchunks*numchannels*2*sizeof(double));
+	memset(hdr,0,sizeof(hdr));
+	memcpy(hdr,"BSCOL",5);
+	put32(hdr+8,1);
+	put32(hdr+12,numchannels);
+	put64(hdr+16,rows);
+	put32(hdr+24,chunkrows);
+	put32(hdr+28,numchunks);
+	put32(hdr+32,(unsigned long)findchannel("t"));
+	put32(hdr+36,(unsigned long)findchannel("label"));
+	put64(hdr+40,statsoffset);
+	fwrite(hdr,1,sizeof(hdr),out);
+	for(int c=0;c<numchannels;c++)
+	{
+		memset(hdr,0,sizeof(hdr));
+		memcpy(hdr,channels[c].name,strlen(channels[c].name));
+		memcpy(hdr+16,channels[c].unit,strlen(channels[c].unit));
+		put64(hdr+32,offset);
+		put32(hdr+40,COLUMNAR_TYPE_F64);
+		fwrite(hdr,1,sizeof(hdr),out);
+		offset = align(offset+(unsigned long long)rows*sizeof(double));
+	}
+	// The host is little endian, as the doubles are written as is
+	memset(pad,0,sizeof(pad));
+	fwrite(pad,1,statsoffset-COLUMNAR_ALIGN-numchannels*COLUMNAR_ALIGN,out);
+	fwrite(stats,sizeof(double),numchunks*numchannels*2,out);
+	offset = statsoffset+numchunks*numchannels*2*sizeof(double);
+	for(int c=0;c<numchannels;c++)
+	{
+		fwrite(pad,1,align(offset)-offset,out);
+		offset = align(offset);
+		for(int i=0;i<numthreads;i++)
+			fwrite(workers[i].col[c],sizeof(double),workers[i].rows,out);
+		offset += (unsigned long long)rows*sizeof(double);
+		fprintf(stderr,"%s%s%s%s\n",channels[c].name,channels[c].unit[0]?" [":"",channels[c].unit,channels[c].unit[0]?"]":"");
+	}
+	if(fclose(out))
+	{
+		perror(name);
+		return 1;
+	}
+	fprintf(stderr,"logdecode: %s: %lu rows in %lu chunks\n",name,rows,numchunks);
+	return 0;
+}
+
+static int cmpseq(const void *a,const void *b)
+{
+	const SECTOR *sa=&sectors[*(const unsigned long*)a],*sb=&sectors[*(const unsigned long*)b];
+	if(sa->seq!=sb->seq)
+		return sa->seq<sb->seq?-1:1;
+	return *(const unsigned long*)a<*(const unsigned long*)b?-1:1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+int main(int argc,char **argv)
+{
+	int fd,arg=1,columnar=0;
+	struct stat st;
+	unsigned long invalid=0,duplicates=0,gaps=0,rows=0,skipped=0,pktgaps=0;
+	double t0=now();
+
+	numthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	for(;arg<argc && argv[arg][0]=='-' && argv[arg][1];arg++)
+	{
+		if(strcmp(argv[arg],"-j")==0 && arg+1<argc)
+			numthreads = atoi(argv[++arg]);
+		else if(strcmp(argv[arg],"-r")==0)
+			raw = 1;
+		else if(strcmp(argv[arg],"-c")==0)
+			columnar = 1;
+		else if(strcmp(argv[arg],"-k")==0 && arg+1<argc && atol(argv[arg+1])>0)
+			chunkrows = atol(argv[++arg]);
+		else
+			break;
+	}
+	if(argc-arg!=2)
+	{
+		fprintf(stderr,"Usage: %s [-j <threads>] [-r] <input> <prefix> | [-j <threads>] [-r] [-k <rows>] -c <input> <output>\n",argv[0]);
+		return 1;
+	}
+	if(numthreads<1)
+		numthreads = 1;
+	if(numthreads>MAXTHREAD)
+		numthreads = MAXTHREAD;
+
+	fd = open(argv[arg],O_RDONLY);
+	if(fd<0 || fstat(fd,&st))
+	{
+		perror(argv[arg]);
+		return 1;
+	}
+	numsectors = st.st_size/512;
+	if(numsectors==0)
+	{
+		fprintf(stderr,"logdecode: %s is empty\n",argv[arg]);
+		return 1;
+	}
+	image = (const unsigned char*)mmap(0,numsectors*512,PROT_READ,MAP_PRIVATE,fd,0);
+	if(image==MAP_FAILED)
+	{
+		perror(argv[arg]);
+		return 1;
+	}
+	if(image[0]!=LOGPACK_MAGIC)
+	{
+		fprintf(stderr,"logdecode: %s is not a packed log (L,<lognum>,<container>,1,2)\n",argv[arg]);
+		return 1;
+	}
+	if((unsigned long)numthreads>numsectors)
+		numthreads = numsectors;
+	for(int i=0;i<numthreads;i++)
+		workers[i].id = i;
+
+	// Pass 1
+	sectors = (SECTOR*)malloc(numsectors*sizeof(SECTOR));
+	for(int i=0;i<numthreads;i++)
+	{
+		workers[i].first = numsectors*i/numthreads;
+		workers[i].last = numsectors*(i+1)/numthreads;
+	}
+	run(pass_check);
+
+	// Order the valid sectors by sequence number
+	order = (unsigned long*)malloc(numsectors*sizeof(unsigned long));
+	for(unsigned long i=0;i<numsectors;i++)
+	{
+		if(sectors[i].size>=0)
+			order[numorder++]=i;
+		else
+		{
+			fprintf(stderr,"logdecode: invalid sector %lu\n",i);
+			invalid++;
+		}
+	}
+	qsort(order,numorder,sizeof(unsigned long),cmpseq);
+	unsigned long n=0;
+	for(unsigned long i=0;i<numorder;i++)
+	{
+		SECTOR *sec=&sectors[order[i]];
+		if(n && sec->seq==sectors[order[n-1]].seq)
+		{
+			fprintf(stderr,"logdecode: sector %lu: duplicate sequence number %lu\n",order[i],sec->seq);
+			duplicates++;
+			continue;
+		}
+		unsigned long expect = n?sectors[order[n-1]].seq+1:0;
+		if(sec->seq!=expect)
+		{
+			if(sec->seq==expect+1)
+				fprintf(stderr,"logdecode: sequence number %lu missing\n",expect);
+			else
+				fprintf(stderr,"logdecode: sequence numbers %lu to %lu missing\n",expect,sec->seq-1);
+			gaps++;
+		}
+		sec->offset = streamsize;
+		streamsize += sec->size;
+		order[n++]=order[i];
+	}
+	numorder = n;
+
+	// Pass 2
+	stream = (unsigned char*)malloc(streamsize?streamsize:1);
+	for(int i=0;i<numthreads;i++)
+	{
+		workers[i].first = numorder*i/numthreads;
+		workers[i].last = numorder*(i+1)/numthreads;
+	}
+	run(pass_copy);
+
+	// Pass 3: the ranges start at a sector, hence at a record
+	for(int i=0;i<numthreads;i++)
+	{
+		workers[i].start = workers[i].first<numorder?sectors[order[workers[i].first]].offset:streamsize;
+		workers[i].end = workers[i].last<numorder?sectors[order[workers[i].last]].offset:streamsize;
+	}
+	run(pass_headers);
+	for(int i=0;i<numthreads;i++)
+		numheaders += workers[i].numhdr;
+	headers = (HEADER*)calloc(numheaders?numheaders:1,sizeof(HEADER));
+	numheaders = 0;
+	for(int i=0;i<numthreads;i++)
+		for(int j=0;j<workers[i].numhdr;j++)
+		{
+			headers[numheaders].offset = workers[i].hdr[j];
+			parseheader(&headers[numheaders++]);
+		}
+	// A range starting within a header block starts after it
+	for(int i=1;i<numthreads;i++)
+		for(int h=0;h<numheaders;h++)
+			if(headers[h].offset<workers[i].start && headers[h].end>workers[i].start)
+			{
+				workers[i].start = headers[h].end<workers[i].end?headers[h].end:workers[i].end;
+				workers[i-1].end = workers[i].start;
+			}
+
+	// Pass 4
+	run(pass_decode);
+	for(int i=0;i<numthreads;i++)
+	{
+		WORKER *w=&workers[i];
+		rows += w->rows;
+		skipped += w->skipped;
+		// The bytes at the start of the range decoded by the preceding range, e.g. the end of a text line, are not skipped
+		if(i && workers[i-1].pos>w->start)
+			skipped -= workers[i-1].pos-w->start<w->leading ? workers[i-1].pos-w->start : w->leading;
+		pktgaps += w->pktgaps;
+		// Sample counter across the ranges
+		for(int j=i-1;j>=0 && w->haspkt;j--)
+			if(workers[j].haspkt)
+			{
+				unsigned long mask = workers[j].lastpkttype==2?0xFFFFFFFFul:0xFFFFul;
+				if(w->firstpkt!=((workers[j].lastpkt+1)&mask))
+					pktgaps++;
+				break;
+			}
+	}
+
+	// Output
+	if(columnar && writecolumnar(argv[arg+1],rows))
+		return 1;
+	for(int c=0;c<numchannels && !columnar;c++)
+	{
+		char name[1024];
+		FILE *out;
+		snprintf(name,sizeof(name),"%s.%s.f64",argv[arg+1],channels[c].name);
+		if(!(out=fopen(name,"wb")))
+		{
+			perror(name);
+			return 1;
+		}
+		for(int i=0;i<numthreads;i++)
+			fwrite(workers[i].col[c],sizeof(double),workers[i].rows,out);
+		fclose(out);
+		fprintf(stderr,"%s%s%s%s\n",name,channels[c].unit[0]?" [":"",channels[c].unit,channels[c].unit[0]?"]":"");
+	}
+
+	double t=now()-t0;
+	fprintf(stderr,"logdecode: sectors: %lu invalid: %lu duplicates: %lu sequence gaps: %lu headers: %d channels: %d records: %lu skipped bytes: %lu sample counter gaps: %lu\n",
+		numsectors,invalid,duplicates,gaps,numheaders,numchannels,rows,skipped,pktgaps);
+	fprintf(stderr,"logdecode: %d threads: %.3f s (%.1f MB/s)\n",numthreads,t,numsectors*512/1048576.0/(t>0?t:1e-9));
+	return invalid||duplicates||gaps?1:0;
+}
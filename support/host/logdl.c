@@ -0,0 +1,296 @@
+/*
+	logdl - downloads a log from a BlueSense node
+
+	Sends the download command (D,<lognum>,<offset>) to a node in SD card mode, validates the frames,
+	and writes their payload at its offset in the output file. The download resumes from the size of
+	the output file if it exists, so an interrupted download can be continued by running logdl again.
+	On a checksum error or a missing frame the download is aborted and restarted from the last offset
+	received correctly.
+
+	Usage:
+		logdl <device> <lognum> <output> [baud] [-x]
+			-x: enter SD card mode (command X) before downloading
+
+	Build:
+		gcc -O2 -o logdl logdl.c
+
+	Frame format (see firmware/bluesense-bsp/download.c):
+
+		'D' 'L' 'F' off_0 off_1 off_2 off_3 size_lo size_hi payload[size] chk_lo chk_hi
+
+	The end of the log is indicated by a frame with an empty payload and the offset equal to the log size.
+*/
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+
+#define DL_HDRSIZE			9
+#define DL_FRAMEOVERHEAD	(DL_HDRSIZE+2)
+#define DL_PAYLOADMAX		512
+// Restart the download if no frame is received within this time (ms)
+#define DL_TIMEOUT			3000
+// Maximum number of restarts without progress
+#define DL_MAXRETRY			10
+
+unsigned short fletcher16(const unsigned char *data,int len)
+{
+	unsigned short sum1=0xff,sum2=0xff;
+	while(len)
+	{
+		int tlen = len>21?21:len;
+		len-=tlen;
+		do
+		{
+			sum1 += *data++;
+			sum2 += sum1;
+		}
+		while(--tlen);
+		sum1 = (sum1&0xff)+(sum1>>8);
+		sum2 = (sum2&0xff)+(sum2>>8);
+	}
+	sum1 = (sum1&0xff)+(sum1>>8);
+	sum2 = (sum2&0xff)+(sum2>>8);
+	return sum1<<8|sum2;
+}
+
+unsigned long time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000ul+ts.tv_nsec/1000000ul;
+}
+
+speed_t baud2speed(long baud)
+{
+	switch(baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		default: return 0;
+	}
+}
+
+int open_device(const char *dev,long baud)
+{
+	struct termios tio;
+	int fd = open(dev,O_RDWR|O_NOCTTY);
+	if(fd<0)
+	{
+		perror(dev);
+		return -1;
+	}
+	if(tcgetattr(fd,&tio)==0)
+	{
+		cfmakeraw(&tio);
+		if(baud)
+		{
+			speed_t s = baud2speed(baud);
+			if(!s)
+			{
+				fprintf(stderr,"Unsupported baud rate %ld\n",baud);
+				close(fd);
+				return -1;
+			}
+			cfsetispeed(&tio,s);
+			cfsetospeed(&tio,s);
+		}
+		tcsetattr(fd,TCSANOW,&tio);
+	}
+	return fd;
+}
+
+void send_str(int fd,const char *str)
+{
+	if(write(fd,str,strlen(str))!=(ssize_t)strlen(str))
+		perror("write");
+}
+
+// Discards the input until the node is silent for ms milliseconds
+void drain(int fd,int ms)
+{
+	unsigned char buf[1024];
+	struct pollfd pfd = {fd,POLLIN,0};
+	while(poll(&pfd,1,ms)>0)
+		if(read(fd,buf,sizeof(buf))<=0)
+			break;
+}
+
+// Aborts an ongoing download and requests the log from offset
+void request(int fd,int lognum,unsigned long offset)
+{
+	char cmd[64];
+	// Any character aborts the download; a newline is ignored by the command interpreter if the download already ended
+	send_str(fd,"\n");
+	drain(fd,200);
+	snprintf(cmd,sizeof(cmd),"D,%d,%lu\n",lognum,offset);
+	send_str(fd,cmd);
+}
+
+int main(int argc,char **argv)
+{
+	unsigned char buf[4096];
+	int fd,out,n=0,lognum=0,sdmode=0,narg=0,retry=0,done=0,error=0;
+	long baud=0;
+	unsigned long offset,start,frames=0,restarts=0,t_start,t_frame;
+	const char *dev=0,*outname=0;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(strcmp(argv[i],"-x")==0)
+		{
+			sdmode=1;
+			continue;
+		}
+		switch(narg++)
+		{
+			case 0: dev=argv[i]; break;
+			case 1: lognum=atoi(argv[i]); break;
+			case 2: outname=argv[i]; break;
+			case 3: baud=atol(argv[i]); break;
+		}
+	}
+	if(narg<3)
+	{
+		fprintf(stderr,"Usage: %s <device> <lognum> <output> [baud] [-x]\n",argv[0]);
+		return 1;
+	}
+	out = open(outname,O_RDWR|O_CREAT,0644);
+	if(out<0)
+	{
+		perror(outname);
+		return 1;
+	}
+	// Resume from the end of the output file
+	offset = start = lseek(out,0,SEEK_END);
+	fd = open_device(dev,baud);
+	if(fd<0)
+		return 1;
+
+	if(sdmode)
+	{
+		send_str(fd,"X\n");
+		drain(fd,500);
+	}
+	fprintf(stderr,"logdl: log %d from offset %lu\n",lognum,offset);
+	request(fd,lognum,offset);
+	t_start = t_frame = time_ms();
+
+	while(!done && !error)
+	{
+		struct pollfd pfd = {fd,POLLIN,0};
+		int rv = poll(&pfd,1,100);
+		if(rv<0)
+		{
+			perror("poll");
+			break;
+		}
+		if(rv>0)
+		{
+			int r = read(fd,buf+n,sizeof(buf)-n);
+			if(r<=0)
+				break;
+			n+=r;
+		}
+
+		int i=0,restart=0;
+		while(i<n && !restart && !done && !error)
+		{
+			if(n-i<3)
+				break;
+			if(buf[i]!='D' || buf[i+1]!='L' || buf[i+2]!='F')
+			{
+				i++;
+				continue;
+			}
+			if(n-i<DL_HDRSIZE)
+				break;
+			unsigned long off = buf[i+3]|(buf[i+4]<<8)|(buf[i+5]<<16)|((unsigned long)buf[i+6]<<24);
+			int size = buf[i+7]|(buf[i+8]<<8);
+			if(size>DL_PAYLOADMAX)
+			{
+				i++;
+				continue;
+			}
+			if(n-i<size+DL_FRAMEOVERHEAD)
+				break;
+			unsigned short chk = buf[i+DL_HDRSIZE+size]|(buf[i+DL_HDRSIZE+size+1]<<8);
+			if(fletcher16(buf+i,DL_HDRSIZE+size)!=chk)
+			{
+				// Not a frame or corrupted frame: resynchronise on the next byte; the next frame will show a gap
+				i++;
+				continue;
+			}
+			i+=size+DL_FRAMEOVERHEAD;
+			t_frame = time_ms();
+			if(size==0 && off!=offset)
+			{
+				fprintf(stderr,"logdl: log size %lu differs from the output file size %lu\n",off,offset);
+				error=1;
+				break;
+			}
+			if(off!=offset)
+			{
+				fprintf(stderr,"logdl: expected offset %lu, received %lu: restarting\n",offset,off);
+				restart=1;
+				break;
+			}
+			if(size==0)
+			{
+				done=1;
+				break;
+			}
+			if(pwrite(out,buf+i-size-2,size,off)!=size)
+			{
+				perror(outname);
+				return 1;
+			}
+			offset+=size;
+			frames++;
+			retry=0;
+		}
+		memmove(buf,buf+i,n-i);
+		n-=i;
+		if(n==sizeof(buf))
+			n=0;
+
+		if(!done && !error && time_ms()-t_frame>DL_TIMEOUT)
+		{
+			fprintf(stderr,"logdl: timeout at offset %lu: restarting\n",offset);
+			restart=1;
+		}
+		if(restart)
+		{
+			if(++retry>DL_MAXRETRY)
+			{
+				fprintf(stderr,"logdl: too many errors, giving up at offset %lu\n",offset);
+				break;
+			}
+			restarts++;
+			n=0;
+			request(fd,lognum,offset);
+			t_frame = time_ms();
+		}
+	}
+	drain(fd,200);
+
+	unsigned long t = time_ms()-t_start;
+	fprintf(stderr,"logdl: %s. Bytes: %lu (total %lu). Frames: %lu. Restarts: %lu. Time: %lu ms (%lu bytes/s)\n",
+		done?"complete":"incomplete",offset-start,offset,frames,restarts,t,t?(offset-start)*1000/t:0);
+	close(out);
+	close(fd);
+	return done?0:1;
+}
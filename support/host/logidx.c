@@ -0,0 +1,181 @@
+/*
+	logidx - uses the time index of a BlueSense log to list it or extract a time range
+
+	Logs written on the SD card by a firmware built with UFAT_LOG_INDEXPERIOD contain index records (see firmware/bluesense-bsp/ufat.c, time index):
+
+		#I,<time>,<pkt>,<offset>			index record, at most every UFAT_LOG_INDEXPERIOD ms
+		#S,<time>,<pkt>,<offset>			summary entries, appended when the log is closed
+		#E,<time>,<pkt>,<summaryoffset>		trailer, last line of the log
+
+	The time range is found with the summary and by scanning only the index records between two summary entries.
+	If the log has no summary (e.g. it was not closed) all the index records are scanned.
+
+	Usage:
+		logidx <log>							Prints the summary and the duration of the log
+		logidx <log> -a							Prints all the index records
+		logidx <log> <start> [end]				Writes the data from start to end (seconds from the start of the log) to stdout,
+												from the index record preceding start to the index record following end
+
+	Build:
+		gcc -O2 -o logidx logidx.c
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEXLINE		48
+#define NOTIME			0xFFFFFFFFul
+
+typedef struct {
+	unsigned long time,pkt,offset;
+} LOGINDEX;
+
+const unsigned char *log_data;
+unsigned long log_size;
+
+/*
+	Parses the records of a type between from and to, as _ufat_log_scanindex in the firmware.
+	Records are accepted until the first record later than t (relative to *t0, set from the first record if NOTIME).
+	Calls cb for each record accepted if cb is non null.
+	Returns the number of records accepted; *offset receives the last one, *next the offset of the first record after t.
+*/
+int scanindex(unsigned long from,unsigned long to,char type,unsigned long t,unsigned long *t0,unsigned long *offset,unsigned long *next,void (*cb)(LOGINDEX *))
+{
+	char line[INDEXLINE];
+	int n=0,num=0;
+	unsigned long linestart=0;
+	LOGINDEX r;
+
+	for(unsigned long pos=from;pos<to;pos++)
+	{
+		char c = log_data[pos];
+		if(c=='#')
+		{
+			n=0;
+			linestart=pos;
+		}
+		if(c!='\n')
+		{
+			if(n<INDEXLINE-1)
+				line[n++]=c;
+			continue;
+		}
+		line[n]=0;
+		n=0;
+		if(line[0]!='#' || line[1]!=type || sscanf(line+2,",%lu,%lu,%lu",&r.time,&r.pkt,&r.offset)!=3)
+			continue;
+		if(type=='I' && r.offset!=linestart)
+			continue;
+		if(*t0==NOTIME)
+			*t0=r.time;
+		if(r.time-*t0>t)
+		{
+			*next=r.offset;
+			break;
+		}
+		*offset=r.offset;
+		num++;
+		if(cb)
+			cb(&r);
+	}
+	return num;
+}
+
+unsigned long print_t0=NOTIME;
+void print_record(LOGINDEX *r)
+{
+	if(print_t0==NOTIME)
+		print_t0=r->time;
+	printf("%10.3lf s  time %10lu  records %10lu  offset %10lu\n",(r->time-print_t0)/1000.0,r->time,r->pkt,r->offset);
+}
+
+/*
+	Returns the offset of the summary, or log_size if the log has no summary
+*/
+unsigned long find_summary(void)
+{
+	unsigned long te=NOTIME,summary=log_size,dummy;
+	unsigned long from = log_size>INDEXLINE?log_size-INDEXLINE:0;
+	if(scanindex(from,log_size,'E',NOTIME,&te,&summary,&dummy,0)==0 || summary>=log_size)
+		return log_size;
+	return summary;
+}
+
+/*
+	Returns the offset of the last index record at or before t (ms), as ufat_log_findtime in the firmware.
+	*next receives the offset of the first index record after t, or the end of the data if there is none.
+*/
+unsigned long find_time(unsigned long t,unsigned long *next)
+{
+	unsigned long summary=find_summary(),from=0,to=summary,t0=NOTIME,offset=0;
+
+	if(summary<log_size)
+		scanindex(summary,log_size,'S',t,&t0,&from,&to,0);
+	*next=summary;
+	if(scanindex(from,to,'I',t,&t0,&offset,next,0)==0)
+		offset=from;
+	return offset;
+}
+
+int main(int argc,char **argv)
+{
+	struct stat st;
+	int fd;
+
+	if(argc<2)
+	{
+		fprintf(stderr,"Usage: %s <log> [-a | <start> [end]]\n",argv[0]);
+		return 1;
+	}
+	fd = open(argv[1],O_RDONLY);
+	if(fd<0 || fstat(fd,&st))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	log_size = st.st_size;
+	if(log_size==0)
+	{
+		fprintf(stderr,"logidx: empty log\n");
+		return 1;
+	}
+	log_data = mmap(0,log_size,PROT_READ,MAP_PRIVATE,fd,0);
+	if(log_data==MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+
+	if(argc==2 || strcmp(argv[2],"-a")==0)
+	{
+		unsigned long summary=find_summary(),t0=NOTIME,dummy;
+		if(argc==2 && summary<log_size)
+		{
+			printf("Summary at offset %lu:\n",summary);
+			scanindex(summary,log_size,'S',NOTIME,&t0,&dummy,&dummy,print_record);
+		}
+		else
+		{
+			if(summary==log_size)
+				printf("No summary: log not closed or without index\n");
+			scanindex(0,summary,'I',NOTIME,&t0,&dummy,&dummy,print_record);
+		}
+		return 0;
+	}
+
+	unsigned long start = atof(argv[2])*1000;
+	unsigned long end = argc>3?atof(argv[3])*1000:NOTIME-1;
+	unsigned long next,dummy;
+	unsigned long from = find_time(start,&dummy);
+	unsigned long to = end>=NOTIME-1?find_summary():(find_time(end,&next),next);
+	if(to<from)
+		to=from;
+	fprintf(stderr,"logidx: offset %lu to %lu\n",from,to);
+	fwrite(log_data+from,1,to-from,stdout);
+	return 0;
+}
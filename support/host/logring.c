@@ -0,0 +1,132 @@
+/*
+	logring - linearises a ring log of a BlueSense node
+
+	Ring logs are written with the command L,<lognum>,<container>,<compact>,<compress>,<ringmb> (see firmware/bluesense-bsp/ufat.c):
+	the log is a header sector followed by a ring of sectors, and the data wraps around the ring. The header sector is the line
+
+		#R,<ringsectors>,<size>,<state>
+
+	where size is the number of bytes written since the log was opened, and state is 0 (open, e.g. after a power loss), 1 (closed)
+	or 2 (closed by a trigger). The sectors following the end of the data are erased, and separate the most recent data from the
+	oldest. When the log was not closed the size is that of the last checkpoint, and the header has a fifth field, the recovery
+	window: the window sectors after the checkpoint hold data or erased sectors, and the end of the data follows the last sector
+	of the window which is not erased. Headers without window (older firmware) end the data at the first erased sector.
+
+	The output is the data kept by the ring, from the oldest to the most recent: with a ring that wrapped the first record may be
+	cut. The offset of the first byte since the log was opened is printed on stderr. Compressed rings are then decompressed
+	with logunzip.
+
+	Usage:
+		logring <input> [output]		Reads a ring log extracted from the card (- for stdin) and writes the data to output (default: stdout)
+
+	Build:
+		gcc -O2 -o logring logring.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+unsigned char *ring;
+unsigned long ringsectors;
+
+// Indicates whether the sector k of the unwrapped log is erased (all bytes 0x00 or 0xFF)
+static int erased(unsigned long k)
+{
+	const unsigned char *s = ring+(k%ringsectors)*512;
+	for(int i=1;i<512;i++)
+		if(s[i]!=s[0])
+			return 0;
+	return s[0]==0x00 || s[0]==0xFF;
+}
+
+int main(int argc,char **argv)
+{
+	FILE *in,*out=stdout;
+	unsigned char header[512];
+	unsigned long size,end,start,window=0,n=0;
+	unsigned state;
+	int fields;
+	size_t r;
+
+	if(argc<2)
+	{
+		fprintf(stderr,"Usage: %s <input> [output]\n",argv[0]);
+		return 1;
+	}
+	in = strcmp(argv[1],"-")==0 ? stdin : fopen(argv[1],"rb");
+	if(!in)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	if(fread(header,1,512,in)!=512 || (fields=sscanf((char*)header,"#R,%lu,%lu,%u,%lu",&ringsectors,&size,&state,&window))<3 || ringsectors==0)
+	{
+		fprintf(stderr,"logring: %s is not a ring log\n",argv[1]);
+		return 1;
+	}
+	ring = (unsigned char*)malloc(ringsectors*512);
+	while(n<ringsectors*512 && (r=fread(ring+n,1,ringsectors*512-n,in))>0)
+		n+=r;
+	if(n!=ringsectors*512)
+	{
+		fprintf(stderr,"logring: truncated ring (%lu of %lu bytes)\n",n,ringsectors*512);
+		return 1;
+	}
+	if(argc>2 && !(out=fopen(argv[2],"wb")))
+	{
+		perror(argv[2]);
+		return 1;
+	}
+
+	// End of the data: the size of a closed log, otherwise after the last sector not erased in the window after the checkpoint
+	end = size;
+	if(state==0 && fields==4)
+	{
+		unsigned long k;
+		if(window>ringsectors)
+			window=ringsectors;
+		for(k=size>>9;k<(size>>9)+window;k++)
+			if(!erased(k))
+				end=(k+1)*512;
+	}
+	else if(state==0)
+	{
+		unsigned long k;
+		for(k=size>>9;k<(size>>9)+ringsectors && !erased(k);k++);
+		if(k==(size>>9)+ringsectors)
+		{
+			fprintf(stderr,"logring: no erased sector after the end of the data\n");
+			return 1;
+		}
+		end = k*512;
+	}
+
+	// Start of the data: the beginning of the log, or after the wrap the first sector written after the erased sectors
+	start = 0;
+	if(end>ringsectors*512)
+	{
+		unsigned long k;
+		for(k=(end+511)>>9;k<(end>>9)+ringsectors && erased(k);k++);
+		// Sector k of the ring was last written one turn before
+		start = k*512-ringsectors*512;
+		if(k>=(end>>9)+ringsectors)
+		{
+			fprintf(stderr,"logring: no data\n");
+			return 1;
+		}
+	}
+	for(unsigned long o=start;o<end;)
+	{
+		unsigned long p=o%(ringsectors*512);
+		unsigned long l=ringsectors*512-p;
+		if(l>end-o)
+			l=end-o;
+		fwrite(ring+p,1,l,out);
+		o+=l;
+	}
+	fprintf(stderr,"logring: ring: %lu sectors state: %s data: %lu bytes from offset %lu to %lu\n",ringsectors,
+		state==0?"open":state==1?"closed":"triggered",end-start,start,end);
+	if(out!=stdout)
+		fclose(out);
+	return 0;
+}
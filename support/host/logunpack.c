@@ -0,0 +1,122 @@
+/*
+	logunpack - unpacks a log whose records were packed in sectors by a BlueSense node
+
+	The records of logs are packed in sectors with the command L,<lognum>,<container>,<compact>,2 (see
+	firmware/bluesense-bsp/logpack.c). Each 512-byte sector holds whole records, and carries a sequence number, the time of its
+	first record and a CRC: the unpacked log is identical to the log written without packing, including the index records, so
+	that it can then be processed by logidx, muxdemux or logcsv. Invalid sectors (bad CRC, e.g. a corrupted card or download)
+	and gaps in the sequence numbers are reported on stderr, and only lose the records of those sectors.
+
+	Usage:
+		logunpack [-v] <input> [output]		Reads a log (- for stdin) and writes the unpacked log to output (default: stdout).
+											With -v the sequence number, time and size of each sector are printed on stderr
+
+	Build:
+		gcc -O2 -o logunpack logunpack.c
+
+	Sector format (see firmware/bluesense-bsp/logpack.c):
+
+		0xD5 version seq[4] time[4] records... padding size[2] crc[2]
+
+	All the fields are little endian; crc is the CRC-CCITT (polynomial 0x1021, initial value 0) of the 510 preceding bytes.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGPACK_MAGIC		0xD5
+#define LOGPACK_VERSION		1
+#define LOGPACK_HDRSIZE		10
+#define LOGPACK_TRLSIZE		4
+#define LOGPACK_PAYLOAD		(512-LOGPACK_HDRSIZE-LOGPACK_TRLSIZE)
+
+static unsigned long le32(const unsigned char *p)
+{
+	return p[0]|(p[1]<<8)|((unsigned long)p[2]<<16)|((unsigned long)p[3]<<24);
+}
+
+static unsigned short crc16(const unsigned char *p,int n)
+{
+	unsigned short crc=0;
+	while(n--)
+	{
+		crc ^= (unsigned short)*p++<<8;
+		for(int i=0;i<8;i++)
+			crc = crc&0x8000 ? (crc<<1)^0x1021 : crc<<1;
+	}
+	return crc;
+}
+
+/*
+	Checks a sector and returns the number of bytes of records, or -1 if the sector is invalid.
+*/
+int unpack_sector(const unsigned char *s)
+{
+	if(s[0]!=LOGPACK_MAGIC || s[1]!=LOGPACK_VERSION)
+		return -1;
+	if(crc16(s,510)!=(s[510]|(s[511]<<8)))
+		return -1;
+	int n=s[508]|(s[509]<<8);
+	return n<=LOGPACK_PAYLOAD ? n : -1;
+}
+
+int main(int argc,char **argv)
+{
+	FILE *in,*out=stdout;
+	unsigned char sector[512];
+	unsigned long sectors=0,invalid=0,gaps=0,size=0,expect=0;
+	int verbose=0,arg=1;
+	size_t r;
+
+	if(argc>1 && strcmp(argv[1],"-v")==0)
+	{
+		verbose=1;
+		arg++;
+	}
+	if(argc<arg+1)
+	{
+		fprintf(stderr,"Usage: %s [-v] <input> [output]\n",argv[0]);
+		return 1;
+	}
+	in = strcmp(argv[arg],"-")==0 ? stdin : fopen(argv[arg],"rb");
+	if(!in)
+	{
+		perror(argv[arg]);
+		return 1;
+	}
+	if(argc>arg+1 && !(out=fopen(argv[arg+1],"wb")))
+	{
+		perror(argv[arg+1]);
+		return 1;
+	}
+	while((r=fread(sector,1,512,in))>0)
+	{
+		int n;
+		if(r<512 || (n=unpack_sector(sector))<0)
+		{
+			// E.g. a sector corrupted on the card, or a truncated download
+			fprintf(stderr,"logunpack: invalid sector %lu\n",sectors);
+			invalid++;
+			expect++;
+		}
+		else
+		{
+			unsigned long seq=le32(sector+2);
+			if(seq!=expect)
+			{
+				fprintf(stderr,"logunpack: sector %lu: sequence number %lu instead of %lu\n",sectors,seq,expect);
+				gaps++;
+			}
+			if(verbose)
+				fprintf(stderr,"sector %lu: seq %lu time %lu ms: %d bytes\n",sectors,seq,le32(sector+6),n);
+			fwrite(sector+LOGPACK_HDRSIZE,1,n,out);
+			size+=n;
+			expect=seq+1;
+		}
+		sectors++;
+	}
+	fprintf(stderr,"logunpack: sectors: %lu invalid: %lu sequence gaps: %lu unpacked bytes: %lu\n",sectors,invalid,gaps,size);
+	if(out!=stdout)
+		fclose(out);
+	return invalid||gaps?1:0;
+}
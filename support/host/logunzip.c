@@ -0,0 +1,109 @@
+/*
+	logunzip - decompresses a log written compressed by a BlueSense node
+
+	Logs are compressed with the command L,<lognum>,<container>,<compact>,1 (see firmware/bluesense-bsp/logzip.c). Each 512-byte
+	sector of the log is decoded independently; the decompressed log is identical to the log written without compression,
+	including the index records, so that it can then be processed by logidx, muxdemux or logcsv.
+
+	Usage:
+		logunzip <input> [output]		Reads a log (- for stdin) and writes the decompressed log to output (default: stdout)
+
+	Build:
+		gcc -O2 -o logunzip logunzip.c
+
+	Sector format (see firmware/bluesense-bsp/logzip.c):
+
+		0xC5 version groups... padding
+
+	A group is a flag byte followed by up to 8 items, LSB first: a literal byte (flag 0), or a match (flag 1) of two bytes,
+	length-3 and distance-1, copying data of the sector. A match with length byte 0xFF ends the sector.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGZIP_MAGIC		0xC5
+#define LOGZIP_VERSION		1
+#define LOGZIP_HDRSIZE		2
+#define LOGZIP_MINMATCH		3
+#define LOGZIP_END			0xFF
+
+/*
+	Decompresses a sector into out, which holds at least 65536 bytes. Returns the number of bytes, or -1 if the sector is invalid.
+*/
+long unzip_sector(const unsigned char *s,unsigned char *out)
+{
+	long n=0;
+	int i=LOGZIP_HDRSIZE;
+
+	if(s[0]!=LOGZIP_MAGIC || s[1]!=LOGZIP_VERSION)
+		return -1;
+	while(i<512)
+	{
+		unsigned char flag=s[i++];
+		for(int b=0;b<8;b++)
+		{
+			if(i>=512)
+				return -1;
+			if(!(flag&(1<<b)))
+			{
+				out[n++]=s[i++];
+				continue;
+			}
+			if(s[i]==LOGZIP_END)
+				return n;
+			if(i+1>=512 || s[i+1]+1>n)
+				return -1;
+			int len=s[i]+LOGZIP_MINMATCH,dist=s[i+1]+1;
+			i+=2;
+			for(;len;len--,n++)
+				out[n]=out[n-dist];
+		}
+	}
+	return -1;
+}
+
+int main(int argc,char **argv)
+{
+	FILE *in,*out=stdout;
+	unsigned char sector[512],data[65536];
+	unsigned long sectors=0,invalid=0,size=0;
+	size_t r;
+
+	if(argc<2)
+	{
+		fprintf(stderr,"Usage: %s <input> [output]\n",argv[0]);
+		return 1;
+	}
+	in = strcmp(argv[1],"-")==0 ? stdin : fopen(argv[1],"rb");
+	if(!in)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	if(argc>2 && !(out=fopen(argv[2],"wb")))
+	{
+		perror(argv[2]);
+		return 1;
+	}
+	while((r=fread(sector,1,512,in))>0)
+	{
+		long n;
+		if(r<512 || (n=unzip_sector(sector,data))<0)
+		{
+			// E.g. a sector of a log not closed, or a truncated download
+			fprintf(stderr,"logunzip: invalid sector %lu\n",sectors);
+			invalid++;
+		}
+		else
+		{
+			fwrite(data,1,n,out);
+			size+=n;
+		}
+		sectors++;
+	}
+	fprintf(stderr,"logunzip: sectors: %lu invalid: %lu decompressed bytes: %lu\n",sectors,invalid,size);
+	if(out!=stdout)
+		fclose(out);
+	return invalid?1:0;
+}
@@ -0,0 +1,143 @@
+/*
+	muxdemux - demultiplexes the output of a BlueSense node in multiplexed mode
+
+	In multiplexed mode (command U,1) all the output of the node is sent in frames carrying a channel number
+	(0: control, 1: status, 2: data, 3: debug). This tool separates the channels.
+
+	Logs written as containers (command L,<lognum>,1, see firmware/bluesense-bsp/logstream.c) use the same frames, the channel
+	being the record type (0: annotations, 1: status, 2: motion, 3: ADC, 4: battery). The index records of the log are skipped.
+
+	Usage:
+		muxdemux <input> [prefix]		Reads from a file or serial device (- for stdin) and writes channel n to <prefix>n (default prefix: ch);
+										the files are created for the channels present in the input
+		muxdemux <input> -c <n>			Writes only channel n to stdout
+
+	Build:
+		gcc -O2 -o muxdemux muxdemux.c
+
+	Frame format (see firmware/bluesense-bsp/mux.c):
+
+		0xA5 channel size payload[size] chk_lo chk_hi
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MUX_SYNC			0xA5
+#define MUX_HDRSIZE			3
+#define MUX_FRAMEOVERHEAD	(MUX_HDRSIZE+2)
+#define MUX_CHANNELS		8
+
+unsigned short fletcher16(const unsigned char *data,int len)
+{
+	unsigned short sum1=0xff,sum2=0xff;
+	while(len)
+	{
+		int tlen = len>21?21:len;
+		len-=tlen;
+		do
+		{
+			sum1 += *data++;
+			sum2 += sum1;
+		}
+		while(--tlen);
+		sum1 = (sum1&0xff)+(sum1>>8);
+		sum2 = (sum2&0xff)+(sum2>>8);
+	}
+	sum1 = (sum1&0xff)+(sum1>>8);
+	sum2 = (sum2&0xff)+(sum2>>8);
+	return sum1<<8|sum2;
+}
+
+int main(int argc,char **argv)
+{
+	FILE *in,*out[MUX_CHANNELS]={0};
+	unsigned char buf[4096];
+	int n=0,only=-1;
+	const char *prefix=0;
+	unsigned long frames=0,skipped=0;
+
+	if(argc<2)
+	{
+		fprintf(stderr,"Usage: %s <input> [prefix] | %s <input> -c <channel>\n",argv[0],argv[0]);
+		return 1;
+	}
+	in = strcmp(argv[1],"-")==0 ? stdin : fopen(argv[1],"rb");
+	if(!in)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	if(argc>3 && strcmp(argv[2],"-c")==0)
+	{
+		only = atoi(argv[3]);
+		if(only<0 || only>=MUX_CHANNELS)
+		{
+			fprintf(stderr,"Invalid channel %d\n",only);
+			return 1;
+		}
+		out[only]=stdout;
+	}
+	else
+		prefix = argc>2?argv[2]:"ch";
+
+	while(1)
+	{
+		// read rather than fread, so that data from a serial device is processed as it arrives
+		ssize_t r = read(fileno(in),buf+n,sizeof(buf)-n);
+		if(r<=0)
+			break;
+		n+=r;
+
+		int i=0;
+		while(i<n)
+		{
+			if(buf[i]!=MUX_SYNC)
+			{
+				skipped++;
+				i++;
+				continue;
+			}
+			if(n-i<MUX_HDRSIZE || n-i<buf[i+2]+MUX_FRAMEOVERHEAD)
+				break;
+			int ch = buf[i+1];
+			int size = buf[i+2];
+			unsigned short chk = buf[i+MUX_HDRSIZE+size]|(buf[i+MUX_HDRSIZE+size+1]<<8);
+			if(ch>=MUX_CHANNELS || fletcher16(buf+i,MUX_HDRSIZE+size)!=chk)
+			{
+				// Not a frame: resynchronise on the next byte
+				skipped++;
+				i++;
+				continue;
+			}
+			if(!out[ch] && prefix)
+			{
+				char name[256];
+				snprintf(name,sizeof(name),"%s%d",prefix,ch);
+				out[ch]=fopen(name,"wb");
+				if(!out[ch])
+				{
+					perror(name);
+					return 1;
+				}
+			}
+			if(out[ch])
+			{
+				fwrite(buf+i+MUX_HDRSIZE,1,size,out[ch]);
+				fflush(out[ch]);
+			}
+			frames++;
+			i+=size+MUX_FRAMEOVERHEAD;
+		}
+		memmove(buf,buf+i,n-i);
+		n-=i;
+		if(n==sizeof(buf))
+			n=0;
+	}
+	fprintf(stderr,"muxdemux: frames: %lu skipped bytes: %lu\n",frames,skipped);
+	for(int i=0;i<MUX_CHANNELS;i++)
+		if(out[i] && out[i]!=stdout)
+			fclose(out[i]);
+	return 0;
+}
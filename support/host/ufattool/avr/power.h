@@ -0,0 +1,2 @@
+// Stub of the firmware/avr-libc header for the host build: see host.h
+#include "host.h"
@@ -0,0 +1,109 @@
+/*
+	host.h - environment to build the firmware uFAT (firmware/bluesense-bsp/ufat.c) on Linux
+	
+	Included first by the stubs of the AVR and firmware headers (cpu.h, wait.h, helper.h and the avr and util directories) and by the tool sources.
+	
+	- The firmware assumes 32-bit longs and unpadded structures, which are overlaid on the card sectors. After the system
+	  headers, long is redefined as int and structures are packed.
+	- The formatted I/O functions are redirected to functions removing the 'l' length modifiers, as longs are ints.
+	- FILE is redefined as a small stream structure supporting the avr-libc functions used by the firmware (fdev_setup_stream,
+	  fdev_set_udata) and the firmware fputbuf.
+	- The firmware headers not needed by ufat.c (global.h, serial.h, system-extra.h) are excluded by defining their guards;
+	  the few declarations used by ufat.c are provided here.
+	
+	No system header may be included after this file.
+*/
+#ifndef __HOST_H
+#define __HOST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Stream of the host build: either a host stream, or a put function and udata as set up by fdev_setup_stream
+typedef FILE HOSTSTREAM;
+typedef struct _HOSTFILE {
+	int (*put)(char c,struct _HOSTFILE *f);
+	void *udata;
+	HOSTSTREAM *host;
+} HOSTFILE;
+
+int host_vfprintf(HOSTFILE *f,const char *fmt,va_list ap);
+int host_fprintf(HOSTFILE *f,const char *fmt,...);
+int host_printf(const char *fmt,...);
+int host_sprintf(char *str,const char *fmt,...);
+int host_snprintf(char *str,size_t size,const char *fmt,...);
+int host_sscanf(const char *str,const char *fmt,...);
+int host_fputc(int c,HOSTFILE *f);
+HOSTFILE *host_stream(HOSTSTREAM *host);
+
+// Firmware types
+#define long int
+#pragma pack(1)
+#define FILE HOSTFILE
+
+// avr-libc
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const unsigned char *)(p))
+#define pgm_read_word(p) (*(const unsigned short *)(p))
+#define strcpy_P strcpy
+#define printf_P host_printf
+#define fprintf_P host_fprintf
+#define sprintf_P host_sprintf
+#define snprintf_P host_snprintf
+#define printf host_printf
+#define fprintf host_fprintf
+#define sprintf host_sprintf
+#define snprintf host_snprintf
+#define sscanf host_sscanf
+#define fputc host_fputc
+#define _FDEV_SETUP_WRITE 2
+#define fdev_setup_stream(f,p,g,fl) do { (f)->put=(p); (f)->udata=0; (f)->host=0; } while(0)
+#define fdev_set_udata(f,u) ((f)->udata=(u))
+#define fdev_get_udata(f) ((f)->udata)
+#define fdev_close()
+#define _delay_ms(t)
+#define _delay_us(t)
+
+// Firmware headers excluded and their declarations used by ufat.c
+#define __GLOBAL_H
+#define __SERIAL_H
+#define __SYSTEM_EXTRA_H
+
+typedef struct 
+{
+	unsigned char blocking;
+	void *txbuf;
+	void *rxbuf;	
+	unsigned char (*putbuf)(char *data,unsigned char n);
+} SERIALPARAM;
+
+extern FILE *file_pri;
+unsigned char fputbuf(FILE *stream,char *data,unsigned char n);
+unsigned char *system_getdevicename(void);
+
+// wait.h and helper.h
+unsigned long timer_ms_get(void);
+unsigned long timer_s_get_frommidnight(void);
+char *format1u32(char *strptr,unsigned long a);
+
+// Host time: added to the time returned by timer_ms_get, to simulate long logs
+extern unsigned long host_time_offset;
+
+// File-backed card (sdfile.c)
+unsigned char sdfile_open(const char *name,unsigned char readonly);
+void sdfile_close(void);
+unsigned long sdfile_streamaddress(void);
+void sdfile_powerloss(void);
+extern unsigned long sdfile_numwrite;
+
+#endif
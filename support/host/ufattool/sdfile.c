@@ -0,0 +1,385 @@
+/*
+	sdfile - file-backed implementation of the SD card interface (firmware/bluesense-bsp/sd.h) and of the
+	firmware functions used by ufat.c, for the host build of the uFAT.
+
+	The card is a raw image (e.g. a dd dump of a card). Sector n is at offset 512*n.
+
+	- Erased sectors read as 0x00; erasing punches holes in the image, which keeps images sparse.
+	- Streaming writes, with and without cache, write complete sectors to the image immediately. As in the firmware,
+	  the sector being filled by sd_streamcache_write is kept in memory until it is complete, or until sd_streamcache_close.
+	- An image opened read-only fails all writes, e.g. to inspect a field image: the recovery of an unclosed log is
+	  then only done in memory.
+	- sdfile_powerloss discards the streaming state and the sector being filled, as a power loss would.
+	- timer_ms_get advances by at least 1 ms at each call, and by host_time_offset to simulate long logs.
+*/
+#include "host.h"
+#include "sd.h"
+
+static int sdfile_fd=-1;
+static unsigned long sdfile_capacity;				// Capacity in sectors
+unsigned long sdfile_numwrite;						// Number of sectors written
+unsigned long host_time_offset;
+
+// Stream write state
+static unsigned long sdfile_stream_address;			// Sector being filled
+static unsigned long sdfile_wrap_start,sdfile_wrap_end;	// Ring area, see sd_streamcache_wrap
+static char sdfile_stream_buffer[512];
+static unsigned short sdfile_stream_n;				// Bytes in sdfile_stream_buffer
+unsigned char _sd_write_stream_open;
+static unsigned short sdfile_opens;					// Number of openings of the multiblock write, see sd_streamcache_getbursts
+unsigned long _sd_write_stream_address;
+unsigned short _sdbuffer_n;
+// Stream read state
+static unsigned char sdfile_read_open;
+static unsigned long sdfile_read_address;
+
+/******************************************************************************
+	Host image
+******************************************************************************/
+unsigned char sdfile_open(const char *name,unsigned char readonly)
+{
+	struct stat st;
+
+	sdfile_fd = open(name,readonly?O_RDONLY:O_RDWR);
+	if(sdfile_fd<0 || fstat(sdfile_fd,&st))
+	{
+		perror(name);
+		return 1;
+	}
+	sdfile_capacity = st.st_size>>9;
+	sdfile_stream_n = 0;
+	sdfile_read_open = 0;
+	return 0;
+}
+void sdfile_close(void)
+{
+	if(sdfile_fd>=0)
+		close(sdfile_fd);
+	sdfile_fd=-1;
+}
+unsigned long sdfile_streamaddress(void)
+{
+	return sdfile_stream_address;
+}
+void sdfile_powerloss(void)
+{
+	sdfile_stream_n = 0;
+	sdfile_read_open = 0;
+	_sd_write_stream_open = 0;
+}
+
+/******************************************************************************
+	SD card
+******************************************************************************/
+unsigned char sd_init(CID *cid,CSD *csd,SDSTAT *sdstat,unsigned long *capacity)
+{
+	if(sdfile_fd<0)
+		return 1;
+	memset(cid,0,sizeof(CID));
+	memset(csd,0,sizeof(CSD));
+	memset(sdstat,0,sizeof(SDSTAT));
+	// SDHC with 512 byte blocks
+	csd->CSD = 1;
+	csd->READ_BL_LEN = 9;
+	csd->WRITE_BL_LEN = 9;
+	*capacity = sdfile_capacity;
+	return 0;
+}
+unsigned char sd_block_read(unsigned long addr,char *buffer)
+{
+	if(addr>=sdfile_capacity || pread(sdfile_fd,buffer,512,(off_t)addr<<9)!=512)
+		return 1;
+	return 0;
+}
+unsigned char sd_block_write(unsigned long addr,char *buffer)
+{
+	if(addr>=sdfile_capacity || pwrite(sdfile_fd,buffer,512,(off_t)addr<<9)!=512)
+		return 1;
+	sdfile_numwrite++;
+	return 0;
+}
+unsigned char sd_erase(unsigned long addr1,unsigned long addr2)
+{
+	static const char zero[512]={0};
+
+	if(addr1>addr2 || addr2>=sdfile_capacity)
+		return 1;
+	if(fallocate(sdfile_fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,(off_t)addr1<<9,((off_t)(addr2-addr1)+1)<<9)==0)
+		return 0;
+	for(unsigned long a=addr1;a<=addr2;a++)
+		if(pwrite(sdfile_fd,zero,512,(off_t)a<<9)!=512)
+			return 1;
+	return 0;
+}
+
+void sd_stream_open(unsigned long addr,unsigned long preerase)
+{
+	sdfile_stream_address = addr;
+	sdfile_stream_n = 0;
+	sdfile_wrap_end = 0;
+	_sd_write_stream_open = 0;
+	_sd_write_stream_address = addr;
+	_sdbuffer_n = 0;
+	sdfile_opens = 0;
+}
+unsigned char sd_stream_write(char *buffer,unsigned short size,unsigned long *currentsect)
+{
+	return sd_streamcache_write(buffer,size,currentsect);
+}
+unsigned char sd_stream_close(unsigned long *currentsect)
+{
+	return sd_streamcache_close(currentsect);
+}
+unsigned char sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentsect)
+{
+	unsigned short effw;
+	unsigned char error=0;
+
+	if(currentsect)
+		*currentsect = sdfile_stream_address;
+	while(size)
+	{
+		effw = size<512-sdfile_stream_n?size:512-sdfile_stream_n;
+		memcpy(sdfile_stream_buffer+sdfile_stream_n,buffer,effw);
+		sdfile_stream_n+=effw;
+		buffer+=effw;
+		size-=effw;
+		if(sdfile_stream_n==512)
+		{
+			error+=sd_block_write(sdfile_stream_address,sdfile_stream_buffer);
+			sdfile_stream_n=0;
+			sdfile_stream_address++;
+			if(sdfile_stream_address==sdfile_wrap_end)
+				sdfile_stream_address=sdfile_wrap_start;
+			if(!_sd_write_stream_open)
+				sdfile_opens++;
+			_sd_write_stream_open=1;
+			_sd_write_stream_address=sdfile_stream_address;
+		}
+	}
+	_sdbuffer_n = sdfile_stream_n;
+	return error;
+}
+void sd_streamcache_wrap(unsigned long start,unsigned long end)
+{
+	sdfile_wrap_start = start;
+	sdfile_wrap_end = end;
+}
+unsigned char sd_streamcache_sync(void)
+{
+	_sd_write_stream_open=0;
+	return 0;
+}
+unsigned char sd_streamcache_close(unsigned long *currentsect)
+{
+	unsigned char error=0;
+
+	// Pad the sector being filled as the firmware
+	if(sdfile_stream_n)
+	{
+		memset(sdfile_stream_buffer+sdfile_stream_n,0x55,512-sdfile_stream_n);
+		error=sd_block_write(sdfile_stream_address,sdfile_stream_buffer);
+		sdfile_stream_n=0;
+		sdfile_stream_address++;
+	}
+	_sd_write_stream_open=0;
+	_sd_write_stream_address=sdfile_stream_address;
+	_sdbuffer_n=0;
+	if(currentsect)
+		*currentsect = sdfile_stream_address-1;
+	return error;
+}
+void sd_streamcache_getstat(unsigned char *hwm,unsigned short *stall)
+{
+	*hwm = 0;
+	*stall = 0;
+}
+void sd_streamcache_burst(unsigned char n)
+{
+}
+unsigned short sd_streamcache_getbursts(void)
+{
+	return sdfile_opens;
+}
+unsigned char sd_streamcache_isidle(void)
+{
+	return _sd_write_stream_open?0:1;
+}
+unsigned char sd_streamread_open(unsigned long addr)
+{
+	sdfile_read_open=1;
+	sdfile_read_address=addr;
+	return 0;
+}
+unsigned char sd_streamread_read(char *buffer,unsigned long *currentsect)
+{
+	if(!sdfile_read_open)
+		return 1;
+	if(currentsect)
+		*currentsect=sdfile_read_address;
+	if(sd_block_read(sdfile_read_address,buffer))
+	{
+		sdfile_read_open=0;
+		return 1;
+	}
+	sdfile_read_address++;
+	return 0;
+}
+unsigned char sd_streamread_close(void)
+{
+	sdfile_read_open=0;
+	return 0;
+}
+unsigned char _sd_acmd23(unsigned long numblocks)
+{
+	return 0;
+}
+// The image has no SPI clock to negotiate
+unsigned char sd_spi_tune(unsigned long sect)
+{
+	return 0;
+}
+void sd_spi_getstat(unsigned short *khz,unsigned char *fallback)
+{
+	*khz = 0;
+	*fallback = 0;
+}
+
+/******************************************************************************
+	Firmware functions used by ufat.c
+******************************************************************************/
+FILE *file_pri;							// Messages of the uFAT, discarded if null
+
+unsigned char fputbuf(FILE *stream,char *data,unsigned char n)
+{
+	if(!stream)
+		return 0;
+	if(stream->host)
+		return fwrite(data,1,n,stream->host)!=n;
+	SERIALPARAM *p = (SERIALPARAM*)fdev_get_udata(stream);
+	return p->putbuf(data,n);
+}
+unsigned char *system_getdevicename(void)
+{
+	static unsigned char name[]="HOST";
+	return name;
+}
+unsigned long timer_ms_get(void)
+{
+	static unsigned long last;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	unsigned long t = ts.tv_sec*1000u+ts.tv_nsec/1000000u+host_time_offset;
+	// The host is much faster than the node: the time advances at each call, so that intervals are never null
+	last = t>last?t:last+1;
+	return last;
+}
+unsigned long timer_s_get_frommidnight(void)
+{
+	time_t t = time(0);
+	struct tm *tm = localtime(&t);
+	return tm->tm_hour*3600+tm->tm_min*60+tm->tm_sec;
+}
+char *format1u32(char *strptr,unsigned long a)
+{
+	char s[11];
+	snprintf(s,sizeof(s),"%010lu",a);
+	memcpy(strptr,s,10);
+	strptr[10]=' ';
+	return strptr+11;
+}
+
+/******************************************************************************
+	Formatted I/O: longs are ints in the host build, the 'l' length modifiers
+	are removed from the formats.
+******************************************************************************/
+static void host_format(char *dst,const char *fmt,size_t size)
+{
+	unsigned char conv=0;
+	size_t n=0;
+
+	for(;*fmt && n<size-1;fmt++)
+	{
+		if(conv && *fmt=='l')
+			continue;
+		if(*fmt=='%')
+			conv=!conv;
+		else if(conv && strchr("diouxXcspfeEgGn[",*fmt))
+			conv=0;
+		dst[n++]=*fmt;
+	}
+	dst[n]=0;
+}
+HOSTFILE *host_stream(HOSTSTREAM *host)
+{
+	HOSTFILE *f = (HOSTFILE*)calloc(1,sizeof(HOSTFILE));
+	f->host = host;
+	return f;
+}
+int host_vfprintf(HOSTFILE *f,const char *fmt,va_list ap)
+{
+	char format[256],str[1024];
+	int n;
+
+	if(!f)
+		return 0;
+	host_format(format,fmt,sizeof(format));
+	if(f->host)
+		return vfprintf(f->host,format,ap);
+	n = vsnprintf(str,sizeof(str),format,ap);
+	for(int i=0;i<n && i<(int)sizeof(str)-1;i++)
+		f->put(str[i],f);
+	return n;
+}
+int host_fprintf(HOSTFILE *f,const char *fmt,...)
+{
+	va_list ap;
+	va_start(ap,fmt);
+	int n = host_vfprintf(f,fmt,ap);
+	va_end(ap);
+	return n;
+}
+int host_printf(const char *fmt,...)
+{
+	va_list ap;
+	va_start(ap,fmt);
+	int n = host_vfprintf(file_pri,fmt,ap);
+	va_end(ap);
+	return n;
+}
+int host_sprintf(char *str,const char *fmt,...)
+{
+	char format[256];
+	va_list ap;
+	host_format(format,fmt,sizeof(format));
+	va_start(ap,fmt);
+	int n = vsprintf(str,format,ap);
+	va_end(ap);
+	return n;
+}
+int host_snprintf(char *str,size_t size,const char *fmt,...)
+{
+	char format[256];
+	va_list ap;
+	host_format(format,fmt,sizeof(format));
+	va_start(ap,fmt);
+	int n = vsnprintf(str,size,format,ap);
+	va_end(ap);
+	return n;
+}
+int host_sscanf(const char *str,const char *fmt,...)
+{
+	char format[256];
+	va_list ap;
+	host_format(format,fmt,sizeof(format));
+	va_start(ap,fmt);
+	int n = vsscanf(str,format,ap);
+	va_end(ap);
+	return n;
+}
+int host_fputc(int c,HOSTFILE *f)
+{
+	if(f->host)
+		return putc(c,f->host);
+	return f->put(c,f);
+}
@@ -0,0 +1,502 @@
+/*
+	ufattool - formats, inspects and extracts logs of uFAT card images, and fuzzes the log writer
+
+	The firmware uFAT (firmware/bluesense-bsp/ufat.c) is built unmodified on the host against a file-backed card (sdfile.c).
+	The image is a raw card image, e.g. a dump of a card (dd if=/dev/sdX of=card.img bs=1M) or an image created with the
+	create command.
+
+	Usage:
+		ufattool [-v] [-z|-a] [-r <ringmb>] <image> create <sizemb>			Creates an empty (sparse) image of sizemb MB
+		ufattool [-v] [-z] <image> format <numlogs> [fixedsize]	Formats the image as the firmware command F (fixedsize 1: fixed-size logs)
+		ufattool [-v] [-z] <image> info						Prints the filesystem and the logs; the image is opened read-only
+		ufattool [-v] [-z] <image> extract <lognum> [output]	Writes a log to output (default: stdout); the image is opened read-only
+		ufattool [-v] [-z] <image> write <lognum> <sizekb>	Writes test data to a log as the firmware command l
+		ufattool [-v] [-z] <image> fuzz <iterations> [seed]	Formats the image, and writes records of random size in random logs,
+													closing the log or simulating a power loss. After each log, the content of all the
+													logs is verified. Returns 1 on the first error.
+			-v: prints the messages of the uFAT
+			-z: the logs are compressed (see firmware/bluesense-bsp/logzip.c): write and fuzz compress the logs they write,
+			    extract and fuzz decompress the logs they read
+			-a: the records of the logs are packed in sectors (see firmware/bluesense-bsp/logpack.c): write and fuzz pack the logs they
+			    write, extract and fuzz unpack the logs they read, checking the CRC and the sequence number of each sector
+			-r: write writes a ring log of ringmb MB (see firmware/bluesense-bsp/ufat.c); extract the ring without -z, then
+			    linearise it with logring (and decompress it with logunzip)
+
+	Images of logs not closed are recovered by info and extract in memory only, as the firmware does at boot.
+
+	Build:
+		g++ -O2 -funsigned-char -DUFAT_LOG_INDEXPERIOD=10000 -I. -I../../../firmware/bluesense-bsp -o ufattool ufattool.c sdfile.c ../../../firmware/bluesense-bsp/ufat.c ../../../firmware/bluesense-bsp/logzip.c ../../../firmware/bluesense-bsp/logpack.c
+
+	All the sources are compiled as C++ with unsigned chars as in the firmware; see host.h for the host environment.
+	The time index, off by default in the firmware, is enabled so that extract and fuzz handle and check the index records.
+*/
+#include "host.h"
+#include "sd.h"
+#include "ufat.h"
+#include "logzip.h"
+#include "logpack.h"
+#include <util/crc16.h>
+
+#define FUZZ_MAXLOG		14
+#define FUZZ_MAXSIZE	(3*UFAT_LOG_CHECKPOINT)
+
+typedef struct {
+	unsigned long records;						// Number of records written
+	unsigned char closed;						// Log closed (1) or recovered after a power loss (0)
+	unsigned char used;
+} FUZZLOG;
+
+FUZZLOG fuzz_log[FUZZ_MAXLOG];
+HOSTFILE *out,*err;
+unsigned char zip;								// Logs compressed
+unsigned char pack;								// Records of the logs packed in sectors
+unsigned long ring;								// Size in MB of the ring logs written by write, 0 for linear logs
+
+char *readlog(unsigned char n,unsigned long *size);
+
+/*
+	Decompresses a sector compressed by logzip into out. Returns the number of bytes, or -1 if the sector is invalid.
+*/
+long unzip_sector(const unsigned char *s,unsigned char *out)
+{
+	long n=0;
+	int i=LOGZIP_HDRSIZE;
+
+	if(s[0]!=LOGZIP_MAGIC || s[1]!=LOGZIP_VERSION)
+		return -1;
+	while(i<512)
+	{
+		unsigned char flag=s[i++];
+		for(int b=0;b<8;b++)
+		{
+			if(i>=512)
+				return -1;
+			if(!(flag&(1<<b)))
+			{
+				out[n++]=s[i++];
+				continue;
+			}
+			if(s[i]==LOGZIP_END)
+				return n;
+			if(i+1>=512 || s[i+1]+1>n)
+				return -1;
+			int len=s[i]+LOGZIP_MINMATCH,dist=s[i+1]+1;
+			i+=2;
+			for(;len;len--,n++)
+				out[n]=out[n-dist];
+		}
+	}
+	return -1;
+}
+
+/*
+	Unpacks a sector packed by logpack into out. Returns the number of bytes of records, or -1 if the sector is invalid
+	or its sequence number is not seq.
+*/
+long unpack_sector(const unsigned char *s,unsigned char *out,unsigned long seq)
+{
+	unsigned short crc=0;
+
+	if(s[0]!=LOGPACK_MAGIC || s[1]!=LOGPACK_VERSION)
+		return -1;
+	for(int i=0;i<510;i++)
+		crc = _crc_xmodem_update(crc,s[i]);
+	if(crc!=(s[510]|(s[511]<<8)))
+		return -1;
+	unsigned n = s[508]|(s[509]<<8);
+	unsigned long sseq = s[2]|(s[3]<<8)|((unsigned long)s[4]<<16)|((unsigned long)s[5]<<24);
+	if(n>LOGPACK_PAYLOAD || sseq!=seq)
+		return -1;
+	memcpy(out,s+LOGPACK_HDRSIZE,n);
+	return n;
+}
+
+/*
+	Initialises the uFAT from the image. Returns 0 on success.
+*/
+unsigned char init(const char *image,unsigned char readonly)
+{
+	if(sdfile_open(image,readonly))
+		return 1;
+	if(ufat_init())
+	{
+		fprintf(err,"ufattool: no uFAT filesystem on %s\n",image);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+	Writes a log to a host file. Returns 0 on success.
+*/
+unsigned char extract(unsigned char n,HOSTFILE *f)
+{
+	unsigned long startsector,size;
+	char block[512];
+
+	if(zip || pack)
+	{
+		char *data = readlog(n,&size);
+		if(!data)
+			return 1;
+		unsigned char rv = fwrite(data,1,size,f->host)!=size;
+		free(data);
+		return rv;
+	}
+	if(ufat_log_getinfo(n,&startsector,&size))
+		return 1;
+	for(unsigned long s=0;s<size;s+=512)
+	{
+		if(sd_block_read(startsector+(s>>9),block))
+			return 1;
+		if(fwrite(block,1,size-s>512?512:size-s,f->host)==0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+	Reads a log into memory, decompressing it with -z or unpacking it with -a. Returns the data (to free) or 0 on error.
+*/
+char *readlog(unsigned char n,unsigned long *size)
+{
+	unsigned long startsector;
+
+	if(ufat_log_getinfo(n,&startsector,size))
+		return 0;
+	char *data = (char*)calloc(1,*size+513);
+	for(unsigned long s=0;s<*size;s+=512)
+		if(sd_block_read(startsector+(s>>9),data+s))
+		{
+			free(data);
+			return 0;
+		}
+	if(!zip && !pack)
+		return data;
+
+	// A sector holds at most 255 matches of 257 bytes
+	unsigned long usize=0,alloc=0;
+	char *udata=0;
+	for(unsigned long s=0;s<*size;s+=512)
+	{
+		if(usize+65536>alloc)
+		{
+			alloc = 2*alloc+65536;
+			udata = (char*)realloc(udata,alloc+513);
+		}
+		long l = zip ? unzip_sector((unsigned char*)data+s,(unsigned char*)udata+usize) : unpack_sector((unsigned char*)data+s,(unsigned char*)udata+usize,s>>9);
+		if(l<0)
+		{
+			fprintf(err,"log %u: invalid %s sector at offset %lu\n",n,zip?"compressed":"packed",s);
+			free(data);
+			free(udata);
+			return 0;
+		}
+		usize+=l;
+	}
+	free(data);
+	if(!udata)
+		udata = (char*)malloc(513);
+	// Zeros after the data, as for uncompressed logs
+	memset(udata+usize,0,513);
+	*size = usize;
+	return udata;
+}
+
+/*
+	Fuzz records: "R<seq>,<len>,<payload>\n" where the payload is len characters derived from seq.
+*/
+int fuzz_record(char *buf,unsigned long seq,unsigned len)
+{
+	int n = sprintf(buf,"R%lu,%u,",seq,len);
+	for(unsigned i=0;i<len;i++)
+		buf[n++] = 'a'+(seq+i)%26;
+	buf[n++]='\n';
+	return n;
+}
+
+/*
+	Verifies the content of a log: the records are in sequence, index lines are at line boundaries,
+	and the time index points to index records. Returns 0 on success.
+*/
+unsigned char fuzz_verify(unsigned char n)
+{
+	unsigned long size,pos=0,seq=0,offset;
+	char rec[512];
+	char *data = readlog(n,&size);
+
+	if(!data)
+	{
+		fprintf(err,"log %u: read error\n",n);
+		return 1;
+	}
+	while(pos<size)
+	{
+		char *end = (char*)memchr(data+pos,'\n',size-pos);
+		unsigned long len = end?end-(data+pos)+1:size-pos;
+		if(data[pos]=='#')
+		{
+			// Index records give their offset in the (decompressed) log
+			unsigned long t,pkt;
+			if(end && sscanf(data+pos,"#I,%lu,%lu,%lu",&t,&pkt,&offset)==3 && offset!=pos)
+			{
+				fprintf(err,"log %u: index record at offset %lu with offset %lu\n",n,pos,offset);
+				free(data);
+				return 1;
+			}
+			pos+=len;
+			continue;
+		}
+		// The last record of a log recovered after a power loss can be cut anywhere
+		unsigned char cut = !end && !fuzz_log[n].closed;
+		char *p;
+		unsigned long s = data[pos]=='R'?strtoul(data+pos+1,&p,10):0;
+		unsigned long l = data[pos]=='R' && *p==','?strtoul(p+1,&p,10):0;
+		int hl = sprintf(rec,"R%lu,",seq);
+		if(cut && p==data+size && memcmp(rec,data+pos,len<(unsigned long)hl?len:hl)==0)
+			break;
+		if(data[pos]!='R' || *p!=',' || s!=seq || l>230)
+		{
+			fprintf(err,"log %u: record %lu expected at offset %lu\n",n,seq,pos);
+			free(data);
+			return 1;
+		}
+		int rl = fuzz_record(rec,seq,l);
+		if(cut && len<(unsigned long)rl && memcmp(rec,data+pos,len)==0)
+			break;
+		if(len!=(unsigned long)rl || memcmp(rec,data+pos,rl))
+		{
+			fprintf(err,"log %u: record %lu corrupted at offset %lu\n",n,seq,pos);
+			free(data);
+			return 1;
+		}
+		seq++;
+		pos+=len;
+	}
+	if(fuzz_log[n].closed && seq!=fuzz_log[n].records)
+	{
+		fprintf(err,"log %u: %lu records instead of %lu\n",n,seq,fuzz_log[n].records);
+		free(data);
+		return 1;
+	}
+	if(!fuzz_log[n].closed && seq>fuzz_log[n].records)
+	{
+		fprintf(err,"log %u: %lu records recovered, %lu written\n",n,seq,fuzz_log[n].records);
+		free(data);
+		return 1;
+	}
+	// The time index points to the start of the log or an index record; the index of compressed or packed logs is only found after decoding
+	if(size && !zip && !pack && (ufat_log_findtime(n,rand()%100000,&offset) || (offset!=0 && (offset>=size || strncmp(data+offset,"#I,",3)))))
+	{
+		fprintf(err,"log %u: invalid time index offset %lu\n",n,offset);
+		free(data);
+		return 1;
+	}
+	free(data);
+	return 0;
+}
+
+/*
+	Writes random records to a log, then closes it or simulates a power loss. Returns 0 on success.
+*/
+unsigned char fuzz_log_write(unsigned char n)
+{
+	char rec[512];
+	unsigned long startsector,size,maxsize,target,written=0,seq=0;
+	FILE *log = ufat_log_open(n);
+
+	if(!log)
+		return 0;				// No free space
+	maxsize = ufat_log_getmaxsize();
+	target = rand()%(FUZZ_MAXSIZE<maxsize/2?FUZZ_MAXSIZE:maxsize/2);
+	while(written<target)
+	{
+		int l = fuzz_record(rec,seq,rand()%(rand()%8?64:230));
+		if(rand()%4)
+		{
+			if(fputbuf(log,rec,l))
+			{
+				fprintf(err,"log %u: fputbuf error at %lu\n",n,written);
+				return 1;
+			}
+		}
+		else
+		{
+			rec[l]=0;
+			fprintf(log,"%s",rec);
+		}
+		written+=l;
+		seq++;
+		host_time_offset+=rand()%200;
+	}
+	fuzz_log[n].records=seq;
+	fuzz_log[n].used=1;
+	if(rand()%3)
+	{
+		fuzz_log[n].closed=1;
+		if(ufat_log_close())
+		{
+			fprintf(err,"log %u: close error\n",n);
+			return 1;
+		}
+		return 0;
+	}
+
+	// Power loss: the complete sectors written must be recovered
+	fuzz_log[n].closed=0;
+	ufat_log_getinfo(n,&startsector,&size);
+	unsigned long streamed = sdfile_streamaddress()-startsector;
+	sdfile_powerloss();
+	if(ufat_init())
+	{
+		fprintf(err,"log %u: init error after power loss\n",n);
+		return 1;
+	}
+	ufat_log_getinfo(n,&startsector,&size);
+	if(size!=streamed<<9)
+	{
+		fprintf(err,"log %u: recovered %lu bytes instead of %lu\n",n,size,streamed<<9);
+		return 1;
+	}
+	return 0;
+}
+
+int fuzz(const char *image,unsigned long iterations,unsigned seed)
+{
+	srand(seed);
+	if(sdfile_open(image,0))
+		return 1;
+	for(unsigned long it=0;it<iterations;it++)
+	{
+		unsigned char numlogs = 1+rand()%FUZZ_MAXLOG,fixed=rand()%2;
+		unsigned long wr=sdfile_numwrite;
+
+		if(ufat_format(numlogs,fixed) || ufat_init())
+		{
+			fprintf(err,"ufattool: format error\n");
+			return 1;
+		}
+		memset(fuzz_log,0,sizeof(fuzz_log));
+		for(unsigned s=0;s<2u*numlogs;s++)
+		{
+			unsigned char n = rand()%numlogs;
+			if(fuzz_log_write(n))
+				return 1;
+			for(unsigned char i=0;i<numlogs;i++)
+				if(fuzz_log[i].used && fuzz_verify(i))
+				{
+					fprintf(err,"ufattool: iteration %lu (seed %u) session %u log %u\n",it,seed,s,n);
+					return 1;
+				}
+		}
+		fprintf(out,"Iteration %lu: %u logs (%s), %lu sectors written\n",it,numlogs,fixed?"fixed size":"extents",sdfile_numwrite-wr);
+	}
+	fprintf(out,"Fuzz: %lu iterations ok\n",iterations);
+	return 0;
+}
+
+int main(int argc,char **argv)
+{
+	unsigned long a1=0,a2=0;
+	int arg=1;
+
+	out = host_stream(stdout);
+	err = host_stream(stderr);
+	for(;arg<argc && argv[arg][0]=='-';arg++)
+	{
+		if(strcmp(argv[arg],"-v")==0)
+			file_pri = host_stream(stderr);
+		else if(strcmp(argv[arg],"-z")==0)
+			zip = 1;
+		else if(strcmp(argv[arg],"-a")==0)
+			pack = 1;
+		else if(strcmp(argv[arg],"-r")==0 && arg+1<argc)
+			ring = strtoul(argv[++arg],0,10);
+		else
+			break;
+	}
+	ufat_log_compress(zip);
+	ufat_log_pack(pack);
+	if(argc-arg<2)
+	{
+		fprintf(err,"Usage: %s [-v] [-z|-a] [-r <ringmb>] <image> create <sizemb> | format <numlogs> [fixedsize] | info | extract <lognum> [output] | write <lognum> <sizekb> | fuzz <iterations> [seed]\n",argv[0]);
+		return 1;
+	}
+	const char *image = argv[arg];
+	const char *cmd = argv[arg+1];
+	if(argc-arg>2)
+		a1 = strtoul(argv[arg+2],0,10);
+	if(argc-arg>3)
+		a2 = strtoul(argv[arg+3],0,10);
+
+	if(strcmp(cmd,"create")==0)
+	{
+		int fd = open(image,O_RDWR|O_CREAT|O_TRUNC,0644);
+		if(fd<0 || ftruncate(fd,(off_t)a1<<20))
+		{
+			perror(image);
+			return 1;
+		}
+		close(fd);
+		return 0;
+	}
+	if(strcmp(cmd,"format")==0)
+	{
+		if(sdfile_open(image,0) || ufat_format(a1,a2) || ufat_init())
+		{
+			fprintf(err,"ufattool: format error\n");
+			return 1;
+		}
+		ufat_print_loginfo(out);
+		return 0;
+	}
+	if(strcmp(cmd,"info")==0)
+	{
+		if(init(image,1))
+			return 1;
+		ufat_print_fsinfo(out,&_fsinfo);
+		ufat_print_loginfo(out);
+		return 0;
+	}
+	if(strcmp(cmd,"extract")==0)
+	{
+		HOSTFILE *f = out;
+		if(init(image,1))
+			return 1;
+		if(argc-arg>3)
+		{
+			f = host_stream(fopen(argv[arg+3],"wb"));
+			if(!f->host)
+			{
+				perror(argv[arg+3]);
+				return 1;
+			}
+		}
+		if(a1>=ufat_log_getnumlogs() || extract(a1,f))
+		{
+			fprintf(err,"ufattool: cannot extract log %lu\n",a1);
+			return 1;
+		}
+		fclose(f->host);
+		return 0;
+	}
+	if(strcmp(cmd,"write")==0)
+	{
+		if(init(image,0))
+			return 1;
+		if(a1>=ufat_log_getnumlogs())
+		{
+			fprintf(err,"ufattool: invalid log %lu\n",a1);
+			return 1;
+		}
+		if(!file_pri)
+			file_pri = out;
+		ufat_log_ring(ring<<20);
+		ufat_log_test(a1,a2*1024,a2*1024/4+1);
+		return 0;
+	}
+	if(strcmp(cmd,"fuzz")==0)
+		return fuzz(image,a1?a1:1,argc-arg>3?a2:time(0));
+	fprintf(err,"ufattool: unknown command %s\n",cmd);
+	return 1;
+}
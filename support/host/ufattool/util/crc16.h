@@ -0,0 +1,11 @@
+// Stub of the firmware/avr-libc header for the host build: see host.h
+#include "host.h"
+
+// avr-libc CRC-CCITT (polynomial 0x1021, no reflection), as used by the firmware
+static inline unsigned short _crc_xmodem_update(unsigned short crc,unsigned char data)
+{
+	crc ^= (unsigned short)data<<8;
+	for(int i=0;i<8;i++)
+		crc = crc&0x8000 ? (crc<<1)^0x1021 : crc<<1;
+	return crc;
+}
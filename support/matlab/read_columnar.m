@@ -0,0 +1,77 @@
+function [data,info] = read_columnar(filename,trange)
+%% Memory maps a columnar file written by support/host/logdecode -c
+% [data,info] = read_columnar(filename) returns a structure with one field
+% per channel (e.g. data.ax, data.q0, data.t, data.label): each field is a
+% column vector of doubles read from the file through memmapfile, with
+% NaN where the channel was not logged.
+%
+% [data,info] = read_columnar(filename,[t0 t1]) only returns the rows of the
+% chunks whose time range (channel t) overlaps [t0 t1]: the chunk statistics
+% are used to skip the other chunks without reading them.
+%
+% info holds the channel names and units, the number of rows, and the chunk
+% statistics: info.min(chunk,channel) and info.max(chunk,channel).
+%
+% Example:
+%   [d,info] = read_columnar('run1.bsc');
+%   plot(d.t/1000,sqrt(d.ax.^2+d.ay.^2+d.az.^2));
+
+fid = fopen(filename,'r','ieee-le');
+if fid<0
+    error('read_columnar: cannot open %s',filename);
+end
+magic = fread(fid,8,'*char')';
+if ~strcmp(magic(1:5),'BSCOL')
+    fclose(fid);
+    error('read_columnar: %s is not a columnar file',filename);
+end
+version = fread(fid,1,'uint32');
+numchannels = fread(fid,1,'uint32');
+info.rows = fread(fid,1,'uint64');
+info.chunkrows = fread(fid,1,'uint32');
+numchunks = fread(fid,1,'uint32');
+timechannel = fread(fid,1,'int32');
+fread(fid,1,'int32');                       % Label channel
+statsoffset = fread(fid,1,'uint64');
+if version~=1
+    fclose(fid);
+    error('read_columnar: unsupported version %d',version);
+end
+
+info.names = cell(numchannels,1);
+info.units = cell(numchannels,1);
+offsets = zeros(numchannels,1);
+for c=1:numchannels
+    fseek(fid,64*c,'bof');
+    info.names{c} = deblank(strrep(fread(fid,16,'*char')',char(0),' '));
+    info.units{c} = deblank(strrep(fread(fid,16,'*char')',char(0),' '));
+    offsets(c) = fread(fid,1,'uint64');
+end
+fseek(fid,statsoffset,'bof');
+s = fread(fid,[2*numchannels numchunks],'double')';
+fclose(fid);
+info.min = s(:,1:2:end);
+info.max = s(:,2:2:end);
+
+% Rows of the chunks to return
+first = 1;
+last = info.rows;
+if nargin>1 && timechannel>=0
+    keep = find(info.max(:,timechannel+1)>=trange(1) & info.min(:,timechannel+1)<=trange(2));
+    if isempty(keep)
+        last = 0;
+    else
+        first = (keep(1)-1)*info.chunkrows+1;
+        last = min(keep(end)*info.chunkrows,info.rows);
+    end
+end
+
+data = struct();
+for c=1:numchannels
+    if last<first
+        data.(info.names{c}) = zeros(0,1);
+        continue;
+    end
+    m = memmapfile(filename,'Offset',offsets(c)+(first-1)*8,'Format',{'double',[last-first+1 1],'x'},'Repeat',1);
+    data.(info.names{c}) = m.Data.x;
+end